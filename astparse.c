@@ -617,13 +617,13 @@ static expression_t *parse_expression(ast_node_t *expr) {
 
       }
 
-      mcurrent = mir_emit(MIR_CALL, mir_var(func), NULL,
-			  NULL);
+      /* The return value is delivered to the temporary allocated above */
+      mcurrent = mir_emit(MIR_CALL, mir_var(func), NULL, mir_reg(reg));
       for(i = 0; i < num_func_args; i++)
 	mir_add_arg(&mcurrent, mir_opr(func_args[i]));
 
 
-      result->op_val = tr_alloc();
+      result->op_val = reg;
       result->op_type = OP_REG;
       result->size = 0;
 
@@ -848,9 +848,20 @@ static void parse_statement(ast_node_t *statement) {
     break;
 
 
-  case NODE_FUNC_CALL:
+  case NODE_FUNC_CALL: {
+    mir_instr_t *call;
+
+    /* The return value of a call statement is discarded */
     parse_expression(statement);
+
+    call = mir_list_tail()->instruction;
+    if(call->opcode != MIR_CALL)
+      compiler_error(CERROR_ERROR, statement->src_line_num,
+		     "Call statement didn't end with a call\n");
+    free(call->operand[2]);
+    call->operand[2] = NULL;
     break;
+  }
 
   default:
     compiler_error(CERROR_WARN, statement->src_line_num,
@@ -0,0 +1,176 @@
+/*
+ * bitset.c
+ *
+ * Fixed width bit sets. The set operations work a whole word at a time,
+ * which makes them much faster than the list based sets for dataflow
+ * problems over large functions.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "bitset.h"
+
+/*
+ * Create a new, empty, bit set which can hold the given number of bits
+ */
+bitset_t *bitset_new(int num_bits) {
+  bitset_t *set;
+
+  set = malloc(sizeof(bitset_t));
+  set->num_bits = num_bits;
+  set->num_words = (num_bits + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+  set->word = calloc(set->num_words ? set->num_words : 1,
+		     sizeof(unsigned int));
+
+  return set;
+}
+
+/*
+ * Free a bit set
+ */
+void bitset_free(bitset_t *set) {
+  if(!set)
+    return;
+
+  free(set->word);
+  free(set);
+}
+
+/*
+ * Grow a set so it can hold the given number of bits. The new bits start
+ * out clear.
+ */
+void bitset_grow(bitset_t *set, long num_bits) {
+  long num_words = (num_bits + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+
+  if(num_bits <= set->num_bits)
+    return;
+
+  if(num_words > set->num_words) {
+    set->word = realloc(set->word, num_words * sizeof(unsigned int));
+    memset(set->word + set->num_words, 0,
+	   (num_words - set->num_words) * sizeof(unsigned int));
+    set->num_words = num_words;
+  }
+
+  set->num_bits = num_bits;
+}
+
+/*
+ * Remove all the bits from a set
+ */
+void bitset_clear_all(bitset_t *set) {
+  memset(set->word, 0, set->num_words * sizeof(unsigned int));
+}
+
+/*
+ * Add a bit to a set
+ */
+void bitset_set(bitset_t *set, long bit) {
+  set->word[bit / BITSET_WORD_BITS] |= 1U << (bit % BITSET_WORD_BITS);
+}
+
+/*
+ * Remove a bit from a set
+ */
+void bitset_clear(bitset_t *set, long bit) {
+  set->word[bit / BITSET_WORD_BITS] &= ~(1U << (bit % BITSET_WORD_BITS));
+}
+
+/*
+ * Test if a bit is in a set
+ */
+int bitset_test(bitset_t *set, long bit) {
+  return (set->word[bit / BITSET_WORD_BITS] >> (bit % BITSET_WORD_BITS)) & 1;
+}
+
+/*
+ * dest = src. Both sets must be the same size.
+ */
+void bitset_copy(bitset_t *dest, bitset_t *src) {
+  memcpy(dest->word, src->word, dest->num_words * sizeof(unsigned int));
+}
+
+/*
+ * dest = dest + src. Returns non-zero if dest was changed.
+ */
+int bitset_union(bitset_t *dest, bitset_t *src) {
+  unsigned int old, changed = 0;
+  int i;
+
+  for(i = 0; i < dest->num_words; i++) {
+    old = dest->word[i];
+    dest->word[i] |= src->word[i];
+    changed |= old ^ dest->word[i];
+  }
+
+  return changed != 0;
+}
+
+/*
+ * dest = dest - src
+ */
+void bitset_difference(bitset_t *dest, bitset_t *src) {
+  int i;
+
+  for(i = 0; i < dest->num_words; i++)
+    dest->word[i] &= ~src->word[i];
+}
+
+/*
+ * Test if two sets have any bits in common. Both sets must be the same size.
+ */
+int bitset_intersects(bitset_t *set1, bitset_t *set2) {
+  int i;
+
+  for(i = 0; i < set1->num_words; i++)
+    if(set1->word[i] & set2->word[i])
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Test if two sets contain the same bits
+ */
+int bitset_equal(bitset_t *set1, bitset_t *set2) {
+  return !memcmp(set1->word, set2->word,
+		 set1->num_words * sizeof(unsigned int));
+}
+
+/*
+ * Return the number of bits in a set
+ */
+int bitset_count(bitset_t *set) {
+  int i, count = 0;
+
+  for(i = 0; i < set->num_words; i++)
+    count += __builtin_popcount(set->word[i]);
+
+  return count;
+}
+
+/*
+ * Return the first bit in the set which is greater than or equal to the
+ * given bit, or -1 if there are none. Used for iterating over a set:
+ *
+ *   for(i = bitset_next(set, 0); i != -1; i = bitset_next(set, i + 1))
+ */
+int bitset_next(bitset_t *set, int bit) {
+  unsigned int word;
+  int i;
+
+  if(bit >= set->num_bits)
+    return -1;
+
+  i = bit / BITSET_WORD_BITS;
+  word = set->word[i] & (~0U << (bit % BITSET_WORD_BITS));
+
+  while(!word) {
+    if(++i >= set->num_words)
+      return -1;
+    word = set->word[i];
+  }
+
+  return (i * BITSET_WORD_BITS) + __builtin_ctz(word);
+}
@@ -0,0 +1,33 @@
+/*
+ * bitset.h
+ *
+ * Fixed width bit sets
+ *
+ */
+#ifndef _BITSET_H_
+#define _BITSET_H_
+
+#define BITSET_WORD_BITS (sizeof(unsigned int) * 8)
+
+typedef struct {
+  long num_bits;
+  long num_words;
+  unsigned int *word;
+} bitset_t;
+
+bitset_t *bitset_new(int);
+void bitset_free(bitset_t *);
+void bitset_grow(bitset_t *, long);
+void bitset_clear_all(bitset_t *);
+void bitset_set(bitset_t *, long);
+void bitset_clear(bitset_t *, long);
+int bitset_test(bitset_t *, long);
+void bitset_copy(bitset_t *, bitset_t *);
+int bitset_union(bitset_t *, bitset_t *);
+void bitset_difference(bitset_t *, bitset_t *);
+int bitset_intersects(bitset_t *, bitset_t *);
+int bitset_equal(bitset_t *, bitset_t *);
+int bitset_count(bitset_t *);
+int bitset_next(bitset_t *, int);
+
+#endif /* _BITSET_H_ */
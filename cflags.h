@@ -18,6 +18,9 @@ typedef struct {
   int history_simple_depth;
   int history_arg_setting;
 
+  int register_allocator;
+  int target;
+
 } compiler_options_t;
 
 /* Compiler Flags */
@@ -32,7 +35,10 @@ enum {
   CFLAG_HISTORY_INLINE = 0x20,
   CFLAG_OUTPUT_STABS = 0x40,
   CFLAG_INLINE = 0x80,
-  CFLAG_HISTORY_AW_ORDER_D = 0x100
+  CFLAG_HISTORY_AW_ORDER_D = 0x100,
+  CFLAG_OUTPUT_OBJECT = 0x200,
+  CFLAG_RUN = 0x400,
+  CFLAG_JIT = 0x800
 };
 
 /* History arg settings */
@@ -41,9 +47,30 @@ enum {
   HISTORY_ARG_TEMP_COPY = 1
 };
 
+/* Register allocators */
+enum {
+  REGALLOC_COLOUR = 0,
+  REGALLOC_LINEAR_SCAN = 1
+};
+
+/* Target machines */
+enum {
+  TARGET_SPARC = 0,
+  TARGET_X86_64 = 1,
+  TARGET_C = 2,
+  TARGET_RV64 = 3
+};
+
 /* Optomisation Flags */
 enum {
-  OFLAG_REG_ASSIGN = 1
+  OFLAG_REG_ASSIGN = 0x1,
+  OFLAG_COALESCE = 0x2,
+  OFLAG_REMAT = 0x4,
+  OFLAG_SPILL_SLOTS = 0x8,
+  OFLAG_LEAF_PROCS = 0x10,
+  OFLAG_DELAY_SLOTS = 0x20,
+  OFLAG_PEEPHOLE = 0x40,
+  OFLAG_SCHEDULE = 0x80
 };
 
 
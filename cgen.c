@@ -0,0 +1,694 @@
+/*
+ * cgen.c
+ *
+ * C source backend. Converts the MIR, after the munging passes but before
+ * register allocation, into a C function for each function, so that a
+ * host C compiler can optimise and run the program on any machine.
+ *
+ * Temporaries and variables held in registers become C locals, and
+ * globals, including the history buffers and their current value and
+ * pointer words, become ordinary C objects. The language has 4 byte
+ * pointers, so addresses are kept in ints and memory is accessed through
+ * them. Locals which have their address taken live in frames on a stack
+ * in the program's data. On 64 bit hosts the program must be linked so
+ * that its data is below 4GB, eg. with gcc -no-pie.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symtable.h"
+#include "typechk.h"
+#include "scope.h"
+#include "mir.h"
+#include "history.h"
+#include "strings.h"
+#include "cerror.h"
+#include "cflags.h"
+#include "cgen.h"
+
+static int c_is_ptr_type(type_info_t *);
+static void c_print_name(name_record_t *);
+static void c_print_func_name(name_record_t *);
+static void c_print_prototype(name_record_t *, int);
+static int c_var_index(name_record_t *);
+static void c_scan_func(mir_node_t *);
+static void c_print_opr(mir_operand_t *);
+static void c_print_addr_opr(mir_operand_t *);
+static void c_print_arg(name_record_t *, int, mir_operand_t *);
+static void c_print_frame_pop(void);
+static void gen_c_instr(mir_node_t *);
+static void gen_c_func(mir_node_t **);
+static void gen_c_data(void);
+static void gen_c_main(void);
+
+extern compiler_options_t cflags;
+extern scope_node_t *global_scope;
+extern char *infile;
+
+/* Conversions between the program's 4 byte addresses and C pointers */
+static const char *c_prelude =
+  "#include <stdint.h>\n\n"
+  "#define HCC_PTR(a) ((void *)(uintptr_t)(unsigned int)(a))\n"
+  "#define HCC_ADDR(p) ((int)(uintptr_t)(p))\n"
+  "#define HCC_MEM(a) (*(int *)HCC_PTR(a))\n\n"
+  "/* Arithmetic wraps, as it does on the Sparc */\n"
+  "#define HCC_ADD(a, b) ((int)((unsigned int)(a) + (unsigned int)(b)))\n"
+  "#define HCC_SUB(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)))\n"
+  "#define HCC_MUL(a, b) ((int)((unsigned int)(a) * (unsigned int)(b)))\n";
+
+static FILE *c_fd;
+static int has_main, has_globals, has_history_ptrs;
+
+/*
+ * The function being generated. Variables held in registers are numbered
+ * in the order they are first used, so that variables of the same name in
+ * different scopes don't clash. Temporaries holding addresses are passed
+ * to variable argument functions as pointers.
+ */
+static name_record_t *current_func;
+static name_record_t **func_vars;
+static int num_func_vars, max_func_vars, current_arg, frame_size;
+static int max_temp;
+static char *addr_temps;
+
+/*
+ * Return non-zero if values of a type are addresses
+ */
+static int c_is_ptr_type(type_info_t *type_info) {
+  return is_address_type(type_info) || is_string_type(type_info) ||
+    is_array_type(type_info);
+}
+
+/*
+ * Print the C name of a global. The history value and pointer words start
+ * with a dot, which isn't allowed in C.
+ */
+static void c_print_name(name_record_t *var) {
+  if(var->name[0] == '.')
+    fprintf(c_fd, "hcc_%s", var->name + 1);
+  else
+    fprintf(c_fd, "%s", var->name);
+}
+
+static void c_print_func_name(name_record_t *func) {
+  fprintf(c_fd, "%s", strcmp(func->name, "main") ? func->name : C_MAIN_NAME);
+}
+
+/*
+ * Print the prototype of a function. Pointer arguments and return values
+ * are real C pointers, so that C library functions can be called, and
+ * functions with variable arguments are left unprototyped.
+ */
+static void c_print_prototype(name_record_t *func, int with_names) {
+  scope_node_t *arg_scope = get_func_arg_scope(func->name);
+  int i;
+
+  fprintf(c_fd, "%s", c_is_ptr_type(func->type_info) ? "void *" : "int ");
+  c_print_func_name(func);
+
+  if(func->num_args == FUNC_VAR_ARGS) {
+    fprintf(c_fd, "()");
+    return;
+  }
+
+  if(!func->num_args || !arg_scope) {
+    fprintf(c_fd, "(void)");
+    return;
+  }
+
+  fprintf(c_fd, "(");
+  for(i = 0; i < func->num_args; i++) {
+    fprintf(c_fd, "%s%s", i ? ", " : "",
+	    c_is_ptr_type(arg_scope->name_table[i]->type_info) ?
+	    "void *" : "int");
+    if(with_names)
+      fprintf(c_fd, "%sa%d", c_is_ptr_type(arg_scope->name_table[i]->type_info)
+	      ? "" : " ", i);
+  }
+  fprintf(c_fd, ")");
+}
+
+/*
+ * Return the number of a variable held in a register in the current
+ * function, adding it if it hasn't been seen before
+ */
+static int c_var_index(name_record_t *var) {
+  int i;
+
+  for(i = 0; i < num_func_vars; i++)
+    if(func_vars[i] == var)
+      return i;
+
+  if(num_func_vars == max_func_vars) {
+    max_func_vars = max_func_vars ? max_func_vars * 2 : 16;
+    func_vars = realloc(func_vars, sizeof(name_record_t *) * max_func_vars);
+  }
+
+  func_vars[num_func_vars] = var;
+  return num_func_vars++;
+}
+
+/*
+ * Find the variables, temporaries and frame size of the function starting
+ * at a label node
+ */
+static void c_scan_func(mir_node_t *node) {
+  mir_instr_t *instr;
+  mir_operand_t *op;
+  int i;
+
+  num_func_vars = 0;
+  max_temp = -1;
+  frame_size = 0;
+
+  for(; node->instruction->opcode != MIR_END; node = node->next) {
+    instr = node->instruction;
+
+    switch(instr->opcode) {
+    case MIR_ADDR:
+    case MIR_STACK_ADDR:
+    case MIR_STACK_LOAD:
+    case MIR_STACK_STORE:
+    case MIR_PUSH_ARG:
+      frame_size = 1;
+      break;
+    }
+
+    for(i = 0; i < 3 + instr->num_args; i++) {
+      op = i < 3 ? instr->operand[i] : instr->args[i - 3];
+      if(!op)
+	continue;
+
+      if(op->optype == MIR_OP_REG && op->val > max_temp)
+	max_temp = op->val;
+      else if(op->optype == MIR_OP_VAR && op->var &&
+	      op->var->type_info->decl_type != TYPE_FUNCTION &&
+	      get_var_scope(op->var) != global_scope &&
+	      !(i == 0 && (instr->opcode == MIR_ADDR ||
+			   instr->opcode == MIR_CALL)))
+	c_var_index(op->var);
+    }
+  }
+
+  free(addr_temps);
+  addr_temps = calloc(max_temp + 2, 1);
+
+  /* Functions which don't use the stack don't need a frame */
+  if(frame_size)
+    frame_size = max_scope_size(get_func_scope(current_func->name));
+  if(frame_size % 8 != 0)
+    frame_size += 8 - (frame_size % 8);
+}
+
+/*
+ * Print a MIR operand as a C expression
+ */
+static void c_print_opr(mir_operand_t *op) {
+  if(op->indirect)
+    fprintf(c_fd, "HCC_MEM(");
+
+  switch(op->optype) {
+  case MIR_OP_CONST:
+    fprintf(c_fd, "%d", op->val);
+    break;
+
+  case MIR_OP_VAR:
+    if(get_var_scope(op->var) == global_scope) {
+      c_print_name(op->var);
+      fprintf(c_fd, "[0]");
+    } else
+      fprintf(c_fd, "v%d", c_var_index(op->var));
+    break;
+
+  case MIR_OP_REG:
+  default:
+    fprintf(c_fd, "t%d", op->val);
+    break;
+  }
+
+  if(op->indirect)
+    fprintf(c_fd, ")");
+}
+
+/*
+ * Print the memory addressed by a MIR operand holding a pointer
+ */
+static void c_print_addr_opr(mir_operand_t *op) {
+  int indirect = op->indirect;
+
+  fprintf(c_fd, "HCC_MEM(");
+  op->indirect = 0;
+  c_print_opr(op);
+  op->indirect = indirect;
+  fprintf(c_fd, ")");
+}
+
+/*
+ * Print an argument to a call, converting addresses to pointers. Other
+ * arguments to functions with variable arguments are widened to longs, as
+ * the function may read them with %ld.
+ */
+static void c_print_arg(name_record_t *func, int arg, mir_operand_t *op) {
+  scope_node_t *arg_scope;
+  int ptr;
+
+  if(func->num_args == FUNC_VAR_ARGS)
+    ptr = (op->optype == MIR_OP_REG && !op->indirect && addr_temps[op->val]) ||
+      (op->optype == MIR_OP_VAR && c_is_ptr_type(op->var->type_info));
+  else {
+    arg_scope = get_func_arg_scope(func->name);
+    ptr = arg_scope && arg < arg_scope->num_records &&
+      c_is_ptr_type(arg_scope->name_table[arg]->type_info);
+  }
+
+  if(ptr) {
+    fprintf(c_fd, "HCC_PTR(");
+    c_print_opr(op);
+    fprintf(c_fd, ")");
+  } else {
+    if(func->num_args == FUNC_VAR_ARGS)
+      fprintf(c_fd, "(long)");
+    c_print_opr(op);
+  }
+}
+
+/*
+ * Free the current function's frame before returning
+ */
+static void c_print_frame_pop(void) {
+  if(frame_size)
+    fprintf(c_fd, "  %s += %d;\n", C_SP_NAME, frame_size);
+}
+
+/*
+ * Convert a single MIR instruction to a C statement, not including its
+ * label
+ */
+static void gen_c_instr(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  mir_operand_t *dest = instr->operand[2];
+  name_record_t *func;
+  int i;
+
+  /* Temporaries defined as addresses */
+  if(dest && dest->optype == MIR_OP_REG && !dest->indirect)
+    switch(instr->opcode) {
+    case MIR_LOAD_STRING:
+    case MIR_ADDR:
+    case MIR_STACK_ADDR:
+    case MIR_HEAP_ADDR:
+      addr_temps[dest->val] = 1;
+      break;
+
+    case MIR_MOVE:
+    case MIR_HEAP_LOAD:
+      if(instr->operand[0]->optype == MIR_OP_VAR &&
+	 c_is_ptr_type(instr->operand[0]->var->type_info))
+	addr_temps[dest->val] = 1;
+      else if(instr->operand[0]->optype == MIR_OP_REG &&
+	      !instr->operand[0]->indirect)
+	addr_temps[dest->val] = addr_temps[instr->operand[0]->val];
+      break;
+
+    case MIR_CALL:
+      addr_temps[dest->val] = c_is_ptr_type(instr->operand[0]->var->type_info);
+      break;
+    }
+
+  switch(instr->opcode) {
+  case MIR_NOP:
+  case MIR_BEGIN:
+    break;
+
+  case MIR_LABEL:
+    /* Function header */
+    current_arg = 0;
+    current_func = get_func_entry(instr->label);
+    c_scan_func(node);
+
+    if(!strcmp(current_func->name, "main"))
+      has_main = 1;
+
+    fprintf(c_fd, "\n");
+    c_print_prototype(current_func, 1);
+    fprintf(c_fd, "\n{\n");
+
+    for(i = 0; i < num_func_vars; i++)
+      fprintf(c_fd, "  int v%d;\t/* %s */\n", i, func_vars[i]->name);
+    for(i = 0; i <= max_temp; i++)
+      fprintf(c_fd, "  int t%d;\n", i);
+    if(frame_size)
+      fprintf(c_fd, "  int sp = %s -= %d;\n", C_SP_NAME, frame_size);
+    fprintf(c_fd, "\n");
+    break;
+
+  case MIR_ADDR:
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    fprintf(c_fd, " = ");
+    if(instr->operand[0]->optype == MIR_OP_VAR) {
+      if(get_var_scope(instr->operand[0]->var) == global_scope) {
+	fprintf(c_fd, "HCC_ADDR(");
+	c_print_name(instr->operand[0]->var);
+	fprintf(c_fd, ")");
+      } else
+	fprintf(c_fd, "sp + %d", instr->operand[0]->var->offset);
+    } else
+      c_print_addr_opr(instr->operand[0]);
+    fprintf(c_fd, ";\n");
+    break;
+
+  case MIR_STACK_ADDR:
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    fprintf(c_fd, " = sp + %d;\n", instr->operand[0]->val);
+    break;
+
+  case MIR_HEAP_ADDR:
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    if(instr->operand[0]->optype == MIR_OP_VAR) {
+      fprintf(c_fd, " = HCC_ADDR(");
+      c_print_name(instr->operand[0]->var);
+      fprintf(c_fd, ");\n");
+    } else
+      fprintf(c_fd, " = %d;\n", instr->operand[0]->val);
+    break;
+
+  case MIR_MOVE:
+  case MIR_HEAP_LOAD:
+    /* Globals held in registers are the C objects themselves */
+    if(instr->opcode == MIR_HEAP_LOAD && dest->optype == MIR_OP_VAR &&
+       dest->var == instr->operand[0]->var)
+      break;
+
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    fprintf(c_fd, " = ");
+    c_print_opr(instr->operand[0]);
+    fprintf(c_fd, ";\n");
+    break;
+
+  case MIR_ADD:
+  case MIR_SUB:
+  case MIR_MUL:
+  case MIR_DIV:
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    switch(instr->opcode) {
+    case MIR_ADD: fprintf(c_fd, " = HCC_ADD("); break;
+    case MIR_SUB: fprintf(c_fd, " = HCC_SUB("); break;
+    case MIR_MUL: fprintf(c_fd, " = HCC_MUL("); break;
+    case MIR_DIV: fprintf(c_fd, " = ("); break;
+    }
+    c_print_opr(instr->operand[0]);
+    fprintf(c_fd, instr->opcode == MIR_DIV ? ") / (" : ", ");
+    c_print_opr(instr->operand[1]);
+    fprintf(c_fd, ");\n");
+    break;
+
+  case MIR_JUMP:
+    fprintf(c_fd, "  goto %s;\n", node->jump->instruction->label);
+    break;
+
+  case MIR_IF:
+    fprintf(c_fd, "  if(");
+    if(!instr->operand[2]) {
+      fprintf(c_fd, "!");
+      c_print_opr(instr->operand[0]);
+
+    } else {
+      c_print_opr(instr->operand[0]);
+      switch(instr->operand[2]->val) {
+      case MIR_NEQ: fprintf(c_fd, " != "); break;
+      case MIR_LSS: fprintf(c_fd, " < "); break;
+      case MIR_LEQ: fprintf(c_fd, " <= "); break;
+      case MIR_GTR: fprintf(c_fd, " > "); break;
+      case MIR_GEQ: fprintf(c_fd, " >= "); break;
+      case MIR_EQL:
+      default: fprintf(c_fd, " == "); break;
+      }
+      c_print_opr(instr->operand[1]);
+    }
+    fprintf(c_fd, ")\n    goto %s;\n", node->jump->instruction->label);
+    break;
+
+  case MIR_LOAD_STRING:
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    fprintf(c_fd, " = HCC_ADDR(hcc_string%d);\n", instr->operand[0]->val);
+    break;
+
+  case MIR_REG_LOAD:
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    fprintf(c_fd, " = ");
+    c_print_addr_opr(instr->operand[0]);
+    fprintf(c_fd, ";\n");
+    break;
+
+  case MIR_STACK_LOAD:
+    fprintf(c_fd, "  ");
+    c_print_opr(dest);
+    fprintf(c_fd, " = HCC_MEM(sp + %d);\n", instr->operand[0]->val);
+    break;
+
+  case MIR_REG_STORE:
+    fprintf(c_fd, "  ");
+    c_print_addr_opr(dest);
+    fprintf(c_fd, " = ");
+    c_print_opr(instr->operand[0]);
+    fprintf(c_fd, ";\n");
+    break;
+
+  case MIR_STACK_STORE:
+    fprintf(c_fd, "  HCC_MEM(sp + %d) = ", dest->val);
+    c_print_opr(instr->operand[0]);
+    fprintf(c_fd, ";\n");
+    break;
+
+  case MIR_HEAP_STORE:
+    if(instr->operand[0]->optype == MIR_OP_VAR &&
+       instr->operand[0]->var == dest->var)
+      break;
+
+    fprintf(c_fd, "  ");
+    c_print_name(dest->var);
+    fprintf(c_fd, "[0] = ");
+    c_print_opr(instr->operand[0]);
+    fprintf(c_fd, ";\n");
+    break;
+
+  case MIR_RECEIVE:
+  case MIR_PUSH_ARG: {
+    scope_node_t *arg_scope = get_func_arg_scope(current_func->name);
+    int ptr = arg_scope && current_arg < arg_scope->num_records &&
+      c_is_ptr_type(arg_scope->name_table[current_arg]->type_info);
+
+    if(instr->opcode == MIR_RECEIVE) {
+      fprintf(c_fd, "  ");
+      c_print_opr(dest);
+    } else
+      fprintf(c_fd, "  HCC_MEM(sp + %d)", dest->val);
+
+    fprintf(c_fd, ptr ? " = HCC_ADDR(a%d);\n" : " = a%d;\n", current_arg++);
+    break;
+  }
+
+  case MIR_CALL:
+    func = instr->operand[0]->var;
+
+    fprintf(c_fd, "  ");
+    if(dest) {
+      c_print_opr(dest);
+      fprintf(c_fd, c_is_ptr_type(func->type_info) ? " = HCC_ADDR(" : " = ");
+    }
+
+    c_print_func_name(func);
+    fprintf(c_fd, "(");
+    for(i = 0; i < instr->num_args; i++) {
+      if(i)
+	fprintf(c_fd, ", ");
+      c_print_arg(func, i, instr->args[i]);
+    }
+    fprintf(c_fd, dest && c_is_ptr_type(func->type_info) ? "));\n" : ");\n");
+    break;
+
+  case MIR_RETURN:
+    c_print_frame_pop();
+    if(!instr->operand[0]) {
+      fprintf(c_fd, "  return 0;\n");
+      break;
+    }
+
+    fprintf(c_fd, c_is_ptr_type(current_func->type_info) ?
+	    "  return HCC_PTR(" : "  return (");
+    c_print_opr(instr->operand[0]);
+    fprintf(c_fd, ");\n");
+    break;
+
+  case MIR_END:
+    /* Function footer */
+    if(node->prev->instruction->opcode != MIR_RETURN) {
+      c_print_frame_pop();
+      fprintf(c_fd, "  return 0;\n");
+    }
+    fprintf(c_fd, "}\n");
+    break;
+
+  default:
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Can't generate C for MIR opcode %d\n", instr->opcode);
+  }
+}
+
+/*
+ * Generate C for a function
+ */
+static void gen_c_func(mir_node_t **node) {
+  mir_instr_t *instr;
+  int done = 0;
+
+  current_func = NULL;
+
+  while(*node && !done) {
+    instr = (*node)->instruction;
+
+    if(instr->opcode != MIR_LABEL && instr->label)
+      fprintf(c_fd, "%s:;\n", instr->label);
+
+    gen_c_instr(*node);
+
+    done = instr->opcode == MIR_END;
+    *node = (*node)->next;
+  }
+}
+
+/*
+ * Generate the strings, globals and function prototypes
+ */
+static void gen_c_data(void) {
+  name_record_t *record;
+  int i, size;
+
+  for(i = 0; i < num_strings(); i++)
+    fprintf(c_fd, "static char hcc_string%d[] = \"%s\";\n", i,
+	    get_string_literal(i)->string);
+
+  /*
+   * Globals are word arrays of the size the Sparc backend gives them. The
+   * history internals, which start with a dot, are declared here too.
+   */
+  has_globals = has_history_ptrs = 0;
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+
+    if(record->type_info->decl_type == TYPE_FUNCTION)
+      continue;
+
+    size = sizeof_type(record->type_info);
+    if(is_history_type(record->type_info)) {
+      size += sizeof_history(record->type_info);
+
+      if(!(cflags.flags & CFLAG_HISTORY_SIMPLE_STORE &&
+	   get_history_depth(record->type_info) <
+	   cflags.history_simple_depth))
+	has_history_ptrs = 1;
+    }
+
+    fprintf(c_fd, "int ");
+    c_print_name(record);
+    fprintf(c_fd, "[%d];\n", size > 0 ? (size + 3) / 4 : 1);
+    has_globals = 1;
+  }
+
+  if(num_strings() || has_globals)
+    fprintf(c_fd, "\n");
+  fprintf(c_fd, "extern int %s;\n", C_SP_NAME);
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+
+    if(record->type_info->decl_type == TYPE_FUNCTION) {
+      c_print_prototype(record, 0);
+      fprintf(c_fd, ";\n");
+    }
+  }
+
+  /* History pointers start at the beginning of their buffers */
+  if(!has_history_ptrs)
+    return;
+
+  fprintf(c_fd, "\nstatic void hcc_init(void) "
+	  "__attribute__((constructor));\n\n");
+  fprintf(c_fd, "static void hcc_init(void)\n{\n");
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+
+    if(is_history_type(record->type_info) &&
+       !(cflags.flags & CFLAG_HISTORY_SIMPLE_STORE &&
+	 get_history_depth(record->type_info) < cflags.history_simple_depth)) {
+      fprintf(c_fd, "  ");
+      c_print_name(history_ptr_entry(record));
+      fprintf(c_fd, "[0] = HCC_ADDR(");
+      c_print_name(record);
+      fprintf(c_fd, ");\n");
+    }
+  }
+  fprintf(c_fd, "}\n");
+}
+
+/*
+ * Generate the C main, which sets up the stack and calls the program's
+ * main
+ */
+static void gen_c_main(void) {
+  fprintf(c_fd, "\nstatic int %s[%d];\n", C_STACK_NAME, C_STACK_SIZE / 4);
+  fprintf(c_fd, "int %s;\n\n", C_SP_NAME);
+  fprintf(c_fd, "int main(void)\n{\n");
+  fprintf(c_fd, "  %s = HCC_ADDR(%s + %d);\n", C_SP_NAME, C_STACK_NAME,
+	  C_STACK_SIZE / 4);
+  fprintf(c_fd, "  return %s();\n}\n", C_MAIN_NAME);
+}
+
+/*
+ * Generate C source from MIR
+ */
+void gen_c_code(char *basename) {
+  mir_node_t *current;
+  int i;
+
+  char *filename = malloc(strlen(basename) + 3);
+  sprintf(filename, "%s.c", basename);
+
+  if(infile && !strcmp(filename, infile))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Output file %s would overwrite the input, use -o\n",
+		   filename);
+
+  if(cflags.flags & (CFLAG_OUTPUT_OBJECT | CFLAG_OUTPUT_STABS)) {
+    compiler_error(CERROR_WARN, CERROR_NO_LINE,
+		   "Objects and debug symbols aren't written for C\n");
+    cflags.flags &= ~(CFLAG_OUTPUT_OBJECT | CFLAG_OUTPUT_STABS);
+  }
+
+  if(!(c_fd = fopen(filename, "w")))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Cannot open file %s for writing\n", filename);
+
+  fprintf(c_fd, "/*\n * %s.c\n * Generated by HCC from %s.hc\n */\n",
+	  basename, basename);
+  fprintf(c_fd, "%s\n", c_prelude);
+  gen_c_data();
+
+  has_main = 0;
+  current = mir_list_head();
+  for(i = 0; i < num_def_functions(); i++)
+    gen_c_func(&current);
+
+  if(has_main)
+    gen_c_main();
+
+  fclose(c_fd);
+  free(filename);
+}
@@ -0,0 +1,23 @@
+/*
+ * cgen.h
+ *
+ * Functions/constants for the C source backend
+ *
+ */
+#ifndef _CGEN_H_
+#define _CGEN_H_
+
+/*
+ * Locals which have their address taken live in frames on a stack in the
+ * program's data, so that their addresses fit in a word
+ */
+#define C_STACK_SIZE 0x1000000
+#define C_STACK_NAME "hcc_stack"
+#define C_SP_NAME "hcc_sp"
+
+/* main is renamed, and called by a main which sets up the stack */
+#define C_MAIN_NAME "hcc_main"
+
+void gen_c_code(char *);
+
+#endif /* _CGEN_H_ */
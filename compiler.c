@@ -19,6 +19,13 @@
 #include "regalloc.h"
 #include "ast_xml.h"
 #include "cflags.h"
+#include "sparc.h"
+#include "x86.h"
+#include "rv64.h"
+#include "cgen.h"
+#include "vm.h"
+#include "jit.h"
+#include "cpp.h"
 
 static void usage(char *, int);
 static char *strip_name(char *);
@@ -35,6 +42,15 @@ char *basename;
 enum {
   GETOPT_HELP = -255,
   OPTOMISE_REG_ASSIGN,
+  OPTOMISE_COALESCE,
+  OPTOMISE_REMAT,
+  OPTOMISE_SPILL_SLOTS,
+  OPTOMISE_LEAF_PROCS,
+  OPTOMISE_DELAY_SLOTS,
+  OPTOMISE_PEEPHOLE,
+  OPTOMISE_SCHEDULE,
+  REGISTER_ALLOCATOR,
+  TARGET,
   FAST_HISTORY_ARRAYS,
   USE_LOCAL_HISTORY_LIB,
   HISTORY_ARG_SETTING,
@@ -42,6 +58,8 @@ enum {
   HISTORY_AW_ORDER_D,
   HISTORY_INLINE,
   INLINE,
+  RUN,
+  JIT,
 };
 
 /* Command line options */
@@ -49,10 +67,13 @@ static struct option const long_options[] = {
   {"output-ic", no_argument, NULL, 'i'},
   {"output-hlic", no_argument, NULL, 'h'},
   {"output-name", required_argument, NULL, 'o'},
+  {"output-object", no_argument, NULL, 'c'},
   {"debug-output", no_argument, NULL, 'x'},
   {"debug", required_argument, NULL, 'd'},
   {"debug-symbols", no_argument, NULL, 'g'},
   {"inline", no_argument, NULL, INLINE},
+  {"run", no_argument, NULL, RUN},
+  {"jit", no_argument, NULL, JIT},
 
   {"history-simple-store", required_argument, NULL, HISTORY_SIMPLE_STORE},
   {"local-history-lib", no_argument, NULL, USE_LOCAL_HISTORY_LIB},
@@ -62,8 +83,17 @@ static struct option const long_options[] = {
 
   {"target-regs", required_argument, NULL, 'r'},
   {"cpp-args", required_argument, NULL, 'p'},
+  {"regalloc", required_argument, NULL, REGISTER_ALLOCATOR},
+  {"target", required_argument, NULL, TARGET},
 
   {"optomise-reg-assign", required_argument, NULL, OPTOMISE_REG_ASSIGN},
+  {"optomise-coalesce", required_argument, NULL, OPTOMISE_COALESCE},
+  {"optomise-remat", required_argument, NULL, OPTOMISE_REMAT},
+  {"optomise-spill-slots", required_argument, NULL, OPTOMISE_SPILL_SLOTS},
+  {"optomise-leaf-procs", required_argument, NULL, OPTOMISE_LEAF_PROCS},
+  {"optomise-delay-slots", required_argument, NULL, OPTOMISE_DELAY_SLOTS},
+  {"optomise-peephole", required_argument, NULL, OPTOMISE_PEEPHOLE},
+  {"optomise-schedule", required_argument, NULL, OPTOMISE_SCHEDULE},
   {"help", no_argument, NULL, GETOPT_HELP},
   {NULL, 0, NULL, 0}
 };
@@ -76,19 +106,14 @@ char *cwd;
  *        passed to make, but it does mean that the compiler can only be
  *        run from the directory it was built in.
  */
-const char *cpp_cmd = "/usr/bin/cpp -D __HCC__ "
-  "-include " HCC_DIR "/rtlib/history.h "
-  "-include " HCC_DIR "/rtlib/harray.h "
-  "-I " HCC_DIR "/rtlib/ ";
-const char *include_rtlib = " -include "HCC_DIR "/rtlib/history.c "
-  "-include " HCC_DIR "/rtlib/harray.c ";
+#define RTLIB_DIR HCC_DIR "/rtlib"
 
 extern void yyinit(void);
 extern FILE *yyin;
 extern ast_node_t *ast;
 
 compiler_options_t cflags;
-char *infile, *command;
+char *infile;
 int yypipe[2];
 
 /*
@@ -101,18 +126,42 @@ static void usage(char *prog_name, int exit_status) {
   printf("  -i, --output-ic\t\tOutput IL (deprecated)\n");
   printf("  -h, --output-hlic\t\tOutput highlevel IC, overrides -i\n");
   printf("  -o, --output-name <file>\tPlace the output into <file>\n");
+  printf("  -c, --output-object\t\tWrite an ELF object rather than"
+	 " assembly\n");
   printf("  -x, --debug-output\t\tGenerate various debug output files\n");
   printf("  -d, --debug <level>\t\tOuptut verbose debugging information\n");
-  printf("  -r, --target-regs <regs>\tNumber of hard regs to allocate for\n");
+  printf("  -r, --target-regs <regs>\tNumber of hard regs to allocate for"
+	 " (default %d)\n", SPARC_ALLOC_REGS);
   printf("  -p, --cpp-args <args>\t\tPass the given arguments to the C"
 	 " preprocessor\n");
+  printf("      --regalloc <colour|linear-scan>\n");
+  printf("\t\t\t\tRegister allocator, linear-scan compiles faster\n");
+  printf("      --target <sparc|x86-64|rv64|c>\n");
+  printf("\t\t\t\tGenerate code for the given machine (default sparc)\n");
   printf("      --inline\t\t\tInline marked functions\n");
+  printf("      --run\t\t\tRun the program rather than compiling it\n");
+  printf("      --jit\t\t\tRun the program as x86-64 code in memory\n");
   printf("\nHistory variable options:\n");
   printf("      --history-simple-store <depth>\n");
   printf("\t\t\t\tUse simple storage below the given depth\n");
   printf("      --history-aw-order-d\tUse the O(d) algorithm for array-wise"
 	 " arrays\n");
   printf("      --history-inline\t\tInline rtlib history functions\n");
+  printf("\nOptimisation options:\n");
+  printf("      --optomise-coalesce <0|1>\tCoalesce register copies"
+	 " (default 1)\n");
+  printf("      --optomise-remat <0|1>\tRecompute spilled constants and"
+	 " addresses (default 1)\n");
+  printf("      --optomise-spill-slots <0|1>\tShare stack slots between"
+	 " spills (default 1)\n");
+  printf("      --optomise-leaf-procs <0|1>\tRun frameless functions in the"
+	 " caller's window (default 1)\n");
+  printf("      --optomise-delay-slots <0|1>\tFill branch delay slots"
+	 " (default 1)\n");
+  printf("      --optomise-peephole <0|1>\tRemove redundant machine"
+	 " instructions (default 1)\n");
+  printf("      --optomise-schedule <0|1>\tSchedule instructions around"
+	 " load latency (default 1)\n");
 
   exit(exit_status);
 }
@@ -162,8 +211,9 @@ static char *strip_name(char *filename) {
  *
  */
 int main(int argc, char **argv) {
-  int c, target_regs = 8;
-  char *outfile = NULL, *cpp_args = "";
+  int c, target_regs = SPARC_ALLOC_REGS;
+  char *outfile = NULL, *cpp_args = "", *source;
+  int source_len;
 
   /*
    * Control flow and interference graphs.
@@ -174,10 +224,14 @@ int main(int argc, char **argv) {
 
   /* Get command line options */
   cflags.flags = CFLAG_CLEAR_ALL;
+  cflags.oflags = OFLAG_COALESCE | OFLAG_REMAT | OFLAG_SPILL_SLOTS |
+    OFLAG_LEAF_PROCS | OFLAG_DELAY_SLOTS | OFLAG_PEEPHOLE | OFLAG_SCHEDULE;
   cflags.debug_level = 0;
   cflags.history_arg_setting = HISTORY_ARG_TEMP_COPY;
+  cflags.register_allocator = REGALLOC_COLOUR;
+  cflags.target = TARGET_SPARC;
 
-  while((c = getopt_long(argc, argv, "iho:xgd:r:p:",
+  while((c = getopt_long(argc, argv, "iho:cxgd:r:p:",
 			 long_options, NULL)) != -1) {
     switch(c) {
     case 0:
@@ -193,6 +247,11 @@ int main(int argc, char **argv) {
       cflags.flags |= CFLAG_OUTPUT_HLIC;
       break;
 
+    case 'c':
+      /* ELF object output */
+      cflags.flags |= CFLAG_OUTPUT_OBJECT;
+      break;
+
     case 'g':
       /* Debug symbols (stabs) */
       cflags.flags |= CFLAG_OUTPUT_STABS;
@@ -221,6 +280,11 @@ int main(int argc, char **argv) {
     case 'r':
       /* Target hard-regs */
       target_regs = atoi(optarg);
+      if(target_regs < 1 || target_regs > SPARC_ALLOC_REGS) {
+	fprintf(stderr, "Error: Invalid number of target regs, must be 1-%d\n",
+		SPARC_ALLOC_REGS);
+	exit(EXIT_FAILURE);
+      }
       break;
 
     case 'p':
@@ -229,6 +293,32 @@ int main(int argc, char **argv) {
       strcpy(cpp_args, optarg);
       break;
 
+    case REGISTER_ALLOCATOR:
+      if(!strcmp(optarg, "colour"))
+	cflags.register_allocator = REGALLOC_COLOUR;
+      else if(!strcmp(optarg, "linear-scan"))
+	cflags.register_allocator = REGALLOC_LINEAR_SCAN;
+      else {
+	fprintf(stderr, "Error: Invalid register allocator\n");
+	exit(EXIT_FAILURE);
+      }
+      break;
+
+    case TARGET:
+      if(!strcmp(optarg, "sparc"))
+	cflags.target = TARGET_SPARC;
+      else if(!strcmp(optarg, "x86-64"))
+	cflags.target = TARGET_X86_64;
+      else if(!strcmp(optarg, "rv64"))
+	cflags.target = TARGET_RV64;
+      else if(!strcmp(optarg, "c"))
+	cflags.target = TARGET_C;
+      else {
+	fprintf(stderr, "Error: Invalid target\n");
+	exit(EXIT_FAILURE);
+      }
+      break;
+
     case INLINE:
       cflags.flags |= CFLAG_INLINE;
       break;
@@ -240,6 +330,55 @@ int main(int argc, char **argv) {
 	cflags.oflags |= OFLAG_REG_ASSIGN;
       break;
 
+    case OPTOMISE_COALESCE:
+      if(!atoi(optarg))
+	cflags.oflags &= ~OFLAG_COALESCE;
+      else
+	cflags.oflags |= OFLAG_COALESCE;
+      break;
+
+    case OPTOMISE_REMAT:
+      if(!atoi(optarg))
+	cflags.oflags &= ~OFLAG_REMAT;
+      else
+	cflags.oflags |= OFLAG_REMAT;
+      break;
+
+    case OPTOMISE_SPILL_SLOTS:
+      if(!atoi(optarg))
+	cflags.oflags &= ~OFLAG_SPILL_SLOTS;
+      else
+	cflags.oflags |= OFLAG_SPILL_SLOTS;
+      break;
+
+    case OPTOMISE_LEAF_PROCS:
+      if(!atoi(optarg))
+	cflags.oflags &= ~OFLAG_LEAF_PROCS;
+      else
+	cflags.oflags |= OFLAG_LEAF_PROCS;
+      break;
+
+    case OPTOMISE_DELAY_SLOTS:
+      if(!atoi(optarg))
+	cflags.oflags &= ~OFLAG_DELAY_SLOTS;
+      else
+	cflags.oflags |= OFLAG_DELAY_SLOTS;
+      break;
+
+    case OPTOMISE_PEEPHOLE:
+      if(!atoi(optarg))
+	cflags.oflags &= ~OFLAG_PEEPHOLE;
+      else
+	cflags.oflags |= OFLAG_PEEPHOLE;
+      break;
+
+    case OPTOMISE_SCHEDULE:
+      if(!atoi(optarg))
+	cflags.oflags &= ~OFLAG_SCHEDULE;
+      else
+	cflags.oflags |= OFLAG_SCHEDULE;
+      break;
+
     case USE_LOCAL_HISTORY_LIB:
       cflags.flags |= CFLAG_USE_LOCAL_HISTORY_LIB;
       break;
@@ -264,6 +403,15 @@ int main(int argc, char **argv) {
       cflags.flags |= CFLAG_HISTORY_INLINE;
       break;
 
+    case RUN:
+      /* The history functions are interpreted along with the program */
+      cflags.flags |= CFLAG_RUN | CFLAG_OUTPUT_HLIC | CFLAG_HISTORY_INLINE;
+      break;
+
+    case JIT:
+      cflags.flags |= CFLAG_JIT | CFLAG_OUTPUT_HLIC | CFLAG_HISTORY_INLINE;
+      break;
+
     case GETOPT_HELP:
       usage(argv[0], EXIT_SUCCESS);
       break;
@@ -320,20 +468,22 @@ int main(int argc, char **argv) {
     strcpy(cflags.entry_point, "main");
   }
 
-  /* Run the C Preprocessor and send its output to yyin */
-  command = malloc(strlen(cpp_cmd) + strlen(cpp_args) +
-		   strlen(include_rtlib) + strlen(infile) + 1);
-
-  strcpy(command, cpp_cmd);
-  if(cpp_args)
-    strcat(command, cpp_args);
-  if(cflags.flags & CFLAG_HISTORY_INLINE)
-    strcat(command, include_rtlib);
-  strcat(command, infile);
+  fclose(yyin);
+
+  /* Preprocess the source file and have the lexer read the result */
+  cpp_define("__HCC__", "1");
+  cpp_include_dir(RTLIB_DIR);
+  cpp_force_include(RTLIB_DIR "/history.h");
+  cpp_force_include(RTLIB_DIR "/harray.h");
+  cpp_parse_args(cpp_args);
+  if(cflags.flags & CFLAG_HISTORY_INLINE) {
+    cpp_force_include(RTLIB_DIR "/history.c");
+    cpp_force_include(RTLIB_DIR "/harray.c");
+  }
 
-  debug_printf(1, "cpp command: %s\n", command);
-  yyin = popen(command, "r");
-  free(command);
+  source = cpp_preprocess(infile, &source_len);
+  debug_printf(1, "Preprocessed %s to %d bytes\n", infile, source_len);
+  yyin = fmemopen(source, source_len, "r");
 
   /* Parse the source file to create the AST */
   yyinit();
@@ -420,6 +570,17 @@ int main(int argc, char **argv) {
     mir_label_nodes();
     mir_print(basename, "mir");
 
+    if(cflags.flags & CFLAG_JIT)
+      exit(jit_run());
+    else if(cflags.flags & CFLAG_RUN)
+      exit(vm_run());
+
+    /* The C compiler does its own register allocation */
+    if(cflags.target == TARGET_C) {
+      gen_c_code(basename);
+      exit(EXIT_SUCCESS);
+    }
+
     cfg_list = mcfg_build(mir_list_head());
     global_load_store(cfg_list);
 
@@ -427,7 +588,12 @@ int main(int argc, char **argv) {
     allocate_registers(cfg_list, target_regs);
 
     /* Fingers crossed ;-) */
-    gen_sparc_code(basename);
+    if(cflags.target == TARGET_X86_64)
+      gen_x86_code(basename);
+    else if(cflags.target == TARGET_RV64)
+      gen_rv64_code(basename);
+    else
+      gen_sparc_code(basename);
 
   }
 
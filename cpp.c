@@ -0,0 +1,901 @@
+/*
+ * cpp.c
+ *
+ * Preprocessor. Handles #include, object-like macros and the conditional
+ * directives, which is all that HC programs and the rtlib use, so that
+ * compiling doesn't need to run /usr/bin/cpp. The output is built in
+ * memory, with line markers as cpp writes them, and read by the lexer.
+ * Files are read once and kept, so the rtlib headers included into every
+ * program are only read from disk once.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include "cerror.h"
+#include "debug.h"
+#include "cpp.h"
+
+/* Text which grows as it is appended to */
+typedef struct {
+  char *text;
+  int len;
+  int max;
+
+} cpp_buf_t;
+
+typedef struct cpp_macro_s {
+  char *name;
+  char *value;
+
+  /* Set while the macro is being expanded, so it can't expand itself */
+  int disabled;
+
+  struct cpp_macro_s *next;
+
+} cpp_macro_t;
+
+/* A file, with its comments removed */
+typedef struct cpp_file_s {
+  char *name;
+  char *text;
+
+  struct cpp_file_s *next;
+
+} cpp_file_t;
+
+/* An #if, #ifdef or #ifndef group */
+typedef struct {
+  int active;
+  int taken;
+  int seen_else;
+
+  /* Line of the #if, for when it isn't ended */
+  int line;
+
+} cpp_cond_t;
+
+static void cpp_append(cpp_buf_t *, char *, int);
+static void cpp_error(int, char *, ...);
+static void cpp_marker(int, char *);
+static char *cpp_strip_comments(char *);
+static cpp_file_t *cpp_read(char *);
+static cpp_file_t *cpp_find_include(char *, int);
+static cpp_macro_t *cpp_find_macro(char *, int);
+static void cpp_undef(char *, int);
+static char *cpp_skip_space(char *);
+static int cpp_ident_len(char *);
+static int cpp_is(char *, int, char *);
+static void cpp_expand(char *, cpp_buf_t *);
+static long cpp_eval_unary(char **);
+static long cpp_eval_binary(char **, int);
+static long cpp_eval_cond(char **);
+static int cpp_eval(char *);
+static int cpp_active(void);
+static void cpp_push_cond(int);
+static int cpp_include(char *);
+static int cpp_directive(char *);
+static void cpp_process(cpp_file_t *);
+
+static cpp_macro_t *cpp_macros;
+static cpp_file_t *cpp_files;
+
+static char **cpp_dirs;
+static int cpp_num_dirs;
+
+static char **cpp_forced;
+static int cpp_num_forced;
+
+static cpp_buf_t cpp_out;
+
+/* Open conditionals. Those from the current file start at cpp_cond_base. */
+static cpp_cond_t *cpp_conds;
+static int cpp_num_conds, cpp_max_conds, cpp_cond_base;
+
+/* The line being preprocessed */
+static char *cpp_cur_name;
+static int cpp_cur_line, cpp_depth;
+
+/* Set while evaluating an operand whose value isn't needed */
+static int cpp_eval_skip;
+
+/* Binary operators for #if, longest first */
+static const struct {
+  char *op;
+  int prec;
+
+} cpp_binops[] = {
+  {"||", 1}, {"&&", 2}, {"==", 6}, {"!=", 6}, {"<=", 7}, {">=", 7},
+  {"<<", 8}, {">>", 8}, {"|", 3}, {"^", 4}, {"&", 5}, {"<", 7}, {">", 7},
+  {"+", 9}, {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10}, {NULL, 0}
+};
+
+static void cpp_append(cpp_buf_t *buf, char *text, int len) {
+  if(buf->len + len + 1 > buf->max) {
+    buf->max = (buf->len + len + 1) * 2;
+    buf->text = realloc(buf->text, buf->max);
+  }
+
+  memcpy(buf->text + buf->len, text, len);
+  buf->len += len;
+  buf->text[buf->len] = '\0';
+}
+
+/*
+ * Report an error at the line being preprocessed
+ */
+static void cpp_error(int type, char *fmt, ...) {
+  char msg[1024];
+  va_list args;
+
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  if(cpp_cur_name)
+    compiler_error(type, CERROR_NO_LINE, "%s:%d: %s\n", cpp_cur_name,
+		   cpp_cur_line, msg);
+  else
+    compiler_error(type, CERROR_NO_LINE, "%s\n", msg);
+}
+
+/*
+ * Line marker, giving the line and file of the next line to the lexer
+ */
+static void cpp_marker(int line, char *name) {
+  char marker[32];
+
+  snprintf(marker, sizeof(marker), "# %d \"", line);
+  cpp_append(&cpp_out, marker, strlen(marker));
+  cpp_append(&cpp_out, name, strlen(name));
+  cpp_append(&cpp_out, "\"\n", 2);
+}
+
+/*
+ * Replace comments with a space, keeping their newlines so that lines
+ * stay numbered
+ */
+static char *cpp_strip_comments(char *text) {
+  char *stripped = malloc(strlen(text) + 1), *dest = stripped, quote = 0;
+
+  while(*text) {
+    if(quote) {
+      if(*text == '\\' && text[1]) {
+	*dest++ = *text++;
+      } else if(*text == quote || *text == '\n')
+	quote = 0;
+      *dest++ = *text++;
+
+    } else if(*text == '"' || *text == '\'') {
+      quote = *text;
+      *dest++ = *text++;
+
+    } else if(text[0] == '/' && text[1] == '*') {
+      *dest++ = ' ';
+      for(text += 2; *text && !(text[0] == '*' && text[1] == '/'); text++)
+	if(*text == '\n')
+	  *dest++ = '\n';
+      if(*text)
+	text += 2;
+
+    } else if(text[0] == '/' && text[1] == '/') {
+      while(*text && *text != '\n')
+	text++;
+
+    } else
+      *dest++ = *text++;
+  }
+
+  *dest = '\0';
+  return stripped;
+}
+
+/*
+ * Read a file, or find it if it has already been read. Returns NULL if
+ * it can't be opened.
+ */
+static cpp_file_t *cpp_read(char *name) {
+  cpp_file_t *file;
+  cpp_buf_t text = {NULL, 0, 0};
+  char block[4096];
+  FILE *fd;
+  int len;
+
+  for(file = cpp_files; file; file = file->next)
+    if(!strcmp(file->name, name))
+      return file;
+
+  if(!(fd = fopen(name, "r")))
+    return NULL;
+
+  cpp_append(&text, "", 0);
+  while((len = fread(block, 1, sizeof(block), fd)) > 0)
+    cpp_append(&text, block, len);
+  fclose(fd);
+
+  debug_printf(1, "Read %s for the preprocessor\n", name);
+
+  file = malloc(sizeof(cpp_file_t));
+  file->name = malloc(strlen(name) + 1);
+  strcpy(file->name, name);
+  file->text = cpp_strip_comments(text.text);
+  file->next = cpp_files;
+  cpp_files = file;
+
+  free(text.text);
+  return file;
+}
+
+/*
+ * Find an include file. Quoted names are looked for beside the file
+ * including them first, and then in the include directories.
+ */
+static cpp_file_t *cpp_find_include(char *name, int quoted) {
+  cpp_file_t *file;
+  char *path, *slash;
+  int i, len;
+
+  if(name[0] == '/')
+    return cpp_read(name);
+
+  path = malloc(strlen(name) + (cpp_cur_name ? strlen(cpp_cur_name) : 0) + 2);
+  if(quoted) {
+    len = 0;
+    if(cpp_cur_name && (slash = strrchr(cpp_cur_name, '/')))
+      len = slash - cpp_cur_name + 1;
+
+    strncpy(path, cpp_cur_name, len);
+    strcpy(path + len, name);
+    if((file = cpp_read(path))) {
+      free(path);
+      return file;
+    }
+  }
+  free(path);
+
+  for(i = 0; i < cpp_num_dirs; i++) {
+    path = malloc(strlen(cpp_dirs[i]) + strlen(name) + 2);
+    strcpy(path, cpp_dirs[i]);
+    if(path[0] && path[strlen(path) - 1] != '/')
+      strcat(path, "/");
+    strcat(path, name);
+
+    file = cpp_read(path);
+    free(path);
+    if(file)
+      return file;
+  }
+
+  return NULL;
+}
+
+static cpp_macro_t *cpp_find_macro(char *name, int len) {
+  cpp_macro_t *macro;
+
+  for(macro = cpp_macros; macro; macro = macro->next)
+    if(cpp_is(name, len, macro->name))
+      return macro;
+
+  return NULL;
+}
+
+/*
+ * Define an object-like macro, as #define or -D do
+ */
+void cpp_define(char *name, char *value) {
+  cpp_macro_t *macro = cpp_find_macro(name, strlen(name));
+
+  if(macro) {
+    if(strcmp(macro->value, value))
+      cpp_error(CERROR_WARN, "%s redefined", name);
+    free(macro->value);
+
+  } else {
+    macro = malloc(sizeof(cpp_macro_t));
+    macro->name = malloc(strlen(name) + 1);
+    strcpy(macro->name, name);
+    macro->disabled = 0;
+    macro->next = cpp_macros;
+    cpp_macros = macro;
+  }
+
+  macro->value = malloc(strlen(value) + 1);
+  strcpy(macro->value, value);
+}
+
+static void cpp_undef(char *name, int len) {
+  cpp_macro_t *macro, *prev = NULL;
+
+  for(macro = cpp_macros; macro; prev = macro, macro = macro->next)
+    if(cpp_is(name, len, macro->name)) {
+      if(prev)
+	prev->next = macro->next;
+      else
+	cpp_macros = macro->next;
+
+      free(macro->name);
+      free(macro->value);
+      free(macro);
+      return;
+    }
+}
+
+void cpp_include_dir(char *dir) {
+  cpp_dirs = realloc(cpp_dirs, sizeof(char *) * (cpp_num_dirs + 1));
+  cpp_dirs[cpp_num_dirs] = malloc(strlen(dir) + 1);
+  strcpy(cpp_dirs[cpp_num_dirs++], dir);
+}
+
+/*
+ * Include a file before the source file, as -include does
+ */
+void cpp_force_include(char *name) {
+  cpp_forced = realloc(cpp_forced, sizeof(char *) * (cpp_num_forced + 1));
+  cpp_forced[cpp_num_forced] = malloc(strlen(name) + 1);
+  strcpy(cpp_forced[cpp_num_forced++], name);
+}
+
+/*
+ * Take the options given for cpp with -p. Only -D, -U, -I and -include
+ * mean anything to the preprocessor.
+ */
+void cpp_parse_args(char *args) {
+  char *copy, *arg, *value;
+
+  if(!args)
+    return;
+
+  copy = malloc(strlen(args) + 1);
+  strcpy(copy, args);
+
+  for(arg = strtok(copy, " \t\n"); arg; arg = strtok(NULL, " \t\n")) {
+    if(!strncmp(arg, "-D", 2) || !strncmp(arg, "-U", 2) ||
+       !strncmp(arg, "-I", 2) || !strcmp(arg, "-include")) {
+      value = arg[2] && strcmp(arg, "-include") ? arg + 2 :
+	strtok(NULL, " \t\n");
+      if(!value) {
+	cpp_error(CERROR_ERROR, "Missing argument to %s", arg);
+	break;
+      }
+
+      if(arg[1] == 'D') {
+	char *eq = strchr(value, '=');
+
+	if(eq)
+	  *eq++ = '\0';
+	cpp_define(value, eq ? eq : "1");
+
+      } else if(arg[1] == 'U')
+	cpp_undef(value, strlen(value));
+      else if(arg[1] == 'I')
+	cpp_include_dir(value);
+      else
+	cpp_force_include(value);
+
+    } else
+      cpp_error(CERROR_WARN, "Ignoring preprocessor option %s", arg);
+  }
+
+  free(copy);
+}
+
+static char *cpp_skip_space(char *text) {
+  while(*text == ' ' || *text == '\t' || *text == '\r' ||
+	*text == '\f' || *text == '\v')
+    text++;
+
+  return text;
+}
+
+static int cpp_ident_len(char *text) {
+  int len = 0;
+
+  if(!isalpha((unsigned char)*text) && *text != '_')
+    return 0;
+
+  while(isalnum((unsigned char)text[len]) || text[len] == '_')
+    len++;
+
+  return len;
+}
+
+/*
+ * Whether a length delimited word is the given name
+ */
+static int cpp_is(char *word, int len, char *name) {
+  return len == (int)strlen(name) && !strncmp(word, name, len);
+}
+
+/*
+ * Append text with its macros expanded. Expansions are spaced from the
+ * text around them, so that they can't join onto its tokens.
+ */
+static void cpp_expand(char *text, cpp_buf_t *out) {
+  cpp_macro_t *macro;
+  char quote;
+  int len;
+
+  while(*text) {
+    len = cpp_ident_len(text);
+
+    if(len) {
+      macro = cpp_find_macro(text, len);
+      if(macro && !macro->disabled) {
+	macro->disabled = 1;
+	cpp_append(out, " ", 1);
+	cpp_expand(macro->value, out);
+	cpp_append(out, " ", 1);
+	macro->disabled = 0;
+      } else
+	cpp_append(out, text, len);
+
+    } else if(isdigit((unsigned char)*text)) {
+      /* Numbers may have letters in them, which aren't macros */
+      while(isalnum((unsigned char)text[len]) || text[len] == '_' ||
+	    text[len] == '.')
+	len++;
+      cpp_append(out, text, len);
+
+    } else if(*text == '"' || *text == '\'') {
+      quote = *text;
+      for(len = 1; text[len] && text[len] != quote; len++)
+	if(text[len] == '\\' && text[len + 1])
+	  len++;
+      if(text[len])
+	len++;
+      cpp_append(out, text, len);
+
+    } else {
+      len = 1;
+      cpp_append(out, text, len);
+    }
+
+    text += len;
+  }
+}
+
+static long cpp_eval_unary(char **expr) {
+  char *text = cpp_skip_space(*expr), *end;
+  long val;
+  int len;
+
+  switch(*text) {
+  case '(':
+    *expr = text + 1;
+    val = cpp_eval_cond(expr);
+    text = cpp_skip_space(*expr);
+    if(*text != ')')
+      cpp_error(CERROR_ERROR, "Missing ) in #if");
+    *expr = text + 1;
+    return val;
+
+  case '!':
+    *expr = text + 1;
+    return !cpp_eval_unary(expr);
+
+  case '~':
+    *expr = text + 1;
+    return ~cpp_eval_unary(expr);
+
+  case '-':
+    *expr = text + 1;
+    return -cpp_eval_unary(expr);
+
+  case '+':
+    *expr = text + 1;
+    return cpp_eval_unary(expr);
+
+  case '\'':
+    val = (unsigned char)text[1];
+    len = 2;
+    if(text[1] == '\\') {
+      switch(text[2]) {
+      case 'n': val = '\n'; break;
+      case 't': val = '\t'; break;
+      case '0': val = '\0'; break;
+      default: val = (unsigned char)text[2]; break;
+      }
+      len = 3;
+    }
+    if(text[len] != '\'')
+      cpp_error(CERROR_ERROR, "Invalid character constant in #if");
+    *expr = text + len + 1;
+    return val;
+  }
+
+  if(isdigit((unsigned char)*text)) {
+    val = strtol(text, &end, 0);
+    while(*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L')
+      end++;
+    *expr = end;
+    return val;
+  }
+
+  /* Identifiers left after expansion are 0 */
+  if((len = cpp_ident_len(text))) {
+    *expr = text + len;
+    return 0;
+  }
+
+  cpp_error(CERROR_ERROR, "Invalid expression in #if");
+  return 0;
+}
+
+/*
+ * Binary operators of at least the given precedence
+ */
+static long cpp_eval_binary(char **expr, int min_prec) {
+  long left = cpp_eval_unary(expr), right;
+  char *text;
+  int i, len, skip;
+
+  for(;;) {
+    text = cpp_skip_space(*expr);
+    for(i = 0; cpp_binops[i].op; i++)
+      if(!strncmp(text, cpp_binops[i].op, strlen(cpp_binops[i].op)))
+	break;
+
+    if(!cpp_binops[i].op || cpp_binops[i].prec < min_prec)
+      return left;
+
+    len = strlen(cpp_binops[i].op);
+    *expr = text + len;
+
+    /* The right of && and || isn't needed if the left decides */
+    skip = (text[0] == '&' && text[1] == '&' && !left) ||
+      (text[0] == '|' && text[1] == '|' && left);
+    cpp_eval_skip += skip;
+    right = cpp_eval_binary(expr, cpp_binops[i].prec + 1);
+    cpp_eval_skip -= skip;
+
+    switch(text[0]) {
+    case '|': left = len == 2 ? left || right : left | right; break;
+    case '&': left = len == 2 ? left && right : left & right; break;
+    case '^': left ^= right; break;
+    case '=': left = left == right; break;
+    case '!': left = left != right; break;
+    case '+': left += right; break;
+    case '-': left -= right; break;
+    case '*': left *= right; break;
+
+    case '<':
+      if(len == 1)
+	left = left < right;
+      else
+	left = text[1] == '=' ? left <= right : left << right;
+      break;
+
+    case '>':
+      if(len == 1)
+	left = left > right;
+      else
+	left = text[1] == '=' ? left >= right : left >> right;
+      break;
+
+    case '/':
+    case '%':
+      if(!right) {
+	if(!cpp_eval_skip)
+	  cpp_error(CERROR_ERROR, "Division by zero in #if");
+	left = 0;
+      } else
+	left = text[0] == '/' ? left / right : left % right;
+      break;
+    }
+  }
+}
+
+static long cpp_eval_cond(char **expr) {
+  long cond = cpp_eval_binary(expr, 1), val, other;
+  char *text = cpp_skip_space(*expr);
+
+  if(*text != '?')
+    return cond;
+
+  *expr = text + 1;
+  cpp_eval_skip += !cond;
+  val = cpp_eval_cond(expr);
+  cpp_eval_skip -= !cond;
+
+  text = cpp_skip_space(*expr);
+  if(*text != ':')
+    cpp_error(CERROR_ERROR, "Missing : in #if");
+  *expr = text + 1;
+
+  cpp_eval_skip += !!cond;
+  other = cpp_eval_cond(expr);
+  cpp_eval_skip -= !!cond;
+
+  return cond ? val : other;
+}
+
+/*
+ * Evaluate the expression of an #if or #elif. defined is replaced before
+ * macros are expanded.
+ */
+static int cpp_eval(char *text) {
+  cpp_buf_t defined = {NULL, 0, 0}, expanded = {NULL, 0, 0};
+  char *expr, *name;
+  int len, paren;
+  long val;
+
+  cpp_append(&defined, "", 0);
+  while(*text) {
+    len = cpp_ident_len(text);
+
+    if(!cpp_is(text, len, "defined")) {
+      cpp_append(&defined, text, len ? len : 1);
+      text += len ? len : 1;
+      continue;
+    }
+
+    name = cpp_skip_space(text + len);
+    if((paren = *name == '('))
+      name = cpp_skip_space(name + 1);
+    if(!(len = cpp_ident_len(name)))
+      cpp_error(CERROR_ERROR, "No macro name given to defined");
+
+    cpp_append(&defined, cpp_find_macro(name, len) ? "1" : "0", 1);
+    text = cpp_skip_space(name + len);
+    if(paren) {
+      if(*text != ')')
+	cpp_error(CERROR_ERROR, "Missing ) after defined");
+      text++;
+    }
+  }
+
+  cpp_append(&expanded, "", 0);
+  cpp_expand(defined.text, &expanded);
+
+  expr = expanded.text;
+  if(!*cpp_skip_space(expr))
+    cpp_error(CERROR_ERROR, "#if with no expression");
+  val = cpp_eval_cond(&expr);
+  if(*cpp_skip_space(expr))
+    cpp_error(CERROR_ERROR, "Invalid expression in #if");
+
+  free(defined.text);
+  free(expanded.text);
+  return val != 0;
+}
+
+static int cpp_active(void) {
+  return !cpp_num_conds || cpp_conds[cpp_num_conds - 1].active;
+}
+
+/*
+ * Start a conditional group. Groups inside skipped lines are skipped too.
+ */
+static void cpp_push_cond(int val) {
+  int parent = cpp_active();
+
+  if(cpp_num_conds == cpp_max_conds) {
+    cpp_max_conds = cpp_max_conds ? cpp_max_conds * 2 : 16;
+    cpp_conds = realloc(cpp_conds, sizeof(cpp_cond_t) * cpp_max_conds);
+  }
+
+  cpp_conds[cpp_num_conds].active = parent && val;
+  cpp_conds[cpp_num_conds].taken = !parent || val;
+  cpp_conds[cpp_num_conds].seen_else = 0;
+  cpp_conds[cpp_num_conds++].line = cpp_cur_line;
+}
+
+/*
+ * Include the file named by an #include. Returns 1.
+ */
+static int cpp_include(char *args) {
+  cpp_buf_t expanded = {NULL, 0, 0};
+  cpp_file_t *file;
+  char *name, *end, *saved_name;
+  int saved_line, saved_base;
+
+  /* Names which aren't quoted come from macros */
+  cpp_append(&expanded, "", 0);
+  if(*args != '"' && *args != '<')
+    cpp_expand(args, &expanded);
+  else
+    cpp_append(&expanded, args, strlen(args));
+
+  name = cpp_skip_space(expanded.text);
+  if((*name != '"' && *name != '<') ||
+     !(end = strchr(name + 1, *name == '"' ? '"' : '>')))
+    cpp_error(CERROR_ERROR, "Invalid #include");
+
+  *end = '\0';
+  if(!(file = cpp_find_include(name + 1, *name == '"')))
+    cpp_error(CERROR_ERROR, "Can't find include file %s", name + 1);
+  free(expanded.text);
+
+  if(++cpp_depth > CPP_MAX_INCLUDE_DEPTH)
+    cpp_error(CERROR_ERROR, "Includes nested too deeply");
+
+  saved_name = cpp_cur_name;
+  saved_line = cpp_cur_line;
+  saved_base = cpp_cond_base;
+  cpp_process(file);
+  cpp_cur_name = saved_name;
+  cpp_cur_line = saved_line;
+  cpp_cond_base = saved_base;
+
+  cpp_depth--;
+  return 1;
+}
+
+/*
+ * Carry out a directive, given the text after its #. Returns 1 if a file
+ * was included.
+ */
+static int cpp_directive(char *text) {
+  cpp_cond_t *cond;
+  char *name, *args, *end;
+  int len;
+
+  name = cpp_skip_space(text);
+  len = cpp_ident_len(name);
+  args = cpp_skip_space(name + len);
+
+  if(cpp_is(name, len, "ifdef") || cpp_is(name, len, "ifndef")) {
+    if(cpp_active() && !cpp_ident_len(args))
+      cpp_error(CERROR_ERROR, "No macro name given to #%.*s", len, name);
+
+    cpp_push_cond((cpp_find_macro(args, cpp_ident_len(args)) != NULL) ^
+		  (len == 6));
+    return 0;
+  }
+
+  if(cpp_is(name, len, "if")) {
+    cpp_push_cond(cpp_active() && cpp_eval(args));
+    return 0;
+  }
+
+  if(cpp_is(name, len, "elif") || cpp_is(name, len, "else") ||
+     cpp_is(name, len, "endif")) {
+    if(cpp_num_conds == cpp_cond_base)
+      cpp_error(CERROR_ERROR, "#%.*s without #if", len, name);
+
+    cond = &cpp_conds[cpp_num_conds - 1];
+    if(len == 5 && name[1] == 'n') {
+      cpp_num_conds--;
+      return 0;
+    }
+
+    if(cond->seen_else)
+      cpp_error(CERROR_ERROR, "#%.*s after #else", len, name);
+
+    if(len == 4 && name[2] == 's') {
+      cond->active = !cond->taken;
+      cond->taken = 1;
+      cond->seen_else = 1;
+    } else if(cond->taken)
+      cond->active = 0;
+    else
+      cond->active = cond->taken = cpp_eval(args);
+    return 0;
+  }
+
+  if(!cpp_active())
+    return 0;
+
+  if(cpp_is(name, len, "define")) {
+    if(!(len = cpp_ident_len(args)))
+      cpp_error(CERROR_ERROR, "No macro name given to #define");
+    if(args[len] == '(')
+      cpp_error(CERROR_ERROR, "Function-like macros aren't supported");
+
+    /* Trailing space isn't part of the value */
+    name = args;
+    args = cpp_skip_space(args + len);
+    for(end = args + strlen(args); end > args && isspace((unsigned char)end[-1]);
+	end--);
+    *end = '\0';
+    name[len] = '\0';
+
+    cpp_define(name, args);
+
+  } else if(cpp_is(name, len, "undef")) {
+    if(!(len = cpp_ident_len(args)))
+      cpp_error(CERROR_ERROR, "No macro name given to #undef");
+    cpp_undef(args, len);
+
+  } else if(cpp_is(name, len, "include"))
+    return cpp_include(args);
+
+  else if(cpp_is(name, len, "error"))
+    cpp_error(CERROR_ERROR, "#error %s", args);
+
+  else if(cpp_is(name, len, "warning"))
+    cpp_error(CERROR_WARN, "#warning %s", args);
+
+  else if(len && !cpp_is(name, len, "line") && !cpp_is(name, len, "pragma"))
+    cpp_error(CERROR_ERROR, "Unknown directive #%.*s", len, name);
+
+  /* Line markers from cpp, and empty directives, are ignored */
+  else if(!len && *name && !isdigit((unsigned char)*name))
+    cpp_error(CERROR_ERROR, "Invalid directive");
+
+  return 0;
+}
+
+/*
+ * Preprocess a file into the output. Lines which aren't output are left
+ * blank, and continued lines are followed by blank lines, so that the
+ * lexer numbers lines as they are in the file.
+ */
+static void cpp_process(cpp_file_t *file) {
+  cpp_buf_t line = {NULL, 0, 0};
+  char *text = file->text, *end, *start;
+  int line_num = 1, lines, cont, included, len;
+
+  cpp_cond_base = cpp_num_conds;
+  cpp_cur_name = file->name;
+  cpp_marker(1, file->name);
+
+  while(*text) {
+    line.len = 0;
+    cpp_append(&line, "", 0);
+
+    for(lines = 0, cont = 1; cont && *text; lines++) {
+      if(!(end = strchr(text, '\n')))
+	end = text + strlen(text);
+
+      len = end - text;
+      cont = len && text[len - 1] == '\\';
+      cpp_append(&line, text, cont ? len - 1 : len);
+      text = *end ? end + 1 : end;
+    }
+
+    cpp_cur_line = line_num;
+    included = 0;
+
+    start = cpp_skip_space(line.text);
+    if(*start == '#')
+      included = cpp_directive(start + 1);
+    else if(cpp_active())
+      cpp_expand(line.text, &cpp_out);
+
+    line_num += lines;
+    if(included)
+      cpp_marker(line_num, file->name);
+    else
+      while(lines--)
+	cpp_append(&cpp_out, "\n", 1);
+  }
+
+  if(cpp_num_conds > cpp_cond_base) {
+    cpp_cur_line = cpp_conds[cpp_num_conds - 1].line;
+    cpp_error(CERROR_ERROR, "Unterminated conditional directive");
+  }
+
+  free(line.text);
+}
+
+/*
+ * Preprocess a source file, after the files which are always included.
+ * Returns the text for the lexer, and its length.
+ */
+char *cpp_preprocess(char *name, int *length) {
+  cpp_file_t *file;
+  int i;
+
+  cpp_out.len = 0;
+  cpp_append(&cpp_out, "", 0);
+
+  for(i = 0; i < cpp_num_forced; i++) {
+    cpp_cur_name = NULL;
+    if(!(file = cpp_read(cpp_forced[i])) &&
+       !(file = cpp_find_include(cpp_forced[i], 0)))
+      cpp_error(CERROR_ERROR, "Can't find include file %s", cpp_forced[i]);
+
+    cpp_process(file);
+  }
+
+  cpp_cur_name = NULL;
+  if(!(file = cpp_read(name)))
+    cpp_error(CERROR_ERROR, "Can't open %s", name);
+  cpp_process(file);
+
+  *length = cpp_out.len;
+  return cpp_out.text;
+}
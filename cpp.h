@@ -0,0 +1,19 @@
+/*
+ * cpp.h
+ *
+ * Functions/constants for the preprocessor
+ *
+ */
+#ifndef _CPP_H_
+#define _CPP_H_
+
+/* Deepest nesting of include files */
+#define CPP_MAX_INCLUDE_DEPTH 200
+
+void cpp_define(char *, char *);
+void cpp_include_dir(char *);
+void cpp_force_include(char *);
+void cpp_parse_args(char *);
+char *cpp_preprocess(char *, int *);
+
+#endif /* _CPP_H_ */
@@ -0,0 +1,561 @@
+/*
+ * jit.c
+ *
+ * x86-64 JIT. Compiles the interpreter's threaded code into machine code
+ * in an executable buffer, and calls the program's entry point in-process,
+ * without an assembler, linker or any other process.
+ *
+ * The program keeps the interpreter's memory and register slots, so each
+ * instruction is a short sequence of loads and stores to slots. Constants
+ * become immediates, and functions are called with real call instructions.
+ * Calls to the rtlib functions which aren't compiled in with the program
+ * go to the interpreter's native functions, by their address in the
+ * compiler.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "cerror.h"
+#include "debug.h"
+#include "cflags.h"
+#include "vm.h"
+#include "x86.h"
+#include "jit.h"
+
+#ifdef __x86_64__
+
+/* Branch or call to the code for an instruction, patched when it's known */
+typedef struct {
+  int offset;
+  int target;
+
+} jit_fixup_t;
+
+/* The generated code, called as a C function */
+typedef int (*jit_entry_t)(int *, char *, int *, long, long);
+
+static void jit_byte(int);
+static void jit_word(int);
+static void jit_quad(uint64_t);
+static void jit_rex(int, int, int, int);
+static void jit_mem(int, int, int, int, int, int);
+static void jit_reg(int, int, int, int);
+static void jit_push_pop(int, int);
+static void jit_mov_imm(int, int);
+static void jit_rel32(int);
+static void jit_jcc_error(int, int);
+static int jit_is_const(vm_func_t *, int);
+static void jit_load(vm_func_t *, int, int);
+static void jit_store(int, int);
+static void jit_alu(vm_func_t *, int, int);
+static void jit_check_addr(void);
+static void jit_call_host(void *);
+static void jit_call(vm_func_t *, vm_instr_t *);
+static void jit_call_native(vm_func_t *, vm_instr_t *);
+static void jit_instr(vm_func_t *, vm_instr_t *);
+static int jit_compile(vm_func_t *);
+
+/* Condition codes for Jcc */
+enum {
+  JIT_CC_B = 0x2,
+  JIT_CC_E = 0x4,
+  JIT_CC_NE = 0x5,
+  JIT_CC_A = 0x7,
+  JIT_CC_L = 0xc,
+  JIT_CC_GE = 0xd,
+  JIT_CC_LE = 0xe,
+  JIT_CC_G = 0xf
+};
+
+/* Arithmetic with a memory or immediate operand */
+enum {
+  JIT_ADD,
+  JIT_SUB,
+  JIT_MUL,
+  JIT_CMP
+};
+
+static unsigned char *jit_buf;
+static int jit_len, jit_max;
+
+/* Offset of the code for each instruction */
+static int *jit_offsets;
+
+static jit_fixup_t *jit_fixups;
+static int jit_num_fixups, jit_max_fixups;
+
+/* Offsets of the code reporting each runtime error */
+static int jit_errors[VM_ERROR_OVERFLOW + 1];
+
+static void jit_byte(int val) {
+  if(jit_len == jit_max) {
+    jit_max = jit_max ? jit_max * 2 : 4096;
+    jit_buf = realloc(jit_buf, jit_max);
+  }
+
+  jit_buf[jit_len++] = val;
+}
+
+static void jit_word(int val) {
+  int i;
+
+  for(i = 0; i < 4; i++)
+    jit_byte((unsigned int)val >> (i * 8));
+}
+
+static void jit_quad(uint64_t val) {
+  int i;
+
+  for(i = 0; i < 8; i++)
+    jit_byte(val >> (i * 8));
+}
+
+/*
+ * REX prefix, for 64 bit operands or the upper eight registers. index is
+ * -1 if there is no index register.
+ */
+static void jit_rex(int wide, int reg, int index, int base) {
+  int rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+
+  if(index >= 0)
+    rex |= (index >> 3) << 1;
+  if(rex != 0x40)
+    jit_byte(rex);
+}
+
+/*
+ * Instruction with a [base + index + disp] operand. Two byte opcodes are
+ * given with their 0x0f escape in the high byte.
+ */
+static void jit_mem(int opcode, int wide, int reg, int base, int index,
+		    int disp) {
+  jit_rex(wide, reg, index, base);
+  if(opcode > 0xff)
+    jit_byte(opcode >> 8);
+  jit_byte(opcode);
+
+  if(index >= 0) {
+    jit_byte(0x84 | ((reg & 7) << 3));
+    jit_byte(((index & 7) << 3) | (base & 7));
+  } else {
+    jit_byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    if((base & 7) == X86_RSP)
+      jit_byte(0x24);
+  }
+  jit_word(disp);
+}
+
+/*
+ * Instruction with two register operands. For opcode groups, reg is the
+ * opcode extension.
+ */
+static void jit_reg(int opcode, int wide, int reg, int rm) {
+  jit_rex(wide, reg, -1, rm);
+  if(opcode > 0xff)
+    jit_byte(opcode >> 8);
+  jit_byte(opcode);
+  jit_byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void jit_push_pop(int pop, int reg) {
+  jit_rex(0, 0, -1, reg);
+  jit_byte((pop ? 0x58 : 0x50) + (reg & 7));
+}
+
+static void jit_mov_imm(int reg, int val) {
+  jit_rex(0, 0, -1, reg);
+  jit_byte(0xb8 + (reg & 7));
+  jit_word(val);
+}
+
+/*
+ * 32 bit displacement to the code for an instruction
+ */
+static void jit_rel32(int target) {
+  if(jit_num_fixups == jit_max_fixups) {
+    jit_max_fixups = jit_max_fixups ? jit_max_fixups * 2 : 256;
+    jit_fixups = realloc(jit_fixups, sizeof(jit_fixup_t) * jit_max_fixups);
+  }
+
+  jit_fixups[jit_num_fixups].offset = jit_len;
+  jit_fixups[jit_num_fixups++].target = target;
+  jit_word(0);
+}
+
+static void jit_jcc_error(int cc, int error) {
+  jit_byte(0x0f);
+  jit_byte(0x80 | cc);
+  jit_word(jit_errors[error] - (jit_len + 4));
+}
+
+static int jit_is_const(vm_func_t *func, int slot) {
+  return slot >= func->const_base &&
+    slot < func->const_base + func->num_consts;
+}
+
+/*
+ * Load a slot into a register, or its value if it is a constant
+ */
+static void jit_load(vm_func_t *func, int reg, int slot) {
+  if(jit_is_const(func, slot))
+    jit_mov_imm(reg, func->consts[slot - func->const_base]);
+  else
+    jit_mem(0x8b, 0, reg, JIT_SLOTS, -1, slot * sizeof(int));
+}
+
+static void jit_store(int reg, int slot) {
+  jit_mem(0x89, 0, reg, JIT_SLOTS, -1, slot * sizeof(int));
+}
+
+/*
+ * %eax = %eax op slot
+ */
+static void jit_alu(vm_func_t *func, int op, int slot) {
+  static const int mem_ops[] = {0x03, 0x2b, 0x0faf, 0x3b};
+  static const int imm_ops[] = {0x05, 0x2d, 0, 0x3d};
+
+  if(!jit_is_const(func, slot)) {
+    jit_mem(mem_ops[op], 0, X86_RAX, JIT_SLOTS, -1, slot * sizeof(int));
+    return;
+  }
+
+  if(op == JIT_MUL)
+    jit_reg(0x69, 0, X86_RAX, X86_RAX);
+  else
+    jit_byte(imm_ops[op]);
+  jit_word(func->consts[slot - func->const_base]);
+}
+
+/*
+ * Check the address in %eax is inside the program's memory, and not in
+ * the null word
+ */
+static void jit_check_addr(void) {
+  /* lea -4(%rax), %ecx */
+  jit_byte(0x8d);
+  jit_byte(0x48);
+  jit_byte(-(int)sizeof(int));
+
+  jit_reg(0x81, 0, 7, X86_RCX);
+  jit_word(VM_MEM_SIZE - 2 * sizeof(int));
+  jit_jcc_error(JIT_CC_A, VM_ERROR_ADDR);
+}
+
+/*
+ * Call a function in the compiler, with the stack aligned as the ABI
+ * requires. The arguments are already in registers.
+ */
+static void jit_call_host(void *func) {
+  jit_reg(0x89, 1, X86_RSP, X86_RBP);
+  jit_reg(0x83, 1, 4, X86_RSP);
+  jit_byte(-16);
+
+  jit_rex(1, 0, -1, X86_RAX);
+  jit_byte(0xb8);
+  jit_quad((uintptr_t)func);
+  jit_reg(0xff, 0, 2, X86_RAX);
+
+  jit_reg(0x89, 1, X86_RBP, X86_RSP);
+}
+
+/*
+ * Call a compiled function. Its slots start after the caller's, with the
+ * arguments first.
+ */
+static void jit_call(vm_func_t *func, vm_instr_t *instr) {
+  vm_func_t *callee = vm_funcs + instr->c;
+  int slots = func->num_slots * sizeof(int), size, i;
+
+  size = callee->num_slots > instr->b ? callee->num_slots : instr->b;
+  jit_mem(0x8d, 1, X86_RAX, JIT_SLOTS, -1, slots + size * sizeof(int));
+  jit_reg(0x39, 1, JIT_SLOTS_END, X86_RAX);
+  jit_jcc_error(JIT_CC_A, VM_ERROR_OVERFLOW);
+
+  jit_reg(0xff, 1, 1, JIT_DEPTH);
+  jit_jcc_error(JIT_CC_E, VM_ERROR_OVERFLOW);
+
+  if(callee->frame_size) {
+    jit_reg(0x81, 1, 5, JIT_FP);
+    jit_word(callee->frame_size);
+    jit_reg(0x81, 1, 7, JIT_FP);
+    jit_word(VM_MEM_SIZE - VM_STACK_SIZE);
+    jit_jcc_error(JIT_CC_L, VM_ERROR_OVERFLOW);
+  }
+
+  for(i = 0; i < instr->b; i++) {
+    jit_load(func, X86_RAX, instr->args[i]);
+    jit_store(X86_RAX, func->num_slots + i);
+  }
+
+  jit_reg(0x81, 1, 0, JIT_SLOTS);
+  jit_word(slots);
+  jit_byte(0xe8);
+  jit_rel32(callee->entry);
+  jit_reg(0x81, 1, 5, JIT_SLOTS);
+  jit_word(slots);
+
+  if(callee->frame_size) {
+    jit_reg(0x81, 1, 0, JIT_FP);
+    jit_word(callee->frame_size);
+  }
+  jit_reg(0xff, 1, 0, JIT_DEPTH);
+
+  if(instr->a >= 0)
+    jit_store(X86_RAX, instr->a);
+}
+
+/*
+ * Call a native function through vm_native, which reads the arguments
+ * from their slots
+ */
+static void jit_call_native(vm_func_t *func, vm_instr_t *instr) {
+  int i;
+
+  for(i = 0; i < instr->b; i++)
+    if(jit_is_const(func, instr->args[i])) {
+      jit_mem(0xc7, 0, 0, JIT_SLOTS, -1, instr->args[i] * sizeof(int));
+      jit_word(func->consts[instr->args[i] - func->const_base]);
+    }
+
+  jit_mov_imm(X86_RDI, instr->c);
+  jit_reg(0x89, 1, JIT_SLOTS, X86_RSI);
+  jit_rex(1, 0, -1, X86_RDX);
+  jit_byte(0xb8 + X86_RDX);
+  jit_quad((uintptr_t)instr->args);
+  jit_mov_imm(X86_RCX, instr->b);
+  jit_call_host((void *)vm_native);
+
+  if(instr->a >= 0)
+    jit_store(X86_RAX, instr->a);
+}
+
+/*
+ * Compile a single instruction
+ */
+static void jit_instr(vm_func_t *func, vm_instr_t *instr) {
+  static const int branch_cc[] = {
+    JIT_CC_E, JIT_CC_NE, JIT_CC_L, JIT_CC_LE, JIT_CC_G, JIT_CC_GE
+  };
+
+  switch(instr->op) {
+  case VM_MOV:
+    if(jit_is_const(func, instr->b)) {
+      jit_mem(0xc7, 0, 0, JIT_SLOTS, -1, instr->a * sizeof(int));
+      jit_word(func->consts[instr->b - func->const_base]);
+      break;
+    }
+
+    jit_load(func, X86_RAX, instr->b);
+    jit_store(X86_RAX, instr->a);
+    break;
+
+  case VM_ADD:
+  case VM_SUB:
+  case VM_MUL:
+    jit_load(func, X86_RAX, instr->b);
+    jit_alu(func, instr->op - VM_ADD + JIT_ADD, instr->c);
+    jit_store(X86_RAX, instr->a);
+    break;
+
+  case VM_DIV:
+    jit_load(func, X86_RAX, instr->b);
+    jit_load(func, X86_RCX, instr->c);
+    jit_reg(0x85, 0, X86_RCX, X86_RCX);
+    jit_jcc_error(JIT_CC_E, VM_ERROR_DIV_ZERO);
+
+    /* Dividing by -1 can trap, so negate instead */
+    jit_reg(0x83, 0, 7, X86_RCX);
+    jit_byte(-1);
+    jit_byte(0x75);
+    jit_byte(4);
+    jit_reg(0xf7, 0, 3, X86_RAX);
+    jit_byte(0xeb);
+    jit_byte(3);
+    jit_byte(0x99);
+    jit_reg(0xf7, 0, 7, X86_RCX);
+    jit_store(X86_RAX, instr->a);
+    break;
+
+  case VM_LDG:
+    jit_mem(0x8b, 0, X86_RAX, JIT_MEM, -1, instr->b);
+    jit_store(X86_RAX, instr->a);
+    break;
+
+  case VM_STG:
+    jit_load(func, X86_RAX, instr->b);
+    jit_mem(0x89, 0, X86_RAX, JIT_MEM, -1, instr->a);
+    break;
+
+  case VM_LD:
+    jit_load(func, X86_RAX, instr->b);
+    jit_check_addr();
+    jit_mem(0x8b, 0, X86_RAX, JIT_MEM, X86_RAX, 0);
+    jit_store(X86_RAX, instr->a);
+    break;
+
+  case VM_ST:
+    jit_load(func, X86_RAX, instr->a);
+    jit_check_addr();
+    jit_load(func, X86_RCX, instr->b);
+    jit_mem(0x89, 0, X86_RCX, JIT_MEM, X86_RAX, 0);
+    break;
+
+  case VM_LDS:
+    jit_mem(0x8b, 0, X86_RAX, JIT_MEM, JIT_FP, instr->b);
+    jit_store(X86_RAX, instr->a);
+    break;
+
+  case VM_STS:
+    jit_load(func, X86_RAX, instr->b);
+    jit_mem(0x89, 0, X86_RAX, JIT_MEM, JIT_FP, instr->a);
+    break;
+
+  case VM_LEAS:
+    jit_mem(0x8d, 0, X86_RAX, JIT_FP, -1, instr->b);
+    jit_store(X86_RAX, instr->a);
+    break;
+
+  case VM_JMP:
+    jit_byte(0xe9);
+    jit_rel32(instr->c);
+    break;
+
+  case VM_BEQZ:
+    jit_load(func, X86_RAX, instr->a);
+    jit_reg(0x85, 0, X86_RAX, X86_RAX);
+    jit_byte(0x0f);
+    jit_byte(0x80 | JIT_CC_E);
+    jit_rel32(instr->c);
+    break;
+
+  case VM_BEQ:
+  case VM_BNE:
+  case VM_BLT:
+  case VM_BLE:
+  case VM_BGT:
+  case VM_BGE:
+    jit_load(func, X86_RAX, instr->a);
+    jit_alu(func, JIT_CMP, instr->b);
+    jit_byte(0x0f);
+    jit_byte(0x80 | branch_cc[instr->op - VM_BEQ]);
+    jit_rel32(instr->c);
+    break;
+
+  case VM_CALL:
+    jit_call(func, instr);
+    break;
+
+  case VM_CALLN:
+    jit_call_native(func, instr);
+    break;
+
+  case VM_RET:
+    jit_load(func, X86_RAX, instr->a);
+    jit_byte(0xc3);
+    break;
+  }
+}
+
+/*
+ * Compile the program, returning the offset of the code which calls its
+ * entry point from C
+ */
+static int jit_compile(vm_func_t *entry) {
+  static const int saved[] = {
+    X86_RBX, X86_RBP, X86_R12, X86_R13, X86_R14, X86_R15
+  };
+  vm_func_t *func = vm_funcs;
+  int start, i;
+
+  jit_len = 0;
+  jit_num_fixups = 0;
+  jit_offsets = malloc(sizeof(int) * (vm_num_code + 1));
+
+  /* Runtime errors, with any bad address in %eax */
+  for(i = 0; i <= VM_ERROR_OVERFLOW; i++) {
+    jit_errors[i] = jit_len;
+    jit_reg(0x89, 0, X86_RAX, X86_RSI);
+    jit_mov_imm(X86_RDI, i);
+    jit_call_host((void *)vm_error);
+  }
+
+  /* Entry from C, setting up the registers from the arguments */
+  start = jit_len;
+  for(i = 0; i < 6; i++)
+    jit_push_pop(0, saved[i]);
+  jit_reg(0x89, 1, X86_RDI, JIT_SLOTS);
+  jit_reg(0x89, 1, X86_RSI, JIT_MEM);
+  jit_reg(0x89, 1, X86_RDX, JIT_SLOTS_END);
+  jit_reg(0x89, 1, X86_RCX, JIT_FP);
+  jit_reg(0x89, 1, X86_R8, JIT_DEPTH);
+  jit_byte(0xe8);
+  jit_rel32(entry->entry);
+  for(i = 5; i >= 0; i--)
+    jit_push_pop(1, saved[i]);
+  jit_byte(0xc3);
+
+  for(i = 0; i < vm_num_code; i++) {
+    while(func + 1 < vm_funcs + vm_num_funcs && i >= func[1].entry)
+      func++;
+
+    jit_offsets[i] = jit_len;
+    jit_instr(func, &vm_code[i]);
+  }
+  jit_offsets[vm_num_code] = jit_len;
+
+  for(i = 0; i < jit_num_fixups; i++)
+    *(int32_t *)(jit_buf + jit_fixups[i].offset) =
+      jit_offsets[jit_fixups[i].target] - (jit_fixups[i].offset + 4);
+
+  return start;
+}
+
+/*
+ * Compile and run the program, returning the result of its entry point
+ */
+int jit_run(void) {
+  vm_func_t *entry = vm_load();
+  jit_entry_t run;
+  void *code;
+  int *regs, start, val;
+
+  start = jit_compile(entry);
+  debug_printf(1, "JIT compiled %d instructions to %d bytes\n",
+	       vm_num_code, jit_len);
+
+  code = mmap(NULL, jit_len, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(code == MAP_FAILED)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Can't map memory for the JIT\n");
+
+  memcpy(code, jit_buf, jit_len);
+  if(mprotect(code, jit_len, PROT_READ | PROT_EXEC))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Can't make the JIT's code executable\n");
+
+  if(!(regs = calloc(VM_REGS_SIZE, sizeof(int))))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE, "Out of memory\n");
+
+  run = (jit_entry_t)((char *)code + start);
+  val = run(regs, vm_mem, regs + VM_REGS_SIZE,
+	    VM_MEM_SIZE - entry->frame_size, VM_MAX_CALLS);
+  fflush(stdout);
+
+  munmap(code, jit_len);
+  free(regs);
+  return val;
+}
+
+#else
+
+int jit_run(void) {
+  compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		 "The JIT needs an x86-64 host\n");
+  return 0;
+}
+
+#endif /* __x86_64__ */
@@ -0,0 +1,24 @@
+/*
+ * jit.h
+ *
+ * Functions/constants for the x86-64 JIT
+ *
+ */
+#ifndef _JIT_H_
+#define _JIT_H_
+
+/*
+ * Registers holding the program's state while it runs. The slots of the
+ * current call start at %rbx, and %r12 holds the frame pointer, an address
+ * in the program's memory which starts at %r13. %r14 is the end of the
+ * slots and %r15 counts down the calls which may still be made.
+ */
+#define JIT_SLOTS X86_RBX
+#define JIT_FP X86_R12
+#define JIT_MEM X86_R13
+#define JIT_SLOTS_END X86_R14
+#define JIT_DEPTH X86_R15
+
+int jit_run(void);
+
+#endif /* _JIT_H_ */
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "symtable.h"
 #include "typechk.h"
 #include "scope.h"
@@ -32,6 +33,12 @@ static const char *MIR_OP_STR[] = {
 static void opstr(FILE *, mir_operand_t *);
 static mir_node_t *mir_emit_load(mir_node_t *, mir_operand_t *, int);
 static void mir_add_to_tail(mir_instr_t *);
+static int fold_trackable(mir_operand_t *);
+static int fold_same(mir_operand_t *, mir_operand_t *);
+static void fold_operand(mir_operand_t **, mir_operand_t *, int *, int);
+
+/* Maximum number of constants tracked at once when folding */
+#define MAX_FOLD_CONSTS 64
 
 static mir_node_t *list_head, *list_tail;
 static int temp_regs = 0;
@@ -306,7 +313,7 @@ void mir_add_arg(mir_node_t **node, mir_operand_t *arg) {
   else
     (*node)->instruction->args =
       realloc((*node)->instruction->args, sizeof(mir_arg_t *) *
-	      (*node)->instruction->num_args + 1);
+	      ((*node)->instruction->num_args + 1));
 
   (*node)->instruction->args[(*node)->instruction->num_args++] = arg;
 
@@ -775,6 +782,7 @@ void mir_rhs_constants(void) {
 
     switch(instr->opcode) {
     case MIR_ADD:
+    case MIR_MUL:
       if(instr->operand[0]->optype == MIR_OP_CONST) {
 	temp = instr->operand[0];
 	instr->operand[0] = instr->operand[1];
@@ -801,43 +809,158 @@ void mir_rhs_constants(void) {
 
 
 /*
- * Convert arithmetic operations involing two constants into move instructions
- * FIXME: This is currently used largely to avoid generating multiply
- * instructions that take two constants when doing array indicies. A more
- * thourogh constant folding optomisation would be better.
+ * Return non-zero if constants moved into an operand can be tracked. Only
+ * temporaries and scalar locals which can't be changed through a pointer
+ * are tracked.
+ */
+static int fold_trackable(mir_operand_t *op) {
+  if(!op || op->indirect)
+    return 0;
+
+  if(op->optype == MIR_OP_REG)
+    return 1;
+
+  return op->optype == MIR_OP_VAR && !op->var->may_alias &&
+    get_var_scope(op->var) != global_scope &&
+    !is_array_type(op->var->type_info) &&
+    !is_struct_type(op->var->type_info) &&
+    !is_history_type(op->var->type_info);
+}
+
+/*
+ * Return non-zero if two trackable operands are the same location
+ */
+static int fold_same(mir_operand_t *a, mir_operand_t *b) {
+  if(a->optype != b->optype)
+    return 0;
+
+  if(a->optype == MIR_OP_REG)
+    return a->val == b->val;
+
+  return a->var == b->var;
+}
+
+/*
+ * Replace an operand known to hold a constant with the constant
+ */
+static void fold_operand(mir_operand_t **op, mir_operand_t *known,
+			 int *known_val, int num_known) {
+  int i;
+
+  if(!fold_trackable(*op))
+    return;
+
+  for(i = 0; i < num_known; i++)
+    if(fold_same(*op, &known[i])) {
+      free(*op);
+      *op = mir_const(known_val[i]);
+      return;
+    }
+}
+
+/*
+ * Evaluate arithmetic on two constants into result. Overflow wraps as it
+ * would on the target. Returns zero for divides which must be left to
+ * run, by zero or of the most negative value by -1.
+ */
+int mir_fold_eval(int opcode, int a, int b, int *result) {
+  switch(opcode) {
+  case MIR_ADD:
+    *result = (unsigned int)a + (unsigned int)b;
+    break;
+  case MIR_SUB:
+    *result = (unsigned int)a - (unsigned int)b;
+    break;
+  case MIR_DIV:
+    if(b == 0 || (a == INT_MIN && b == -1))
+      return 0;
+    *result = a / b;
+    break;
+  case MIR_MUL:
+  default:
+    *result = (unsigned int)a * (unsigned int)b;
+    break;
+  }
+
+  return 1;
+}
+
+/*
+ * Fold arithmetic on constants into move instructions. Constants moved
+ * into temporaries and scalar locals are propagated forward within each
+ * basic block first, so that whole expressions and sequences such as
+ * loops = 1000; loops = loops * 1000; are computed at compile time.
  */
 void mir_fold_constants(void) {
   mir_node_t *current = list_head;
   mir_instr_t *instr;
+  mir_operand_t known[MAX_FOLD_CONSTS], *dest;
+  int known_val[MAX_FOLD_CONSTS], num_known = 0;
+  int i;
 
   while(current) {
     instr = current->instruction;
 
+    /* Constants are only known until the next jump target */
+    if(current->in_links || instr->opcode == MIR_LABEL)
+      num_known = 0;
+
     switch(instr->opcode) {
     case MIR_ADD:
+    case MIR_SUB:
+    case MIR_MUL:
+    case MIR_DIV:
+      for(i = 0; i < 2; i++)
+	fold_operand(&instr->operand[i], known, known_val, num_known);
+
       if(instr->operand[0]->optype == MIR_OP_CONST &&
-	 instr->operand[1]->optype == MIR_OP_CONST) {
+	 instr->operand[1]->optype == MIR_OP_CONST &&
+	 mir_fold_eval(instr->opcode, instr->operand[0]->val,
+		       instr->operand[1]->val, &instr->operand[0]->val)) {
 	instr->opcode = MIR_MOVE;
-	instr->operand[0]->val =
-	  instr->operand[0]->val + instr->operand[1]->val;
 
 	free(instr->operand[1]);
 	instr->operand[1] = NULL;
-	break;
       }
+      break;
 
-    case MIR_MUL:
-      if(instr->operand[0]->optype == MIR_OP_CONST &&
-	 instr->operand[1]->optype == MIR_OP_CONST) {
-	instr->opcode = MIR_MOVE;
-	instr->operand[0]->val =
-	  instr->operand[0]->val * instr->operand[1]->val;
+    case MIR_MOVE:
+      /* Constants can't be moved directly to a pointer */
+      if(!instr->operand[2]->indirect)
+	fold_operand(&instr->operand[0], known, known_val, num_known);
+      break;
 
-	free(instr->operand[1]);
-	instr->operand[1] = NULL;
-	break;
-      }
+    case MIR_IF:
+      for(i = 0; i < 2; i++)
+	fold_operand(&instr->operand[i], known, known_val, num_known);
+      break;
+
+    case MIR_RETURN:
+      fold_operand(&instr->operand[0], known, known_val, num_known);
+      break;
 
+    case MIR_CALL:
+      for(i = 0; i < instr->num_args; i++)
+	fold_operand(&instr->args[i], known, known_val, num_known);
+      break;
+    }
+
+    /* Forget the old value of the dest, and remember new constants */
+    dest = instr->operand[2];
+    if(fold_trackable(dest)) {
+      for(i = 0; i < num_known; i++)
+	if(fold_same(dest, &known[i])) {
+	  known[i] = known[--num_known];
+	  known_val[i] = known_val[num_known];
+	  break;
+	}
+
+      if(instr->opcode == MIR_MOVE &&
+	 instr->operand[0]->optype == MIR_OP_CONST &&
+	 num_known < MAX_FOLD_CONSTS) {
+	known[num_known] = *dest;
+	known_val[num_known++] = instr->operand[0]->val;
+      }
     }
 
     current = current->next;
@@ -964,10 +1087,11 @@ void mir_spill_may_aliases(void) {
 
 
 /*
- * Convert MIR instructions to LIR with symbolic registers
+ * Convert the MIR instructions for the function the given interference
+ * graph was built from to LIR with symbolic registers
  */
 void mir_to_sym_lir(ig_graph_t *ig_graph) {
-  mir_node_t *current = list_head;
+  mir_node_t *current = ig_graph->cfg->node[0]->mir_node;
   mir_instr_t *instr;
   int i;
 
@@ -1032,6 +1156,9 @@ void mir_to_sym_lir(ig_graph_t *ig_graph) {
       break;
     }
 
+    if(instr->opcode == MIR_END)
+      break;
+
     current = current->next;
   }
 }
@@ -154,6 +154,7 @@ mir_node_t *mir_add_instr(mir_node_t *, int, mir_operand_t *,
 char *mir_opstr(mir_operand_t *, char *);
 void mir_spill_may_aliases(void);
 void mir_fold_constants(void);
+int mir_fold_eval(int, int, int, int *);
 void mir_munge_globals(void);
 void mir_strip(void);
 void mir_munge(void);
@@ -20,7 +20,9 @@
 static void mcfg_add_node(mcfg_graph_t *, mcfg_node_t *);
 static void mcfg_add_edge(mcfg_node_t *, mcfg_node_t *);
 static void mcfg_adjust_edge(mcfg_node_t *, mcfg_node_t *, mcfg_node_t *);
-static int liveness_at_node(mcfg_node_t *);
+static int mcfg_var_id(mcfg_graph_t *, mcfg_var_t *);
+static int mcfg_var_slot(mcfg_graph_t *, mcfg_var_t *);
+static void mcfg_number_var(mcfg_graph_t *, mcfg_var_t *, int);
 
 static void mcfg_add_global(mcfg_graph_t *, name_record_t *);
 
@@ -52,6 +54,12 @@ static mcfg_node_t *mcfg_mk_node(mir_node_t *mir_node, int type) {
   cfg_node->out = NULL;
   cfg_node->num_ins = 0;
   cfg_node->num_outs = 0;
+  cfg_node->live_in = NULL;
+  cfg_node->live_out = NULL;
+
+  cfg_node->order = -1;
+  cfg_node->idom = NULL;
+  cfg_node->loop_depth = 0;
 
   cfg_node->var_def = NULL;
   cfg_node->var_use = NULL;
@@ -63,22 +71,79 @@ static mcfg_node_t *mcfg_mk_node(mir_node_t *mir_node, int type) {
 /*
  * Inserts a new cfg node into an existing CFG. This is used for inserting
  * load and store instructions for spill code generation during register
- * allocation
+ * allocation. If the instruction after the new one is still a jump target
+ * the jumps bypass the new instruction, so only the fall through edge is
+ * moved.
  */
 void mcfg_insert_node(mir_node_t *mir_node) {
+  mcfg_node_t *cfg_node, *succ = mir_node->next->cfg_node;
   int i;
-  mcfg_node_t *cfg_node, *pred;
 
   cfg_node = mcfg_mk_node(mir_node, MCFG_NODE_STATEMENT);
-  mcfg_add_node(mir_node->next->cfg_node->graph, cfg_node);
+  mcfg_add_node(succ->graph, cfg_node);
+  cfg_node->loop_depth = succ->loop_depth;
+
+  /*
+   * Move the preds of the new nodes successor to the new node. Adjusting
+   * an edge removes it from the successor's pred list.
+   */
+  if(mir_node->next->in_links) {
+    for(i = 0; i < succ->num_preds; i++)
+      if(succ->pred[i]->mir_node == mir_node->prev) {
+	mcfg_adjust_edge(succ->pred[i], succ, cfg_node);
+	break;
+      }
+  } else {
+    while(succ->num_preds)
+      mcfg_adjust_edge(succ->pred[0], succ, cfg_node);
+  }
+
+  mcfg_add_edge(cfg_node, succ);
+
+}
+
+/*
+ * Removes a statement node from an existing CFG, joining its predecessors
+ * to its successor. This is used for deleting moves removed by register
+ * coalescing. The MIR node itself is left alone.
+ */
+void mcfg_remove_node(mir_node_t *mir_node) {
+  mcfg_node_t *cfg_node = mir_node->cfg_node, *succ;
+  mcfg_graph_t *graph = cfg_node->graph;
+  int i;
+
+  if(cfg_node->num_succs != 1)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Can only remove cfg nodes with a single successor\n");
 
-  /* Move all preds of the new nodes successor to the new node */
-  for(i = 0; i < mir_node->next->cfg_node->num_preds; i++)
-    mcfg_adjust_edge(mir_node->next->cfg_node->pred[i],
-		     mir_node->next->cfg_node, cfg_node);
+  succ = cfg_node->succ[0];
+  while(cfg_node->num_preds)
+    mcfg_adjust_edge(cfg_node->pred[0], cfg_node, succ);
 
-  mcfg_add_edge(cfg_node, mir_node->next->cfg_node);
+  /* Remove the edge to the successor */
+  for(i = 0; i < succ->num_preds; i++)
+    if(succ->pred[i] == cfg_node) {
+      succ->pred[i] = succ->pred[--succ->num_preds];
+      break;
+    }
 
+  /* Keep the remaining nodes in order */
+  for(i = 0; i < graph->num_nodes; i++)
+    if(graph->node[i] == cfg_node)
+      break;
+  memmove(&graph->node[i], &graph->node[i + 1],
+	  sizeof(mcfg_node_t *) * (graph->num_nodes - i - 1));
+  graph->num_nodes--;
+
+  mir_node->cfg_node = NULL;
+  bitset_free(cfg_node->live_in);
+  bitset_free(cfg_node->live_out);
+  free(cfg_node->in);
+  free(cfg_node->out);
+  free(cfg_node->var_use);
+  free(cfg_node->succ);
+  free(cfg_node->pred);
+  free(cfg_node);
 }
 
 /*
@@ -94,6 +159,11 @@ static mcfg_graph_t *mcfg_mk_graph(void) {
   graph->num_globals = 0;
   graph->global = NULL;
 
+  graph->var = NULL;
+  graph->num_vars = 0;
+  graph->var_hash = NULL;
+  graph->var_hash_size = 0;
+
   return graph;
 }
 
@@ -127,6 +197,7 @@ mcfg_var_t *mcfg_var(mir_operand_t *operand) {
   var->reg = operand->val;
   var->var = operand->var;
   var->indirect = operand->indirect;
+  var->id = -1;
 
   switch(operand->optype) {
   case MIR_OP_VAR:
@@ -172,24 +243,114 @@ int mcfg_var_match(mcfg_var_t *var1, mcfg_var_t *var2) {
   return 0;
 }
 
+/*
+ * Hash a cfg var. Registers are keyed on their number and variables on
+ * their name record, matching the rules in mcfg_var_match.
+ */
+static unsigned int mcfg_var_hash(mcfg_var_t *var) {
+  unsigned long key;
+
+  if(var->type == MCFG_TYPE_VAR)
+    key = (unsigned long)var->var >> 3;
+  else
+    key = (unsigned long)var->reg;
+
+  return ((unsigned int)key * 2654435761U) ^ var->type;
+}
+
+/*
+ * Grow the variable hash table and rehash the existing variables
+ */
+static void mcfg_var_rehash(mcfg_graph_t *graph) {
+  unsigned int h;
+  int i;
+
+  free(graph->var_hash);
+  graph->var_hash_size = graph->var_hash_size ? graph->var_hash_size * 2 : 64;
+  graph->var_hash = malloc(sizeof(int) * graph->var_hash_size);
+  for(i = 0; i < graph->var_hash_size; i++)
+    graph->var_hash[i] = -1;
+
+  for(i = 0; i < graph->num_vars; i++) {
+    h = mcfg_var_hash(graph->var[i]) & (graph->var_hash_size - 1);
+    while(graph->var_hash[h] != -1)
+      h = (h + 1) & (graph->var_hash_size - 1);
+    graph->var_hash[h] = i;
+  }
+}
+
+/*
+ * Return the hash table slot which holds the given variable, or the empty
+ * slot it would be placed in.
+ */
+static int mcfg_var_slot(mcfg_graph_t *graph, mcfg_var_t *var) {
+  unsigned int h;
+  int id;
+
+  h = mcfg_var_hash(var) & (graph->var_hash_size - 1);
+  while((id = graph->var_hash[h]) != -1) {
+    if(mcfg_var_match(graph->var[id], var))
+      break;
+    h = (h + 1) & (graph->var_hash_size - 1);
+  }
+
+  return h;
+}
+
+/*
+ * Return the dense id for a variable in the given graph, or -1 if the
+ * variable is not used in the graph.
+ */
+int mcfg_find_var(mcfg_graph_t *graph, mcfg_var_t *var) {
+  if(!graph->num_vars)
+    return -1;
+
+  return graph->var_hash[mcfg_var_slot(graph, var)];
+}
+
+/*
+ * Return the dense id for a variable in the given graph, adding it to the
+ * variable table if it hasn't been seen before. The id is also stored in
+ * the var itself.
+ */
+static int mcfg_var_id(mcfg_graph_t *graph, mcfg_var_t *var) {
+  int h;
+
+  /* Keep the hash table at most half full */
+  if(graph->num_vars * 2 >= graph->var_hash_size)
+    mcfg_var_rehash(graph);
+
+  h = mcfg_var_slot(graph, var);
+  if(graph->var_hash[h] != -1)
+    return var->id = graph->var_hash[h];
+
+  graph->var = realloc(graph->var, sizeof(mcfg_var_t *) *
+		       (graph->num_vars + 1));
+  graph->var[graph->num_vars] = var;
+  graph->var_hash[h] = graph->num_vars;
+
+  return var->id = graph->num_vars++;
+}
+
 /*
  * Add a variable to the use list
  */
-static void mcfg_add_var_use(mcfg_node_t *node, mcfg_var_t *var) {
+static void mcfg_add_var_use(mcfg_node_t *node, mcfg_var_t *var, int sym) {
   int i;
 
+  /* Don't add functions */
+  if(var->type == MCFG_TYPE_VAR &&
+     var->var->type_info->decl_type == TYPE_FUNCTION)
+    return;
+
   /* Don't add the same var twice to the use list */
+  mcfg_number_var(node->graph, var, sym);
   for(i = 0; i < node->num_var_use; i++)
-    if(mcfg_var_match(node->var_use[i], var)) {
+    if(node->var_use[i]->id == var->id) {
       /* FIXME: free(var); */
       return;
     }
 
-  /* Don't add functions */
-  if(var->type == MCFG_TYPE_VAR &&
-     var->var->type_info->decl_type == TYPE_FUNCTION)
-    return;
-
   /* If the variable is a global, add it to the global list for this graph */
   if(var->type == MCFG_TYPE_VAR && get_var_scope(var->var) == global_scope)
     mcfg_add_global(node->graph, var->var);
@@ -203,31 +364,6 @@ static void mcfg_add_var_use(mcfg_node_t *node, mcfg_var_t *var) {
   node->var_use[node->num_var_use++] = var;
 }
 
-/*
- * Add an in var
- */
-static int mcfg_add_in_var(mcfg_node_t *node, mcfg_var_t *var) {
-  int i;
-
-  if(!var)
-    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
-		   "Attempting to add null var to in list");
-
-  /* Don't add the same var twice to the in list */
-  for(i = 0; i < node->num_ins; i++)
-    if(mcfg_var_match(node->in[i], var))
-      return 0;
-
-
-  if(!node->in)
-    node->in = malloc(sizeof(mcfg_var_t *));
-  else
-    node->in = realloc(node->in, sizeof(mcfg_var_t *) * (node->num_ins + 1));
-
-  node->in[node->num_ins++] = var;
-  return 1;
-}
-
 /*
  * Add a variable to the global list
  */
@@ -250,33 +386,6 @@ static void mcfg_add_global(mcfg_graph_t *graph, name_record_t *var) {
 
 }
 
-
-/*
- * Add an out var
- */
-static int mcfg_add_out_var(mcfg_node_t *node, mcfg_var_t *var) {
-  int i;
-
-  if(!var)
-    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
-		   "Attempting to add null var to out list");
-
-  /* Don't add the same var twice to the out list */
-  for(i = 0; i < node->num_outs; i++)
-    if(mcfg_var_match(node->out[i], var))
-      return 0;
-
-
-  if(!node->out)
-    node->out = malloc(sizeof(mcfg_var_t *));
-  else
-    node->out = realloc(node->out, sizeof(mcfg_var_t *) *
-			(node->num_outs + 1));
-
-  node->out[node->num_outs++] = var;
-  return 1;
-}
-
 /*
  * Add a node to a graph
  */
@@ -455,174 +564,499 @@ mcfg_list_t *mcfg_build(mir_node_t *mir_list_head) {
 }
 
 /*
- * Build the def/use sets for a control flow graph
+ * Give a variable its id. Normally ids are handed out from the variable
+ * table. Once the code has been converted to symbolic registers (sym is
+ * set) each register number is its id, and the table is just extended to
+ * cover any new registers.
  */
-void mcfg_build_defuse(mcfg_graph_t *graph) {
+static void mcfg_number_var(mcfg_graph_t *graph, mcfg_var_t *var, int sym) {
+  int i;
+
+  if(!sym) {
+    mcfg_var_id(graph, var);
+    return;
+  }
+
+  var->id = var->reg;
+  if(var->id >= graph->num_vars) {
+    graph->var = realloc(graph->var, sizeof(mcfg_var_t *) * (var->id + 1));
+    for(i = graph->num_vars; i <= var->id; i++)
+      graph->var[i] = NULL;
+    graph->num_vars = var->id + 1;
+  }
+
+  if(!graph->var[var->id])
+    graph->var[var->id] = var;
+}
+
+/*
+ * Build the def/use sets for a single node
+ */
+static void mcfg_node_defuse(mcfg_node_t *node, int sym) {
+  mcfg_graph_t *graph = node->graph;
   mir_instr_t *instr;
-  int i, j;
+  int j;
 
-  for(i = 0; i < graph->num_nodes; i++) {
+  /* Clear the def/use sets if necessary */
+  if(node->var_def)
+    node->var_def = NULL;
 
-    /* Clear the def/use sets if necessary */
-    if(graph->node[i]->var_def)
-      graph->node[i]->var_def = NULL;
+  if(node->var_use) {
+    free(node->var_use);
+    node->var_use = NULL;
+    node->num_var_use = 0;
+  }
 
-    if(graph->node[i]->var_use) {
-      free(graph->node[i]->var_use);
-      graph->node[i]->var_use = NULL;
-      graph->node[i]->num_var_use = 0;
-    }
+  /*
+   * Var def. Only ever one since we are working with three address code.
+   * The storage location for a register storage is counted as a use rather
+   * than a def, since it alters what is at the location of the register
+   * and not the register itself.
+   */
+  instr = node->mir_node->instruction;
+  if(instr->operand[2] && instr->operand[2]->optype != MIR_OP_CONST &&
+     instr->opcode != MIR_REG_STORE && instr->opcode != MIR_HEAP_STORE) {
+    node->var_def = mcfg_var(instr->operand[2]);
+    mcfg_number_var(graph, node->var_def, sym);
 
     /*
-     * Var def. Only ever one since we are working with three address code.
-     * The storage location for a register storage is counted as a use rather
-     * than a def, since it alters what is at the location of the register
-     * and not the register itself.
+     * If the variable is a global, add it to the global list
+     * for this graph
      */
-    instr = graph->node[i]->mir_node->instruction;
-    if(instr->operand[2] && instr->operand[2]->optype != MIR_OP_CONST &&
-       instr->opcode != MIR_REG_STORE && instr->opcode != MIR_HEAP_STORE) {
-      graph->node[i]->var_def = mcfg_var(instr->operand[2]);
-
-      /*
-       * If the variable is a global, add it to the global list
-       * for this graph
-       */
-      if(graph->node[i]->var_def->type == MCFG_TYPE_VAR &&
-         get_var_scope(graph->node[i]->var_def->var) == global_scope)
-	mcfg_add_global(graph, graph->node[i]->var_def->var);
-    }
+    if(node->var_def->type == MCFG_TYPE_VAR &&
+       get_var_scope(node->var_def->var) == global_scope)
+      mcfg_add_global(graph, node->var_def->var);
+  }
 
-    /*
-     * Var uses. Can be many since functions can pass several arguments. The
-     * first operand in a load instruction is not var use since it is being
-     * fetched from memory.
-     */
-    switch(instr->opcode) {
-    case MIR_REG_STORE:
-      mcfg_add_var_use(graph->node[i], mcfg_var(instr->operand[2]));
-      goto default_handler;
-      break;
+  /*
+   * Var uses. Can be many since functions can pass several arguments. The
+   * first operand in a load instruction is not var use since it is being
+   * fetched from memory.
+   */
+  switch(instr->opcode) {
+  case MIR_REG_STORE:
+    mcfg_add_var_use(node, mcfg_var(instr->operand[2]), sym);
+    goto default_handler;
+    break;
 
-    case MIR_HEAP_ADDR:
-    case MIR_HEAP_LOAD:
-      break;
+  case MIR_HEAP_ADDR:
+  case MIR_HEAP_LOAD:
+    break;
 
-    case MIR_CALL:
-      for(j = 0; j < instr->num_args; j++)
-	if(instr->args[j]->optype != MIR_OP_CONST)
-	  mcfg_add_var_use(graph->node[i], mcfg_var(instr->args[j]));
-      break;
+  case MIR_CALL:
+    for(j = 0; j < instr->num_args; j++)
+      if(instr->args[j]->optype != MIR_OP_CONST)
+	mcfg_add_var_use(node, mcfg_var(instr->args[j]), sym);
+    break;
 
-    default_handler:
-    default:
-      for(j = 0; j < 2; j++)
-	if(instr->operand[j] && instr->operand[j]->optype != MIR_OP_CONST)
-	  mcfg_add_var_use(graph->node[i], mcfg_var(instr->operand[j]));
+  default_handler:
+  default:
+    for(j = 0; j < 2; j++)
+      if(instr->operand[j] && instr->operand[j]->optype != MIR_OP_CONST)
+	mcfg_add_var_use(node, mcfg_var(instr->operand[j]), sym);
+
+  }
+}
+
+/*
+ * Build the def/use sets for a control flow graph
+ */
+void mcfg_build_defuse(mcfg_graph_t *graph) {
+  int i;
+
+  /* Renumber the variables from scratch */
+  graph->num_vars = 0;
+  for(i = 0; i < graph->var_hash_size; i++)
+    graph->var_hash[i] = -1;
+
+  for(i = 0; i < graph->num_nodes; i++)
+    mcfg_node_defuse(graph->node[i], 0);
+}
 
+/*
+ * Order the nodes of a graph in postorder, starting from the function
+ * entry. Uses an explicit stack so that long functions can't overflow the
+ * C stack. Nodes which can't be reached from the entry are appended at the
+ * end. Returns the number of nodes written to order.
+ */
+static int mcfg_postorder(mcfg_graph_t *graph, mcfg_node_t **order) {
+  mcfg_node_t **stack, *current;
+  int *next_succ, sp, count, i;
+
+  stack = malloc(sizeof(mcfg_node_t *) * graph->num_nodes);
+  next_succ = malloc(sizeof(int) * graph->num_nodes);
+
+  for(i = 0; i < graph->num_nodes; i++)
+    graph->node[i]->visited = 0;
+
+  count = 0;
+  sp = 0;
+  stack[sp] = graph->node[0];
+  next_succ[sp++] = 0;
+  graph->node[0]->visited = 1;
+
+  while(sp) {
+    current = stack[sp - 1];
+
+    if(next_succ[sp - 1] < current->num_succs) {
+      current = current->succ[next_succ[sp - 1]++];
+      if(!current->visited) {
+	current->visited = 1;
+	stack[sp] = current;
+	next_succ[sp++] = 0;
+      }
+    } else {
+      order[count++] = current;
+      sp--;
     }
+  }
 
-#if 0
-    for(j = 0; j < 2; j++)
-      if(instr->operand[j] && instr->operand[j]->optype != MIR_OP_CONST)
-        mcfg_add_var_use(graph->node[i], mcfg_var(instr->operand[j]));
+  for(i = 0; i < graph->num_nodes; i++)
+    if(!graph->node[i]->visited)
+      order[count++] = graph->node[i];
 
-    if(instr->opcode == MIR_REG_STORE)
-      mcfg_add_var_use(graph->node[i], mcfg_var(instr->operand[2]));
+  free(stack);
+  free(next_succ);
+  return count;
+}
 
+/*
+ * Convert a live bitset back to an array of cfg vars
+ */
+static mcfg_var_t **mcfg_live_vars(mcfg_graph_t *graph, bitset_t *set,
+				   int *num) {
+  mcfg_var_t **vars;
+  int i;
 
-    for(j = 0; j < instr->num_args; j++)
-      if(instr->args[j]->optype != MIR_OP_CONST)
-        mcfg_add_var_use(graph->node[i], mcfg_var(instr->args[j]));
-#endif
+  *num = bitset_count(set);
+  if(!*num)
+    return NULL;
+
+  vars = malloc(sizeof(mcfg_var_t *) * *num);
+  for(*num = 0, i = bitset_next(set, 0); i != -1; i = bitset_next(set, i + 1))
+    vars[(*num)++] = graph->var[i];
+
+  return vars;
+}
+
+/*
+ * Run the liveness worklist until nothing changes. The first count entries
+ * of the worklist are the starting nodes, which must already be flagged as
+ * visited. The worklist is a circular queue with room for every node, each
+ * node being on it at most once as tracked by the visited flag. If refresh
+ * is set the in/out arrays of each node are rebuilt as it is processed.
+ * Returns the number of nodes processed.
+ */
+static int mcfg_solve_liveness(mcfg_graph_t *graph, mcfg_node_t **worklist,
+			       int count, int refresh) {
+  mcfg_node_t *current;
+  bitset_t *scratch;
+  int i, head, tail, visits;
+
+  scratch = bitset_new(graph->num_vars);
+  head = 0;
+  tail = count % graph->num_nodes;
+  visits = 0;
+
+  while(count) {
+    current = worklist[head];
+    head = (head + 1) % graph->num_nodes;
+    count--;
+    current->visited = 0;
+    visits++;
+
+    /* out(n) = U in(s) */
+    for(i = 0; i < current->num_succs; i++)
+      bitset_union(current->live_out, current->succ[i]->live_in);
+
+    /* in(n) = use(n) + (out(n) - def(n)) */
+    bitset_copy(scratch, current->live_out);
+    if(current->var_def)
+      bitset_clear(scratch, current->var_def->id);
+    for(i = 0; i < current->num_var_use; i++)
+      bitset_set(scratch, current->var_use[i]->id);
+
+    if(refresh) {
+      free(current->in);
+      free(current->out);
+      current->in = mcfg_live_vars(graph, scratch, &current->num_ins);
+      current->out = mcfg_live_vars(graph, current->live_out,
+				    &current->num_outs);
+    }
+
+    /* The in sets only ever grow, so a union tells us if it changed */
+    if(!bitset_union(current->live_in, scratch))
+      continue;
 
+    for(i = 0; i < current->num_preds; i++)
+      if(!current->pred[i]->visited) {
+	current->pred[i]->visited = 1;
+	worklist[tail] = current->pred[i];
+	tail = (tail + 1) % graph->num_nodes;
+	count++;
+      }
   }
 
+  bitset_free(scratch);
+  return visits;
 }
 
 /*
  * Calculate the liveness for each variable in the given CFG.
  *
- * Calculates the live in and out sets.
+ * Calculates the live in and out sets using bit vectors indexed by the
+ * variable ids assigned in mcfg_build_defuse:
+ *
+ *   out(n) = U in(s) for each successor s of n
+ *   in(n)  = use(n) + (out(n) - def(n))
  *
+ * Liveness flows backwards, so the worklist is seeded in postorder (reverse
+ * postorder of the reversed graph) and a node's predecessors are only
+ * revisited when its in set grows.
  */
 void mcfg_calculate_liveness(mcfg_graph_t *graph) {
-  mcfg_node_t *current;
-  int i, j, k, changed, exit_node;
+  mcfg_node_t *current, **worklist;
+  int i, count, visits;
 
-  /* Initialise the in set: in(n) = use(n) */
   for(i = 0; i < graph->num_nodes; i++) {
+    current = graph->node[i];
+
     /* Clear the in/out sets if necessary */
-    if(graph->node[i]->in) {
-      free(graph->node[i]->in);
-      graph->node[i]->in = NULL;
-      graph->node[i]->num_ins = 0;
-    }
+    free(current->in);
+    current->in = NULL;
+    current->num_ins = 0;
+
+    free(current->out);
+    current->out = NULL;
+    current->num_outs = 0;
+
+    bitset_free(current->live_in);
+    bitset_free(current->live_out);
+    current->live_in = bitset_new(graph->num_vars);
+    current->live_out = bitset_new(graph->num_vars);
+  }
 
-    if(graph->node[i]->out) {
-      free(graph->node[i]->out);
-      graph->node[i]->out = NULL;
-      graph->node[i]->num_outs = 0;
-    }
+  if(!graph->num_nodes)
+    return;
+
+  debug_printf(1, "Calculating liveness: ");
 
-#if 0
-    for(j = 0; j < graph->node[i]->num_var_use; j++)
-      mcfg_add_in_var(graph->node[i], graph->node[i]->var_use[j]);
-#endif
+  worklist = malloc(sizeof(mcfg_node_t *) * graph->num_nodes);
+  count = mcfg_postorder(graph, worklist);
+  for(i = 0; i < count; i++)
+    worklist[i]->visited = 1;
 
+  visits = mcfg_solve_liveness(graph, worklist, count, 0);
+
+  debug_printf(1, "%d nodes, %d vars, %d visits\n", graph->num_nodes,
+	       graph->num_vars, visits);
+
+  /* Build the in/out arrays for the vcg output */
+  for(i = 0; i < graph->num_nodes; i++) {
+    current = graph->node[i];
+    current->in = mcfg_live_vars(graph, current->live_in, &current->num_ins);
+    current->out = mcfg_live_vars(graph, current->live_out,
+				  &current->num_outs);
   }
 
-  debug_printf(1, "Calculating liveness: ");
-  changed = 1;
+  free(worklist);
+}
 
-  while(changed) {
-    changed = 0;
-    debug_printf(1, ".");
+/*
+ * Update the def/use sets and liveness after spill code has been added to a
+ * graph which has been converted to symbolic registers.
+ *
+ * Spilling only changes the live ranges of the spilled registers, and adds
+ * new registers which live from a reload to the next use or from a def to
+ * the following store. Every other register keeps its live range, so the
+ * spilled registers are removed from the live sets and the dataflow is
+ * rerun from the nodes which touch a spilled register and from the new
+ * nodes, rather than for the whole graph. Those are also the only nodes
+ * whose def/use sets are rebuilt.
+ */
+void mcfg_update_liveness(mcfg_graph_t *graph, bitset_t *spilled) {
+  mcfg_node_t *current, **worklist;
+  int i, j, count, visits, changed, num_vars = graph->num_vars;
+
+  if(!graph->num_nodes)
+    return;
+
+  debug_printf(1, "Updating liveness: ");
 
-    for(i = 0; i < graph->num_nodes; i++) {
-      current = graph->node[i];
-      current->visited = 0;
+  /* Find the changed nodes before any new registers are numbered */
+  worklist = malloc(sizeof(mcfg_node_t *) * graph->num_nodes);
+  count = 0;
 
-      if(current->type == MCFG_NODE_FUNC_EXIT)
-	exit_node = i;
+  for(i = 0; i < graph->num_nodes; i++) {
+    current = graph->node[i];
+    current->visited = 0;
+
+    changed = !current->live_in ||
+      (current->var_def && bitset_test(spilled, current->var_def->id));
+    for(j = 0; j < current->num_var_use && !changed; j++)
+      changed = bitset_test(spilled, current->var_use[j]->id);
+
+    if(changed) {
+      current->visited = 1;
+      worklist[count++] = current;
     }
+  }
 
-    changed = liveness_at_node(graph->node[exit_node]);
+  for(i = 0; i < count; i++)
+    mcfg_node_defuse(worklist[i], 1);
 
+  /* Fill any gaps in the numbering of the new registers */
+  for(i = num_vars; i < graph->num_vars; i++)
+    if(!graph->var[i]) {
+      graph->var[i] = mcfg_var(mir_reg(i));
+      graph->var[i]->id = i;
+    }
+  bitset_grow(spilled, graph->num_vars);
+
+  for(i = 0; i < graph->num_nodes; i++) {
+    current = graph->node[i];
+
+    if(!current->live_in) {
+      current->live_in = bitset_new(graph->num_vars);
+      current->live_out = bitset_new(graph->num_vars);
+    } else {
+      bitset_grow(current->live_in, graph->num_vars);
+      bitset_grow(current->live_out, graph->num_vars);
+      bitset_difference(current->live_in, spilled);
+      bitset_difference(current->live_out, spilled);
+    }
   }
-  debug_printf(1, "\n");
+
+  visits = mcfg_solve_liveness(graph, worklist, count, 1);
+
+  debug_printf(1, "%d changed nodes, %d new vars, %d visits\n", count,
+	       graph->num_vars - num_vars, visits);
+
+  free(worklist);
 }
 
-static int liveness_at_node(mcfg_node_t *node) {
-  int i, j, changed = 0;
 
-  if(node->visited)
-    return changed;
-  node->visited = 1;
+/*
+ * Find the common dominator of two nodes, walking up the dominator tree
+ * using postorder numbers. The entry node has the highest number.
+ */
+static mcfg_node_t *mcfg_intersect(mcfg_node_t *node1, mcfg_node_t *node2) {
+  while(node1 != node2) {
+    while(node1->order < node2->order)
+      node1 = node1->idom;
+    while(node2->order < node1->order)
+      node2 = node2->idom;
+  }
 
-  /* Add all out(n) that are not in def(n) to in(n) */
-  for(i = 0; i < node->num_var_use; i++)
-    mcfg_add_in_var(node, node->var_use[i]);
+  return node1;
+}
 
-  for(i = 0; i < node->num_outs; i++)
-    if(!node->var_def || !mcfg_var_match(node->out[i], node->var_def))
-      if(mcfg_add_in_var(node, node->out[i]))
-	changed = 1;
+/*
+ * Test if node1 dominates node2
+ */
+static int mcfg_dominates(mcfg_node_t *node1, mcfg_node_t *node2) {
+  while(node2->order < node1->order)
+    node2 = node2->idom;
+
+  return node1 == node2;
+}
+
+/*
+ * Calculate the loop nesting depth of each node in the given CFG.
+ *
+ * Dominators are found with the iterative algorithm of Cooper, Harvey and
+ * Kennedy, visiting the nodes in reverse postorder. An edge n -> h where h
+ * dominates n is a back edge, and the natural loop of h is h plus every
+ * node which can reach a back edge source without going through h. Back
+ * edges to the same header form a single loop. A node's depth is the
+ * number of loops it is in. Unreachable nodes get a depth of 0.
+ */
+void mcfg_find_loops(mcfg_graph_t *graph) {
+  mcfg_node_t **order, **body, *current, *new_idom;
+  int i, j, k, n, count, reachable, changed, stamp, body_size, is_loop;
+  int *mark;
+
+  if(!graph->num_nodes)
+    return;
+
+  order = malloc(sizeof(mcfg_node_t *) * graph->num_nodes);
+  body = malloc(sizeof(mcfg_node_t *) * graph->num_nodes);
+  count = mcfg_postorder(graph, order);
+
+  /* Number the reachable nodes, mcfg_postorder leaves them visited */
+  for(i = 0, reachable = 0; i < count; i++) {
+    order[i]->idom = NULL;
+    order[i]->loop_depth = 0;
+    order[i]->order = order[i]->visited ? reachable++ : -1;
+  }
+
+  /* Dominators */
+  graph->node[0]->idom = graph->node[0];
+  changed = 1;
+  while(changed) {
+    changed = 0;
+
+    for(i = reachable - 2; i >= 0; i--) {
+      current = order[i];
+      new_idom = NULL;
 
-  /* Foreach successor s of n: out(n) = out(n) + in(s) */
-  for(i = 0; i < node->num_succs; i++)
-    for(j = 0; j < node->succ[i]->num_ins; j++)
-      if(mcfg_add_out_var(node, node->succ[i]->in[j]))
+      for(j = 0; j < current->num_preds; j++)
+	if(current->pred[j]->idom)
+	  new_idom = new_idom ? mcfg_intersect(current->pred[j], new_idom) :
+	    current->pred[j];
+
+      if(current->idom != new_idom) {
+	current->idom = new_idom;
 	changed = 1;
+      }
+    }
+  }
 
-  /* Visit each pred of this node */
-  for(i = 0; i < node->num_preds; i++)
-    if(liveness_at_node(node->pred[i]))
-      changed = 1;
+  /* Natural loops. The mark array is indexed by postorder number. */
+  mark = calloc(reachable, sizeof(int));
+  stamp = 0;
+
+  for(i = 0; i < reachable; i++) {
+    stamp++;
+    mark[i] = stamp;
+    body[0] = order[i];
+    body_size = 1;
+    is_loop = 0;
+
+    for(j = 0; j < order[i]->num_preds; j++) {
+      current = order[i]->pred[j];
+      if(current->order == -1 || !mcfg_dominates(order[i], current))
+	continue;
+
+      is_loop = 1;
+      if(mark[current->order] == stamp)
+	continue;
+
+      /* Walk backwards from the back edge source until the header */
+      mark[current->order] = stamp;
+      body[body_size++] = current;
+
+      for(k = body_size - 1; k < body_size; k++) {
+	current = body[k];
+
+	for(n = 0; n < current->num_preds; n++)
+	  if(current->pred[n]->order != -1 &&
+	     mark[current->pred[n]->order] != stamp) {
+	    mark[current->pred[n]->order] = stamp;
+	    body[body_size++] = current->pred[n];
+	  }
+      }
+    }
 
-  return changed;
-}
+    if(is_loop)
+      for(j = 0; j < body_size; j++)
+	body[j]->loop_depth++;
+  }
 
+  free(mark);
+  free(body);
+  free(order);
+}
 
 /*
  * Output a VCG graph file
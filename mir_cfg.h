@@ -8,6 +8,7 @@
 
 #include "symtable.h"
 #include "mir.h"
+#include "bitset.h"
 
 typedef struct {
   int type;
@@ -16,6 +17,9 @@ typedef struct {
   int reg;
   int indirect;
 
+  /* Dense index into the graph's variable table, -1 if not yet numbered */
+  int id;
+
 } mcfg_var_t;
 
 enum {
@@ -39,6 +43,15 @@ typedef struct mcfg_node_s {
   int num_ins;
   int num_outs;
 
+  /* in/out sets as bit vectors indexed by variable id */
+  bitset_t *live_in;
+  bitset_t *live_out;
+
+  /* Dominator tree and loop nesting, see mcfg_find_loops */
+  int order;
+  struct mcfg_node_s *idom;
+  int loop_depth;
+
   int visited;
 
   struct mcfg_graph_s *graph;
@@ -67,6 +80,12 @@ typedef struct mcfg_graph_s {
   int num_globals;
   name_record_t **global;
 
+  /* Variable table, built by mcfg_build_defuse */
+  mcfg_var_t **var;
+  int num_vars;
+  int *var_hash;
+  int var_hash_size;
+
 } mcfg_graph_t;
 
 typedef struct {
@@ -82,9 +101,13 @@ typedef struct {
 
 mcfg_list_t *mcfg_build(mir_node_t *);
 int mcfg_var_match(mcfg_var_t *, mcfg_var_t *);
+int mcfg_find_var(mcfg_graph_t *, mcfg_var_t *);
 mcfg_var_t *mcfg_var(mir_operand_t *);
 void mcfg_insert_node(mir_node_t *);
+void mcfg_remove_node(mir_node_t *);
 void mcfg_calculate_liveness(mcfg_graph_t *);
+void mcfg_update_liveness(mcfg_graph_t *, bitset_t *);
+void mcfg_find_loops(mcfg_graph_t *);
 void mcfg_build_defuse(mcfg_graph_t *);
 
 #endif /* _MIR_CFG_H_ */
@@ -18,6 +18,7 @@
 #include "cerror.h"
 #include "icg.h"
 #include "cflags.h"
+#include "sparc.h"
 
 typedef struct {
   name_record_t **vars;
@@ -32,12 +33,58 @@ typedef struct {
 typedef struct {
   int num_regs;
   stack_loc_t *reg;
+
+  /* Number of slots used once the temporaries have been coloured */
+  int num_slots;
 } stack_loc_list_t;
 
+/*
+ * Degree buckets for ig_prune. Bucket d holds the nodes with d neighbours
+ * not on the stack, except for the last bucket which holds every node of
+ * degree R or more. Each bucket is a doubly linked list threaded through
+ * the adjacency nodes.
+ */
+typedef struct {
+  int *head;
+  int num_buckets;
+  int lowest;
+} degree_buckets_t;
+
+/*
+ * Spill candidate priority queue. A binary heap ordered on spill cost
+ * divided by degree, ties going to the lowest numbered node. Removing
+ * neighbours only ever raises a node's priority, so entries are re-keyed
+ * lazily when they reach the top of the heap.
+ */
+typedef struct {
+  int node;
+  int priority;
+} spill_entry_t;
+
+typedef struct {
+  spill_entry_t *entry;
+  int size;
+} spill_heap_t;
+
+/*
+ * Live interval of a symbolic register for the linear scan allocator. Each
+ * CFG node has two points, 2n where its uses are read and 2n + 1 where its
+ * def is written, so a register dying at a node doesn't overlap the one the
+ * node defines.
+ */
+typedef struct {
+  int reg;
+  int start;
+  int end;
+} live_interval_t;
+
 extern compiler_options_t cflags;
 extern char *basename;
 extern scope_node_t *global_scope;
 
+/* Loops nested deeper than this don't increase spill costs any further */
+#define MAX_SPILL_LOOP_DEPTH 5
+
 /* The adjacency node stack */
 static int *stack;
 static int sp;
@@ -45,77 +92,170 @@ static int sp;
 /* Temporary stack locations */
 static stack_loc_list_t *stack_temps = NULL;
 
+/* Registers loaded by the spill code since they were last numbered */
+static bitset_t *reload_temps = NULL;
+
 /* Static functions */
-static void adjust_neighbours(int, adj_node_t **, int);
 static adj_node_t **build_adj_lists(ig_graph_t *);
 static void free_adj_list(adj_node_t **, int);
 static int min_colour(adj_node_t **, int, int, int);
 static int assign_regs(adj_node_t **, int, int);
-static int compare_ints(const void *, const void *);
 static void compute_spill_costs(ig_graph_t *, adj_node_t **);
-static void modify_code(adj_node_t **);
-static void gen_spill_code(adj_node_t **, int);
+static void find_remat_defs(ig_graph_t *, adj_node_t **);
+static void find_reg_constraints(ig_graph_t *, adj_node_t **, int, int);
+static int leaf_candidate(mcfg_graph_t *, int);
+static int spill_cost_reg(ig_graph_t *, mir_operand_t *);
+static void modify_code(ig_graph_t *, adj_node_t **);
+static void gen_spill_code(ig_graph_t *, adj_node_t **);
+static void allocate_func_registers(mcfg_graph_t *, int);
+static int coalesce_moves(ig_graph_t *, int);
+static int linear_scan(ig_graph_t *, adj_node_t **, int);
+static void number_spill_temps(ig_graph_t *, bitset_t *);
+static void renumber_no_spill(ig_graph_t *, bitset_t *);
 
 void global_load_store(mcfg_list_t *);
 
-static void init_temp_stack_locations(int);
+static void init_temp_stack_locations(void);
 static void free_temp_stack_locations(void);
 static int assign_stack_location(int, int);
 static int temp_stack_location(char *, int);
 static void add_temps_to_scopes(void);
+static void colour_stack_temps(mcfg_graph_t *, char *);
 
 static void ig_prune(ig_graph_t *, int, adj_node_t **);
-static void ig_add_link(ig_graph_t *, mcfg_var_t *, mcfg_var_t *);
-static int ig_are_linked(ig_graph_t *, mcfg_var_t *, mcfg_var_t *);
+static void adjust_neighbours(degree_buckets_t *, adj_node_t **, int);
+static void ig_add_link(ig_graph_t *, int, int);
+static int ig_are_linked(ig_graph_t *, int, int);
+static void ig_free_graph(ig_graph_t *);
+static ig_graph_t *ig_new_graph(mcfg_graph_t *);
+static void ig_grow_graph(ig_graph_t *);
+static void ig_link_node(ig_graph_t *, mcfg_node_t *);
+static void ig_update_graph(ig_graph_t *, bitset_t *);
 
 /*
- * Register allocator
+ * Register allocator. Each function is allocated separately since registers
+ * never interfere across functions.
  */
 void allocate_registers(mcfg_list_t *cfg, int nregs) {
+  int i;
+
+  /* FIXME: make_du_chains(); make_webs(); */
+
+  for(i = 0; i < cfg->num_graphs; i++)
+    allocate_func_registers(cfg->graph[i], nregs);
+
+  /* Add temporary stack locations to the scope table */
+  add_temps_to_scopes();
+
+  mir_print(basename, "lir-ra");
+  vcg_output_mcfg(cfg, basename, "cfg-ra.vcg");
+
+}
+
+/*
+ * Allocate registers for a single function
+ */
+static void allocate_func_registers(mcfg_graph_t *graph, int nregs) {
   adj_node_t **adj_lists;
   ig_graph_t *ig_graph;
-  int i, j, finished, passes = 1;
-  char ext[10];
+  mcfg_list_t func_cfg;
+  bitset_t *spilled = NULL, *no_spill;
+  char *func_name, *ext;
+  int i, j, finished, leaf = 0, passes = 1;
 
-  /* FIXME: make_du_chains(); make_webs(); */
+  func_name = graph->node[0]->mir_node->instruction->label;
+  ext = malloc(strlen(func_name) + 16);
+
+  /* Single graph list for the vcg output */
+  func_cfg.graph = &graph;
+  func_cfg.num_graphs = 1;
 
+  /*
+   * The registers which hold spilled values reloaded for a single use. They
+   * are never spilled again, or the same code could be generated forever.
+   */
+  no_spill = bitset_new(0);
+  reload_temps = bitset_new(0);
 
   finished = 0;
   while(!finished) {
 
-    debug_printf(1, "----\nRegister allocation pass %d (hard regs = %d)\n----\n",
-		 passes, nregs);
+    debug_printf(1, "----\nRegister allocation pass %d for %s (hard regs = %d)"
+		 "\n----\n", passes, func_name, nregs);
 
-    /* Calculate def/use sets and liveness */
-    for(i = 0; i < cfg->num_graphs; i++)
-      mcfg_build_defuse(cfg->graph[i]);
+    if(!spilled) {
+      /* Calculate def/use sets and liveness */
+      mcfg_build_defuse(graph);
+      mcfg_calculate_liveness(graph);
+      mcfg_find_loops(graph);
 
-    //global_load_store(cfg);
+      /*
+       * Construct the interference graph. Linear scan works from the
+       * liveness alone, so it only needs the symbolic registers.
+       */
+      if(cflags.register_allocator == REGALLOC_LINEAR_SCAN)
+	ig_graph = ig_new_graph(graph);
+      else
+	ig_graph = ig_build_graph(graph);
 
-    for(i = 0; i < cfg->num_graphs; i++)
-      mcfg_build_defuse(cfg->graph[i]);
+      renumber_no_spill(ig_graph, no_spill);
+      tr_set_lowest(ig_graph->num_sym_regs);
+      mir_to_sym_lir(ig_graph);
 
-    for(i = 0; i < cfg->num_graphs; i++)
-      mcfg_calculate_liveness(cfg->graph[i]);
+      if(passes == 1)
+	leaf = leaf_candidate(graph, nregs);
 
-    sprintf(ext, "cfg%d.vcg", passes);
-    vcg_output_mcfg(cfg, basename, ext);
+    } else {
+      /*
+       * Only the spill code has changed since the last pass, so number the
+       * new registers and update the liveness and IG around it.
+       */
+      number_spill_temps(ig_graph, no_spill);
+      mcfg_update_liveness(graph, spilled);
+      if(cflags.register_allocator == REGALLOC_LINEAR_SCAN)
+	ig_grow_graph(ig_graph);
+      else
+	ig_update_graph(ig_graph, spilled);
 
-    /* Construct the interference graph and build the adjacency lists */
-    ig_graph = ig_build_graph(cfg);
-    adj_lists = build_adj_lists(ig_graph);
+      bitset_free(spilled);
+      spilled = NULL;
 
-    sprintf(ext, "ig%d.vcg", passes);
-    vcg_output_ig(ig_graph, basename, ext);
+      tr_set_lowest(ig_graph->num_sym_regs);
+    }
 
-    tr_set_lowest(ig_graph->num_sym_regs);
-    mir_to_sym_lir(ig_graph);
+    sprintf(ext, "%s.cfg%d.vcg", func_name, passes);
+    vcg_output_mcfg(&func_cfg, basename, ext);
 
-    /* Output the IG and LIR code */
-    sprintf(ext, "lir%d", passes);
+    sprintf(ext, "%s.ig%d.vcg", func_name, passes);
+    vcg_output_ig(ig_graph, basename, ext);
+
+    /* Output the LIR code */
+    sprintf(ext, "%s.lir%d", func_name, passes);
     mir_print(basename, ext);
 
+    /*
+     * Merge copies. If any moves were removed the liveness and IG need
+     * to be rebuilt before colouring. Coalescing needs the interferences
+     * so it is only done when colouring.
+     */
+    if(cflags.register_allocator == REGALLOC_COLOUR &&
+       (cflags.oflags & OFLAG_COALESCE) && coalesce_moves(ig_graph, nregs)) {
+      ig_free_graph(ig_graph);
+      passes++;
+      continue;
+    }
+
+    adj_lists = build_adj_lists(ig_graph);
+
+    if(cflags.oflags & OFLAG_REMAT)
+      find_remat_defs(ig_graph, adj_lists);
+    for(i = bitset_next(no_spill, 0); i != -1;
+	i = bitset_next(no_spill, i + 1)) {
+      adj_lists[i]->remat = NULL;
+      adj_lists[i]->no_spill = 1;
+    }
     compute_spill_costs(ig_graph, adj_lists);
+    find_reg_constraints(ig_graph, adj_lists, nregs, leaf);
 
     debug_printf(1, "Allocating for %d sym regs:\n", ig_graph->num_sym_regs);
 
@@ -129,12 +269,36 @@ void allocate_registers(mcfg_list_t *cfg, int nregs) {
     debug_printf(1, "\n");
 #endif
 
-    ig_prune(ig_graph, nregs, adj_lists);
-    if(!(finished = assign_regs(adj_lists, ig_graph->num_sym_regs, nregs)))
-      gen_spill_code(adj_lists, ig_graph->num_sym_regs);
+    if(cflags.register_allocator == REGALLOC_LINEAR_SCAN) {
+      finished = linear_scan(ig_graph, adj_lists, nregs);
+    } else {
+      ig_prune(ig_graph, nregs, adj_lists);
+      finished = assign_regs(adj_lists, ig_graph->num_sym_regs, nregs);
+    }
 
-    if(!finished)
+    if(!finished && leaf) {
+      /*
+       * Spill code needs a stack frame, so allocate again without the
+       * leaf procedure restrictions.
+       */
+      debug_printf(1, "%s needs spill code, not a leaf procedure\n",
+		   func_name);
+      leaf = 0;
       free_adj_list(adj_lists, ig_graph->num_sym_regs);
+      ig_free_graph(ig_graph);
+      passes++;
+      continue;
+    }
+
+    if(!finished) {
+      spilled = bitset_new(ig_graph->num_sym_regs);
+      for(i = 0; i < ig_graph->num_sym_regs; i++)
+	if(adj_lists[i]->spill)
+	  bitset_set(spilled, i);
+
+      gen_spill_code(ig_graph, adj_lists);
+      free_adj_list(adj_lists, ig_graph->num_sym_regs);
+    }
 
     passes++;
 
@@ -143,9 +307,6 @@ void allocate_registers(mcfg_list_t *cfg, int nregs) {
 		     "Too many register allocation passes, aborting\n");
   }
 
-  /* Add temporary stack locations to the scope table */
-  add_temps_to_scopes();
-
   /* Print out the register allocation */
   for(i = 0; i < nregs; i++) {
     debug_printf(1, "Reg %d: ", i);
@@ -159,11 +320,17 @@ void allocate_registers(mcfg_list_t *cfg, int nregs) {
     if(adj_lists[i]->var && adj_lists[i]->var->var)
       adj_lists[i]->var->var->reg_alloc = adj_lists[i]->colour;
 
-  modify_code(adj_lists);
+  get_func_entry(func_name)->func_leaf = leaf;
 
-  mir_print(basename, "lir-ra");
-  vcg_output_mcfg(cfg, basename, "cfg-ra.vcg");
+  modify_code(ig_graph, adj_lists);
+  colour_stack_temps(graph, func_name);
 
+  free_adj_list(adj_lists, ig_graph->num_sym_regs);
+  ig_free_graph(ig_graph);
+  bitset_free(no_spill);
+  bitset_free(reload_temps);
+  reload_temps = NULL;
+  free(ext);
 }
 
 /*
@@ -171,7 +338,7 @@ void allocate_registers(mcfg_list_t *cfg, int nregs) {
  */
 static adj_node_t **build_adj_lists(ig_graph_t *graph) {
   adj_node_t **lists;
-  int i, j, count;
+  int i;
 
   lists = malloc(sizeof(adj_node_t *) * graph->num_sym_regs);
   for(i = 0; i < graph->num_sym_regs; i++) {
@@ -181,6 +348,7 @@ static adj_node_t **build_adj_lists(ig_graph_t *graph) {
 
 
     lists[i]->offset = -1;
+    lists[i]->location = -1;
 
 
     lists[i]->spill_cost = 10;
@@ -188,25 +356,19 @@ static adj_node_t **build_adj_lists(ig_graph_t *graph) {
     lists[i]->on_stack = 0;
 
     lists[i]->var = graph->sym_reg[i];
-
-
-    /* Connected nodes */
-    lists[i]->adj_node = malloc(sizeof(int) * graph->num_sym_regs);
-    lists[i]->rem_node = malloc(sizeof(int) * graph->num_sym_regs);
-
-    lists[i]->num_adjs = 0;
-    lists[i]->num_rems = 0;
-
-    for(j = 0; j < graph->num_sym_regs; j++) {
-      lists[i]->adj_node[j] = 0;
-      lists[i]->rem_node[j] = 0;
-    }
-
-    for(j = 0; j < graph->num_sym_regs; j++)
-      if(ig_are_linked(graph, graph->sym_reg[i], graph->sym_reg[j])) {
-	lists[i]->adj_node[j] = 1;
-	lists[i]->num_adjs++;
-      }
+    lists[i]->remat = NULL;
+    lists[i]->no_spill = 0;
+    lists[i]->forbidden = 0;
+
+    /* Connected nodes. num_adjs counts the ones not on the stack. */
+    lists[i]->num_nodes = graph->num_adj[i];
+    lists[i]->num_adjs = graph->num_adj[i];
+    lists[i]->adj_node = malloc(sizeof(int) * (graph->num_adj[i] + 1));
+    memcpy(lists[i]->adj_node, graph->adj[i],
+	   sizeof(int) * graph->num_adj[i]);
+
+    lists[i]->prev = -1;
+    lists[i]->next = -1;
   }
 
   return lists;
@@ -219,70 +381,182 @@ static void free_adj_list(adj_node_t **adj_list, int sregs) {
   int i;
 
   for(i = 0; i < sregs; i++) {
-    if(adj_list[i]->adj_node)
-      free(adj_list[i]->adj_node);
-    if(adj_list[i]->rem_node)
-      free(adj_list[i]->rem_node);
+    free(adj_list[i]->adj_node);
     free(adj_list[i]);
   }
   free(adj_list);
 }
 
+static void bucket_insert(degree_buckets_t *buckets, adj_node_t **adj_list,
+			  int node) {
+  int b = adj_list[node]->num_adjs;
 
+  if(b >= buckets->num_buckets)
+    b = buckets->num_buckets - 1;
+
+  adj_list[node]->prev = -1;
+  adj_list[node]->next = buckets->head[b];
+  if(buckets->head[b] != -1)
+    adj_list[buckets->head[b]]->prev = node;
+  buckets->head[b] = node;
+
+  if(b < buckets->lowest)
+    buckets->lowest = b;
+}
+
+static void bucket_remove(degree_buckets_t *buckets, adj_node_t **adj_list,
+			  int node) {
+  int b = adj_list[node]->num_adjs;
+
+  if(b >= buckets->num_buckets)
+    b = buckets->num_buckets - 1;
+
+  if(adj_list[node]->prev != -1)
+    adj_list[adj_list[node]->prev]->next = adj_list[node]->next;
+  else
+    buckets->head[b] = adj_list[node]->next;
+
+  if(adj_list[node]->next != -1)
+    adj_list[adj_list[node]->next]->prev = adj_list[node]->prev;
+}
+
+static int spill_before(spill_entry_t *a, spill_entry_t *b) {
+  return a->priority < b->priority ||
+    (a->priority == b->priority && a->node < b->node);
+}
+
+static void spill_heap_push(spill_heap_t *heap, int node, int priority) {
+  spill_entry_t tmp;
+  int i;
+
+  i = heap->size++;
+  heap->entry[i].node = node;
+  heap->entry[i].priority = priority;
+
+  while(i && spill_before(&heap->entry[i], &heap->entry[(i - 1) / 2])) {
+    tmp = heap->entry[i];
+    heap->entry[i] = heap->entry[(i - 1) / 2];
+    heap->entry[(i - 1) / 2] = tmp;
+    i = (i - 1) / 2;
+  }
+}
+
+static spill_entry_t spill_heap_pop(spill_heap_t *heap) {
+  spill_entry_t top, tmp;
+  int i, child;
+
+  top = heap->entry[0];
+  heap->entry[0] = heap->entry[--heap->size];
+
+  for(i = 0; (child = i * 2 + 1) < heap->size; i = child) {
+    if(child + 1 < heap->size &&
+       spill_before(&heap->entry[child + 1], &heap->entry[child]))
+      child++;
+
+    if(!spill_before(&heap->entry[child], &heap->entry[i]))
+      break;
+
+    tmp = heap->entry[i];
+    heap->entry[i] = heap->entry[child];
+    heap->entry[child] = tmp;
+  }
+
+  return top;
+}
 
 /*
- * Prune the interference graph by applying an R-colouring to it
+ * Push a node onto the colouring stack and remove it from the graph
+ */
+static void ig_push_node(degree_buckets_t *buckets, adj_node_t **adj_list,
+			 int node) {
+  bucket_remove(buckets, adj_list, node);
+  adj_list[node]->on_stack = 1;
+  stack[sp++] = node;
+
+  adjust_neighbours(buckets, adj_list, node);
+}
+
+/*
+ * Prune the interference graph by applying an R-colouring to it.
+ *
+ * Nodes are kept in buckets by their degree, so the degree < R rule just
+ * takes the lowest bucket. When only nodes of degree R or more are left
+ * the one with the lowest spill cost divided by its degree is pushed
+ * instead.
  */
 static void ig_prune(ig_graph_t *graph, int nregs, adj_node_t **adj_list) {
-  int i, nodes_left, finished, spill_cost, spill_node;
+  degree_buckets_t buckets;
+  spill_heap_t heap;
+  spill_entry_t top;
+  int i, nodes_left, priority;
 
-  stack = malloc(sizeof(int) * graph->num_sym_regs);
+  stack = malloc(sizeof(int) * (graph->num_sym_regs + 1));
   sp = 0;
   nodes_left = graph->num_sym_regs;
 
+  buckets.num_buckets = nregs + 1;
+  buckets.head = malloc(sizeof(int) * buckets.num_buckets);
+  for(i = 0; i < buckets.num_buckets; i++)
+    buckets.head[i] = -1;
+  buckets.lowest = buckets.num_buckets;
+
+  heap.entry = malloc(sizeof(spill_entry_t) * (graph->num_sym_regs + 1));
+  heap.size = 0;
+
+  /*
+   * Insert in reverse so that each bucket lists its nodes in ascending
+   * order. Nodes that start with a degree of R or more are the only
+   * ones that can ever be spill candidates.
+   */
+  for(i = graph->num_sym_regs - 1; i >= 0; i--) {
+    bucket_insert(&buckets, adj_list, i);
+
+    if(adj_list[i]->num_adjs >= nregs && adj_list[i]->spill_cost > 0 &&
+       !adj_list[i]->no_spill)
+      spill_heap_push(&heap, i,
+		      adj_list[i]->spill_cost / adj_list[i]->num_adjs);
+  }
+
   while(nodes_left > 0) {
 
     /*
      * Apply the degree < R rule and push nodes onto the stack
      */
-    finished = 0;
-    while(!finished) {
-      finished = 1;
-
-      for(i = 0; i < graph->num_sym_regs; i++) {
-
-	if(!adj_list[i]->on_stack && adj_list[i]->num_adjs < nregs) {
-
-	  finished = 0;
-	  adj_list[i]->on_stack = 1;
-	  stack[sp++] = i;
-
-	  adjust_neighbours(graph->num_sym_regs, adj_list, i);
-	  nodes_left--;
-	}
+    while(buckets.lowest < nregs) {
+      if(buckets.head[buckets.lowest] == -1) {
+	buckets.lowest++;
+	continue;
       }
+
+      ig_push_node(&buckets, adj_list, buckets.head[buckets.lowest]);
+      nodes_left--;
     }
 
     if(nodes_left) {
       /*
        * Find the node with the lowest spill cost divided by its degree
-       * and push it onto the stack. Start with a suitably large value
-       * for spill_cost.
+       * and push it onto the stack. Stale heap entries are skipped or
+       * re-keyed with the node's current degree.
        */
-      spill_cost = 100;
-      spill_node = -1;
-
-      for(i = 0; i < graph->num_sym_regs; i++) {
-	if(!adj_list[i]->on_stack &&
-	   adj_list[i]->spill_cost > 0 &&
-	   (adj_list[i]->spill_cost / adj_list[i]->num_adjs) < spill_cost) {
+      top.node = -1;
+      while(heap.size) {
+	top = spill_heap_pop(&heap);
 
-	  spill_node = i;
-	  spill_cost = adj_list[i]->spill_cost / adj_list[i]->num_adjs;
+	if(adj_list[top.node]->on_stack) {
+	  top.node = -1;
+	  continue;
 	}
+
+	priority = adj_list[top.node]->spill_cost /
+	  adj_list[top.node]->num_adjs;
+	if(priority == top.priority)
+	  break;
+
+	spill_heap_push(&heap, top.node, priority);
+	top.node = -1;
       }
 
-      if(spill_node == -1) {
+      if(top.node == -1) {
 	debug_printf(1, "====\n");
 	for(i = 0; i < graph->num_sym_regs; i++)
 	  debug_printf(1, "Reg %3d: Spill cost = %4d, adjacent = %3d, %s [%s]\n", i,
@@ -297,24 +571,230 @@ static void ig_prune(ig_graph_t *graph, int nregs, adj_node_t **adj_list) {
 
 
       debug_printf(1, "Selected node %d as spill candidate, cost = %d\n",
-		   spill_node, adj_list[spill_node]->spill_cost);
+		   top.node, adj_list[top.node]->spill_cost);
 
-      adj_list[spill_node]->on_stack = 1;
-      stack[sp++] = spill_node;
-      adjust_neighbours(graph->num_sym_regs, adj_list, spill_node);
+      ig_push_node(&buckets, adj_list, top.node);
       nodes_left--;
     }
   }
+
+  free(buckets.head);
+  free(heap.entry);
+}
+
+/*
+ * Return the symbolic register for a move operand if it can be coalesced,
+ * otherwise -1. Globals and variables which may be aliased must stay in
+ * their home locations.
+ */
+static int coalesce_reg(ig_graph_t *graph, mir_operand_t *op) {
+  name_record_t *var;
+
+  if(!op || op->optype != MIR_OP_REG || op->indirect ||
+     op->val < 0 || op->val >= graph->num_sym_regs)
+    return -1;
+
+  var = graph->sym_reg[op->val]->var;
+  if(var && (var->may_alias || get_var_scope(var) == global_scope))
+    return -1;
+
+  return op->val;
+}
+
+/*
+ * Find the symbolic register a register has been merged into
+ */
+static int coalesce_alias(int *alias, int reg) {
+  while(alias[reg] != reg)
+    reg = alias[reg];
+
+  return reg;
+}
+
+/*
+ * Conservative coalescing tests for merging register from into register to.
+ *
+ * Briggs: the merged node has fewer than R neighbours of significant
+ * degree (R or more).
+ * George: every neighbour of from either already interferes with to or has
+ * insignificant degree.
+ *
+ * Either test guarantees that the merge can't make the graph uncolourable.
+ * Degrees are taken from the IG and are over-estimates once nodes have
+ * been merged, which only makes the tests more conservative.
+ */
+static int coalesce_ok(ig_graph_t *graph, int *alias, int *mark, int stamp,
+		       int from, int to, int nregs) {
+  int i, j, n, node, degree, significant = 0;
+
+  for(i = 0; i < 2; i++) {
+    node = i ? to : from;
+
+    for(j = 0; j < graph->num_adj[node]; j++) {
+      n = coalesce_alias(alias, graph->adj[node][j]);
+      if(n == from || n == to || mark[n] == stamp)
+	continue;
+      mark[n] = stamp;
+
+      degree = graph->num_adj[n];
+      if(ig_are_linked(graph, n, from) && ig_are_linked(graph, n, to))
+	degree--;
+
+      if(degree >= nregs)
+	significant++;
+    }
+  }
+
+  if(significant < nregs)
+    return 1;
+
+  for(j = 0; j < graph->num_adj[from]; j++) {
+    n = coalesce_alias(alias, graph->adj[from][j]);
+    if(n != to && !ig_are_linked(graph, n, to) && graph->num_adj[n] >= nregs)
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Rename a coalesced operand to the register it was merged into
+ */
+static void coalesce_rename(ig_graph_t *graph, int *alias, mir_operand_t *op) {
+  if(!op || op->optype != MIR_OP_REG ||
+     op->val < 0 || op->val >= graph->num_sym_regs ||
+     alias[op->val] == op->val)
+    return;
+
+  op->val = coalesce_alias(alias, op->val);
+  op->var = graph->sym_reg[op->val]->var;
+}
+
+/*
+ * Delete an instruction, such as a coalesced move. Instructions which are
+ * jump targets keep their label as a nop.
+ */
+static void remove_instr(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  int i;
+
+  if(instr->label || node->in_links) {
+    instr->opcode = MIR_NOP;
+    for(i = 0; i < 3; i++) {
+      free(instr->operand[i]);
+      instr->operand[i] = NULL;
+    }
+    return;
+  }
+
+  mcfg_remove_node(node);
+  mir_remove_node(node);
 }
 
 /*
- * Compute the cost of spilling each temporary
- * FIXME: Doesn't take nesting level into account yet.
+ * Conservative (Briggs/George) register coalescing. Moves between two
+ * symbolic registers which don't interfere are deleted and the registers
+ * merged, provided the merge passes one of the tests in coalesce_ok.
+ *
+ * A temporary can be merged into another temporary or a local variable, but
+ * two variables are never merged so each register has a single home if it
+ * is spilled later. Returns the number of moves deleted. The caller must
+ * rebuild the liveness and IG if any were.
+ */
+static int coalesce_moves(ig_graph_t *graph, int nregs) {
+  mir_node_t *current, *next;
+  mir_instr_t *instr;
+  int i, src, dest, from, to, stamp, removed;
+  int *alias, *mark;
+
+  if(!graph->num_sym_regs)
+    return 0;
+
+  alias = malloc(sizeof(int) * graph->num_sym_regs);
+  mark = calloc(graph->num_sym_regs, sizeof(int));
+  for(i = 0; i < graph->num_sym_regs; i++)
+    alias[i] = i;
+
+  stamp = 0;
+  removed = 0;
+
+  /* Merge registers and delete the moves between them */
+  for(current = graph->cfg->node[0]->mir_node;
+      current->instruction->opcode != MIR_END; current = next) {
+    next = current->next;
+    instr = current->instruction;
+
+    if(instr->opcode != MIR_MOVE ||
+       (src = coalesce_reg(graph, instr->operand[0])) == -1 ||
+       (dest = coalesce_reg(graph, instr->operand[2])) == -1)
+      continue;
+
+    src = coalesce_alias(alias, src);
+    dest = coalesce_alias(alias, dest);
+
+    if(src != dest) {
+      if(graph->sym_reg[src]->var && graph->sym_reg[dest]->var)
+	continue;
+
+      if(ig_are_linked(graph, src, dest))
+	continue;
+
+      /* Variables keep their own register */
+      if(graph->sym_reg[src]->var) {
+	to = src;
+	from = dest;
+      } else {
+	to = dest;
+	from = src;
+      }
+
+      if(!coalesce_ok(graph, alias, mark, ++stamp, from, to, nregs))
+	continue;
+
+      debug_printf(1, "Coalescing s%d into s%d\n", from, to);
+
+      alias[from] = to;
+      for(i = 0; i < graph->num_adj[from]; i++)
+	if(coalesce_alias(alias, graph->adj[from][i]) != to)
+	  ig_add_link(graph, to, coalesce_alias(alias, graph->adj[from][i]));
+    }
+
+    remove_instr(current);
+    removed++;
+  }
+
+  /* Rename the merged registers */
+  if(removed)
+    for(current = graph->cfg->node[0]->mir_node;
+	current->instruction->opcode != MIR_END; current = current->next) {
+      instr = current->instruction;
+
+      for(i = 0; i < 3; i++)
+	if(!(instr->opcode == MIR_HEAP_LOAD && i == 0) &&
+	   !(instr->opcode == MIR_HEAP_STORE && i == 2))
+	  coalesce_rename(graph, alias, instr->operand[i]);
+
+      if(instr->opcode == MIR_CALL)
+	for(i = 0; i < instr->num_args; i++)
+	  coalesce_rename(graph, alias, instr->args[i]);
+    }
+
+  debug_printf(1, "Coalesced %d moves\n", removed);
+
+  free(alias);
+  free(mark);
+  return removed;
+}
+
+/*
+ * Compute the cost of spilling each temporary. Each def and use is weighted
+ * by 10^depth of the loop nest it is in, so that values used in inner
+ * loops are the last to be spilled.
  */
 static void compute_spill_costs(ig_graph_t *graph, adj_node_t **adj_list) {
-  mir_node_t *current = mir_list_head();
+  mir_node_t *current = graph->cfg->node[0]->mir_node;
   mir_instr_t *instr;
-  int i, *copies, *defs, *uses;
+  int i, reg, depth, weight, *copies, *defs, *uses;
 
   copies = calloc(graph->num_sym_regs, sizeof(int));
   defs = calloc(graph->num_sym_regs, sizeof(int));
@@ -323,60 +803,81 @@ static void compute_spill_costs(ig_graph_t *graph, adj_node_t **adj_list) {
   while(current) {
     instr = current->instruction;
 
+    /* Cap the depth so the costs can't overflow */
+    depth = current->cfg_node ? current->cfg_node->loop_depth : 0;
+    if(depth > MAX_SPILL_LOOP_DEPTH)
+      depth = MAX_SPILL_LOOP_DEPTH;
+    for(weight = 1; depth > 0; depth--)
+      weight *= 10;
+
     switch(instr->opcode) {
     case MIR_CALL:
       for(i = 0; i < instr->num_args; i++)
-	if(instr->args[i]->optype != MIR_OP_CONST)
-	  uses[instr->args[i]->val]++;
+	if((reg = spill_cost_reg(graph, instr->args[i])) != -1)
+	  uses[reg] += weight;
 
-      if(instr->operand[2])
-	defs[instr->operand[2]->val]++;
+      if((reg = spill_cost_reg(graph, instr->operand[2])) != -1)
+	defs[reg] += weight;
 
       break;
 
     case MIR_MOVE:
-      if(instr->operand[0]->optype != MIR_OP_CONST)
-        copies[instr->operand[0]->val]++;
+      if((reg = spill_cost_reg(graph, instr->operand[0])) != -1)
+        copies[reg] += weight;
 
-      if(instr->operand[2]->optype != MIR_OP_CONST)
-        defs[instr->operand[2]->val]++;
+      if((reg = spill_cost_reg(graph, instr->operand[2])) != -1)
+        defs[reg] += weight;
       break;
 
     case MIR_STACK_LOAD:
     case MIR_HEAP_LOAD:
     case MIR_REG_LOAD:
-      defs[instr->operand[2]->val] += 10;
+      if((reg = spill_cost_reg(graph, instr->operand[2])) != -1)
+	defs[reg] += 10 * weight;
       break;
 
     case MIR_STACK_STORE:
     case MIR_HEAP_STORE:
     case MIR_REG_STORE:
-      uses[instr->operand[0]->val] += 10;
+      if((reg = spill_cost_reg(graph, instr->operand[0])) != -1)
+	uses[reg] += 10 * weight;
       break;
 
     case MIR_ADDR:
     case MIR_HEAP_ADDR:
     case MIR_STACK_ADDR:
-      defs[instr->operand[2]->val] += 10;
+      if((reg = spill_cost_reg(graph, instr->operand[2])) != -1)
+	defs[reg] += 10 * weight;
       break;
 
     default:
-      if(instr->operand[2] && instr->operand[2]->optype != MIR_OP_CONST)
-	defs[instr->operand[2]->val]++;
+      if((reg = spill_cost_reg(graph, instr->operand[2])) != -1)
+	defs[reg] += weight;
 
       for(i = 0; i < 2; i++)
-	if(instr->operand[i] && instr->operand[i]->optype != MIR_OP_CONST)
-	  uses[instr->operand[i]->val]++;
+	if((reg = spill_cost_reg(graph, instr->operand[i])) != -1)
+	  uses[reg] += weight;
 
       break;
     }
 
+    /* Only count the instructions in this function */
+    if(instr->opcode == MIR_END)
+      break;
+
     current = current->next;
   }
 
-  /* Add up the spill costs */
-  for(i = 0; i < graph->num_sym_regs; i++)
-    adj_list[i]->spill_cost = copies[i] + defs[i] + uses[i];
+  /*
+   * Add up the spill costs. Rematerialised registers are never stored and
+   * are recomputed without touching memory, so only their uses count.
+   */
+  for(i = 0; i < graph->num_sym_regs; i++) {
+    if(adj_list[i]->remat)
+      adj_list[i]->spill_cost = copies[i] + uses[i];
+    else
+      adj_list[i]->spill_cost = copies[i] + defs[i] + uses[i];
+  }
 
 
   free(copies);
@@ -385,148 +886,550 @@ static void compute_spill_costs(ig_graph_t *graph, adj_node_t **adj_list) {
 }
 
 /*
- * Move the neighbours of the given node to its removed list and then
- * disconnect the given node from its neighbours
+ * Returns true if an instruction defines its destination register with a
+ * value that doesn't depend on any other register: a constant, or a stack,
+ * heap or string address.
  */
-static void adjust_neighbours(int sregs, adj_node_t **adj_list, int node) {
-  int i, j;
+static int is_remat_instr(mir_instr_t *instr) {
+  if(instr->operand[2]->indirect)
+    return 0;
+
+  switch(instr->opcode) {
+  case MIR_MOVE:
+    return instr->operand[0]->optype == MIR_OP_CONST &&
+      !instr->operand[0]->indirect;
+
+  case MIR_HEAP_ADDR:
+    return instr->operand[0]->optype != MIR_OP_REG;
+
+  case MIR_STACK_ADDR:
+  case MIR_LOAD_STRING:
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Add delta to the use counts of the symbolic registers an instruction uses
+ */
+static void count_reg_uses(ig_graph_t *graph, mir_instr_t *instr, int *uses,
+			   int delta) {
+  int i, reg;
+
+  for(i = 0; i < 2; i++)
+    if((reg = spill_cost_reg(graph, instr->operand[i])) != -1)
+      uses[reg] += delta;
+
+  if(instr->opcode == MIR_REG_STORE &&
+     (reg = spill_cost_reg(graph, instr->operand[2])) != -1)
+    uses[reg] += delta;
+
+  if(instr->opcode == MIR_CALL)
+    for(i = 0; i < instr->num_args; i++)
+      if((reg = spill_cost_reg(graph, instr->args[i])) != -1)
+	uses[reg] += delta;
+}
+
+/*
+ * Find the symbolic registers with a single definition that can be
+ * recomputed, rather than stored and reloaded, if the register is spilled.
+ * Globals must be kept in memory so they are never rematerialised.
+ *
+ * A register whose only use directly follows its definition is left alone,
+ * rematerialising it would just rebuild the same code.
+ */
+static void find_remat_defs(ig_graph_t *graph, adj_node_t **adj_list) {
+  mir_node_t *current = graph->cfg->node[0]->mir_node;
+  mir_instr_t *instr;
+  mcfg_var_t *var;
+  int i, reg, *defs, *uses, *next_uses;
+
+  defs = calloc(graph->num_sym_regs, sizeof(int));
+  uses = calloc(graph->num_sym_regs, sizeof(int));
+  next_uses = calloc(graph->num_sym_regs, sizeof(int));
+
+  while(current) {
+    instr = current->instruction;
+
+    count_reg_uses(graph, instr, uses, 1);
+
+    if(instr->opcode != MIR_REG_STORE &&
+       (reg = spill_cost_reg(graph, instr->operand[2])) != -1) {
+      var = adj_list[reg]->var;
+
+      if(defs[reg]++ == 0 && is_remat_instr(instr) &&
+	 (var->type != MCFG_TYPE_VAR ||
+	  get_var_scope(var->var) != global_scope))
+	adj_list[reg]->remat = current;
+      else
+	adj_list[reg]->remat = NULL;
+    }
+
+    if(instr->opcode == MIR_END)
+      break;
+
+    current = current->next;
+  }
+
+  for(i = 0; i < graph->num_sym_regs; i++) {
+    if(!adj_list[i]->remat || uses[i] != 1)
+      continue;
+
+    instr = adj_list[i]->remat->next->instruction;
+    count_reg_uses(graph, instr, next_uses, 1);
+    if(next_uses[i])
+      adj_list[i]->remat = NULL;
+    count_reg_uses(graph, instr, next_uses, -1);
+  }
+
+  free(defs);
+  free(uses);
+  free(next_uses);
+}
+
+/*
+ * Return the colours, up to nregs, of the hard registers in a class
+ */
+static unsigned int class_colours(int reg_class, int nregs) {
+  unsigned int colours = 0;
+  int i;
+
+  for(i = 0; i < nregs; i++)
+    if(sparc_reg_class(i) == reg_class)
+      colours |= 1 << i;
+
+  return colours;
+}
+
+/*
+ * Return the colour of a hardware register, or no colours if it isn't one
+ * of the first nregs allocatable registers
+ */
+static unsigned int reg_colour(int reg, int nregs) {
+  int i;
+
+  for(i = 0; i < nregs; i++)
+    if(sparc_reg_number(i) == reg)
+      return 1 << i;
+
+  return 0;
+}
+
+/*
+ * Return the colours a leaf procedure can use. Without a save the locals
+ * and ins belong to the caller.
+ */
+static unsigned int leaf_colours(int nregs) {
+  return class_colours(SPARC_REG_OUT, nregs) |
+    class_colours(SPARC_REG_GLOBAL, nregs);
+}
+
+/*
+ * Return non-zero if a function may be a leaf procedure. It can't make
+ * calls or use the stack, and has to be allocated from the leaf colours
+ * without spilling.
+ */
+static int leaf_candidate(mcfg_graph_t *graph, int nregs) {
+  mir_node_t *current = graph->node[0]->mir_node;
+  mir_instr_t *instr;
+  int i;
+
+  if(!(cflags.oflags & OFLAG_LEAF_PROCS) || !leaf_colours(nregs))
+    return 0;
+
+  for(; current; current = current->next) {
+    instr = current->instruction;
+
+    switch(instr->opcode) {
+    case MIR_CALL:
+    case MIR_PUSH_ARG:
+    case MIR_STACK_ADDR:
+    case MIR_STACK_LOAD:
+    case MIR_STACK_STORE:
+      return 0;
+
+    case MIR_HEAP_ADDR:
+    case MIR_HEAP_LOAD:
+    case MIR_HEAP_STORE:
+      break;
+
+    default:
+      /* Variables left in memory are on the stack */
+      for(i = 0; i < 3; i++)
+	if(instr->operand[i] && instr->operand[i]->optype == MIR_OP_VAR)
+	  return 0;
+      break;
+    }
+
+    if(instr->opcode == MIR_END)
+      break;
+  }
+
+  debug_printf(1, "%s is a leaf procedure candidate\n",
+	       graph->node[0]->mir_node->instruction->label);
+  return 1;
+}
+
+/*
+ * Forbid colours for every symbolic register in a live set
+ */
+static void forbid_live_set(adj_node_t **adj_list, bitset_t *live,
+			    int except, unsigned int colours) {
+  int i;
+
+  for(i = bitset_next(live, 0); i != -1; i = bitset_next(live, i + 1))
+    if(i != except)
+      adj_list[i]->forbidden |= colours;
+}
+
+/*
+ * Find the colours each symbolic register can't have because the hard
+ * register is in use, the same as an interference with the hard register:
+ *
+ *   - Calls clobber the outs and the application globals, so registers live
+ *     across a call can't use them. The arguments are moved into the outs
+ *     one at a time, so nothing live into the call can be in an out.
+ *   - Each in holds an argument until it is received, so registers live
+ *     before then can't use it. Leaf procedures receive their arguments in
+ *     the outs instead, and can only use the outs and globals.
+ *
+ * Each forbidden colour counts towards a register's degree, so that the
+ * degree < R rule in ig_prune still holds.
+ */
+static void find_reg_constraints(ig_graph_t *graph, adj_node_t **adj_list,
+				 int nregs, int leaf) {
+  mir_node_t *current = graph->cfg->node[0]->mir_node;
+  mcfg_node_t *node;
+  mir_instr_t *instr;
+  unsigned int outs, clobbered, pending, colours;
+  int i, arg, def, args_base;
+
+  outs = class_colours(SPARC_REG_OUT, nregs);
+  clobbered = outs | class_colours(SPARC_REG_GLOBAL, nregs);
+  args_base = leaf ? SPARC_OUTS : SPARC_INS;
+
+  if(leaf) {
+    colours = ~leaf_colours(nregs) & ((1 << nregs) - 1);
+    for(i = 0; i < graph->num_sym_regs; i++)
+      adj_list[i]->forbidden |= colours;
+  }
+
+  /* The ins holding arguments which are yet to be received */
+  pending = 0;
+  for(arg = 0; current; current = current->next) {
+    if(current->instruction->opcode == MIR_RECEIVE ||
+       current->instruction->opcode == MIR_PUSH_ARG)
+      pending |= reg_colour(args_base + arg++, nregs);
+
+    if(current->instruction->opcode == MIR_END)
+      break;
+  }
+
+  current = graph->cfg->node[0]->mir_node;
+  if(current->cfg_node)
+    forbid_live_set(adj_list, current->cfg_node->live_in, -1, pending);
+
+  for(arg = 0; current; current = current->next) {
+    instr = current->instruction;
+    node = current->cfg_node;
+
+    /* Receiving an argument frees its in, even for its own def */
+    if(instr->opcode == MIR_RECEIVE || instr->opcode == MIR_PUSH_ARG)
+      pending &= ~reg_colour(args_base + arg++, nregs);
+
+    if(node) {
+      def = node->var_def ? node->var_def->id : -1;
+
+      if(pending) {
+	if(def != -1)
+	  adj_list[def]->forbidden |= pending;
+	forbid_live_set(adj_list, node->live_out, -1, pending);
+      }
+
+      if(instr->opcode == MIR_CALL) {
+	forbid_live_set(adj_list, node->live_in, -1, outs);
+	forbid_live_set(adj_list, node->live_out, def, clobbered);
+      }
+    }
+
+    if(instr->opcode == MIR_END)
+      break;
+  }
+
+  for(i = 0; i < graph->num_sym_regs; i++)
+    for(colours = adj_list[i]->forbidden; colours; colours &= colours - 1)
+      adj_list[i]->num_adjs++;
+}
+
+/*
+ * Return the symbolic register used by an operand for the spill cost
+ * calculation, or -1 if it isn't a symbolic register in the given graph.
+ */
+static int spill_cost_reg(ig_graph_t *graph, mir_operand_t *op) {
+  if(!op || op->optype != MIR_OP_REG ||
+     op->val < 0 || op->val >= graph->num_sym_regs)
+    return -1;
+
+  return op->val;
+}
+
+/*
+ * Disconnect the given node from its neighbours, moving each neighbour
+ * down a degree bucket
+ */
+static void adjust_neighbours(degree_buckets_t *buckets, adj_node_t **adj_list,
+			      int node) {
+  int i, n;
+
+  for(i = 0; i < adj_list[node]->num_nodes; i++) {
+    n = adj_list[node]->adj_node[i];
+    if(adj_list[n]->on_stack)
+      continue;
+
+    bucket_remove(buckets, adj_list, n);
+    adj_list[n]->num_adjs--;
+    bucket_insert(buckets, adj_list, n);
+  }
+
+  adj_list[node]->num_adjs = 0;
+}
+
+/*
+ * Assign symbolic registers to real registers.
+ */
+static int assign_regs(adj_node_t **adj_list, int sregs, int nregs) {
+  int node;
+  int colour, no_spills;
+
+  /* Pop nodes from the stack and attempt to assign a colour to them */
+  no_spills = 1;
+  while(sp) {
+
+    node = stack[--sp];
+    adj_list[node]->on_stack = 0;
+
+    if((colour = min_colour(adj_list, node, sregs, nregs)) > 0) {
+      adj_list[node]->colour = colour;
+      adj_list[node]->spill = 0;
+
+    } else {
+      /* Cant colour this node, mark it for spilling */
+      debug_printf(1, "Cannot assign a colour to node %d, spill it\n", node);
+      adj_list[node]->spill = 1;
+      no_spills = 0;
+    }
+  }
+
+  /* Finsihed with the stack */
+  free(stack);
+
+  return no_spills;
+}
+
+/*
+ * Return the lowest colour not used by any of the given node's neighbours
+ * or forbidden for the node, or 0 if no more colours are available.
+ * Neighbours which are still on the stack or have been spilled have no
+ * colour.
+ */
+static int min_colour(adj_node_t **adj_list, int node, int sregs, int nregs) {
+  char *used;
+  int i, colour;
+
+  used = calloc(nregs + 1, sizeof(char));
+
+  for(i = 0; i < adj_list[node]->num_nodes; i++)
+    used[adj_list[adj_list[node]->adj_node[i]]->colour] = 1;
+
+  for(colour = 1; colour <= nregs; colour++)
+    if(!used[colour] && !(adj_list[node]->forbidden & (1 << (colour - 1))))
+      break;
+
+  free(used);
+  return colour <= nregs ? colour : 0;
+}
+
+/*
+ * Extend a live interval to cover the given point
+ */
+static void interval_extend(live_interval_t *interval, int point) {
+  if(interval->start == -1 || point < interval->start)
+    interval->start = point;
+  if(point > interval->end)
+    interval->end = point;
+}
+
+/*
+ * Build the live interval of each symbolic register from the CFG's
+ * liveness, numbering the nodes in code order. The intervals have no holes,
+ * so any two registers which interfere have overlapping intervals.
+ * Registers that are never live have a start of -1.
+ */
+static live_interval_t *build_live_intervals(ig_graph_t *graph) {
+  mir_node_t *current = graph->cfg->node[0]->mir_node;
+  mcfg_node_t *node;
+  live_interval_t *interval;
+  int i, point = 0;
+
+  interval = malloc(sizeof(live_interval_t) * (graph->num_sym_regs + 1));
+  for(i = 0; i < graph->num_sym_regs; i++) {
+    interval[i].reg = i;
+    interval[i].start = -1;
+    interval[i].end = -1;
+  }
+
+  while(current) {
+    if((node = current->cfg_node)) {
 
-  /* Don't need to do anything if this node has no neighbours */
-  if(!adj_list[node]->adj_node)
-    return;
+      for(i = bitset_next(node->live_in, 0); i != -1;
+	  i = bitset_next(node->live_in, i + 1))
+	interval_extend(&interval[i], point);
 
-  for(i = 0; i < sregs; i++) {
-    if(adj_list[node]->adj_node[i]) {
-      adj_list[node]->adj_node[i] = 0;
-      adj_list[node]->rem_node[i] = 1;
+      for(i = 0; i < node->num_var_use; i++)
+	if(node->var_use[i]->id != -1)
+	  interval_extend(&interval[node->var_use[i]->id], point);
 
-      adj_list[node]->num_adjs--;
-    }
+      if(node->var_def && node->var_def->id != -1)
+	interval_extend(&interval[node->var_def->id], point + 1);
 
-    /* Disconnect from other nodes */
-    if(adj_list[i]->adj_node[node]) {
-      adj_list[i]->adj_node[node] = 0;
-      adj_list[i]->rem_node[node] = 1;
+      for(i = bitset_next(node->live_out, 0); i != -1;
+	  i = bitset_next(node->live_out, i + 1))
+	interval_extend(&interval[i], point + 1);
 
-      adj_list[i]->num_adjs--;
+      point += 2;
     }
+
+    if(current->instruction->opcode == MIR_END)
+      break;
+
+    current = current->next;
   }
+
+  return interval;
 }
 
 /*
- * Assign symbolic registers to real registers.
+ * Order live intervals by their start point
  */
-static int assign_regs(adj_node_t **adj_list, int sregs, int nregs) {
-  int i, node;
-  int colour, no_spills;
+static int interval_cmp(const void *a, const void *b) {
+  const live_interval_t *ia = a, *ib = b;
 
-  /* Pop nodes from the stack and attempt to assign a colour to them */
-  no_spills = 1;
-  while(sp) {
+  if(ia->start != ib->start)
+    return ia->start - ib->start;
 
-    node = stack[--sp];
-    adj_list[node]->on_stack = 0;
+  return ia->reg - ib->reg;
+}
 
-    /* Reconnect to other nodes that aren't on the stack */
-    for(i = 0; i < sregs; i++) {
-      if(adj_list[node]->rem_node[i] && !adj_list[i]->on_stack) {
+/*
+ * Returns true if interval a should be spilled in preference to b, which
+ * may be NULL. The cheapest interval for its length goes first. Intervals
+ * that only reach the next point, such as the registers created by spill
+ * code, are never spilled since the spill code would be just the same.
+ */
+static int interval_spill_before(adj_node_t **adj_list, live_interval_t *a,
+				 live_interval_t *b) {
+  long cost_a, cost_b;
 
-	adj_list[node]->adj_node[i] = 1;
-	adj_list[node]->rem_node[i] = 0;
+  if(adj_list[a->reg]->no_spill || a->end - a->start <= 1)
+    return 0;
+  if(!b)
+    return 1;
 
-	adj_list[node]->num_adjs++;
-      }
+  cost_a = (long)adj_list[a->reg]->spill_cost * (b->end - b->start + 1);
+  cost_b = (long)adj_list[b->reg]->spill_cost * (a->end - a->start + 1);
 
-      if(adj_list[i]->rem_node[node] && !adj_list[i]->on_stack) {
-	adj_list[i]->adj_node[node] = 1;
-	adj_list[i]->rem_node[node] = 0;
+  return cost_a < cost_b;
+}
 
-	adj_list[i]->num_adjs++;
-      }
+/*
+ * Linear scan register allocation. The intervals are visited in order of
+ * their start point, keeping the active ones sorted by end point. When an
+ * interval starts with every colour it is allowed in use, either it or one
+ * of the active intervals holding such a colour is spilled. Marks the
+ * spilled registers in the same way as assign_regs, and returns true if
+ * nothing was spilled.
+ */
+static int linear_scan(ig_graph_t *graph, adj_node_t **adj_list, int nregs) {
+  live_interval_t *interval, *current, *spill, **active;
+  unsigned int forbidden;
+  char *used;
+  int i, j, num_active, colour, no_spills;
+
+  interval = build_live_intervals(graph);
+  qsort(interval, graph->num_sym_regs, sizeof(live_interval_t), interval_cmp);
+
+  active = malloc(sizeof(live_interval_t *) * (nregs + 1));
+  used = calloc(nregs + 2, sizeof(char));
+  num_active = 0;
+  no_spills = 1;
 
+  for(i = 0; i < graph->num_sym_regs; i++) {
+    current = &interval[i];
 
+    /* Registers which are never live can have any colour */
+    if(current->start == -1) {
+      adj_list[current->reg]->colour = 1;
+      continue;
     }
 
-    if((colour = min_colour(adj_list, node, sregs, nregs)) > 0) {
-      adj_list[node]->colour = colour;
-      adj_list[node]->spill = 0;
-
-    } else {
-      /* Cant colour this node, mark it for spilling */
-      debug_printf(1, "Cannot assign a colour to node %d, spill it\n", node);
-      adj_list[node]->spill = 1;
-      no_spills = 0;
-    }
-  }
+    /* Expire the active intervals which end before this one starts */
+    for(j = 0; j < num_active && active[j]->end < current->start; j++)
+      used[adj_list[active[j]->reg]->colour] = 0;
+    num_active -= j;
+    memmove(active, active + j, sizeof(live_interval_t *) * num_active);
 
-  /* Finsihed with the stack */
-  free(stack);
+    forbidden = adj_list[current->reg]->forbidden;
+    for(colour = 1; colour <= nregs; colour++)
+      if(!used[colour] && !(forbidden & (1 << (colour - 1))))
+	break;
 
-  return no_spills;
-}
+    if(colour > nregs) {
+      spill = interval_spill_before(adj_list, current, NULL) ? current : NULL;
+      for(j = 0; j < num_active; j++)
+	if(!(forbidden & (1 << (adj_list[active[j]->reg]->colour - 1))) &&
+	   interval_spill_before(adj_list, active[j], spill))
+	  spill = active[j];
 
-/*
- * Return the next available colour for the given node, or -1 if no more
- * colours are available.
- *
- * FIXME: This is slow
- *
- */
-static int min_colour(adj_node_t **adj_list, int node, int sregs, int nregs) {
-  int i, j, *used_colours, num_used, colour, duplicate;
+      if(!spill)
+	compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		       "Failed to find spillable node for regalloc\n");
 
-  /* Build a list of used colours for this node */
-  used_colours = malloc(sizeof(int) * nregs);
-  num_used = 0;
+      debug_printf(1, "Selected node %d as spill candidate, cost = %d\n",
+		   spill->reg, adj_list[spill->reg]->spill_cost);
 
-  for(i = 0; i < sregs; i++)
-    if(adj_list[node]->adj_node[i] && adj_list[i]->colour) {
-      /* Don't add duplicates */
-      for(j = 0, duplicate = 0; j < i && j < num_used; j++)
-	if(used_colours[j] == adj_list[i]->colour)
-	  duplicate = 1;
+      adj_list[spill->reg]->spill = 1;
+      no_spills = 0;
 
-      if(!duplicate)
-	used_colours[num_used++] = adj_list[i]->colour;
-    }
+      if(spill == current)
+	continue;
 
-  /* Sort the list in ascending order */
-  qsort(used_colours, num_used, sizeof(int), compare_ints);
+      /* Take over the colour of the spilled interval */
+      for(j = 0; active[j] != spill; j++)
+	;
+      num_active--;
+      memmove(active + j, active + j + 1,
+	      sizeof(live_interval_t *) * (num_active - j));
 
-#if 0
-  debug_printf(1, "Sorted colour list [%d]: ", node);
-  for(i = 0; i < num_used; i++)
-    debug_printf(1, "%d, ", used_colours[i]);
-#endif
+      colour = adj_list[spill->reg]->colour;
+      adj_list[spill->reg]->colour = 0;
+    }
 
-  /* Find the lowest available colour */
-  if(num_used == 0)
-    colour = 1;
-  else {
-    colour = 0;
-    for(i = 0; i < num_used; i++)
-      if(used_colours[i] != i + 1) {
-	colour = i + 1;
-	break;
-      }
+    used[colour] = 1;
+    adj_list[current->reg]->colour = colour;
 
-    if(!colour && num_used < nregs)
-      colour = i + 1;
+    /* Insert into the active list, sorted by end point */
+    for(j = num_active; j > 0 && active[j - 1]->end > current->end; j--)
+      active[j] = active[j - 1];
+    active[j] = current;
+    num_active++;
   }
 
-#if 0
-  debug_printf(1, ": first free = %d\n", colour);
-#endif
-
-  free(used_colours);
-  return colour;
-}
+  free(interval);
+  free(active);
+  free(used);
 
-/*
- * Compare two ints for the qsort in min_colour
- */
-static int compare_ints(const void *a, const void *b) {
-  return *(int *)a > *(int *)b;
+  return no_spills;
 }
 
 /*
@@ -601,8 +1504,8 @@ void global_load_store(mcfg_list_t *cfg) {
 /*
  * Modify the MIR code, replacing symbolic registers with real ones
  */
-void modify_code(adj_node_t **adj_list) {
-  mir_node_t *current = mir_list_head();
+static void modify_code(ig_graph_t *graph, adj_node_t **adj_list) {
+  mir_node_t *current = graph->cfg->node[0]->mir_node;
   mir_instr_t *instr;
   int i;
 
@@ -629,10 +1532,26 @@ void modify_code(adj_node_t **adj_list) {
 	  adj_list[instr->args[i]->val]->colour - 1;
 	}
 
+    if(instr->opcode == MIR_END)
+      break;
+
     current = current->next;
   }
 }
 
+/*
+ * Move the label of an instruction to a spill load inserted before it, so
+ * that jumps to the instruction also execute the load.
+ */
+static void spill_move_label(mir_node_t *src, mir_node_t *dest) {
+  if(!src->in_links)
+    return;
+
+  mir_move_label(src, dest);
+  dest->instruction->label = src->instruction->label;
+  src->instruction->label = NULL;
+}
+
 /*
  * Generate a spill load.
  * Returns a pointer to the newly created node, or null if an existing
@@ -654,7 +1573,7 @@ static mir_node_t *gen_spill_load(mir_node_t *mir_node, adj_node_t *spill_node,
 
   } else {
     opcode = MIR_STACK_LOAD;
-    offset = temp_stack_location(func, spill_node->var->reg);
+    offset = temp_stack_location(func, spill_node->location);
   }
 
   debug_printf(1, "Generating spill load: type = %s, offset = %d, dest reg = %d\n",
@@ -674,6 +1593,7 @@ static mir_node_t *gen_spill_load(mir_node_t *mir_node, adj_node_t *spill_node,
 #endif
     new_node = mir_add_instr(mir_node, opcode, mir_const(offset), NULL,
 			     mir_reg(dest));
+    spill_move_label(new_node->next, new_node);
     mcfg_insert_node(new_node);
 
 #if 0
@@ -683,6 +1603,34 @@ static mir_node_t *gen_spill_load(mir_node_t *mir_node, adj_node_t *spill_node,
   return new_node;
 }
 
+/*
+ * Reload a spilled register into dest before the given node, either by
+ * recomputing its definition or by loading it from memory.
+ */
+static mir_node_t *gen_spill_reload(mir_node_t *mir_node,
+				    adj_node_t *spill_node, char *func,
+				    int dest) {
+  mir_instr_t *def;
+  mir_node_t *new_node;
+
+  bitset_grow(reload_temps, dest + 1);
+  bitset_set(reload_temps, dest);
+
+  if(!spill_node->remat)
+    return gen_spill_load(mir_node, spill_node, func, dest);
+
+  def = spill_node->remat->instruction;
+  debug_printf(1, "Generating rematerialisation: dest reg = %d\n", dest);
+
+  new_node = mir_add_instr(mir_node, def->opcode,
+			   mir_opr_copy(def->operand[0]), NULL,
+			   mir_reg(dest));
+  spill_move_label(new_node->next, new_node);
+  mcfg_insert_node(new_node);
+
+  return new_node;
+}
+
 /*
  * Generate a spill store
  */
@@ -703,7 +1651,7 @@ static mir_node_t *gen_spill_store(mir_node_t *mir_node,
 
   } else {
     opcode = MIR_STACK_STORE;
-    offset = temp_stack_location(func, spill_node->var->reg);
+    offset = temp_stack_location(func, spill_node->location);
   }
 
   debug_printf(1, "Generating spill store: type = %s, offset = %d\n",
@@ -734,12 +1682,12 @@ static mir_node_t *gen_spill_store(mir_node_t *mir_node,
 /*
  * Generate extra load/store instructions for spilled registers.
  */
-static void gen_spill_code(adj_node_t **adj_list, int sregs) {
-  mir_node_t *new_node, *current = mir_list_head();
+static void gen_spill_code(ig_graph_t *graph, adj_node_t **adj_list) {
+  mir_node_t *new_node, *next, *current = graph->cfg->node[0]->mir_node;
   mir_instr_t *instr;
   mir_operand_t *dest;
   char *func_name;
-  int i, j, reg, offset, loads, stores, opcode;
+  int i, j, reg, offset, loads, stores, opcode, sregs = graph->num_sym_regs;
 
   debug_printf(1, "Generating spill code: %d sregs\n", sregs);
 
@@ -753,11 +1701,26 @@ static void gen_spill_code(adj_node_t **adj_list, int sregs) {
   debug_printf(1, "Total spills  = %d\n", j);
 
   /* Initialise temporary stack locations */
-  init_temp_stack_locations(sregs);
+  init_temp_stack_locations();
+
+  /*
+   * Spilled temporaries are keyed in the stack location lists on a new
+   * temporary register, so they can't clash with the registers spilled by
+   * earlier passes.
+   */
+  for(j = 0; j < sregs; j++)
+    if(adj_list[j]->spill && !adj_list[j]->var->var)
+      adj_list[j]->location = tr_alloc();
 
   while(current) {
     instr = current->instruction;
 
+    /*
+     * Loads go in before the instruction and stores after it, so carry on
+     * from the original next instruction once every register is done.
+     */
+    next = current->next;
+
     if(instr->opcode == MIR_LABEL)
       func_name = instr->label;
 
@@ -773,7 +1736,7 @@ static void gen_spill_code(adj_node_t **adj_list, int sregs) {
 	      debug_printf(1, "Generating load for call argument\n");
 
 	    reg = tr_alloc();
-	    gen_spill_load(current->prev, adj_list[j], func_name, reg);
+	    gen_spill_reload(current->prev, adj_list[j], func_name, reg);
 	    free(instr->args[i]);
 	    instr->args[i] = mir_reg(reg);
 	    loads++;
@@ -792,27 +1755,38 @@ static void gen_spill_code(adj_node_t **adj_list, int sregs) {
 	    }
 	}
 
-	/* Use registers */
-	for(i = 0; i < 2; i++) {
+	/*
+	 * Use registers. Operands using the same register share a reload,
+	 * and the address of a register store is a use.
+	 */
+	reg = -1;
+	for(i = 0; i < 3; i++) {
+	  if(i == 2 && instr->opcode != MIR_REG_STORE)
+	    break;
+
 	  if(instr->operand[i] && instr->operand[i]->optype == MIR_OP_REG &&
 	     instr->operand[i]->val == j) {
 
-	    reg = tr_alloc();
-	    if(gen_spill_load(current->prev, adj_list[j], func_name, reg)) {
-	      free(instr->operand[i]);
-	      instr->operand[i] = mir_reg(reg);
+	    if(reg == -1) {
+	      reg = tr_alloc();
+	      gen_spill_reload(current->prev, adj_list[j], func_name, reg);
+	      loads++;
 	    }
 
-	    loads++;
-
-	    break;
+	    free(instr->operand[i]);
+	    instr->operand[i] = mir_reg(reg);
 	  }
 	}
 
 	/* Def register */
-	if(instr->operand[2] && instr->operand[2]->optype == MIR_OP_REG &&
+	if(instr->opcode != MIR_REG_STORE &&
+	   instr->operand[2] && instr->operand[2]->optype == MIR_OP_REG &&
 	   instr->operand[2]->val == j) {
 
+	  /* Rematerialised definitions are deleted below */
+	  if(adj_list[j]->remat)
+	    continue;
+
 	  debug_printf(1, "Generating store for reg %d\n", j);
 
 	  switch(instr->opcode) {
@@ -828,12 +1802,14 @@ static void gen_spill_code(adj_node_t **adj_list, int sregs) {
 	    break;
 
 	  default:
+	    /*
+	     * Define a new register and store that, so the spilled register
+	     * is left with no defs or uses at all.
+	     */
+	    instr->operand[2]->val = tr_alloc();
+	    instr->operand[2]->var = NULL;
 	    gen_spill_store(current, adj_list[j], func_name,
 			    instr->operand[2]);
-
-	    /* Skip the newly generated instruction */
-	    current = current->next;
-
 	    break;
 	  }
 
@@ -842,29 +1818,114 @@ static void gen_spill_code(adj_node_t **adj_list, int sregs) {
       }
     }
 
-    current = current->next;
+    if(instr->opcode == MIR_END)
+      break;
+
+    current = next;
   }
 
+  /* The uses have all been recomputed so the original definitions can go */
+  for(j = 0; j < sregs; j++)
+    if(adj_list[j]->spill && adj_list[j]->remat)
+      remove_instr(adj_list[j]->remat);
+
   debug_printf(1, "Generated %d load, %d store instructions\n", loads, stores);
 }
 
+/*
+ * Give the registers created by the spill code the next free symbolic
+ * register numbers, in the order they appear. Every register numbered at
+ * or above the number of symbolic registers is new, see tr_set_lowest.
+ * The reloaded ones are added to no_spill.
+ */
+static void number_spill_temps(ig_graph_t *graph, bitset_t *no_spill) {
+  mir_node_t *current = graph->cfg->node[0]->mir_node;
+  mir_instr_t *instr;
+  mir_operand_t *op;
+  int i, size, next, *id;
+
+  next = graph->num_sym_regs;
+  size = tr_max_temps() - graph->num_sym_regs;
+  if(size <= 0)
+    return;
+
+  id = malloc(sizeof(int) * size);
+  for(i = 0; i < size; i++)
+    id[i] = -1;
+
+  while(current) {
+    instr = current->instruction;
+
+    for(i = 0; i < 3 + instr->num_args; i++) {
+      op = i < 3 ? instr->operand[i] : instr->args[i - 3];
+
+      if(!op || op->optype != MIR_OP_REG || op->val < graph->num_sym_regs)
+	continue;
+
+      if(id[op->val - graph->num_sym_regs] == -1) {
+	id[op->val - graph->num_sym_regs] = next;
+	if(op->val < reload_temps->num_bits &&
+	   bitset_test(reload_temps, op->val)) {
+	  bitset_grow(no_spill, next + 1);
+	  bitset_set(no_spill, next);
+	}
+	next++;
+      }
+      op->val = id[op->val - graph->num_sym_regs];
+    }
+
+    if(instr->opcode == MIR_END)
+      break;
+
+    current = current->next;
+  }
+
+  debug_printf(1, "Numbered %d spill temporaries\n",
+	       next - graph->num_sym_regs);
+
+  bitset_clear_all(reload_temps);
+  free(id);
+}
+
+/*
+ * Rebuilding the IG gives the symbolic registers new numbers, so move the
+ * no_spill registers over to theirs. A register coalesced away is dropped.
+ */
+static void renumber_no_spill(ig_graph_t *graph, bitset_t *no_spill) {
+  bitset_t *old;
+  mir_operand_t op;
+  int i, reg;
+
+  old = bitset_new(no_spill->num_bits);
+  bitset_copy(old, no_spill);
+  bitset_clear_all(no_spill);
+  bitset_grow(no_spill, graph->num_sym_regs);
+
+  op.optype = MIR_OP_REG;
+  op.var = NULL;
+  for(i = bitset_next(old, 0); i != -1; i = bitset_next(old, i + 1)) {
+    op.val = i;
+    if((reg = ig_sym_reg(graph, &op)) != -1)
+      bitset_set(no_spill, reg);
+  }
+
+  bitset_free(old);
+}
+
 /*
  * Initialise the temporary stack location lists
  */
-static void init_temp_stack_locations(int sregs) {
+static void init_temp_stack_locations(void) {
   int i;
 
-  if(!stack_temps) {
-    stack_temps = malloc(num_def_functions() * sizeof(stack_loc_list_t));
-    for(i = 0; i < num_def_functions(); i++) {
-      stack_temps[i].reg = malloc(sregs * sizeof(stack_loc_t));
-      stack_temps[i].num_regs = 0;
-    }
+  if(stack_temps)
+    return;
 
-  } else {
-    for(i = 0; i < num_def_functions(); i++)
-      stack_temps[i].reg = realloc(stack_temps[i].reg,
-				   sregs * sizeof(stack_loc_t));
+  stack_temps = malloc(num_def_functions() * sizeof(stack_loc_list_t));
+  for(i = 0; i < num_def_functions(); i++) {
+    stack_temps[i].reg = NULL;
+    stack_temps[i].num_regs = 0;
+    stack_temps[i].num_slots = 0;
   }
 }
 
@@ -887,6 +1948,8 @@ static void free_temp_stack_locations(void) {
 static int assign_stack_location(int func_num, int temp_reg) {
   int offset, index = stack_temps[func_num].num_regs;
 
+  stack_temps[func_num].reg = realloc(stack_temps[func_num].reg,
+				      sizeof(stack_loc_t) * (index + 1));
   stack_temps[func_num].reg[index].temp_reg = temp_reg;
 
   /* FIXME: Shouldn't assume 4 byte register size */
@@ -923,6 +1986,162 @@ static int temp_stack_location(char *func_name, int temp_reg) {
   return assign_stack_location(index, temp_reg) + base_offset;
 }
 
+/*
+ * Return the temporary stack location an instruction stores to (def) or
+ * loads from (use), or -1 if it doesn't access one.
+ */
+static int stack_temp_slot(mir_instr_t *instr, int base_offset, int num_regs,
+			   int def) {
+  mir_operand_t *op;
+  int slot;
+
+  if(def && instr->opcode == MIR_STACK_STORE)
+    op = instr->operand[2];
+  else if(!def && instr->opcode == MIR_STACK_LOAD)
+    op = instr->operand[0];
+  else
+    return -1;
+
+  /* FIXME: Shouldn't assume 4 byte register size */
+  if(op->optype != MIR_OP_CONST || op->val < base_offset ||
+     (op->val - base_offset) % 4)
+    return -1;
+
+  slot = (op->val - base_offset) / 4;
+  return slot < num_regs ? slot : -1;
+}
+
+/*
+ * Colour the temporary stack locations of a function so that temporaries
+ * which are never live in memory at the same time share a slot. Liveness
+ * of the slots is calculated over the final code, with spill stores as
+ * defs and spill loads as uses. The slots are numbered in the order they
+ * were created and each is given the lowest slot not used by an earlier
+ * one it interferes with.
+ */
+static void colour_stack_temps(mcfg_graph_t *graph, char *func_name) {
+  mcfg_node_t *node;
+  mir_instr_t *instr;
+  bitset_t **live_in, **live_out, **conflict, *live;
+  char *used;
+  int i, j, k, slot, changed, num_regs, base_offset, index, *colour;
+
+  if(!stack_temps)
+    return;
+
+  index = get_def_func_index(func_name);
+  num_regs = stack_temps[index].num_regs;
+  stack_temps[index].num_slots = num_regs;
+
+  if(num_regs < 2 || !(cflags.oflags & OFLAG_SPILL_SLOTS))
+    return;
+
+  base_offset = max_scope_size(get_func_scope(func_name));
+
+  /* Allocation is finished, so the node order can be reused as an index */
+  live_in = malloc(sizeof(bitset_t *) * graph->num_nodes);
+  live_out = malloc(sizeof(bitset_t *) * graph->num_nodes);
+  live = bitset_new(num_regs);
+  for(i = 0; i < graph->num_nodes; i++) {
+    graph->node[i]->order = i;
+    live_in[i] = bitset_new(num_regs);
+    live_out[i] = bitset_new(num_regs);
+  }
+
+  /*
+   * Each node holds a single instruction, so in = (out - def) + use.
+   * Spill code is appended to the node array, so just iterate backwards
+   * over the whole graph until nothing changes.
+   */
+  do {
+    changed = 0;
+
+    for(i = graph->num_nodes - 1; i >= 0; i--) {
+      node = graph->node[i];
+      instr = node->mir_node->instruction;
+
+      for(j = 0; j < node->num_succs; j++)
+	bitset_union(live_out[i], live_in[node->succ[j]->order]);
+
+      bitset_copy(live, live_out[i]);
+      if((slot = stack_temp_slot(instr, base_offset, num_regs, 1)) != -1)
+	bitset_clear(live, slot);
+      if((slot = stack_temp_slot(instr, base_offset, num_regs, 0)) != -1)
+	bitset_set(live, slot);
+
+      if(!bitset_equal(live, live_in[i])) {
+	bitset_copy(live_in[i], live);
+	changed = 1;
+      }
+    }
+  } while(changed);
+
+  /* Slots interfere if they are live together or one is stored over another */
+  conflict = malloc(sizeof(bitset_t *) * num_regs);
+  for(i = 0; i < num_regs; i++)
+    conflict[i] = bitset_new(num_regs);
+
+  for(i = 0; i < graph->num_nodes; i++) {
+    instr = graph->node[i]->mir_node->instruction;
+
+    for(k = bitset_next(live_out[i], 0); k != -1;
+	k = bitset_next(live_out[i], k + 1))
+      bitset_union(conflict[k], live_out[i]);
+
+    if((slot = stack_temp_slot(instr, base_offset, num_regs, 1)) != -1) {
+      bitset_union(conflict[slot], live_out[i]);
+      for(k = bitset_next(live_out[i], 0); k != -1;
+	  k = bitset_next(live_out[i], k + 1))
+	bitset_set(conflict[k], slot);
+    }
+  }
+
+  /* Greedy colouring in creation order */
+  colour = malloc(sizeof(int) * num_regs);
+  used = malloc(num_regs);
+  stack_temps[index].num_slots = 0;
+
+  for(i = 0; i < num_regs; i++) {
+    memset(used, 0, num_regs);
+    for(k = bitset_next(conflict[i], 0); k != -1 && k < i;
+	k = bitset_next(conflict[i], k + 1))
+      used[colour[k]] = 1;
+
+    for(colour[i] = 0; used[colour[i]]; colour[i]++)
+      ;
+
+    if(colour[i] + 1 > stack_temps[index].num_slots)
+      stack_temps[index].num_slots = colour[i] + 1;
+  }
+
+  debug_printf(1, "Coloured %d stack temporaries for %s into %d slots\n",
+	       num_regs, func_name, stack_temps[index].num_slots);
+
+  /* Rewrite the spill code with the coloured offsets */
+  for(i = 0; i < graph->num_nodes; i++) {
+    instr = graph->node[i]->mir_node->instruction;
+
+    if((slot = stack_temp_slot(instr, base_offset, num_regs, 1)) != -1)
+      instr->operand[2]->val = base_offset + colour[slot] * 4;
+    else if((slot = stack_temp_slot(instr, base_offset, num_regs, 0)) != -1)
+      instr->operand[0]->val = base_offset + colour[slot] * 4;
+  }
+
+  for(i = 0; i < graph->num_nodes; i++) {
+    bitset_free(live_in[i]);
+    bitset_free(live_out[i]);
+  }
+  for(i = 0; i < num_regs; i++)
+    bitset_free(conflict[i]);
+  bitset_free(live);
+
+  free(live_in);
+  free(live_out);
+  free(conflict);
+  free(colour);
+  free(used);
+}
+
 /*
  * Add the temporary stack locations to the scope table
  * FIXME: Should add a new variable called ".temporaries" and give that
@@ -939,9 +2158,9 @@ static void add_temps_to_scopes(void) {
     scope = get_func_scope(get_def_func(i)->name);
 
     debug_printf(1, "Adding %d bytes to function scope %d\n",
-		 stack_temps[i].num_regs * 4, i);
+		 stack_temps[i].num_slots * 4, i);
     /* FIXME: Shouldn't assume 4-byte register size */
-    scope->size += stack_temps[i].num_regs * 4;
+    scope->size += stack_temps[i].num_slots * 4;
   }
 
   free_temp_stack_locations();
@@ -951,160 +2170,260 @@ static void add_temps_to_scopes(void) {
 
 
 /*
- * Add a symbolic register to the IG
+ * Return the bit in the triangular links matrix for a pair of symbolic
+ * registers. The pair must be distinct.
  */
-static void ig_add_sym_reg(ig_graph_t *ig, mcfg_var_t *sym_reg) {
-  int i;
+static long ig_link_bit(int sym_reg1, int sym_reg2) {
+  if(sym_reg1 < sym_reg2)
+    return ((long)sym_reg2 * (sym_reg2 - 1)) / 2 + sym_reg1;
 
-  /* Don't add duplicates */
-  for(i = 0; i < ig->num_sym_regs; i++)
-    if(mcfg_var_match(ig->sym_reg[i], sym_reg)) {
-      /* FIXME: free(sym_reg); */
-      return;
-    }
+  return ((long)sym_reg1 * (sym_reg1 - 1)) / 2 + sym_reg2;
+}
 
-  if(!ig->sym_reg)
-    ig->sym_reg = malloc(sizeof(name_record_t *));
-  else
-    ig->sym_reg = realloc(ig->sym_reg,
-			  sizeof(name_record_t *) * (ig->num_sym_regs + 1));
+/*
+ * Add a symbolic register to another's neighbour vector. The vectors are
+ * doubled in size each time they reach a power of two.
+ */
+static void ig_add_neighbour(ig_graph_t *ig, int sym_reg, int neighbour) {
+  int n = ig->num_adj[sym_reg];
 
-  ig->sym_reg[ig->num_sym_regs++] = sym_reg;
-}
+  if(!n)
+    ig->adj[sym_reg] = malloc(sizeof(int));
+  else if(!(n & (n - 1)))
+    ig->adj[sym_reg] = realloc(ig->adj[sym_reg], sizeof(int) * n * 2);
 
+  ig->adj[sym_reg][ig->num_adj[sym_reg]++] = neighbour;
+}
 
 /*
- * Add a link between two variables in the IG
+ * Add a link between two symbolic registers in the IG
  */
-static void ig_add_link(ig_graph_t *ig, mcfg_var_t *sym_reg1,
-			mcfg_var_t *sym_reg2) {
-  int i, index1 = -1, index2 = -1;
+static void ig_add_link(ig_graph_t *ig, int sym_reg1, int sym_reg2) {
+  long bit;
 
-  if(!sym_reg1 || !sym_reg2)
+  if(sym_reg1 < 0 || sym_reg1 >= ig->num_sym_regs ||
+     sym_reg2 < 0 || sym_reg2 >= ig->num_sym_regs)
     compiler_error(CERROR_ERROR, CERROR_NO_LINE,
 		   "Invalid sym_reg in ig_add_link\n");
 
   /* Don't need to link variables with themselves */
-  if(mcfg_var_match(sym_reg1, sym_reg2))
+  if(sym_reg1 == sym_reg2)
     return;
 
-  for(i = 0; i < ig->num_sym_regs; i++)
-    if(mcfg_var_match(ig->sym_reg[i], sym_reg1))
-      index1 = i;
-    else if(mcfg_var_match(ig->sym_reg[i], sym_reg2))
-      index2 = i;
+  bit = ig_link_bit(sym_reg1, sym_reg2);
+  if(bitset_test(ig->links, bit))
+    return;
 
-  if(index1 == -1 || index2 == -1) {
-    if(sym_reg1->type == MCFG_TYPE_VAR)
-      debug_printf(1, "sym_reg1 = %s\n", sym_reg1->var->name);
-    else
-      debug_printf(1, "sym_reg1 = %%t%d\n", sym_reg1->reg);
-    if(sym_reg2->type == MCFG_TYPE_VAR)
-      debug_printf(1, "sym_reg2 = %s\n", sym_reg2->var->name);
-    else
-      debug_printf(1, "sym_reg2 = %%t%d\n", sym_reg2->reg);
+  bitset_set(ig->links, bit);
+  ig_add_neighbour(ig, sym_reg1, sym_reg2);
+  ig_add_neighbour(ig, sym_reg2, sym_reg1);
+}
 
-    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
-		   "Cannot find sym_reg in graph\n");
-  }
 
+/*
+ * Test if two symbolic registers are connected in the IG
+ */
+static int ig_are_linked(ig_graph_t *ig, int sym_reg1, int sym_reg2) {
+
+  /* Variables are not linked to themselves */
+  if(sym_reg1 == sym_reg2)
+    return 0;
 
-  ig->links[index1][index2] = 1;
-  ig->links[index2][index1] = 1;
+  return bitset_test(ig->links, ig_link_bit(sym_reg1, sym_reg2));
 }
 
+/*
+ * Remove a symbolic register from another's neighbour vector
+ */
+static void ig_remove_neighbour(ig_graph_t *ig, int sym_reg, int neighbour) {
+  int i;
+
+  for(i = 0; i < ig->num_adj[sym_reg]; i++)
+    if(ig->adj[sym_reg][i] == neighbour) {
+      ig->adj[sym_reg][i] = ig->adj[sym_reg][--ig->num_adj[sym_reg]];
+      break;
+    }
+
+  if(!ig->num_adj[sym_reg]) {
+    free(ig->adj[sym_reg]);
+    ig->adj[sym_reg] = NULL;
+  }
+}
 
 /*
- * Test if two vars are connected in the IG
+ * Link every pair of symbolic registers in a live set
  */
-static int ig_are_linked(ig_graph_t *ig, mcfg_var_t *sym_reg1,
-			 mcfg_var_t *sym_reg2) {
-  int i, index1, index2;
+static void ig_link_live_set(ig_graph_t *ig, bitset_t *live) {
+  int i, j;
 
-  /* Non-existant variables do not interfere */
-  if(!sym_reg1 || !sym_reg2 || !ig->num_sym_regs)
-    return 0;
+  for(i = bitset_next(live, 0); i != -1; i = bitset_next(live, i + 1))
+    for(j = bitset_next(live, i + 1); j != -1; j = bitset_next(live, j + 1))
+      ig_add_link(ig, i, j);
+}
 
-  /* Variables are not linked to themselves */
-  if(mcfg_var_match(sym_reg1, sym_reg2))
-    return 0;
+/*
+ * Add the links for a single CFG node: the def against everything live
+ * out. Two registers interfere if one is live where the other is defined,
+ * so this finds every link without enumerating the pairs in each live set.
+ * The source of a copy doesn't interfere with its destination, since they
+ * hold the same value.
+ */
+static void ig_link_node(ig_graph_t *ig, mcfg_node_t *node) {
+  mir_instr_t *instr = node->mir_node->instruction;
+  int j, src = -1;
+
+  if(!node->var_def)
+    return;
 
-  for(i = 0; i < ig->num_sym_regs; i++)
-    if(ig->sym_reg[i] == sym_reg1)
-      index1 = i;
-    else if(ig->sym_reg[i] == sym_reg2)
-      index2 = i;
+  if(instr->opcode == MIR_MOVE && instr->operand[0] &&
+     !instr->operand[0]->indirect && !instr->operand[2]->indirect)
+    src = ig_sym_reg(ig, instr->operand[0]);
 
-  return ig->links[index1][index2];
+  /* Add links for def[n] -> out[n] */
+  for(j = bitset_next(node->live_out, 0); j != -1;
+      j = bitset_next(node->live_out, j + 1))
+    if(j != src)
+      ig_add_link(ig, node->var_def->id, j);
 }
 
 /*
- * Build the IG from the given CFG graph, each item in the IG is a
- * symbolic register.
- *
- * TODO: This will probably get slow for functions that have lots of vars/temps
+ * Build the IG for a single function from its CFG, each item in the IG is a
+ * symbolic register. Registers never interfere across functions, so each
+ * function gets its own graph. The CFG's def/use sets and liveness must be
+ * up to date.
  *
  * Currently this just treats each mcfg_var as a symbolic register. It should
  * use webs as symbolic registers, however this requires first
  * determining the reachibilty of the CFG, then construction du-chains and
  * finally building webs.
  */
-ig_graph_t *ig_build_graph(mcfg_list_t *cfg_list) {
+ig_graph_t *ig_build_graph(mcfg_graph_t *cfg) {
   ig_graph_t *ig_graph;
-  mcfg_node_t *current;
-  int i, j, k, l;
+  int i, n = cfg->num_vars;
+
+  ig_graph = ig_new_graph(cfg);
+  bitset_grow(ig_graph->links, ((long)n * (n - 1)) / 2);
+
+  /*
+   * Calculate the interferences. Registers live on entry to the function,
+   * such as the arguments, have no def inside it so are linked here.
+   */
+  for(i = 0; i < cfg->num_nodes; i++) {
+    if(cfg->node[i]->type == MCFG_NODE_FUNC_ENTRY)
+      ig_link_live_set(ig_graph, cfg->node[i]->live_in);
+    ig_link_node(ig_graph, cfg->node[i]);
+  }
+
+  return ig_graph;
+}
+
+/*
+ * Create an IG with a symbolic register for each of the CFG's variables,
+ * but no links. The links matrix is left empty, linear scan never needs it.
+ */
+static ig_graph_t *ig_new_graph(mcfg_graph_t *cfg) {
+  ig_graph_t *ig_graph;
+  int n = cfg->num_vars;
 
-  /* Initialise the IG */
   ig_graph = malloc(sizeof(ig_graph_t));
-  ig_graph->sym_reg = NULL;
-  ig_graph->num_sym_regs = 0;
-  ig_graph->num_links = 0;
+  ig_graph->cfg = cfg;
+  ig_graph->num_sym_regs = n;
+  ig_graph->sym_reg = malloc(sizeof(mcfg_var_t *) * (n ? n : 1));
+  memcpy(ig_graph->sym_reg, cfg->var, sizeof(mcfg_var_t *) * n);
+
+  ig_graph->links = bitset_new(0);
+  ig_graph->adj = calloc(n ? n : 1, sizeof(int *));
+  ig_graph->num_adj = calloc(n ? n : 1, sizeof(int));
 
-  /* Add all variables */
-  for(i = 0; i < cfg_list->num_graphs; i++) {
-    for(j = 0; j < cfg_list->graph[i]->num_nodes; j++) {
-      current = cfg_list->graph[i]->node[j];
+  return ig_graph;
+}
 
-      if(current->var_def)
-	ig_add_sym_reg(ig_graph, current->var_def);
-      for(k = 0; k < current->num_var_use; k++)
-	ig_add_sym_reg(ig_graph, current->var_use[k]);
+/*
+ * Grow the IG for any variables added to its CFG. The new registers have
+ * no links, and the links matrix is left for the caller to grow.
+ */
+static void ig_grow_graph(ig_graph_t *ig) {
+  mcfg_graph_t *cfg = ig->cfg;
+  int i, n = ig->num_sym_regs, num = cfg->num_vars;
+
+  ig->sym_reg = realloc(ig->sym_reg, sizeof(mcfg_var_t *) * (num ? num : 1));
+  memcpy(ig->sym_reg, cfg->var, sizeof(mcfg_var_t *) * num);
+  ig->adj = realloc(ig->adj, sizeof(int *) * (num ? num : 1));
+  ig->num_adj = realloc(ig->num_adj, sizeof(int) * (num ? num : 1));
+  for(i = n; i < num; i++) {
+    ig->adj[i] = NULL;
+    ig->num_adj[i] = 0;
+  }
+  ig->num_sym_regs = num;
+}
 
+/*
+ * Update the IG after spill code has been added and the CFG's liveness
+ * updated with mcfg_update_liveness. The spilled registers lose all their
+ * links, then the links of the spilled and new registers are added back
+ * from the nodes where they are live. Links between the other registers
+ * can't have changed.
+ */
+static void ig_update_graph(ig_graph_t *ig, bitset_t *spilled) {
+  mcfg_graph_t *cfg = ig->cfg;
+  mcfg_node_t *current;
+  bitset_t *changed;
+  int i, j, n = ig->num_sym_regs, num = cfg->num_vars;
+
+  /*
+   * Grow the IG for the new registers. The triangular links matrix keeps
+   * the existing bits in place as it grows.
+   */
+  ig_grow_graph(ig);
+  bitset_grow(ig->links, ((long)num * (num - 1)) / 2);
+
+  for(i = bitset_next(spilled, 0); i != -1 && i < n;
+      i = bitset_next(spilled, i + 1)) {
+    for(j = 0; j < ig->num_adj[i]; j++) {
+      bitset_clear(ig->links, ig_link_bit(i, ig->adj[i][j]));
+      ig_remove_neighbour(ig, ig->adj[i][j], i);
     }
+
+    free(ig->adj[i]);
+    ig->adj[i] = NULL;
+    ig->num_adj[i] = 0;
   }
 
-  if(!ig_graph->num_sym_regs)
-    return;
+  changed = bitset_new(num);
+  bitset_copy(changed, spilled);
+  for(i = n; i < num; i++)
+    bitset_set(changed, i);
 
-  /* Initialise the links matrix */
-  ig_graph->links = calloc(ig_graph->num_sym_regs, sizeof(int *));
-  for(i = 0; i < ig_graph->num_sym_regs; i++)
-    ig_graph->links[i] = calloc(ig_graph->num_sym_regs, sizeof(int));
+  for(i = 0; i < cfg->num_nodes; i++) {
+    current = cfg->node[i];
 
-  /* Calculate the interferences */
-  for(i = 0; i < cfg_list->num_graphs; i++) {
-    for(l = 0; l < cfg_list->graph[i]->num_nodes; l++) {
-      current = cfg_list->graph[i]->node[l];
+    if(current->type == MCFG_NODE_FUNC_ENTRY &&
+       bitset_intersects(current->live_in, changed))
+      ig_link_live_set(ig, current->live_in);
 
-      /* Add links for def[n] -> out[n] */
-      if(current->var_def && current->num_outs)
-	for(j = 0; j < current->num_outs; j++)
-	  ig_add_link(ig_graph, current->var_def, current->out[j]);
+    if((current->var_def && bitset_test(changed, current->var_def->id)) ||
+       bitset_intersects(current->live_out, changed))
+      ig_link_node(ig, current);
+  }
 
-      /* Find links in the out sets */
-      for(j = 0; j < current->num_outs; j++)
-	for(k = 0; k < current->num_outs; k++)
-	  ig_add_link(ig_graph, current->out[j], current->out[k]);
+  bitset_free(changed);
+}
 
-      /* Find links in the in sets */
-      for(j = 0; j < current->num_ins; j++)
-	for(k = 0; k < current->num_ins; k++)
-	  ig_add_link(ig_graph, current->in[j], current->in[k]);
+/*
+ * Free an interference graph. The symbolic registers belong to the CFG
+ * nodes, so only the arrays are freed.
+ */
+static void ig_free_graph(ig_graph_t *ig_graph) {
+  int i;
 
-    }
-  }
+  for(i = 0; i < ig_graph->num_sym_regs; i++)
+    free(ig_graph->adj[i]);
+  free(ig_graph->adj);
+  free(ig_graph->num_adj);
+  bitset_free(ig_graph->links);
 
-  return ig_graph;
+  free(ig_graph->sym_reg);
+  free(ig_graph);
 }
 
 /*
@@ -1112,24 +2431,25 @@ ig_graph_t *ig_build_graph(mcfg_list_t *cfg_list) {
  * MIR operand. Will return -1 if no symbolic register can be found.
  */
 int ig_sym_reg(ig_graph_t *graph, mir_operand_t *op) {
-  int i;
+  mcfg_var_t key;
 
-  if(op->optype == MIR_OP_CONST)
-    return -1;
+  switch(op->optype) {
+  case MIR_OP_VAR:
+    key.type = MCFG_TYPE_VAR;
+    break;
 
-  for(i = 0; i < graph->num_sym_regs; i++)
-    if(op->optype == MIR_OP_VAR &&
-       graph->sym_reg[i]->type == MCFG_TYPE_VAR &&
-       op->var == graph->sym_reg[i]->var)
-      return i;
+  case MIR_OP_REG:
+    key.type = MCFG_TYPE_REG;
+    break;
 
-    else if(op->optype == MIR_OP_REG &&
-	    graph->sym_reg[i]->type == MCFG_TYPE_REG &&
-	    op->val == graph->sym_reg[i]->reg)
-      return i;
+  default:
+    return -1;
+  }
 
+  key.var = op->var;
+  key.reg = op->val;
 
-  return -1;
+  return mcfg_find_var(graph->cfg, &key);
 }
 
 
@@ -1181,11 +2501,11 @@ void vcg_output_ig(ig_graph_t *ig_graph, char *basename, char *ext) {
 
   /* Edges */
   for(i = 0; i < ig_graph->num_sym_regs; i++)
-    for(j = i + 1; j < ig_graph->num_sym_regs; j++)
-      if(ig_are_linked(ig_graph, ig_graph->sym_reg[i], ig_graph->sym_reg[j]))
+    for(j = 0; j < ig_graph->num_adj[i]; j++)
+      if(ig_graph->adj[i][j] > i)
 	fprintf(fd, "edge: { sourcename:\"%p\" targetname:\"%p\""
 		"arrowstyle: none }\n",
-		ig_graph->sym_reg[i], ig_graph->sym_reg[j]);
+		ig_graph->sym_reg[i], ig_graph->sym_reg[ig_graph->adj[i][j]]);
 
   /* Footer */
   fprintf(fd, "\n}\n");
@@ -10,18 +10,25 @@
 
 #include "symtable.h"
 #include "mir_cfg.h"
+#include "bitset.h"
 
 /*
- * Interference Graph (IG)
+ * Interference Graph (IG). There is one graph per function.
  *
- * The connections are stored as a 2d bitmap
+ * The symbolic registers are the dense variable ids from the CFG. The
+ * connections are stored twice, as a triangular bit matrix for constant
+ * time tests and as a vector of neighbours for each register.
  */
 typedef struct {
+  /* The function this graph was built for */
+  mcfg_graph_t *cfg;
+
   int num_sym_regs;
   mcfg_var_t **sym_reg;
 
-  int **links;
-  int num_links;
+  bitset_t *links;
+  int **adj;
+  int *num_adj;
 } ig_graph_t;
 
 typedef struct adj_node_s {
@@ -33,13 +40,25 @@ typedef struct adj_node_s {
 
   mcfg_var_t *var;
 
+  /* Single definition which can be recomputed at each use if spilled */
+  mir_node_t *remat;
+
+  /* Holds a reloaded value, so must never be spilled itself */
+  int no_spill;
+
+  /* Colours clashing with a hard register use, bit c - 1 for colour c */
+  unsigned int forbidden;
+
   int on_stack;
 
-  int num_adjs;
+  /* Neighbours, and how many of them are not on the stack */
+  int num_nodes;
   int *adj_node;
+  int num_adjs;
 
-  int num_rems;
-  int *rem_node;
+  /* Degree bucket links used while pruning */
+  int prev;
+  int next;
 } adj_node_t;
 
 /* Storage allocation types */
@@ -50,7 +69,7 @@ enum {
 
 
 void vcg_output_ig(ig_graph_t *, char *, char *);
-ig_graph_t *ig_build_graph(mcfg_list_t *);
+ig_graph_t *ig_build_graph(mcfg_graph_t *);
 void allocate_registers(mcfg_list_t *, int);
 int ig_sym_reg(ig_graph_t *graph, mir_operand_t *op);
 
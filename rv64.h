@@ -0,0 +1,87 @@
+/*
+ * rv64.h
+ *
+ * Functions/constants for the RISC-V RV64 backend
+ *
+ */
+#ifndef _RV64_H_
+#define _RV64_H_
+
+/* Integer registers, numbered as in the instruction encoding */
+enum {
+  RV_ZERO,
+  RV_RA,
+  RV_SP,
+  RV_GP,
+  RV_TP,
+  RV_T0,
+  RV_T1,
+  RV_T2,
+  RV_S0,
+  RV_S1,
+  RV_A0,
+  RV_A1,
+  RV_A2,
+  RV_A3,
+  RV_A4,
+  RV_A5,
+  RV_A6,
+  RV_A7,
+  RV_S2,
+  RV_S3,
+  RV_S4,
+  RV_S5,
+  RV_S6,
+  RV_S7,
+  RV_S8,
+  RV_S9,
+  RV_S10,
+  RV_S11,
+  RV_T3,
+  RV_T4,
+  RV_T5,
+  RV_T6,
+
+  RV_NUM_REGS
+};
+
+/*
+ * There are only twelve callee saved registers for the fourteen Sparc
+ * locals and ins, so the last two ins live in word sized slots in the
+ * stack frame, numbered after the hardware registers
+ */
+#define RV_SLOT(n) (RV_NUM_REGS + (n))
+#define RV_NUM_SLOTS 2
+
+/*
+ * %t0 and %t1 are never allocated, and are used as scratch registers.
+ * %t2 holds addresses too far from their base register for an immediate.
+ */
+#define RV_SCRATCH RV_T0
+#define RV_SCRATCH2 RV_T1
+#define RV_ADDR_SCRATCH RV_T2
+
+/* The first eight arguments are passed in %a0-%a7, the rest in 8 bytes */
+#define RV_ARG_REGS 8
+#define RV_ARG_SIZE 8
+#define RV_REG_SIZE 8
+#define RV_STACK_ALIGN 16
+
+/* Signed 12 bit immediates */
+#define RV_MIN_CONST -2048
+#define RV_MAX_CONST 2047
+#define IS_SIMM12(val) ((val) >= RV_MIN_CONST && (val) <= RV_MAX_CONST)
+
+/*
+ * Code is generated for a 32 bit data model, so main runs on a stack in
+ * the bss below 2GB, where addresses are the same sign or zero extended.
+ * The function compiled from main is renamed and called by a small main
+ * which switches stacks.
+ */
+#define RV_STACK_SIZE 0x1000000
+#define RV_STACK_NAME "__hcc_stack"
+#define RV_MAIN_NAME "__hcc_main"
+
+void gen_rv64_code(char *);
+
+#endif /* _RV64_H_ */
@@ -0,0 +1,929 @@
+/*
+ * rv64gen.c
+ *
+ * RISC-V backend code generator. Converts the register allocated MIR for
+ * the Sparc into RV64GC assembly for the standard LP64 calling convention,
+ * so that programs can be run on RISC-V Linux or under qemu-riscv64. The
+ * generated code can be assembled and linked with the host compiler's
+ * rtlib using gcc -static or -no-pie.
+ *
+ * The language has 4 byte ints and pointers, so all arithmetic is done
+ * with the 32 bit word instructions, which keep values sign extended in
+ * the full registers. Globals and strings are linked below 2GB, and main
+ * switches to a stack in the bss.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symtable.h"
+#include "typechk.h"
+#include "scope.h"
+#include "mir.h"
+#include "history.h"
+#include "strings.h"
+#include "cerror.h"
+#include "cflags.h"
+#include "sparc.h"
+#include "rv64.h"
+
+static void rv_scan_func(mir_node_t *);
+static int rv_loc(int);
+static int rv_slot_offset(int);
+static void rv_emit_mem(char *, int, int, int);
+static void rv_emit_li(int, int);
+static void rv_emit_la(int, char *);
+static void rv_emit_mv(int, int);
+static void rv_emit_addi(int, int, int);
+static int rv_ptr(mir_operand_t *, int);
+static int rv_src(mir_operand_t *, int);
+static int rv_dest(mir_operand_t *);
+static void rv_set_dest(mir_operand_t *, int);
+static int rv_log2(unsigned int);
+static void rv_emit_arith(mir_instr_t *);
+static void rv_emit_div(mir_operand_t *, mir_operand_t *, int);
+static void rv_emit_if(mir_node_t *);
+static int rv_arg_src(int);
+static void rv_emit_call(mir_instr_t *);
+static void rv_emit_prologue(void);
+static void rv_emit_epilogue(void);
+static char *rv_func_name(char *);
+static void gen_rv64_instr(mir_node_t *);
+static void gen_rv64_func(mir_node_t **);
+
+extern compiler_options_t cflags;
+extern scope_node_t *global_scope;
+
+static const char *rv_names[RV_NUM_REGS] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+/*
+ * Where each Sparc register handed out by the register allocator lives,
+ * indexed by the Sparc register number. The outs are the argument
+ * registers, so leaf procedures take their arguments where the ABI passes
+ * them. Locals and ins go in the callee saved registers, and so keep their
+ * values across calls, as do the two ins left over in stack slots. The
+ * application globals are clobbered by calls, as the temporaries are.
+ */
+static const int rv_sparc_regs[32] = {
+  -1, -1, RV_T3, RV_T4, RV_T5, -1, -1, -1,
+  RV_A0, RV_A1, RV_A2, RV_A3, RV_A4, RV_A5, -1, -1,
+  RV_S1, RV_S2, RV_S3, RV_S4, RV_S5, RV_S6, RV_S7, RV_S8,
+  RV_S9, RV_S10, RV_S11, RV_S0, RV_SLOT(0), RV_SLOT(1), -1, -1
+};
+
+/* Callee saved registers, in the order they are saved */
+#define RV_NUM_SAVED 12
+static const int rv_callee_saved[RV_NUM_SAVED] = {
+  RV_S0, RV_S1, RV_S2, RV_S3, RV_S4, RV_S5,
+  RV_S6, RV_S7, RV_S8, RV_S9, RV_S10, RV_S11
+};
+
+static FILE *rv_fd;
+static int current_arg, has_main;
+
+/*
+ * The function being generated and its frame. From %sp up the frame holds
+ * the outgoing stack arguments, the locals and spills, the register slots,
+ * slots for the incoming arguments passed in %a6 and %a7, and the saved
+ * registers, with %ra last.
+ */
+static name_record_t *current_func;
+static int frame_size, out_size, slot_base, save_base, num_params;
+static int saved_regs[RV_NUM_SAVED], num_saved, save_ra;
+
+/*
+ * Work out the frame layout of the function starting at a label node
+ */
+static void rv_scan_func(mir_node_t *node) {
+  int used[RV_NUM_REGS], i, j, max_args = RV_ARG_REGS;
+  mir_operand_t *op;
+  mir_instr_t *instr;
+
+  memset(used, 0, sizeof(used));
+  num_params = 0;
+  save_ra = 0;
+
+  for(; node->instruction->opcode != MIR_END; node = node->next) {
+    instr = node->instruction;
+
+    if(instr->opcode == MIR_CALL) {
+      save_ra = 1;
+      if(instr->num_args > max_args)
+	max_args = instr->num_args;
+    }
+    if(instr->opcode == MIR_RECEIVE || instr->opcode == MIR_PUSH_ARG)
+      num_params++;
+
+    for(i = 0; i < 3 + instr->num_args; i++) {
+      op = i < 3 ? instr->operand[i] : instr->args[i - 3];
+      if(op && op->optype == MIR_OP_REG) {
+	j = rv_sparc_regs[sparc_reg_number(op->val)];
+	if(j >= 0 && j < RV_NUM_REGS)
+	  used[j] = 1;
+      }
+    }
+  }
+
+  /* Leaf procedures run without a frame */
+  if(current_func->func_leaf) {
+    frame_size = out_size = slot_base = save_base = num_saved = 0;
+    return;
+  }
+
+  /* Each in is written when the function is entered */
+  for(i = 0; i < num_params && i < REG_ARGS; i++) {
+    j = rv_sparc_regs[SPARC_INS + i];
+    if(j < RV_NUM_REGS)
+      used[j] = 1;
+  }
+
+  num_saved = 0;
+  for(i = 0; i < RV_NUM_SAVED; i++)
+    if(used[rv_callee_saved[i]])
+      saved_regs[num_saved++] = rv_callee_saved[i];
+
+  out_size = (max_args - RV_ARG_REGS) * RV_ARG_SIZE;
+  slot_base = out_size +
+    align(max_scope_size(get_func_scope(current_func->name)));
+  save_base = align(slot_base + ((RV_NUM_SLOTS + RV_ARG_REGS - REG_ARGS) *
+				 WORD_SIZE));
+
+  frame_size = save_base + ((num_saved + save_ra) * RV_REG_SIZE);
+  if(frame_size % RV_STACK_ALIGN != 0)
+    frame_size += RV_STACK_ALIGN - (frame_size % RV_STACK_ALIGN);
+}
+
+/*
+ * Return the hardware register or register slot of an allocated register
+ */
+static int rv_loc(int reg) {
+  int hw = rv_sparc_regs[sparc_reg_number(reg)];
+
+  if(hw < 0)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Invalid allocated register %d\n", reg);
+
+  return hw;
+}
+
+static int rv_slot_offset(int slot) {
+  return slot_base + ((slot - RV_NUM_REGS) * WORD_SIZE);
+}
+
+/*
+ * Emit a load or store. Offsets which don't fit in an immediate are added
+ * to the base in the address scratch register.
+ */
+static void rv_emit_mem(char *op, int reg, int base, int offset) {
+  if(!IS_SIMM12(offset)) {
+    rv_emit_li(RV_ADDR_SCRATCH, offset);
+    fprintf(rv_fd, "\tadd\t%s, %s, %s\n", rv_names[RV_ADDR_SCRATCH],
+	    rv_names[RV_ADDR_SCRATCH], rv_names[base]);
+    base = RV_ADDR_SCRATCH;
+    offset = 0;
+  }
+
+  fprintf(rv_fd, "\t%s\t%s, %d(%s)\n", op, rv_names[reg], offset,
+	  rv_names[base]);
+}
+
+/*
+ * Load a constant. Anything outside 12 bits is built with lui and addiw,
+ * which sign extend the word.
+ */
+static void rv_emit_li(int reg, int val) {
+  int hi, lo;
+
+  if(IS_SIMM12(val)) {
+    fprintf(rv_fd, "\taddi\t%s, zero, %d\n", rv_names[reg], val);
+    return;
+  }
+
+  lo = ((val & 0xfff) ^ 0x800) - 0x800;
+  hi = (int)(((unsigned int)val - (unsigned int)lo) >> 12) & 0xfffff;
+
+  fprintf(rv_fd, "\tlui\t%s, %d\n", rv_names[reg], hi);
+  if(lo)
+    fprintf(rv_fd, "\taddiw\t%s, %s, %d\n", rv_names[reg], rv_names[reg], lo);
+}
+
+/*
+ * Load the address of a symbol, which is linked below 2GB
+ */
+static void rv_emit_la(int reg, char *sym) {
+  fprintf(rv_fd, "\tlui\t%s, %%hi(%s)\n", rv_names[reg], sym);
+  fprintf(rv_fd, "\taddi\t%s, %s, %%lo(%s)\n", rv_names[reg], rv_names[reg],
+	  sym);
+}
+
+static void rv_emit_mv(int dest, int src) {
+  if(dest != src)
+    fprintf(rv_fd, "\tmv\t%s, %s\n", rv_names[dest], rv_names[src]);
+}
+
+/*
+ * Add a constant to a 64 bit base register, such as %sp
+ */
+static void rv_emit_addi(int dest, int src, int val) {
+  if(IS_SIMM12(val)) {
+    fprintf(rv_fd, "\taddi\t%s, %s, %d\n", rv_names[dest], rv_names[src],
+	    val);
+    return;
+  }
+
+  rv_emit_li(RV_ADDR_SCRATCH, val);
+  fprintf(rv_fd, "\tadd\t%s, %s, %s\n", rv_names[dest], rv_names[src],
+	  rv_names[RV_ADDR_SCRATCH]);
+}
+
+/*
+ * Return the register holding a MIR operand used as a pointer. Pointers in
+ * register slots and constant addresses are loaded into reg.
+ */
+static int rv_ptr(mir_operand_t *op, int reg) {
+  int loc;
+
+  if(op->optype == MIR_OP_CONST) {
+    rv_emit_li(reg, op->val);
+    return reg;
+  }
+
+  loc = rv_loc(op->val);
+  if(loc < RV_NUM_REGS)
+    return loc;
+
+  rv_emit_mem("lw", reg, RV_SP, rv_slot_offset(loc));
+  return reg;
+}
+
+/*
+ * Return the register holding the value of a MIR operand, loading it into
+ * reg if it isn't in a register already
+ */
+static int rv_src(mir_operand_t *op, int reg) {
+  int loc;
+
+  switch(op->optype) {
+  case MIR_OP_VAR:
+    rv_emit_mem("lw", reg, RV_SP, out_size + op->var->offset);
+    return reg;
+
+  case MIR_OP_CONST:
+    if(!op->val)
+      return RV_ZERO;
+    rv_emit_li(reg, op->val);
+    return reg;
+
+  case MIR_OP_REG:
+  default:
+    if(op->indirect) {
+      rv_emit_mem("lw", reg, rv_ptr(op, reg), 0);
+      return reg;
+    }
+
+    loc = rv_loc(op->val);
+    if(loc < RV_NUM_REGS)
+      return loc;
+
+    rv_emit_mem("lw", reg, RV_SP, rv_slot_offset(loc));
+    return reg;
+  }
+}
+
+/*
+ * Return the register to compute a MIR operand into. Anything other than
+ * a hardware register is computed into the scratch register, then written
+ * by rv_set_dest.
+ */
+static int rv_dest(mir_operand_t *op) {
+  int loc;
+
+  if(op->optype == MIR_OP_REG && !op->indirect) {
+    loc = rv_loc(op->val);
+    if(loc < RV_NUM_REGS)
+      return loc;
+  }
+
+  return RV_SCRATCH;
+}
+
+static void rv_set_dest(mir_operand_t *op, int reg) {
+  int loc;
+
+  switch(op->optype) {
+  case MIR_OP_VAR:
+    rv_emit_mem("sw", reg, RV_SP, out_size + op->var->offset);
+    break;
+
+  case MIR_OP_REG:
+    if(op->indirect) {
+      rv_emit_mem("sw", reg, rv_ptr(op, RV_SCRATCH2), 0);
+      break;
+    }
+
+    loc = rv_loc(op->val);
+    if(loc < RV_NUM_REGS)
+      rv_emit_mv(loc, reg);
+    else
+      rv_emit_mem("sw", reg, RV_SP, rv_slot_offset(loc));
+    break;
+
+  default:
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Cannot assign to a constant\n");
+  }
+}
+
+/*
+ * Return log2 of a power of two, or -1
+ */
+static int rv_log2(unsigned int val) {
+  int shift = 0;
+
+  if(!val || (val & (val - 1)))
+    return -1;
+
+  while(val >>= 1)
+    shift++;
+
+  return shift;
+}
+
+/*
+ * Emit an arithmetic instruction. Constants are normally the second
+ * operand, but the register allocator can rematerialise them into either.
+ */
+static void rv_emit_arith(mir_instr_t *instr) {
+  mir_operand_t *a = instr->operand[0], *b = instr->operand[1], *t;
+  int dest = rv_dest(instr->operand[2]), src1, src2, val, shift;
+  char *op;
+
+  if(a->optype == MIR_OP_CONST && b->optype == MIR_OP_CONST &&
+     mir_fold_eval(instr->opcode, a->val, b->val, &val)) {
+    rv_emit_li(dest, val);
+    rv_set_dest(instr->operand[2], dest);
+    return;
+  }
+
+  if(instr->opcode == MIR_DIV) {
+    rv_emit_div(a, b, dest);
+    rv_set_dest(instr->operand[2], dest);
+    return;
+  }
+
+  /* Keep constants second for commutative instructions */
+  if(instr->opcode != MIR_SUB && a->optype == MIR_OP_CONST) {
+    t = a;
+    a = b;
+    b = t;
+  }
+
+  src1 = rv_src(a, RV_SCRATCH);
+
+  /* Small constants are immediates, and multiplies by powers of two shifts */
+  if(b->optype == MIR_OP_CONST) {
+    val = instr->opcode == MIR_SUB ? -b->val : b->val;
+
+    if(instr->opcode != MIR_MUL && IS_SIMM12(val)) {
+      fprintf(rv_fd, "\taddiw\t%s, %s, %d\n", rv_names[dest], rv_names[src1],
+	      val);
+      rv_set_dest(instr->operand[2], dest);
+      return;
+    }
+
+    if(instr->opcode == MIR_MUL && (shift = rv_log2(b->val)) >= 0) {
+      if(shift)
+	fprintf(rv_fd, "\tslliw\t%s, %s, %d\n", rv_names[dest],
+		rv_names[src1], shift);
+      else
+	rv_emit_mv(dest, src1);
+      rv_set_dest(instr->operand[2], dest);
+      return;
+    }
+  }
+
+  switch(instr->opcode) {
+  case MIR_SUB: op = "subw"; break;
+  case MIR_MUL: op = "mulw"; break;
+  case MIR_ADD:
+  default: op = "addw"; break;
+  }
+
+  src2 = rv_src(b, RV_SCRATCH2);
+  fprintf(rv_fd, "\t%s\t%s, %s, %s\n", op, rv_names[dest], rv_names[src1],
+	  rv_names[src2]);
+  rv_set_dest(instr->operand[2], dest);
+}
+
+/*
+ * Emit a signed divide. Positive powers of two are shifted, rounding towards
+ * zero.
+ */
+static void rv_emit_div(mir_operand_t *a, mir_operand_t *b, int dest) {
+  int src1, src2, shift;
+
+  src1 = rv_src(a, RV_SCRATCH);
+
+  if(b->optype == MIR_OP_CONST && (b->val == 1 || b->val == -1)) {
+    if(b->val == -1)
+      fprintf(rv_fd, "\tsubw\t%s, zero, %s\n", rv_names[dest],
+	      rv_names[src1]);
+    else
+      rv_emit_mv(dest, src1);
+    return;
+  }
+
+  if(b->optype == MIR_OP_CONST && b->val > 0 &&
+     (shift = rv_log2(b->val)) > 0) {
+    if(shift > 1) {
+      fprintf(rv_fd, "\tsraiw\t%s, %s, 31\n", rv_names[RV_SCRATCH2],
+	      rv_names[src1]);
+      fprintf(rv_fd, "\tsrliw\t%s, %s, %d\n", rv_names[RV_SCRATCH2],
+	      rv_names[RV_SCRATCH2], 32 - shift);
+    } else
+      fprintf(rv_fd, "\tsrliw\t%s, %s, 31\n", rv_names[RV_SCRATCH2],
+	      rv_names[src1]);
+    fprintf(rv_fd, "\taddw\t%s, %s, %s\n", rv_names[RV_SCRATCH],
+	    rv_names[src1], rv_names[RV_SCRATCH2]);
+    fprintf(rv_fd, "\tsraiw\t%s, %s, %d\n", rv_names[dest],
+	    rv_names[RV_SCRATCH], shift);
+    return;
+  }
+
+  src2 = rv_src(b, RV_SCRATCH2);
+  fprintf(rv_fd, "\tdivw\t%s, %s, %s\n", rv_names[dest], rv_names[src1],
+	  rv_names[src2]);
+}
+
+/*
+ * Emit a conditional branch. Comparisons between constants are decided
+ * here. There are only branches for equality, less than and greater or
+ * equal, so greater than and less or equal swap their operands.
+ */
+static void rv_emit_if(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  mir_operand_t *a = instr->operand[0], *b = instr->operand[1];
+  int relop = instr->operand[2] ? instr->operand[2]->val : -1, val;
+  int src1, src2, t;
+  char *branch = "beq";
+
+  if(a->optype == MIR_OP_CONST && (relop < 0 || b->optype == MIR_OP_CONST)) {
+    if(relop < 0)
+      val = !a->val;
+    else
+      switch(relop) {
+      case MIR_NEQ: val = a->val != b->val; break;
+      case MIR_LSS: val = a->val < b->val; break;
+      case MIR_LEQ: val = a->val <= b->val; break;
+      case MIR_GTR: val = a->val > b->val; break;
+      case MIR_GEQ: val = a->val >= b->val; break;
+      case MIR_EQL:
+      default: val = a->val == b->val; break;
+      }
+
+    if(val)
+      fprintf(rv_fd, "\tj\t.L%s\n", node->jump->instruction->label);
+    return;
+  }
+
+  src1 = rv_src(a, RV_SCRATCH);
+  src2 = relop < 0 ? RV_ZERO : rv_src(b, RV_SCRATCH2);
+
+  switch(relop) {
+  case MIR_NEQ: branch = "bne"; break;
+  case MIR_LSS: branch = "blt"; break;
+  case MIR_GEQ: branch = "bge"; break;
+  case MIR_GTR:
+  case MIR_LEQ:
+    branch = relop == MIR_GTR ? "blt" : "bge";
+    t = src1;
+    src1 = src2;
+    src2 = t;
+    break;
+  }
+
+  fprintf(rv_fd, "\t%s\t%s, %s, .L%s\n", branch, rv_names[src1],
+	  rv_names[src2], node->jump->instruction->label);
+}
+
+/*
+ * Return the register holding an incoming argument, loading arguments
+ * passed on the stack into the scratch register
+ */
+static int rv_arg_src(int arg) {
+  int loc;
+
+  if(arg >= RV_ARG_REGS) {
+    rv_emit_mem("lw", RV_SCRATCH, RV_SP,
+		frame_size + ((arg - RV_ARG_REGS) * RV_ARG_SIZE));
+    return RV_SCRATCH;
+  }
+
+  /* %a6 and %a7 are saved on entry, unless the function makes no calls */
+  if(arg >= REG_ARGS) {
+    if(current_func->func_leaf)
+      return RV_A0 + arg;
+
+    rv_emit_mem("lw", RV_SCRATCH, RV_SP, slot_base +
+		((RV_NUM_SLOTS + arg - REG_ARGS) * WORD_SIZE));
+    return RV_SCRATCH;
+  }
+
+  loc = rv_sparc_regs[(current_func->func_leaf ? SPARC_OUTS : SPARC_INS) +
+		      arg];
+  if(loc < RV_NUM_REGS)
+    return loc;
+
+  rv_emit_mem("lw", RV_SCRATCH, RV_SP, rv_slot_offset(loc));
+  return RV_SCRATCH;
+}
+
+/*
+ * Emit a call. Arguments past the eighth are passed in 8 byte stack slots.
+ */
+static void rv_emit_call(mir_instr_t *instr) {
+  int i, src;
+
+  for(i = RV_ARG_REGS; i < instr->num_args; i++) {
+    src = rv_src(instr->args[i], RV_SCRATCH);
+    rv_emit_mem("sd", src, RV_SP, (i - RV_ARG_REGS) * RV_ARG_SIZE);
+  }
+
+  for(i = 0; i < instr->num_args && i < RV_ARG_REGS; i++) {
+    src = rv_src(instr->args[i], RV_A0 + i);
+    rv_emit_mv(RV_A0 + i, src);
+  }
+
+  fprintf(rv_fd, "\tcall\t%s\n", rv_func_name(instr->operand[0]->var->name));
+
+  /* Return value */
+  if(instr->operand[2])
+    rv_set_dest(instr->operand[2], RV_A0);
+}
+
+/*
+ * Emit the frame setup for the current function
+ */
+static void rv_emit_prologue(void) {
+  int i, loc;
+
+  if(frame_size)
+    rv_emit_addi(RV_SP, RV_SP, -frame_size);
+
+  for(i = 0; i < num_saved; i++)
+    rv_emit_mem("sd", saved_regs[i], RV_SP, save_base + (i * RV_REG_SIZE));
+  if(save_ra)
+    rv_emit_mem("sd", RV_RA, RV_SP, save_base + (num_saved * RV_REG_SIZE));
+
+  if(current_func->func_leaf)
+    return;
+
+  /* Each in holds its incoming argument until it is received */
+  for(i = 0; i < num_params && i < RV_ARG_REGS; i++) {
+    if(i >= REG_ARGS) {
+      rv_emit_mem("sw", RV_A0 + i, RV_SP, slot_base +
+		  ((RV_NUM_SLOTS + i - REG_ARGS) * WORD_SIZE));
+      continue;
+    }
+
+    loc = rv_sparc_regs[SPARC_INS + i];
+    if(loc < RV_NUM_REGS)
+      rv_emit_mv(loc, RV_A0 + i);
+    else
+      rv_emit_mem("sw", RV_A0 + i, RV_SP, rv_slot_offset(loc));
+  }
+}
+
+/*
+ * Emit the return from the current function
+ */
+static void rv_emit_epilogue(void) {
+  int i;
+
+  for(i = 0; i < num_saved; i++)
+    rv_emit_mem("ld", saved_regs[i], RV_SP, save_base + (i * RV_REG_SIZE));
+  if(save_ra)
+    rv_emit_mem("ld", RV_RA, RV_SP, save_base + (num_saved * RV_REG_SIZE));
+
+  if(frame_size)
+    rv_emit_addi(RV_SP, RV_SP, frame_size);
+  fprintf(rv_fd, "\tret\n");
+}
+
+/*
+ * Return the assembler name of a function
+ */
+static char *rv_func_name(char *name) {
+  return strcmp(name, "main") ? name : RV_MAIN_NAME;
+}
+
+/*
+ * Lower a single MIR instruction to machine instructions, not including
+ * its label
+ */
+static void gen_rv64_instr(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  mir_operand_t *dest = instr->operand[2];
+  char *name;
+  int reg, src;
+
+  switch(instr->opcode) {
+  case MIR_NOP:
+    break;
+
+  case MIR_LABEL:
+    /* Function header */
+    current_arg = 0;
+    current_func = get_func_entry(instr->label);
+    rv_scan_func(node);
+
+    name = rv_func_name(current_func->name);
+    if(name == current_func->name)
+      fprintf(rv_fd, "\t.globl %s\n", name);
+    else
+      has_main = 1;
+    fprintf(rv_fd, "\t.align 2\n");
+    fprintf(rv_fd, "\t.type %s, @function\n%s:\n", name, name);
+    rv_emit_prologue();
+    break;
+
+  case MIR_ADDR:
+    reg = rv_dest(dest);
+    if(instr->operand[0]->optype == MIR_OP_VAR)
+      rv_emit_addi(reg, RV_SP, out_size + instr->operand[0]->var->offset);
+    else
+      rv_emit_mem("lw", reg, rv_ptr(instr->operand[0], reg), 0);
+    rv_set_dest(dest, reg);
+    break;
+
+  case MIR_STACK_ADDR:
+    reg = rv_dest(dest);
+    rv_emit_addi(reg, RV_SP, out_size + instr->operand[0]->val);
+    rv_set_dest(dest, reg);
+    break;
+
+  case MIR_MOVE:
+    reg = rv_dest(dest);
+    rv_emit_mv(reg, rv_src(instr->operand[0], reg));
+    rv_set_dest(dest, reg);
+    break;
+
+  case MIR_ADD:
+  case MIR_SUB:
+  case MIR_MUL:
+  case MIR_DIV:
+    rv_emit_arith(instr);
+    break;
+
+  case MIR_JUMP:
+    fprintf(rv_fd, "\tj\t.L%s\n", node->jump->instruction->label);
+    break;
+
+  case MIR_IF:
+    rv_emit_if(node);
+    break;
+
+  case MIR_LOAD_STRING:
+    name = malloc(20);
+    sprintf(name, ".Lstring%d", instr->operand[0]->val);
+    reg = rv_dest(dest);
+    rv_emit_la(reg, name);
+    rv_set_dest(dest, reg);
+    free(name);
+    break;
+
+  case MIR_REG_LOAD:
+    reg = rv_dest(dest);
+    rv_emit_mem("lw", reg, rv_ptr(instr->operand[0], reg), 0);
+    rv_set_dest(dest, reg);
+    break;
+
+  case MIR_HEAP_LOAD:
+    reg = rv_dest(dest);
+    name = instr->operand[0]->var->name;
+    fprintf(rv_fd, "\tlui\t%s, %%hi(%s)\n", rv_names[RV_ADDR_SCRATCH], name);
+    fprintf(rv_fd, "\tlw\t%s, %%lo(%s)(%s)\n", rv_names[reg], name,
+	    rv_names[RV_ADDR_SCRATCH]);
+    rv_set_dest(dest, reg);
+    break;
+
+  case MIR_HEAP_ADDR:
+    reg = rv_dest(dest);
+    if(instr->operand[0]->optype == MIR_OP_VAR)
+      rv_emit_la(reg, instr->operand[0]->var->name);
+    else if(instr->operand[0]->optype == MIR_OP_CONST)
+      rv_emit_li(reg, instr->operand[0]->val);
+    else
+      compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		     "Cannot take the heap address of a register\n");
+    rv_set_dest(dest, reg);
+    break;
+
+  case MIR_STACK_LOAD:
+    reg = rv_dest(dest);
+    rv_emit_mem("lw", reg, RV_SP, out_size + instr->operand[0]->val);
+    rv_set_dest(dest, reg);
+    break;
+
+  case MIR_REG_STORE:
+    src = rv_src(instr->operand[0], RV_SCRATCH);
+    rv_emit_mem("sw", src, rv_ptr(dest, RV_SCRATCH2), 0);
+    break;
+
+  case MIR_STACK_STORE:
+    src = rv_src(instr->operand[0], RV_SCRATCH);
+    rv_emit_mem("sw", src, RV_SP, out_size + dest->val);
+    break;
+
+  case MIR_HEAP_STORE:
+    /* The address register the Sparc needs isn't used */
+    src = rv_src(instr->operand[0], RV_SCRATCH);
+    name = dest->var->name;
+    fprintf(rv_fd, "\tlui\t%s, %%hi(%s)\n", rv_names[RV_ADDR_SCRATCH], name);
+    fprintf(rv_fd, "\tsw\t%s, %%lo(%s)(%s)\n", rv_names[src], name,
+	    rv_names[RV_ADDR_SCRATCH]);
+    break;
+
+  case MIR_RECEIVE:
+  case MIR_PUSH_ARG:
+    src = rv_arg_src(current_arg++);
+
+    if(instr->opcode == MIR_RECEIVE)
+      rv_set_dest(dest, src);
+    else
+      rv_emit_mem("sw", src, RV_SP, out_size + dest->val);
+    break;
+
+  case MIR_CALL:
+    rv_emit_call(instr);
+    break;
+
+  case MIR_RETURN:
+    if(instr->operand[0])
+      rv_emit_mv(RV_A0, rv_src(instr->operand[0], RV_A0));
+    rv_emit_epilogue();
+    break;
+
+  case MIR_END:
+    /* Function footer */
+    if(node->prev->instruction->opcode != MIR_RETURN)
+      rv_emit_epilogue();
+
+    name = rv_func_name(current_func->name);
+    fprintf(rv_fd, "\t.size %s, .-%s\n\n", name, name);
+    break;
+  }
+}
+
+/*
+ * Generate RISC-V code for a function
+ */
+static void gen_rv64_func(mir_node_t **node) {
+  mir_instr_t *instr;
+  int done = 0;
+
+  current_func = NULL;
+
+  while(*node && !done) {
+    instr = (*node)->instruction;
+
+    if(instr->opcode != MIR_LABEL && instr->label)
+      fprintf(rv_fd, ".L%s:\n", instr->label);
+
+    gen_rv64_instr(*node);
+
+    done = instr->opcode == MIR_END;
+    *node = (*node)->next;
+  }
+}
+
+/*
+ * Generate RV64 code from IC code
+ */
+void gen_rv64_code(char *basename) {
+  mir_node_t *current;
+  name_record_t *record, *cur_var, *ptr_var;
+  char *name;
+  int i;
+
+  char *filename = malloc(strlen(basename) + 3);
+  sprintf(filename, "%s.s", basename);
+
+  if(cflags.flags & CFLAG_OUTPUT_OBJECT) {
+    compiler_error(CERROR_WARN, CERROR_NO_LINE,
+		   "Objects are only written for the Sparc, writing "
+		   "assembly\n");
+    cflags.flags &= ~CFLAG_OUTPUT_OBJECT;
+  }
+
+  if(cflags.flags & CFLAG_OUTPUT_STABS) {
+    compiler_error(CERROR_WARN, CERROR_NO_LINE,
+		   "Debug symbols are only written for the Sparc\n");
+    cflags.flags &= ~CFLAG_OUTPUT_STABS;
+  }
+
+  if(!(rv_fd = fopen(filename, "w")))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Cannot open file %s for writing\n", filename);
+
+  /* Header */
+  fprintf(rv_fd, "\t.file \"%s.hc\"\n", basename);
+  fprintf(rv_fd, "\t.option nopic\n");
+
+  /* Read-only data. Strings */
+  if(num_strings()) {
+    fprintf(rv_fd, "\t.section .rodata\n");
+    for(i = 0; i < num_strings(); i++)
+      fprintf(rv_fd, ".Lstring%d:\t.asciz \"%s\"\n", i,
+	      get_string_literal(i)->string);
+  }
+
+  /* BSS (Unitialised data) Segment */
+  fprintf(rv_fd, "\t.bss\n");
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+
+    if(record->type_info->decl_type != TYPE_FUNCTION &&
+       !is_history_type(record->type_info) && record->name[0] != '.')
+      fprintf(rv_fd, "\t.comm %s, %d, %d\n", record->name,
+	      sizeof_type(record->type_info), WORD_SIZE);
+  }
+
+  /* Data (initialised) segment, for global history variables */
+  fprintf(rv_fd, "\t.data\n");
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+    if(!is_history_type(record->type_info))
+      continue;
+
+    fprintf(rv_fd, "\t.align 2\n");
+    fprintf(rv_fd, "\t.type %s, @object\n", record->name);
+    fprintf(rv_fd, "\t.size %s, %d\n", record->name,
+	    sizeof_type(record->type_info) + sizeof_history(record->type_info));
+    fprintf(rv_fd, "%s:\n", record->name);
+    fprintf(rv_fd, "\t.word 0\n");
+    fprintf(rv_fd, "\t.skip %d\n\n", sizeof_history(record->type_info));
+
+    if(!(cflags.flags & CFLAG_HISTORY_SIMPLE_STORE &&
+	 get_history_depth(record->type_info) < cflags.history_simple_depth)) {
+
+      /* Current value */
+      cur_var = history_current_entry(record);
+
+      fprintf(rv_fd, "\t.align 2\n");
+      fprintf(rv_fd, "\t.type %s, @object\n", cur_var->name);
+      fprintf(rv_fd, "\t.size %s, %d\n", cur_var->name,
+	      sizeof_type(cur_var->type_info));
+      fprintf(rv_fd, "%s:\n", cur_var->name);
+      fprintf(rv_fd, "\t.word 0\n\n");
+
+      /* Pointer */
+      ptr_var = history_ptr_entry(record);
+
+      fprintf(rv_fd, "\t.align 2\n");
+      fprintf(rv_fd, "\t.type %s, @object\n", ptr_var->name);
+      fprintf(rv_fd, "\t.size %s, %d\n", ptr_var->name,
+	      sizeof_type(ptr_var->type_info));
+      fprintf(rv_fd, "%s:\n", ptr_var->name);
+      fprintf(rv_fd, "\t.word %s\n\n", record->name);
+    }
+  }
+
+  /* Text Segment */
+  fprintf(rv_fd, "\t.text\n");
+
+  has_main = 0;
+  current = mir_list_head();
+  for(i = 0; i < num_def_functions(); i++)
+    gen_rv64_func(&current);
+
+  /* Run main on a stack below 2GB, %s1 keeps the old stack pointer */
+  if(has_main) {
+    fprintf(rv_fd, "\t.local %s\n", RV_STACK_NAME);
+    fprintf(rv_fd, "\t.comm %s, %d, %d\n", RV_STACK_NAME, RV_STACK_SIZE,
+	    RV_STACK_ALIGN);
+    fprintf(rv_fd, "\t.globl main\n\t.align 2\n");
+    fprintf(rv_fd, "\t.type main, @function\nmain:\n");
+    fprintf(rv_fd, "\taddi\tsp, sp, -16\n");
+    fprintf(rv_fd, "\tsd\tra, 8(sp)\n\tsd\ts1, 0(sp)\n\tmv\ts1, sp\n");
+    name = malloc(strlen(RV_STACK_NAME) + 12);
+    sprintf(name, "%s+%d", RV_STACK_NAME, RV_STACK_SIZE);
+    rv_emit_la(RV_SP, name);
+    free(name);
+    fprintf(rv_fd, "\tcall\t%s\n", RV_MAIN_NAME);
+    fprintf(rv_fd, "\tmv\tsp, s1\n\tld\ts1, 0(sp)\n\tld\tra, 8(sp)\n");
+    fprintf(rv_fd, "\taddi\tsp, sp, 16\n\tret\n");
+    fprintf(rv_fd, "\t.size main, .-main\n\n");
+  }
+
+  /* Footer */
+  fprintf(rv_fd, "\t.ident \"HCC: History Capable Compiler\"\n");
+  fprintf(rv_fd, "\t.section .note.GNU-stack,\"\",@progbits\n");
+  fclose(rv_fd);
+  free(filename);
+}
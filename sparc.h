@@ -14,6 +14,37 @@
 #define SPARC_LOCALS 16
 #define SPARC_INS 24
 
+/*
+ * Register classes, in hardware order so that a register's class is its
+ * number divided by 8. Locals and ins are preserved across calls by the
+ * register window, but each in holds an incoming argument until it has
+ * been received. Outs and the application globals are clobbered by calls.
+ */
+enum {
+  SPARC_REG_GLOBAL,
+  SPARC_REG_OUT,
+  SPARC_REG_LOCAL,
+  SPARC_REG_IN
+};
+
+/* Number of registers the register allocator can hand out */
+#define SPARC_ALLOC_REGS 23
+
+/* Hardware registers with a fixed use */
+#define SPARC_G0 0
+#define SPARC_SCRATCH 1
+#define SPARC_SP 14
+#define SPARC_O7 15
+#define SPARC_FP 30
+#define SPARC_I7 31
+
+/*
+ * A second scratch register for the rare stores which need two. %o7 is
+ * free outside calls in functions with a frame, and leaf procedures don't
+ * use the stack.
+ */
+#define SPARC_SCRATCH2 SPARC_O7
+
 #define STACK_HEADER_SIZE 112
 #define STACK_ALIGN 8
 #define STACK_LOCAL_BASE 96
@@ -22,7 +53,6 @@
 /* GCC does it this way, so we follow that */
 #define STACK_FP_BASE 20
 
-#define LOCAL_PREFIX "%l"
 #define SP_PREFIX "%sp"
 #define FP_PREFIX "%fp"
 #define SCRATCH_REG "%g1"
@@ -30,13 +60,146 @@
 /* Maximum number of args that can be passed in registers */
 #define REG_ARGS 6
 
+/* Signed 13 bit immediates */
+#define MIN_CONST -4096
 #define MAX_CONST 4095
-#define CONST_BITS 12
-#define LOW_BIT_MASK  0x00000fff
-#define HIGH_BIT_MASK 0xfffff000
+#define IS_SIMM13(val) ((val) >= MIN_CONST && (val) <= MAX_CONST)
+
+/* Bits below those set by sethi */
+#define SETHI_LOW_MASK 0x3ff
+
+/* Machine instructions */
+enum {
+  SPARC_LABEL,
+  SPARC_LINE,
+  SPARC_NOP,
+  SPARC_MOV,
+  SPARC_ADD,
+  SPARC_SUB,
+  SPARC_SMUL,
+  SPARC_SDIV,
+  SPARC_OR,
+  SPARC_SLL,
+  SPARC_SRL,
+  SPARC_SRA,
+  SPARC_NEG,
+  SPARC_SETHI,
+  SPARC_LD,
+  SPARC_ST,
+  SPARC_CMP,
+  SPARC_RD,
+  SPARC_WR,
+  SPARC_BA,
+  SPARC_BE,
+  SPARC_BNE,
+  SPARC_BL,
+  SPARC_BLE,
+  SPARC_BG,
+  SPARC_BGE,
+  SPARC_CALL,
+  SPARC_RET,
+  SPARC_RETL,
+  SPARC_SAVE,
+  SPARC_RESTORE,
+  SPARC_NUM_OPS
+};
+
+/* Machine instruction properties */
+enum {
+  SPARC_F_PSEUDO = 0x1,
+  SPARC_F_BRANCH = 0x2,
+  SPARC_F_COND = 0x4,
+  SPARC_F_SETCC = 0x8,
+  SPARC_F_LOAD = 0x10,
+  SPARC_F_STORE = 0x20,
+  SPARC_F_PURE = 0x40,
+  SPARC_F_SETY = 0x80,
+  SPARC_F_USEY = 0x100
+};
+
+typedef struct {
+  char *name;
+
+  /* The operand written, or -1 */
+  int dest;
+  int flags;
+} sparc_op_info_t;
+
+/* Machine operand types */
+enum {
+  SPARC_OP_REG,
+  SPARC_OP_IMM,
+  SPARC_OP_HI,
+  SPARC_OP_LO,
+  SPARC_OP_MEM,
+  SPARC_OP_SYM,
+  SPARC_OP_LABEL,
+  SPARC_OP_Y
+};
+
+/*
+ * Operands are a hardware register, an immediate, %hi/%lo of a symbol or
+ * value, a memory address [reg + index], [reg + val] or [reg + %lo(sym)],
+ * a symbol, a local label plus an offset or the %y register used by
+ * multiply and divide.
+ */
+typedef struct sparc_operand_s {
+  int type;
+  int reg;
+  int index;
+  int val;
+  char *sym;
+} sparc_operand_t;
+
+typedef struct sparc_instr_s {
+  int op;
+  sparc_operand_t *operand[3];
+
+  /* Annulled delay slot, and the register arguments for calls */
+  int annul;
+  int num_args;
+
+  /* Position in the function, for the optimisation passes */
+  int id;
+
+  struct sparc_instr_s *prev;
+  struct sparc_instr_s *next;
+} sparc_instr_t;
+
+extern const sparc_op_info_t sparc_ops[SPARC_NUM_OPS];
+
+sparc_operand_t *sparc_reg(int);
+sparc_operand_t *sparc_imm(int);
+sparc_operand_t *sparc_hi(char *, int);
+sparc_operand_t *sparc_lo(char *, int);
+sparc_operand_t *sparc_mem(int, int);
+sparc_operand_t *sparc_mem_index(int, int);
+sparc_operand_t *sparc_sym(char *);
+sparc_operand_t *sparc_label(char *);
+sparc_operand_t *sparc_y(void);
+sparc_operand_t *sparc_copy_operand(sparc_operand_t *);
+sparc_instr_t *sparc_new_instr(int, sparc_operand_t *, sparc_operand_t *,
+			       sparc_operand_t *);
+sparc_instr_t *sparc_copy_instr(sparc_instr_t *);
+void sparc_insert_after(sparc_instr_t *, sparc_instr_t *);
+void sparc_unlink_instr(sparc_instr_t *);
+void sparc_free_instr(sparc_instr_t *);
+
+/* Machine level optimisations */
+void sparc_optimise(sparc_instr_t *);
+
+/* ELF object output */
+void elf_begin(char *);
+void elf_string(char *);
+void elf_common(char *, int, int);
+void elf_object(char *, int, int, char *);
+void elf_func(char *, sparc_instr_t *);
+void elf_end(char *);
 
 int fp_offset(int, int, int);
 int sp_offset(int, int);
 int align(int);
+int sparc_reg_number(int);
+int sparc_reg_class(int);
 
 #endif /* _SPARC_H_ */
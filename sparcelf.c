@@ -0,0 +1,811 @@
+/*
+ * sparcelf.c
+ *
+ * Writes the Sparc backend's output as a relocatable ELF32 object, rather
+ * than assembly for gas. Functions are encoded from the machine instruction
+ * lists, with branches to local labels resolved here and references to
+ * symbols left as relocations for the linker.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cerror.h"
+#include "sparc.h"
+
+/* ELF constants, from the System V ABI */
+#define ET_REL 1
+#define EM_SPARC 2
+#define EV_CURRENT 1
+#define ELFCLASS32 1
+#define ELFDATA2MSB 2
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHT_NOBITS 8
+
+#define SHF_WRITE 0x1
+#define SHF_ALLOC 0x2
+#define SHF_EXECINSTR 0x4
+
+#define SHN_UNDEF 0
+#define SHN_ABS 0xfff1
+#define SHN_COMMON 0xfff2
+
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define STT_FILE 4
+
+#define R_SPARC_32 3
+#define R_SPARC_WDISP30 7
+#define R_SPARC_HI22 9
+#define R_SPARC_LO10 12
+
+#define EHDR_SIZE 52
+#define SHDR_SIZE 40
+#define SYM_SIZE 16
+#define RELA_SIZE 12
+
+/* Sections, in the order they are written */
+enum {
+  SEC_NULL,
+  SEC_TEXT,
+  SEC_RELA_TEXT,
+  SEC_DATA,
+  SEC_RELA_DATA,
+  SEC_BSS,
+  SEC_RODATA,
+  SEC_SYMTAB,
+  SEC_STRTAB,
+  SEC_SHSTRTAB,
+  SEC_NUM
+};
+
+/* A growable byte buffer holding a section's contents */
+typedef struct {
+  unsigned char *data;
+  int len, size;
+} elf_buf_t;
+
+typedef struct {
+  char *name;
+  int bind, type, shndx;
+  int value, size;
+
+  /* Index in the written symbol table */
+  int index;
+} elf_sym_t;
+
+typedef struct {
+  int offset, type, sym, addend;
+} elf_rela_t;
+
+/* Local labels of the function being encoded */
+#define LABEL_HASH_SIZE 256
+
+typedef struct elf_label_s {
+  char *name;
+  int offset;
+  struct elf_label_s *next;
+} elf_label_t;
+
+static void buf_put(elf_buf_t *, void *, int);
+static void buf_zero(elf_buf_t *, int);
+static void buf_put32(elf_buf_t *, unsigned int);
+static void buf_put16(elf_buf_t *, unsigned int);
+static void buf_set32(elf_buf_t *, int, unsigned int);
+static void buf_align(elf_buf_t *, int);
+static int add_name(elf_buf_t *, char *);
+static int find_sym(char *);
+static int add_sym(char *, int, int, int, int, int);
+static int sym_ref(char *, int *);
+static void add_rela(int, int, int, char *, int);
+static unsigned int label_hash(char *);
+static void add_label(char *, int);
+static int find_label(char *);
+static void free_labels(void);
+static int arith_op3(int);
+static unsigned int encode_src2(sparc_operand_t *, int);
+static unsigned int encode_format3(int, int, int, int, sparc_operand_t *,
+				   int);
+static unsigned int encode_mem(int, int, sparc_operand_t *, int);
+static unsigned int encode_instr(sparc_instr_t *, int);
+static void put_string(char *);
+
+/* Section contents and relocations */
+static elf_buf_t text, data, rodata;
+static elf_rela_t *rela[SEC_NUM];
+static int num_rela[SEC_NUM];
+
+static elf_sym_t *syms;
+static int num_syms;
+static int section_sym[SEC_NUM];
+
+/* Offsets of the strings in .rodata, by string number */
+static int *string_offsets;
+static int num_string_offsets;
+
+static elf_label_t *labels[LABEL_HASH_SIZE];
+
+/* Condition field of the branch instructions */
+static const int branch_cond[] = {
+  8,	/* ba */
+  1,	/* be */
+  9,	/* bne */
+  3,	/* bl */
+  2,	/* ble */
+  10,	/* bg */
+  11	/* bge */
+};
+
+/*
+ * Start an object for the given source file
+ */
+void elf_begin(char *source) {
+  int i;
+
+  memset(&text, 0, sizeof(elf_buf_t));
+  memset(&data, 0, sizeof(elf_buf_t));
+  memset(&rodata, 0, sizeof(elf_buf_t));
+  for(i = 0; i < SEC_NUM; i++) {
+    rela[i] = NULL;
+    num_rela[i] = 0;
+  }
+
+  syms = NULL;
+  num_syms = 0;
+  string_offsets = NULL;
+  num_string_offsets = 0;
+
+  add_sym(NULL, STB_LOCAL, STT_NOTYPE, SHN_UNDEF, 0, 0);
+  add_sym(source, STB_LOCAL, STT_FILE, SHN_ABS, 0, 0);
+
+  section_sym[SEC_TEXT] = add_sym(NULL, STB_LOCAL, STT_SECTION, SEC_TEXT,
+				  0, 0);
+  section_sym[SEC_DATA] = add_sym(NULL, STB_LOCAL, STT_SECTION, SEC_DATA,
+				  0, 0);
+  section_sym[SEC_BSS] = add_sym(NULL, STB_LOCAL, STT_SECTION, SEC_BSS,
+				 0, 0);
+  section_sym[SEC_RODATA] = add_sym(NULL, STB_LOCAL, STT_SECTION,
+				    SEC_RODATA, 0, 0);
+}
+
+/*
+ * Add the next string literal to .rodata. Escapes are interpreted as gas
+ * does for .asciz.
+ */
+void elf_string(char *str) {
+  string_offsets = realloc(string_offsets,
+			   (num_string_offsets + 1) * sizeof(int));
+  string_offsets[num_string_offsets++] = rodata.len;
+  put_string(str);
+}
+
+/*
+ * Add a common symbol, which the linker places in .bss
+ */
+void elf_common(char *name, int size, int align) {
+  add_sym(name, STB_GLOBAL, STT_OBJECT, SHN_COMMON, align, size);
+}
+
+/*
+ * Add a word aligned object to .data, with space bytes of zeroes. If
+ * init is given the first word holds its address.
+ */
+void elf_object(char *name, int size, int space, char *init) {
+  buf_align(&data, 4);
+  add_sym(name, STB_LOCAL, STT_OBJECT, SEC_DATA, data.len, size);
+
+  if(init)
+    add_rela(SEC_RELA_DATA, data.len, R_SPARC_32, init, 0);
+
+  buf_zero(&data, space);
+}
+
+/*
+ * Encode a function into .text. The head of the list is the function's
+ * label.
+ */
+void elf_func(char *name, sparc_instr_t *head) {
+  sparc_instr_t *instr;
+  int start, offset;
+
+  buf_align(&text, 4);
+  start = text.len;
+
+  /* Find the local labels */
+  offset = start;
+  for(instr = head; instr; instr = instr->next) {
+    if(instr->op == SPARC_LABEL &&
+       instr->operand[0]->type == SPARC_OP_LABEL)
+      add_label(instr->operand[0]->sym, offset);
+    else if(!(sparc_ops[instr->op].flags & SPARC_F_PSEUDO))
+      offset += WORD_SIZE;
+  }
+
+  for(instr = head; instr; instr = instr->next)
+    if(!(sparc_ops[instr->op].flags & SPARC_F_PSEUDO))
+      buf_put32(&text, encode_instr(instr, text.len));
+
+  free_labels();
+
+  add_sym(name, STB_GLOBAL, STT_FUNC, SEC_TEXT, start, text.len - start);
+}
+
+/*
+ * Write out the object
+ */
+void elf_end(char *filename) {
+  elf_buf_t out, symtab, strtab, shstrtab, relbuf[SEC_NUM];
+  int offset[SEC_NUM], size[SEC_NUM], name[SEC_NUM];
+  int i, j, s, first_global;
+  elf_sym_t *sym;
+  FILE *fd;
+
+  static unsigned char ident[EHDR_SIZE] = {
+    0x7f, 'E', 'L', 'F', ELFCLASS32, ELFDATA2MSB, EV_CURRENT
+  };
+  static const char *section_names[SEC_NUM] = {
+    "", ".text", ".rela.text", ".data", ".rela.data", ".bss", ".rodata",
+    ".symtab", ".strtab", ".shstrtab"
+  };
+
+  memset(&out, 0, sizeof(elf_buf_t));
+  memset(&symtab, 0, sizeof(elf_buf_t));
+  memset(&strtab, 0, sizeof(elf_buf_t));
+  memset(&shstrtab, 0, sizeof(elf_buf_t));
+  memset(relbuf, 0, sizeof(relbuf));
+
+  for(i = 0; i < SEC_NUM; i++)
+    name[i] = add_name(&shstrtab, (char *)section_names[i]);
+
+  /* Locals have to come before globals in the symbol table */
+  add_name(&strtab, "");
+  for(s = 0, i = STB_LOCAL; i <= STB_GLOBAL; i++) {
+    if(i == STB_GLOBAL)
+      first_global = s;
+
+    for(j = 0; j < num_syms; j++) {
+      sym = &syms[j];
+      if(sym->bind != i)
+	continue;
+
+      sym->index = s++;
+      buf_put32(&symtab, sym->name ? add_name(&strtab, sym->name) : 0);
+      buf_put32(&symtab, sym->value);
+      buf_put32(&symtab, sym->size);
+      buf_put16(&symtab, (sym->bind << 12) | (sym->type << 8));
+      buf_put16(&symtab, sym->shndx);
+    }
+  }
+
+  for(i = 0; i < SEC_NUM; i++)
+    for(j = 0; j < num_rela[i]; j++) {
+      buf_put32(&relbuf[i], rela[i][j].offset);
+      buf_put32(&relbuf[i], (syms[rela[i][j].sym].index << 8) |
+		rela[i][j].type);
+      buf_put32(&relbuf[i], rela[i][j].addend);
+    }
+
+  /* Section contents follow the header, then the section headers */
+  buf_put(&out, ident, EHDR_SIZE);
+  offset[SEC_NULL] = 0;
+  size[SEC_NULL] = 0;
+  for(i = SEC_TEXT; i < SEC_NUM; i++) {
+    elf_buf_t *buf;
+
+    switch(i) {
+    case SEC_TEXT: buf = &text; break;
+    case SEC_DATA: buf = &data; break;
+    case SEC_RODATA: buf = &rodata; break;
+    case SEC_SYMTAB: buf = &symtab; break;
+    case SEC_STRTAB: buf = &strtab; break;
+    case SEC_SHSTRTAB: buf = &shstrtab; break;
+    case SEC_BSS: buf = NULL; break;
+    default: buf = &relbuf[i]; break;
+    }
+
+    buf_align(&out, 4);
+    offset[i] = out.len;
+    size[i] = buf ? buf->len : 0;
+    if(buf && buf->len)
+      buf_put(&out, buf->data, buf->len);
+  }
+  buf_align(&out, 4);
+
+  /* ELF header. The entry point and program headers are left as zero. */
+  buf_set32(&out, 16, (ET_REL << 16) | EM_SPARC);
+  buf_set32(&out, 20, EV_CURRENT);
+  buf_set32(&out, 32, out.len);
+  buf_set32(&out, 40, EHDR_SIZE << 16);
+  buf_set32(&out, 44, SHDR_SIZE);
+  buf_set32(&out, 48, (SEC_NUM << 16) | SEC_SHSTRTAB);
+
+  /* Section headers */
+  for(i = 0; i < SEC_NUM; i++) {
+    int type = 0, flags = 0, link = 0, info = 0, align = 0, entsize = 0;
+
+    switch(i) {
+    case SEC_TEXT:
+      type = SHT_PROGBITS;
+      flags = SHF_ALLOC | SHF_EXECINSTR;
+      align = 4;
+      break;
+
+    case SEC_DATA:
+      type = SHT_PROGBITS;
+      flags = SHF_ALLOC | SHF_WRITE;
+      align = 4;
+      break;
+
+    case SEC_BSS:
+      type = SHT_NOBITS;
+      flags = SHF_ALLOC | SHF_WRITE;
+      align = 1;
+      break;
+
+    case SEC_RODATA:
+      type = SHT_PROGBITS;
+      flags = SHF_ALLOC;
+      align = 1;
+      break;
+
+    case SEC_RELA_TEXT:
+    case SEC_RELA_DATA:
+      type = SHT_RELA;
+      link = SEC_SYMTAB;
+      info = i - 1;
+      align = 4;
+      entsize = RELA_SIZE;
+      break;
+
+    case SEC_SYMTAB:
+      type = SHT_SYMTAB;
+      link = SEC_STRTAB;
+      info = first_global;
+      align = 4;
+      entsize = SYM_SIZE;
+      break;
+
+    case SEC_STRTAB:
+    case SEC_SHSTRTAB:
+      type = SHT_STRTAB;
+      align = 1;
+      break;
+    }
+
+    buf_put32(&out, name[i]);
+    buf_put32(&out, type);
+    buf_put32(&out, flags);
+    buf_put32(&out, 0);
+    buf_put32(&out, offset[i]);
+    buf_put32(&out, size[i]);
+    buf_put32(&out, link);
+    buf_put32(&out, info);
+    buf_put32(&out, align);
+    buf_put32(&out, entsize);
+  }
+
+  if(!(fd = fopen(filename, "wb")))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Cannot open file %s for writing\n", filename);
+
+  if(fwrite(out.data, 1, out.len, fd) != (size_t)out.len)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Error writing to %s\n", filename);
+  fclose(fd);
+
+  free(out.data);
+  free(symtab.data);
+  free(strtab.data);
+  free(shstrtab.data);
+  for(i = 0; i < SEC_NUM; i++) {
+    free(relbuf[i].data);
+    free(rela[i]);
+  }
+  free(text.data);
+  free(data.data);
+  free(rodata.data);
+  free(syms);
+  free(string_offsets);
+}
+
+/*
+ * Append zeroes or bytes to a buffer
+ */
+static void buf_zero(elf_buf_t *buf, int n) {
+  if(buf->len + n > buf->size) {
+    buf->size = buf->size ? buf->size * 2 : 4096;
+    if(buf->size < buf->len + n)
+      buf->size = buf->len + n;
+    buf->data = realloc(buf->data, buf->size);
+  }
+
+  memset(buf->data + buf->len, 0, n);
+  buf->len += n;
+}
+
+static void buf_put(elf_buf_t *buf, void *bytes, int n) {
+  buf_zero(buf, n);
+  memcpy(buf->data + buf->len - n, bytes, n);
+}
+
+/*
+ * Append a big endian word or half word
+ */
+static void buf_put32(elf_buf_t *buf, unsigned int val) {
+  unsigned char bytes[4];
+
+  bytes[0] = val >> 24;
+  bytes[1] = val >> 16;
+  bytes[2] = val >> 8;
+  bytes[3] = val;
+  buf_put(buf, bytes, 4);
+}
+
+static void buf_put16(elf_buf_t *buf, unsigned int val) {
+  unsigned char bytes[2];
+
+  bytes[0] = val >> 8;
+  bytes[1] = val;
+  buf_put(buf, bytes, 2);
+}
+
+static void buf_set32(elf_buf_t *buf, int offset, unsigned int val) {
+  buf->data[offset] = val >> 24;
+  buf->data[offset + 1] = val >> 16;
+  buf->data[offset + 2] = val >> 8;
+  buf->data[offset + 3] = val;
+}
+
+/*
+ * Pad a buffer with zeroes to a multiple of align bytes
+ */
+static void buf_align(elf_buf_t *buf, int align) {
+  if(buf->len % align)
+    buf_zero(buf, align - buf->len % align);
+}
+
+/*
+ * Add a name to a string table, returning its offset
+ */
+static int add_name(elf_buf_t *strtab, char *name) {
+  int offset = strtab->len;
+
+  buf_put(strtab, name, strlen(name) + 1);
+  return offset;
+}
+
+/*
+ * Return the index of a named symbol, or -1
+ */
+static int find_sym(char *name) {
+  int i;
+
+  for(i = 0; i < num_syms; i++)
+    if(syms[i].name && !strcmp(syms[i].name, name))
+      return i;
+
+  return -1;
+}
+
+/*
+ * Add a symbol, or define one which has already been referenced
+ */
+static int add_sym(char *name, int bind, int type, int shndx, int value,
+		   int size) {
+  int i = name ? find_sym(name) : -1;
+
+  if(i == -1) {
+    syms = realloc(syms, (num_syms + 1) * sizeof(elf_sym_t));
+    i = num_syms++;
+    syms[i].name = name;
+  }
+
+  syms[i].bind = bind;
+  syms[i].type = type;
+  syms[i].shndx = shndx;
+  syms[i].value = value;
+  syms[i].size = size;
+  return i;
+}
+
+/*
+ * Return the symbol a relocation against name is made against, adjusting
+ * the addend. String literals are addressed from the start of .rodata, and
+ * names not yet defined are added as undefined globals.
+ */
+static int sym_ref(char *name, int *addend) {
+  int i;
+
+  if(!strncmp(name, ".string", 7)) {
+    *addend += string_offsets[atoi(name + 7)];
+    return section_sym[SEC_RODATA];
+  }
+
+  if((i = find_sym(name)) != -1)
+    return i;
+
+  return add_sym(name, STB_GLOBAL, STT_NOTYPE, SHN_UNDEF, 0, 0);
+}
+
+/*
+ * Add a relocation to a section
+ */
+static void add_rela(int section, int offset, int type, char *name,
+		     int addend) {
+  elf_rela_t *r;
+
+  rela[section] = realloc(rela[section],
+			  (num_rela[section] + 1) * sizeof(elf_rela_t));
+  r = &rela[section][num_rela[section]++];
+
+  r->offset = offset;
+  r->type = type;
+  r->sym = sym_ref(name, &addend);
+  r->addend = addend;
+}
+
+static unsigned int label_hash(char *name) {
+  unsigned int h = 0;
+
+  while(*name)
+    h = h * 31 + *name++;
+  return h % LABEL_HASH_SIZE;
+}
+
+static void add_label(char *name, int offset) {
+  elf_label_t *label = malloc(sizeof(elf_label_t));
+  unsigned int h = label_hash(name);
+
+  label->name = name;
+  label->offset = offset;
+  label->next = labels[h];
+  labels[h] = label;
+}
+
+static int find_label(char *name) {
+  elf_label_t *label;
+
+  for(label = labels[label_hash(name)]; label; label = label->next)
+    if(!strcmp(label->name, name))
+      return label->offset;
+
+  compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		 "Branch to undefined label %s\n", name);
+  return 0;
+}
+
+static void free_labels(void) {
+  elf_label_t *label, *next;
+  int i;
+
+  for(i = 0; i < LABEL_HASH_SIZE; i++) {
+    for(label = labels[i]; label; label = next) {
+      next = label->next;
+      free(label);
+    }
+    labels[i] = NULL;
+  }
+}
+
+/*
+ * Return the op3 field of a format 3 arithmetic instruction
+ */
+static int arith_op3(int op) {
+  switch(op) {
+  case SPARC_ADD: return 0x00;
+  case SPARC_MOV:
+  case SPARC_OR: return 0x02;
+  case SPARC_SUB:
+  case SPARC_NEG: return 0x04;
+  case SPARC_SMUL: return 0x0b;
+  case SPARC_SDIV: return 0x0f;
+  case SPARC_CMP: return 0x14;
+  case SPARC_SLL: return 0x25;
+  case SPARC_SRL: return 0x26;
+  case SPARC_SRA: return 0x27;
+  case SPARC_RD: return 0x28;
+  case SPARC_WR: return 0x30;
+  case SPARC_SAVE: return 0x3c;
+  case SPARC_RESTORE: return 0x3d;
+  }
+
+  compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		 "No encoding for %s\n", sparc_ops[op].name);
+  return 0;
+}
+
+/*
+ * Encode the second source of a format 3 instruction, which is a register
+ * or a 13 bit immediate, relocated for %lo(sym)
+ */
+static unsigned int encode_src2(sparc_operand_t *op, int pc) {
+  if(!op)
+    return 0;
+
+  switch(op->type) {
+  case SPARC_OP_REG:
+    return op->reg;
+
+  case SPARC_OP_LO:
+    if(op->sym) {
+      add_rela(SEC_RELA_TEXT, pc, R_SPARC_LO10, op->sym, op->val);
+      return 1 << 13;
+    }
+    return (1 << 13) | (op->val & SETHI_LOW_MASK);
+
+  case SPARC_OP_IMM:
+  default:
+    if(!IS_SIMM13(op->val))
+      compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		     "Immediate %d out of range\n", op->val);
+    return (1 << 13) | (op->val & 0x1fff);
+  }
+}
+
+static unsigned int encode_format3(int op, int op3, int rd, int rs1,
+				   sparc_operand_t *src2, int pc) {
+  return (op << 30) | (rd << 25) | (op3 << 19) | (rs1 << 14) |
+    encode_src2(src2, pc);
+}
+
+/*
+ * Encode a load or store with the address in a memory operand
+ */
+static unsigned int encode_mem(int op3, int rd, sparc_operand_t *addr,
+			       int pc) {
+  sparc_operand_t src2;
+
+  memset(&src2, 0, sizeof(sparc_operand_t));
+  if(addr->index != -1) {
+    src2.type = SPARC_OP_REG;
+    src2.reg = addr->index;
+  } else if(addr->sym) {
+    src2.type = SPARC_OP_LO;
+    src2.sym = addr->sym;
+    src2.val = addr->val;
+  } else {
+    src2.type = SPARC_OP_IMM;
+    src2.val = addr->val;
+  }
+
+  return encode_format3(3, op3, rd, addr->reg, &src2, pc);
+}
+
+/*
+ * Encode a machine instruction at offset pc in .text
+ */
+static unsigned int encode_instr(sparc_instr_t *instr, int pc) {
+  sparc_operand_t **opr = instr->operand;
+  int disp;
+
+  switch(instr->op) {
+  case SPARC_NOP:
+    return 0x01000000;
+
+  case SPARC_SETHI:
+    if(opr[0]->sym) {
+      add_rela(SEC_RELA_TEXT, pc, R_SPARC_HI22, opr[0]->sym, opr[0]->val);
+      return (opr[1]->reg << 25) | (4 << 22);
+    }
+    return (opr[1]->reg << 25) | (4 << 22) |
+      (((unsigned int)opr[0]->val >> 10) & 0x3fffff);
+
+  case SPARC_MOV:
+    return encode_format3(2, arith_op3(SPARC_MOV), opr[1]->reg, SPARC_G0,
+			  opr[0], pc);
+
+  case SPARC_NEG:
+    return encode_format3(2, arith_op3(SPARC_NEG), opr[0]->reg, SPARC_G0,
+			  opr[0], pc);
+
+  case SPARC_CMP:
+    return encode_format3(2, arith_op3(SPARC_CMP), SPARC_G0, opr[0]->reg,
+			  opr[1], pc);
+
+  case SPARC_RD:
+    return encode_format3(2, arith_op3(SPARC_RD), opr[1]->reg, 0, NULL, pc);
+
+  case SPARC_WR:
+    return encode_format3(2, arith_op3(SPARC_WR), 0, opr[0]->reg, opr[1],
+			  pc);
+
+  case SPARC_LD:
+    return encode_mem(0x00, opr[1]->reg, opr[0], pc);
+
+  case SPARC_ST:
+    return encode_mem(0x04, opr[0]->reg, opr[1], pc);
+
+  case SPARC_BA:
+  case SPARC_BE:
+  case SPARC_BNE:
+  case SPARC_BL:
+  case SPARC_BLE:
+  case SPARC_BG:
+  case SPARC_BGE:
+    disp = (find_label(opr[0]->sym) + opr[0]->val - pc) / WORD_SIZE;
+    return (instr->annul << 29) | (branch_cond[instr->op - SPARC_BA] << 25) |
+      (2 << 22) | (disp & 0x3fffff);
+
+  case SPARC_CALL:
+    add_rela(SEC_RELA_TEXT, pc, R_SPARC_WDISP30, opr[0]->sym, 0);
+    return 1 << 30;
+
+  case SPARC_RET:
+  case SPARC_RETL: {
+    /* jmpl %i7 + 8, %g0 or jmpl %o7 + 8, %g0 */
+    sparc_operand_t eight;
+
+    memset(&eight, 0, sizeof(sparc_operand_t));
+    eight.type = SPARC_OP_IMM;
+    eight.val = 8;
+    return encode_format3(2, 0x38, SPARC_G0, instr->op == SPARC_RET ?
+			  SPARC_I7 : SPARC_O7, &eight, pc);
+  }
+
+  case SPARC_SAVE:
+  case SPARC_RESTORE:
+    if(!opr[0])
+      return encode_format3(2, arith_op3(instr->op), SPARC_G0, SPARC_G0,
+			    NULL, pc);
+    /* Fall through */
+
+  default:
+    return encode_format3(2, arith_op3(instr->op), opr[2]->reg, opr[0]->reg,
+			  opr[1], pc);
+  }
+}
+
+/*
+ * Add a string literal to .rodata, interpreting its escapes
+ */
+static void put_string(char *str) {
+  unsigned char c;
+  int i, val;
+
+  while(*str) {
+    c = *str++;
+
+    if(c == '\\' && *str) {
+      c = *str++;
+      switch(c) {
+      case 'n': c = '\n'; break;
+      case 't': c = '\t'; break;
+      case 'r': c = '\r'; break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'v': c = '\v'; break;
+      case 'a': c = '\a'; break;
+
+      case 'x':
+	for(val = 0; isxdigit((unsigned char)*str); str++)
+	  val = val * 16 + (isdigit((unsigned char)*str) ? *str - '0' :
+			    tolower((unsigned char)*str) - 'a' + 10);
+	c = val;
+	break;
+
+      default:
+	if(c >= '0' && c <= '7') {
+	  val = c - '0';
+	  for(i = 1; i < 3 && *str >= '0' && *str <= '7'; i++)
+	    val = val * 8 + *str++ - '0';
+	  c = val;
+	}
+	break;
+      }
+    }
+
+    buf_put(&rodata, &c, 1);
+  }
+
+  buf_put(&rodata, "", 1);
+}
@@ -3,13 +3,15 @@
  * Ryan Mallon (2006)
  *
  * Sparc V8 backend code generator. Converts code from LIR (low level
- * intermediate code) to Sparc assembly. The generated code is written to a
- * file which can then be compiled using gas or gcc.
+ * intermediate code) to a list of Sparc machine instructions for each
+ * function, which is optimised and then written out as assembly. The
+ * generated code can then be compiled using gas or gcc.
  *
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "symtable.h"
 #include "typechk.h"
 #include "scope.h"
@@ -29,21 +31,126 @@ extern void stabs_print_file_info(FILE *);
 extern void stabs_print_line_num(FILE *, int, char *);
 
 static int max_call_args(mir_node_t *);
-static char *sparc_opstr(mir_operand_t *, int);
+static void gen_sparc_instr(mir_node_t *);
+static sparc_instr_t *sparc_emit(int, sparc_operand_t *, sparc_operand_t *,
+				 sparc_operand_t *);
+static void sparc_emit_mov(sparc_operand_t *, sparc_operand_t *);
+static sparc_operand_t *sparc_opr(mir_operand_t *);
+static sparc_operand_t *sparc_ptr_opr(mir_operand_t *);
+static sparc_operand_t *sparc_stack_opr(int);
+static void sparc_emit_set(int, int);
+static void sparc_emit_move(mir_operand_t *, int);
+static sparc_operand_t *sparc_reg_opr(mir_operand_t *, int);
+static sparc_operand_t *sparc_simm_opr(mir_operand_t *);
+static void sparc_emit_arith(mir_instr_t *);
+static int sparc_log2(unsigned int);
+static void sparc_emit_shift(int, int, int, int);
+static void sparc_emit_mul_const(int, int, int);
+static void sparc_div_magic(unsigned int, int *, int *);
+static void sparc_emit_div_const(int, int, int);
+static void sparc_emit_div(mir_operand_t *, mir_operand_t *, int);
+static int sparc_compare(int, int, int);
+static void out_reserve(int);
+static void out_char(char);
+static void out_str(char *);
+static void out_int(int);
+static void out_flush(FILE *);
+static void gen_sparc_object(char *);
+static void sparc_print_func(FILE *, sparc_instr_t *);
+static void sparc_print_reg(int);
+static void sparc_print_operand(sparc_operand_t *);
 
 extern compiler_options_t cflags;
 extern scope_node_t *global_scope;
 
-typedef struct sparc_instr_s {
-  int val[3];
-  int type[3];
+/*
+ * Machine instructions, in the order of the SPARC_* constants. Pure
+ * instructions have no effect other than writing their dest, apart from
+ * smul also setting %y, which rd and sdiv read.
+ */
+const sparc_op_info_t sparc_ops[SPARC_NUM_OPS] = {
+  {NULL, -1, SPARC_F_PSEUDO},
+  {NULL, -1, SPARC_F_PSEUDO},
+  {"nop", -1, 0},
+  {"mov", 1, SPARC_F_PURE},
+  {"add", 2, SPARC_F_PURE},
+  {"sub", 2, SPARC_F_PURE},
+  {"smul", 2, SPARC_F_PURE | SPARC_F_SETY},
+  {"sdiv", 2, SPARC_F_USEY},
+  {"or", 2, SPARC_F_PURE},
+  {"sll", 2, SPARC_F_PURE},
+  {"srl", 2, SPARC_F_PURE},
+  {"sra", 2, SPARC_F_PURE},
+  {"neg", 0, SPARC_F_PURE},
+  {"sethi", 1, SPARC_F_PURE},
+  {"ld", 1, SPARC_F_LOAD},
+  {"st", -1, SPARC_F_STORE},
+  {"cmp", -1, SPARC_F_SETCC},
+  {"rd", 1, SPARC_F_USEY},
+  {"wr", -1, SPARC_F_SETY},
+  {"ba", -1, SPARC_F_BRANCH},
+  {"be", -1, SPARC_F_BRANCH | SPARC_F_COND},
+  {"bne", -1, SPARC_F_BRANCH | SPARC_F_COND},
+  {"bl", -1, SPARC_F_BRANCH | SPARC_F_COND},
+  {"ble", -1, SPARC_F_BRANCH | SPARC_F_COND},
+  {"bg", -1, SPARC_F_BRANCH | SPARC_F_COND},
+  {"bge", -1, SPARC_F_BRANCH | SPARC_F_COND},
+  {"call", -1, SPARC_F_BRANCH},
+  {"ret", -1, SPARC_F_BRANCH},
+  {"retl", -1, SPARC_F_BRANCH},
+  {"save", -1, 0},
+  {"restore", -1, 0}
+};
+
+static int current_arg;
 
-  struct sparc_instr_s *jump;
-  struct sparc_instr_s *next;
+/* The function being generated and its frame */
+static name_record_t *current_func;
+static int frame_size, offset_words;
 
-} sparc_instr_t;
+/* Machine instructions for the function being generated */
+static sparc_instr_t *sparc_head, *sparc_tail;
 
-static int current_arg;
+/*
+ * Assembly for the functions is formatted into a single buffer, which is
+ * written out in one go rather than a line at a time through stdio
+ */
+#define OUT_BUF_SIZE 65536
+static char *out_buf;
+static int out_len, out_size;
+
+/*
+ * The registers handed out by the register allocator, in order of
+ * preference. %g1 is kept back as the code generator's scratch register,
+ * and %i6, %i7, %o6 and %o7 hold the frame, stack and return addresses.
+ */
+static const int sparc_alloc_regs[SPARC_ALLOC_REGS] = {
+  SPARC_LOCALS + 0, SPARC_LOCALS + 1, SPARC_LOCALS + 2, SPARC_LOCALS + 3,
+  SPARC_LOCALS + 4, SPARC_LOCALS + 5, SPARC_LOCALS + 6, SPARC_LOCALS + 7,
+  SPARC_INS + 0, SPARC_INS + 1, SPARC_INS + 2,
+  SPARC_INS + 3, SPARC_INS + 4, SPARC_INS + 5,
+  SPARC_OUTS + 0, SPARC_OUTS + 1, SPARC_OUTS + 2,
+  SPARC_OUTS + 3, SPARC_OUTS + 4, SPARC_OUTS + 5,
+  2, 3, 4
+};
+
+/*
+ * Return the hardware register number (0-31) of an allocated register
+ */
+int sparc_reg_number(int reg) {
+  if(reg < 0 || reg >= SPARC_ALLOC_REGS)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Invalid allocated register %d\n", reg);
+
+  return sparc_alloc_regs[reg];
+}
+
+/*
+ * Return the class of an allocated register
+ */
+int sparc_reg_class(int reg) {
+  return sparc_reg_number(reg) / 8;
+}
 
 /*
  * Return an aligned address
@@ -66,339 +173,887 @@ int sp_offset(int offset, int offset_words) {
   return offset + STACK_LOCAL_BASE + (offset_words * WORD_SIZE);
 }
 
+/*
+ * Machine operands. Symbol names aren't copied, so they must outlive the
+ * function being generated.
+ */
+static sparc_operand_t *sparc_new_operand(int type) {
+  sparc_operand_t *op = malloc(sizeof(sparc_operand_t));
+
+  op->type = type;
+  op->reg = 0;
+  op->index = -1;
+  op->val = 0;
+  op->sym = NULL;
+
+  return op;
+}
+
+sparc_operand_t *sparc_reg(int reg) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_REG);
+
+  op->reg = reg;
+  return op;
+}
+
+sparc_operand_t *sparc_imm(int val) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_IMM);
+
+  op->val = val;
+  return op;
+}
+
+sparc_operand_t *sparc_hi(char *sym, int val) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_HI);
+
+  op->sym = sym;
+  op->val = val;
+  return op;
+}
+
+sparc_operand_t *sparc_lo(char *sym, int val) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_LO);
+
+  op->sym = sym;
+  op->val = val;
+  return op;
+}
+
+sparc_operand_t *sparc_mem(int reg, int val) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_MEM);
+
+  op->reg = reg;
+  op->val = val;
+  return op;
+}
+
+sparc_operand_t *sparc_mem_index(int reg, int index) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_MEM);
+
+  op->reg = reg;
+  op->index = index;
+  return op;
+}
+
+sparc_operand_t *sparc_sym(char *sym) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_SYM);
+
+  op->sym = sym;
+  return op;
+}
+
+sparc_operand_t *sparc_label(char *label) {
+  sparc_operand_t *op = sparc_new_operand(SPARC_OP_LABEL);
+
+  op->sym = label;
+  return op;
+}
+
+sparc_operand_t *sparc_y(void) {
+  return sparc_new_operand(SPARC_OP_Y);
+}
+
+sparc_operand_t *sparc_copy_operand(sparc_operand_t *op) {
+  sparc_operand_t *copy;
+
+  if(!op)
+    return NULL;
+
+  copy = malloc(sizeof(sparc_operand_t));
+  memcpy(copy, op, sizeof(sparc_operand_t));
+  return copy;
+}
 
 /*
- * Generate sparc code for a function
+ * Create a machine instruction, not yet in a list
  */
-void gen_sparc_func(FILE *fd, mir_node_t **node) {
-  name_record_t *func = NULL;
-  mir_instr_t *instr;
-  char *op_str[3];
-  int i, done, frame_size = 0, offset_words = 0, line_num;
+sparc_instr_t *sparc_new_instr(int op, sparc_operand_t *op1,
+			       sparc_operand_t *op2, sparc_operand_t *op3) {
+  sparc_instr_t *instr = malloc(sizeof(sparc_instr_t));
+
+  instr->op = op;
+  instr->operand[0] = op1;
+  instr->operand[1] = op2;
+  instr->operand[2] = op3;
+  instr->annul = 0;
+  instr->num_args = 0;
+  instr->id = -1;
+  instr->prev = NULL;
+  instr->next = NULL;
+
+  return instr;
+}
 
-  line_num = 0;
-  done = 0;
-  while(*node && !done) {
-    instr = (*node)->instruction;
+sparc_instr_t *sparc_copy_instr(sparc_instr_t *instr) {
+  sparc_instr_t *copy;
 
-    if(cflags.flags & CFLAG_OUTPUT_STABS) {
-      if(func && (*node)->src_line_num > line_num) {
-	line_num = (*node)->src_line_num;
-	stabs_print_line_num(fd, line_num, func->name);
-      }
-    }
+  copy = sparc_new_instr(instr->op, sparc_copy_operand(instr->operand[0]),
+			 sparc_copy_operand(instr->operand[1]),
+			 sparc_copy_operand(instr->operand[2]));
+  copy->annul = instr->annul;
+  copy->num_args = instr->num_args;
 
-    /* Get the operand strings */
-    for(i = 0; i < 3; i++)
-      op_str[i] = sparc_opstr(instr->operand[i], offset_words);
+  return copy;
+}
 
-    if(instr->opcode != MIR_LABEL && instr->label)
-      fprintf(fd, ".%s:\n", instr->label);
+/*
+ * Insert an instruction into the list after the given one
+ */
+void sparc_insert_after(sparc_instr_t *pos, sparc_instr_t *instr) {
+  instr->prev = pos;
+  instr->next = pos->next;
+  if(pos->next)
+    pos->next->prev = instr;
+  pos->next = instr;
+}
 
-    switch(instr->opcode) {
-    case MIR_NOP:
-      break;
+/*
+ * Remove an instruction from its list. The head of a function's list is
+ * its label, which is never removed.
+ */
+void sparc_unlink_instr(sparc_instr_t *instr) {
+  if(instr->prev)
+    instr->prev->next = instr->next;
+  if(instr->next)
+    instr->next->prev = instr->prev;
+
+  instr->prev = NULL;
+  instr->next = NULL;
+}
 
-    case MIR_LABEL:
-      /* Function header */
-      current_arg = 0;
-      func = get_func_entry(instr->label);
+void sparc_free_instr(sparc_instr_t *instr) {
+  int i;
 
-      /* Stack frame size, must be 8 byte aligned */
-      i = max_call_args(*node);
-      offset_words = max_call_args(*node);
-      frame_size = align(STACK_HEADER_SIZE +
-			 max_scope_size(get_func_scope(func->name)) +
-			 (offset_words * WORD_SIZE));
+  for(i = 0; i < 3; i++)
+    free(instr->operand[i]);
+  free(instr);
+}
 
-      if(cflags.flags & CFLAG_OUTPUT_STABS)
-        stabs_print_function(fd, func, frame_size, offset_words);
+/*
+ * Append an instruction to the function being generated
+ */
+static sparc_instr_t *sparc_emit(int op, sparc_operand_t *op1,
+				 sparc_operand_t *op2, sparc_operand_t *op3) {
+  sparc_instr_t *instr = sparc_new_instr(op, op1, op2, op3);
 
-      fprintf(fd, "\t.global %s\n", func->name);
-      fprintf(fd, "\t.type %s,#function\n", func->name);
-      fprintf(fd, "\t.proc 020\n");
-      fprintf(fd, "%s:\n", func->name);
+  if(sparc_tail)
+    sparc_insert_after(sparc_tail, instr);
+  else
+    sparc_head = instr;
+  sparc_tail = instr;
 
-      if(frame_size > MAX_CONST) {
-	fprintf(fd, "\tsethi\t%%hi(%d), %%l0\n", frame_size & HIGH_BIT_MASK);
-	fprintf(fd, "\tor\t%%l0, %d, %%l0\n", frame_size & LOW_BIT_MASK);
-	fprintf(fd, "\tneg\t%%l0\n");
-	fprintf(fd, "\tsave\t%%sp, %%l0, %%sp\n");
+  return instr;
+}
 
-      } else
-	fprintf(fd, "\tsave\t%%sp, -%d, %%sp\n", frame_size);
+/*
+ * Emit a move, leaving out moves from a register to itself
+ */
+static void sparc_emit_mov(sparc_operand_t *src, sparc_operand_t *dest) {
+  if(src->type == SPARC_OP_REG && dest->type == SPARC_OP_REG &&
+     src->reg == dest->reg) {
+    free(src);
+    free(dest);
+    return;
+  }
 
-      break;
+  sparc_emit(SPARC_MOV, src, dest, NULL);
+}
 
-    case MIR_ADDR:
-      if(instr->operand[0]->optype == MIR_OP_VAR)
-	fprintf(fd, "\tadd\t%s, %d, %s\n", SP_PREFIX,
-		sp_offset(instr->operand[0]->var->offset, offset_words),
-		op_str[2]);
-      else
-	fprintf(fd, "\tld\t[%s], %s\n", op_str[0], op_str[2]);
+/*
+ * Return the machine operand for a MIR operand
+ */
+static sparc_operand_t *sparc_opr(mir_operand_t *op) {
+  if(!op)
+    return NULL;
 
-      break;
+  switch(op->optype) {
+  case MIR_OP_VAR:
+    return sparc_mem(SPARC_SP, sp_offset(op->var->offset, offset_words));
 
-    case MIR_STACK_ADDR: {
-      int offset = sp_offset(instr->operand[0]->val, offset_words);
+  case MIR_OP_CONST:
+    return sparc_imm(op->val);
 
-      if(offset > MAX_CONST) {
-	fprintf(fd, "\tsethi\t%%hi(%d), %s\n", offset & HIGH_BIT_MASK,
-		op_str[2]);
-	fprintf(fd, "\tor\t%s, %d, %s\n", op_str[2], offset & LOW_BIT_MASK,
-		op_str[2]);
-	fprintf(fd, "\tadd\t%s, %s, %s\n", SP_PREFIX, op_str[2], op_str[2]);
+  case MIR_OP_REG:
+  default:
+    if(op->indirect)
+      return sparc_mem(sparc_reg_number(op->val), 0);
+    return sparc_reg(sparc_reg_number(op->val));
+  }
+}
 
-      } else
-	fprintf(fd, "\tadd\t%s, %d, %s\n", SP_PREFIX, offset, op_str[2]);
-	break;
+/*
+ * Return the memory operand addressed by a MIR operand holding a pointer
+ */
+static sparc_operand_t *sparc_ptr_opr(mir_operand_t *op) {
+  if(op->optype == MIR_OP_CONST)
+    return sparc_mem(SPARC_G0, op->val);
 
-    }
+  return sparc_mem(sparc_reg_number(op->val), 0);
+}
 
-    case MIR_MOVE:
-      if(instr->operand[0]->indirect)
-	fprintf(fd, "\tld\t%s, %s\n", op_str[0], op_str[2]);
+/*
+ * Return the memory operand for a stack offset. Offsets too large for an
+ * immediate are built in the scratch register.
+ */
+static sparc_operand_t *sparc_stack_opr(int offset) {
+  if(offset <= MAX_CONST)
+    return sparc_mem(SPARC_SP, offset);
 
-      else if(instr->operand[2]->indirect)
-	fprintf(fd, "\tst\t%s, %s\n", op_str[0], op_str[2]);
+  sparc_emit_set(offset, SPARC_SCRATCH);
+  return sparc_mem_index(SPARC_SP, SPARC_SCRATCH);
+}
 
-      else
-	fprintf(fd, "\tmov\t%s, %s\n", op_str[0], op_str[2]);
-      break;
+/*
+ * Emit the instructions to set a register to a constant. Signed 13 bit
+ * values fit in a mov, values with the low 10 bits clear only need a
+ * sethi, and anything else takes a sethi/or pair.
+ */
+static void sparc_emit_set(int val, int reg) {
+  if(IS_SIMM13(val)) {
+    sparc_emit(SPARC_MOV, sparc_imm(val), sparc_reg(reg), NULL);
+    return;
+  }
 
-    case MIR_ADD:
-	fprintf(fd, "\tadd\t%s, %s, %s\n", op_str[0], op_str[1], op_str[2]);
-      break;
+  sparc_emit(SPARC_SETHI, sparc_hi(NULL, val), sparc_reg(reg), NULL);
+  if(val & SETHI_LOW_MASK)
+    sparc_emit(SPARC_OR, sparc_reg(reg), sparc_lo(NULL, val),
+	       sparc_reg(reg));
+}
 
-    case MIR_SUB:
-      fprintf(fd, "\tsub\t%s, %s, %s\n", op_str[0], op_str[1], op_str[2]);
-      break;
+/*
+ * Emit the move of a MIR operand into a hardware register
+ */
+static void sparc_emit_move(mir_operand_t *src, int reg) {
+  if(src->optype == MIR_OP_CONST)
+    sparc_emit_set(src->val, reg);
+  else if(src->indirect)
+    sparc_emit(SPARC_LD, sparc_opr(src), sparc_reg(reg), NULL);
+  else
+    sparc_emit_mov(sparc_opr(src), sparc_reg(reg));
+}
 
-    case MIR_MUL:
-      fprintf(fd, "\tsmul\t%s, %s, %s\n", op_str[0], op_str[1], op_str[2]);
-      break;
+/*
+ * Return a MIR operand as a register, setting the given scratch register
+ * for constants other than zero
+ */
+static sparc_operand_t *sparc_reg_opr(mir_operand_t *op, int scratch) {
+  if(op->optype != MIR_OP_CONST)
+    return sparc_opr(op);
 
-    case MIR_JUMP:
-      fprintf(fd, "\tba\t.%s\n", (*node)->jump->instruction->label);
-      fprintf(fd, "\tnop\n");
-      break;
+  if(!op->val)
+    return sparc_reg(SPARC_G0);
 
-    case MIR_IF:
-      if(!instr->operand[2]) {
-	fprintf(fd, "\tcmp\t%s, 0\n", op_str[0]);
-	fprintf(fd, "\tbe\t");
+  sparc_emit_set(op->val, scratch);
+  return sparc_reg(scratch);
+}
 
-      } else {
-	fprintf(fd, "\tcmp\t%s, %s\n", op_str[0], op_str[1]);
-
-	switch(instr->operand[2]->val) {
-	case MIR_EQL: fprintf(fd, "\tbe\t"); break;
-	case MIR_NEQ: fprintf(fd, "\tbne\t"); break;
-	case MIR_LSS: fprintf(fd, "\tbl\t"); break;
-	case MIR_LEQ: fprintf(fd, "\tble\t"); break;
-	case MIR_GTR: fprintf(fd, "\tbg\t"); break;
-	case MIR_GEQ: fprintf(fd, "\tbge\t"); break;
-	}
-      }
+/*
+ * Return a MIR operand as a register or signed 13 bit immediate, setting
+ * the scratch register for larger constants
+ */
+static sparc_operand_t *sparc_simm_opr(mir_operand_t *op) {
+  if(op->optype != MIR_OP_CONST || IS_SIMM13(op->val))
+    return sparc_opr(op);
 
-      fprintf(fd, ".%s\n", (*node)->jump->instruction->label);
-      fprintf(fd, "\tnop\n");
-      break;
+  sparc_emit_set(op->val, SPARC_SCRATCH);
+  return sparc_reg(SPARC_SCRATCH);
+}
 
-    case MIR_EQL:
-      fprintf(fd, "\tbe\t");
-      break;
+/*
+ * Emit an arithmetic instruction. Constants are kept to the second operand
+ * by the MIR passes, but the register allocator can rematerialise them into
+ * either one.
+ */
+static void sparc_emit_arith(mir_instr_t *instr) {
+  mir_operand_t *a = instr->operand[0], *b = instr->operand[1];
+  sparc_operand_t *src1, *src2;
+  int op, dest = sparc_reg_number(instr->operand[2]->val), val;
+
+  if(a->optype == MIR_OP_CONST && b->optype == MIR_OP_CONST &&
+     mir_fold_eval(instr->opcode, a->val, b->val, &val)) {
+    sparc_emit_set(val, dest);
+    return;
+  }
 
-    case MIR_NEQ:
-      fprintf(fd, "\tbne\t");
-      break;
+  switch(instr->opcode) {
+  case MIR_ADD: op = SPARC_ADD; break;
+  case MIR_SUB: op = SPARC_SUB; break;
+  case MIR_DIV:
+    sparc_emit_div(a, b, dest);
+    return;
+  case MIR_MUL:
+  default: op = SPARC_SMUL; break;
+  }
 
-    case MIR_LSS:
-      fprintf(fd, "\tbl\t");
-      break;
+  if(a->optype == MIR_OP_CONST && op != SPARC_SUB) {
+    a = instr->operand[1];
+    b = instr->operand[0];
+  }
 
-    case MIR_LEQ:
-      fprintf(fd, "\tble\t");
-      break;
+  if(op == SPARC_SMUL && b->optype == MIR_OP_CONST) {
+    sparc_emit_mul_const(sparc_reg_number(a->val), b->val, dest);
+    return;
+  }
 
-    case MIR_GTR:
-      fprintf(fd, "\tbg\t");
-      break;
+  src1 = sparc_reg_opr(a, SPARC_SCRATCH);
+  src2 = sparc_simm_opr(b);
+  sparc_emit(op, src1, src2, sparc_reg(dest));
+}
 
-    case MIR_GEQ:
-      fprintf(fd, "\tbge\t");
-      break;
+/*
+ * Return log2 of a power of two, or -1 for other values
+ */
+static int sparc_log2(unsigned int val) {
+  int k = 0;
 
-    case MIR_LOAD_STRING:
-      fprintf(fd, "\tsethi\t%%hi(.string%d), %s\n", instr->operand[0]->val,
-              op_str[2]);
-      fprintf(fd, "\tor\t%s, %%lo(.string%d), %s\n", op_str[2],
-              instr->operand[0]->val, op_str[2]);
-      break;
+  if(!val || (val & (val - 1)))
+    return -1;
 
-    case MIR_REG_LOAD:
-      fprintf(fd, "\tld\t[%s], %s\n", op_str[0], op_str[2]);
-      break;
+  while(val >>= 1)
+    k++;
+  return k;
+}
 
-    case MIR_HEAP_LOAD:
-      fprintf(fd, "\tsethi\t%%hi(%s), %s\n", instr->operand[0]->var->name,
-	      op_str[2]);
-      fprintf(fd, "\tor\t%s, %%lo(%s), %s\n", op_str[2],
-	      instr->operand[0]->var->name, op_str[2]);
-      fprintf(fd, "\tld\t[%s], %s\n", op_str[2], op_str[2]);
-      break;
+/*
+ * Emit a shift of a register by a constant
+ */
+static void sparc_emit_shift(int op, int src, int shift, int dest) {
+  sparc_emit(op, sparc_reg(src), sparc_imm(shift), sparc_reg(dest));
+}
 
-    case MIR_HEAP_ADDR:
+/*
+ * Emit a multiply by a constant. Powers of two, and constants next to or
+ * made up of two powers of two, are built from shifts and adds rather than
+ * taking an smul.
+ */
+static void sparc_emit_mul_const(int src, int val, int dest) {
+  unsigned int mag = val < 0 ? -(unsigned int)val : (unsigned int)val;
+  unsigned int low = mag & -mag;
 
-      fprintf(fd, "\tsethi\t%%hi(%s), %s\n",
-	      instr->operand[0]->optype == MIR_OP_VAR ?
-	      instr->operand[0]->var->name : op_str[0],
-	      op_str[2]);
+  if(!mag) {
+    sparc_emit_set(0, dest);
+    return;
+  }
 
-      fprintf(fd, "\tor\t%s, %%lo(%s), %s\n", op_str[2],
-	      instr->operand[0]->optype == MIR_OP_VAR ?
-	      instr->operand[0]->var->name : op_str[0], op_str[2]);
-      break;
+  if(mag == 1) {
+    if(val < 0)
+      sparc_emit(SPARC_SUB, sparc_reg(SPARC_G0), sparc_reg(src),
+		 sparc_reg(dest));
+    else
+      sparc_emit_mov(sparc_reg(src), sparc_reg(dest));
+    return;
+  }
+
+  if(sparc_log2(mag) != -1)
+    sparc_emit_shift(SPARC_SLL, src, sparc_log2(mag), dest);
+
+  else if(sparc_log2(mag - 1) != -1) {
+    sparc_emit_shift(SPARC_SLL, src, sparc_log2(mag - 1), SPARC_SCRATCH);
+    sparc_emit(SPARC_ADD, sparc_reg(SPARC_SCRATCH), sparc_reg(src),
+	       sparc_reg(dest));
+
+  } else if(sparc_log2(mag + 1) != -1) {
+    sparc_emit_shift(SPARC_SLL, src, sparc_log2(mag + 1), SPARC_SCRATCH);
+    sparc_emit(SPARC_SUB, sparc_reg(SPARC_SCRATCH), sparc_reg(src),
+	       sparc_reg(dest));
+
+  } else if(sparc_log2(mag - low) != -1) {
+    sparc_emit_shift(SPARC_SLL, src, sparc_log2(mag - low), SPARC_SCRATCH);
+    sparc_emit_shift(SPARC_SLL, src, sparc_log2(low), dest);
+    sparc_emit(SPARC_ADD, sparc_reg(SPARC_SCRATCH), sparc_reg(dest),
+	       sparc_reg(dest));
+
+  } else {
+    if(IS_SIMM13(val))
+      sparc_emit(SPARC_SMUL, sparc_reg(src), sparc_imm(val), sparc_reg(dest));
+    else {
+      sparc_emit_set(val, SPARC_SCRATCH);
+      sparc_emit(SPARC_SMUL, sparc_reg(src), sparc_reg(SPARC_SCRATCH),
+		 sparc_reg(dest));
+    }
+    return;
+  }
 
-    case MIR_STACK_LOAD: {
-      int offset = sp_offset(instr->operand[0]->val, offset_words);
+  if(val < 0)
+    sparc_emit(SPARC_NEG, sparc_reg(dest), NULL, NULL);
+}
 
-      if(offset > MAX_CONST) {
-	fprintf(fd, "\tsethi\t%%hi(%d), %s\n", offset & HIGH_BIT_MASK,
-		SCRATCH_REG);
-	fprintf(fd, "\tor\t%s, %d, %s\n", SCRATCH_REG, offset & LOW_BIT_MASK,
-		SCRATCH_REG);
-	fprintf(fd, "\tld\t[%s + %s], %s\n", SP_PREFIX, SCRATCH_REG, op_str[2]);
+/*
+ * Find the magic multiplier and shift for a signed divide by a constant,
+ * which is greater than two and not a power of two. The quotient is the
+ * high word of the dividend times the multiplier, plus the dividend when
+ * the multiplier is negative, shifted right and rounded towards zero.
+ * See Warren, Hacker's Delight, chapter 10.
+ */
+static void sparc_div_magic(unsigned int div, int *magic, int *shift) {
+  unsigned int two31 = 0x80000000U;
+  unsigned int anc = two31 - 1 - two31 % div;
+  unsigned int q1 = two31 / anc, r1 = two31 - q1 * anc;
+  unsigned int q2 = two31 / div, r2 = two31 - q2 * div;
+  unsigned int delta;
+  int p = 31;
+
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if(r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
 
-      } else
-	fprintf(fd, "\tld\t[%s + %d], %s\n", SP_PREFIX, offset, op_str[2]);
+    q2 *= 2;
+    r2 *= 2;
+    if(r2 >= div) {
+      q2++;
+      r2 -= div;
+    }
 
+    delta = div - r2;
+  } while(q1 < delta || (q1 == delta && r1 == 0));
 
-      break;
+  *magic = q2 + 1;
+  *shift = p - 32;
+}
+
+/*
+ * Emit a signed divide of a register by a non-zero constant, rounding
+ * towards zero. Powers of two are shifted, with the divisor less one added
+ * to negative dividends first, and other constants use a magic multiply.
+ */
+static void sparc_emit_div_const(int src, int val, int dest) {
+  unsigned int mag = val < 0 ? -(unsigned int)val : (unsigned int)val;
+  int k = sparc_log2(mag), magic, shift;
+
+  if(mag == 1) {
+    sparc_emit_mul_const(src, val, dest);
+    return;
+  }
+
+  if(k != -1) {
+    if(k == 1)
+      sparc_emit_shift(SPARC_SRL, src, 31, SPARC_SCRATCH);
+    else {
+      sparc_emit_shift(SPARC_SRA, src, 31, SPARC_SCRATCH);
+      sparc_emit_shift(SPARC_SRL, SPARC_SCRATCH, 32 - k, SPARC_SCRATCH);
     }
+    sparc_emit(SPARC_ADD, sparc_reg(src), sparc_reg(SPARC_SCRATCH),
+	       sparc_reg(SPARC_SCRATCH));
+    sparc_emit_shift(SPARC_SRA, SPARC_SCRATCH, k, dest);
+
+  } else {
+    sparc_div_magic(mag, &magic, &shift);
+
+    sparc_emit_set(magic, SPARC_SCRATCH);
+    sparc_emit(SPARC_SMUL, sparc_reg(src), sparc_reg(SPARC_SCRATCH),
+	       sparc_reg(SPARC_SCRATCH));
+    sparc_emit(SPARC_RD, sparc_y(), sparc_reg(SPARC_SCRATCH), NULL);
+    if(magic < 0)
+      sparc_emit(SPARC_ADD, sparc_reg(SPARC_SCRATCH), sparc_reg(src),
+		 sparc_reg(SPARC_SCRATCH));
+    if(shift)
+      sparc_emit_shift(SPARC_SRA, SPARC_SCRATCH, shift, SPARC_SCRATCH);
+
+    /* Add one to negative quotients */
+    sparc_emit_shift(SPARC_SRL, SPARC_SCRATCH, 31, dest);
+    sparc_emit(SPARC_ADD, sparc_reg(SPARC_SCRATCH), sparc_reg(dest),
+	       sparc_reg(dest));
+  }
+
+  if(val < 0)
+    sparc_emit(SPARC_NEG, sparc_reg(dest), NULL, NULL);
+}
+
+/*
+ * Emit a signed divide. sdiv divides the 64 bit value in %y and the
+ * dividend, so %y is set to the sign extension of the dividend first. The
+ * write to %y takes three instructions to be seen.
+ */
+static void sparc_emit_div(mir_operand_t *a, mir_operand_t *b, int dest) {
+  sparc_operand_t *src;
+  sparc_instr_t *wr;
+  int delay;
+
+  if(b->optype == MIR_OP_CONST && b->val && a->optype != MIR_OP_CONST) {
+    sparc_emit_div_const(sparc_reg_number(a->val), b->val, dest);
+    return;
+  }
+
+  if(a->optype == MIR_OP_CONST) {
+    sparc_emit(SPARC_WR, sparc_reg(SPARC_G0), sparc_imm(a->val < 0 ? -1 : 0),
+	       sparc_y());
+    wr = sparc_tail;
+    src = sparc_reg_opr(a, SPARC_SCRATCH);
+
+  } else {
+    src = sparc_opr(a);
+    sparc_emit_shift(SPARC_SRA, src->reg, 31, SPARC_SCRATCH);
+    sparc_emit(SPARC_WR, sparc_reg(SPARC_SCRATCH), sparc_imm(0), sparc_y());
+    wr = sparc_tail;
+  }
+
+  for(delay = 0; wr->next; wr = wr->next)
+    delay++;
+  for(; delay < 3; delay++)
+    sparc_emit(SPARC_NOP, NULL, NULL, NULL);
+
+  /* Only a zero or -1 divisor is left as a constant */
+  sparc_emit(SPARC_SDIV, src, sparc_opr(b), sparc_reg(dest));
+}
+
+/*
+ * Return non-zero if a comparison between two constants holds
+ */
+static int sparc_compare(int relop, int a, int b) {
+  switch(relop) {
+  case MIR_NEQ: return a != b;
+  case MIR_LSS: return a < b;
+  case MIR_LEQ: return a <= b;
+  case MIR_GTR: return a > b;
+  case MIR_GEQ: return a >= b;
+  case MIR_EQL:
+  default: return a == b;
+  }
+}
 
-    case MIR_REG_STORE:
-      fprintf(fd, "\tst\t%s, [%s]\n", op_str[0], op_str[2]);
+/*
+ * Emit a branch to the target of a MIR node, with an empty delay slot
+ */
+static void sparc_emit_branch(int op, mir_node_t *node) {
+  sparc_emit(op, sparc_label(node->jump->instruction->label), NULL, NULL);
+  sparc_emit(SPARC_NOP, NULL, NULL, NULL);
+}
+
+/*
+ * Emit the load of an address into a register with sethi/or
+ */
+static void sparc_emit_addr(char *sym, int val, int reg) {
+  sparc_emit(SPARC_SETHI, sparc_hi(sym, val), sparc_reg(reg), NULL);
+  sparc_emit(SPARC_OR, sparc_reg(reg), sparc_lo(sym, val), sparc_reg(reg));
+}
+
+/*
+ * Lower a single MIR instruction to machine instructions, not including
+ * its label
+ */
+static void gen_sparc_instr(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  sparc_operand_t *src;
+  sparc_instr_t *call;
+  int i, dest;
+
+  switch(instr->opcode) {
+  case MIR_NOP:
+    break;
+
+  case MIR_LABEL:
+    /* Function header */
+    current_arg = 0;
+    current_func = get_func_entry(instr->label);
+
+    /* Stack frame size, must be 8 byte aligned */
+    offset_words = max_call_args(node);
+    frame_size = align(STACK_HEADER_SIZE +
+		       max_scope_size(get_func_scope(current_func->name)) +
+		       (offset_words * WORD_SIZE));
+
+    sparc_emit(SPARC_LABEL, sparc_sym(current_func->name), NULL, NULL);
+
+    /* Leaf procedures run in the caller's window without a frame */
+    if(current_func->func_leaf)
       break;
 
-    case MIR_STACK_STORE: {
-      int offset = sp_offset(instr->operand[2]->val, offset_words);
+    /* The locals still belong to the caller until the save */
+    if(frame_size > MAX_CONST) {
+      sparc_emit_set(-frame_size, SPARC_SCRATCH);
+      sparc_emit(SPARC_SAVE, sparc_reg(SPARC_SP), sparc_reg(SPARC_SCRATCH),
+		 sparc_reg(SPARC_SP));
+
+    } else
+      sparc_emit(SPARC_SAVE, sparc_reg(SPARC_SP), sparc_imm(-frame_size),
+		 sparc_reg(SPARC_SP));
+
+    break;
+
+  case MIR_ADDR:
+    if(instr->operand[0]->optype == MIR_OP_VAR)
+      sparc_emit(SPARC_ADD, sparc_reg(SPARC_SP),
+		 sparc_imm(sp_offset(instr->operand[0]->var->offset,
+				     offset_words)),
+		 sparc_opr(instr->operand[2]));
+    else
+      sparc_emit(SPARC_LD, sparc_ptr_opr(instr->operand[0]),
+		 sparc_opr(instr->operand[2]), NULL);
+
+    break;
+
+  case MIR_STACK_ADDR: {
+    int offset = sp_offset(instr->operand[0]->val, offset_words);
 
-      if(offset > MAX_CONST) {
-	fprintf(fd, "\tsethi\t%%hi(%d), %%g1\n", offset & HIGH_BIT_MASK);
-	fprintf(fd, "\tor\t%%g1, %d, %%g1\n", offset & LOW_BIT_MASK);
-	fprintf(fd, "\tst\t%s, [%s + %%g1]\n", op_str[0], SP_PREFIX);
+    dest = sparc_reg_number(instr->operand[2]->val);
+    if(offset > MAX_CONST) {
+      sparc_emit_set(offset, dest);
+      sparc_emit(SPARC_ADD, sparc_reg(SPARC_SP), sparc_reg(dest),
+		 sparc_reg(dest));
 
-      } else
-	fprintf(fd, "\tst\t%s, [%s + %d]\n", op_str[0], SP_PREFIX, offset);
+    } else
+      sparc_emit(SPARC_ADD, sparc_reg(SPARC_SP), sparc_imm(offset),
+		 sparc_reg(dest));
+    break;
+  }
+
+  case MIR_MOVE:
+    if(instr->operand[0]->indirect)
+      sparc_emit(SPARC_LD, sparc_opr(instr->operand[0]),
+		 sparc_opr(instr->operand[2]), NULL);
+
+    else if(instr->operand[2]->indirect) {
+      src = sparc_reg_opr(instr->operand[0], SPARC_SCRATCH);
+      sparc_emit(SPARC_ST, src, sparc_opr(instr->operand[2]), NULL);
+
+    } else
+      sparc_emit_move(instr->operand[0],
+		      sparc_reg_number(instr->operand[2]->val));
+    break;
+
+  case MIR_ADD:
+  case MIR_SUB:
+  case MIR_MUL:
+  case MIR_DIV:
+    sparc_emit_arith(instr);
+    break;
+
+  case MIR_JUMP:
+    sparc_emit_branch(SPARC_BA, node);
+    break;
+
+  case MIR_IF: {
+    mir_operand_t *a = instr->operand[0], *b = instr->operand[1];
+    int branch = SPARC_BE;
+
+    /* Comparisons between constants are decided here */
+    if(a->optype == MIR_OP_CONST &&
+       (!instr->operand[2] || b->optype == MIR_OP_CONST)) {
+      if(instr->operand[2] ? sparc_compare(instr->operand[2]->val, a->val,
+					   b->val) : !a->val)
+	sparc_emit_branch(SPARC_BA, node);
       break;
     }
 
-    case MIR_HEAP_STORE:
-      fprintf(fd, "\tsethi\t%%hi(%s), %s\n", instr->operand[2]->var->name,
-	      op_str[1]);
-      fprintf(fd, "\tor\t%s, %%lo(%s), %s\n", op_str[1],
-	      instr->operand[2]->var->name, op_str[1]);
-      fprintf(fd, "\tst\t%s, [%s]\n", op_str[0], op_str[1]);
+    if(!instr->operand[2]) {
+      sparc_emit(SPARC_CMP, sparc_opr(a), sparc_imm(0), NULL);
 
-      break;
+    } else {
+      src = sparc_reg_opr(a, SPARC_SCRATCH);
+      sparc_emit(SPARC_CMP, src, sparc_simm_opr(b), NULL);
 
-    case MIR_RECEIVE:
-    case MIR_PUSH_ARG:
-    {
-      char *arg_str = sparc_opstr((*node)->instruction->operand[2],
-				  frame_size);
-
-      /* Additional arguments passed on stack */
-      if(current_arg >= REG_ARGS) {
-	/* Argument on stack */
-	fprintf(fd, "\tld\t[%s + %d], %s\n", FP_PREFIX,
-		STACK_ARGS_BASE + ((current_arg - REG_ARGS) * WORD_SIZE),
-		arg_str);
-      } else {
-	/* Argument in register */
-	if((*node)->instruction->opcode == MIR_RECEIVE)
-	  fprintf(fd, "\tmov\t%%i%d, %s\n", current_arg++, arg_str);
-	else
-	  fprintf(fd, "\tst\t%%i%d, [%s + %d]\n", current_arg++,
-		  SP_PREFIX, sp_offset((*node)->instruction->operand[2]->val,
-				       offset_words));
+      switch(instr->operand[2]->val) {
+      case MIR_EQL: branch = SPARC_BE; break;
+      case MIR_NEQ: branch = SPARC_BNE; break;
+      case MIR_LSS: branch = SPARC_BL; break;
+      case MIR_LEQ: branch = SPARC_BLE; break;
+      case MIR_GTR: branch = SPARC_BG; break;
+      case MIR_GEQ: branch = SPARC_BGE; break;
       }
+    }
 
-      free(arg_str);
+    sparc_emit_branch(branch, node);
+    break;
+  }
 
-      break;
-    }
+  case MIR_LOAD_STRING: {
+    char *string = malloc(20);
 
-    case MIR_CALL: {
-      char *arg_str;
+    sprintf(string, ".string%d", instr->operand[0]->val);
+    sparc_emit_addr(string, 0, sparc_reg_number(instr->operand[2]->val));
+    break;
+  }
 
-      /* Additional arguments passed on stack */
-      if(instr->num_args > REG_ARGS) {
-	for(i = REG_ARGS; i < instr->num_args; i++) {
-	  arg_str = sparc_opstr(instr->args[i], frame_size);
+  case MIR_REG_LOAD:
+    sparc_emit(SPARC_LD, sparc_ptr_opr(instr->operand[0]),
+	       sparc_opr(instr->operand[2]), NULL);
+    break;
 
-	  fprintf(fd, "\tst\t%s, [%s + %d]\n", arg_str, SP_PREFIX,
-		  ((i - REG_ARGS) * WORD_SIZE) + STACK_ARGS_BASE);
+  case MIR_HEAP_LOAD:
+    dest = sparc_reg_number(instr->operand[2]->val);
+    sparc_emit_addr(instr->operand[0]->var->name, 0, dest);
+    sparc_emit(SPARC_LD, sparc_mem(dest, 0), sparc_reg(dest), NULL);
+    break;
 
-	  free(arg_str);
-	}
-      }
+  case MIR_HEAP_ADDR:
+    dest = sparc_reg_number(instr->operand[2]->val);
+    if(instr->operand[0]->optype == MIR_OP_VAR)
+      sparc_emit_addr(instr->operand[0]->var->name, 0, dest);
+    else if(instr->operand[0]->optype == MIR_OP_CONST)
+      sparc_emit_addr(NULL, instr->operand[0]->val, dest);
+    else
+      compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		     "Cannot take the heap address of a register\n");
+    break;
+
+  case MIR_STACK_LOAD:
+    sparc_emit(SPARC_LD,
+	       sparc_stack_opr(sp_offset(instr->operand[0]->val, offset_words)),
+	       sparc_opr(instr->operand[2]), NULL);
+    break;
+
+  case MIR_REG_STORE:
+    src = sparc_reg_opr(instr->operand[0], SPARC_SCRATCH);
+    sparc_emit(SPARC_ST, src, sparc_ptr_opr(instr->operand[2]), NULL);
+    break;
 
-      /* First six arguments go in registers */
-      for(i = 0; i < instr->num_args && i < REG_ARGS; i++) {
-	arg_str = sparc_opstr(instr->args[i], frame_size);
+  case MIR_STACK_STORE: {
+    int offset = sp_offset(instr->operand[2]->val, offset_words);
 
-	if(instr->args[i]->indirect)
-	  fprintf(fd, "\tld\t%s, %%o%d\n", arg_str, i);
-	else
-	  fprintf(fd, "\tmov\t%s, %%o%d\n", arg_str, i);
+    /* Large offsets need the scratch register for the address */
+    src = sparc_reg_opr(instr->operand[0], offset > MAX_CONST ?
+			SPARC_SCRATCH2 : SPARC_SCRATCH);
+    sparc_emit(SPARC_ST, src, sparc_stack_opr(offset), NULL);
+    break;
+  }
+
+  case MIR_HEAP_STORE:
+    dest = sparc_reg_number(instr->operand[1]->val);
+    src = sparc_reg_opr(instr->operand[0], SPARC_SCRATCH);
+    sparc_emit_addr(instr->operand[2]->var->name, 0, dest);
+    sparc_emit(SPARC_ST, src, sparc_mem(dest, 0), NULL);
+    break;
 
-	free(arg_str);
+  case MIR_RECEIVE:
+  case MIR_PUSH_ARG:
+    /* Additional arguments passed on stack */
+    if(current_arg >= REG_ARGS) {
+      int arg_offset = STACK_ARGS_BASE + ((current_arg++ - REG_ARGS) *
+					  WORD_SIZE);
+
+      /* Argument on stack, spilled arguments go via %g1 */
+      if(instr->opcode == MIR_RECEIVE)
+	sparc_emit(SPARC_LD, sparc_mem(current_func->func_leaf ?
+				       SPARC_SP : SPARC_FP, arg_offset),
+		   sparc_opr(instr->operand[2]), NULL);
+      else {
+	sparc_emit(SPARC_LD, sparc_mem(SPARC_FP, arg_offset),
+		   sparc_reg(SPARC_SCRATCH), NULL);
+	sparc_emit(SPARC_ST, sparc_reg(SPARC_SCRATCH),
+		   sparc_mem(SPARC_SP, sp_offset(instr->operand[2]->val,
+						 offset_words)), NULL);
       }
+    } else {
+      /* Argument in register */
+      if(instr->opcode == MIR_RECEIVE)
+	sparc_emit_mov(sparc_reg((current_func->func_leaf ?
+				  SPARC_OUTS : SPARC_INS) + current_arg++),
+		       sparc_opr(instr->operand[2]));
+      else
+	sparc_emit(SPARC_ST, sparc_reg(SPARC_INS + current_arg++),
+		   sparc_mem(SPARC_SP, sp_offset(instr->operand[2]->val,
+						 offset_words)), NULL);
+    }
+    break;
+
+  case MIR_CALL:
+    /* Additional arguments passed on stack */
+    for(i = REG_ARGS; i < instr->num_args; i++) {
+      src = sparc_reg_opr(instr->args[i], SPARC_SCRATCH);
+      sparc_emit(SPARC_ST, src, sparc_mem(SPARC_SP, ((i - REG_ARGS) *
+						     WORD_SIZE) +
+					  STACK_ARGS_BASE), NULL);
+    }
 
-      fprintf(fd, "\tcall\t%s, 0\n", instr->operand[0]->var->name);
-      fprintf(fd, "\tnop\n");
+    /* First six arguments go in registers */
+    for(i = 0; i < instr->num_args && i < REG_ARGS; i++)
+      sparc_emit_move(instr->args[i], SPARC_OUTS + i);
 
-      /* Return value */
-      if(instr->operand[2])
-	fprintf(fd, "\tmov\t%%o0, %s\n", op_str[2]);
+    call = sparc_emit(SPARC_CALL, sparc_sym(instr->operand[0]->var->name),
+		      sparc_imm(0), NULL);
+    call->num_args = i;
+    sparc_emit(SPARC_NOP, NULL, NULL, NULL);
 
+    /* Return value */
+    if(instr->operand[2])
+      sparc_emit_mov(sparc_reg(SPARC_OUTS), sparc_opr(instr->operand[2]));
+    break;
+
+  case MIR_RETURN:
+    if(current_func->func_leaf) {
+      if(instr->operand[0])
+	sparc_emit_move(instr->operand[0], SPARC_OUTS);
+      sparc_emit(SPARC_RETL, NULL, NULL, NULL);
+      sparc_emit(SPARC_NOP, NULL, NULL, NULL);
       break;
     }
 
-    case MIR_RETURN:
-      fprintf(fd, "\tmov\t%s, %%i0\n", op_str[0]);
-      fprintf(fd, "\tret\n");
-      fprintf(fd, "\trestore\n");
-      break;
+    if(instr->operand[0])
+      sparc_emit_move(instr->operand[0], SPARC_INS);
+    sparc_emit(SPARC_RET, NULL, NULL, NULL);
+    sparc_emit(SPARC_RESTORE, NULL, NULL, NULL);
+    break;
 
-    case MIR_END:
-      /*
-       * Function footer.
-       * Only generate ret/restore if prev instruction is not a return
-       */
-      if((*node)->prev->instruction->opcode != MIR_RETURN) {
-	fprintf(fd, "\tret\n");
-	fprintf(fd, "\trestore\n");
+  case MIR_END:
+    /*
+     * Function footer.
+     * Only generate ret/restore if prev instruction is not a return
+     */
+    if(node->prev->instruction->opcode != MIR_RETURN) {
+      if(current_func->func_leaf) {
+	sparc_emit(SPARC_RETL, NULL, NULL, NULL);
+	sparc_emit(SPARC_NOP, NULL, NULL, NULL);
+      } else {
+	sparc_emit(SPARC_RET, NULL, NULL, NULL);
+	sparc_emit(SPARC_RESTORE, NULL, NULL, NULL);
       }
-      fprintf(fd, ".%s_end:\n", func->name);
-      fprintf(fd, "\t.size %s,.%s_end-%s\n", func->name,
-	      func->name, func->name);
-      done = 1;
-      break;
+    }
+    break;
+  }
+}
+
+/*
+ * Generate sparc code for a function
+ */
+void gen_sparc_func(FILE *fd, mir_node_t **node) {
+  sparc_instr_t *next;
+  mir_instr_t *instr;
+  int done, line_num;
+
+  current_func = NULL;
+  sparc_head = NULL;
+  sparc_tail = NULL;
 
+  line_num = 0;
+  done = 0;
+  while(*node && !done) {
+    instr = (*node)->instruction;
+
+    if(cflags.flags & CFLAG_OUTPUT_STABS) {
+      if(current_func && (*node)->src_line_num > line_num) {
+	line_num = (*node)->src_line_num;
+	sparc_emit(SPARC_LINE, sparc_imm(line_num), NULL, NULL);
+      }
     }
 
-    /* Free the operand strings */
-    for(i = 0; i < 3; i++)
-      free(op_str[i]);
+    if(instr->opcode != MIR_LABEL && instr->label)
+      sparc_emit(SPARC_LABEL, sparc_label(instr->label), NULL, NULL);
+
+    gen_sparc_instr(*node);
 
+    done = instr->opcode == MIR_END;
     *node = (*node)->next;
   }
-}
 
+  if(!sparc_head)
+    return;
+
+  sparc_optimise(sparc_head);
+  if(cflags.flags & CFLAG_OUTPUT_OBJECT)
+    elf_func(current_func->name, sparc_head);
+  else
+    sparc_print_func(fd, sparc_head);
+
+  for(; sparc_head; sparc_head = next) {
+    next = sparc_head->next;
+    sparc_free_instr(sparc_head);
+  }
+}
 
 /*
  * Generate sparc code from IC code
@@ -408,8 +1063,14 @@ void gen_sparc_code(char *basename) {
   mir_node_t *current;
   int i;
 
-  char *filename = malloc(strlen(basename) + 3);
+  char *filename = malloc(strlen(basename) + 4);
   strcpy(filename, basename);
+
+  if(cflags.flags & CFLAG_OUTPUT_OBJECT) {
+    gen_sparc_object(filename);
+    return;
+  }
+
   strcat(filename, ".s");
 
   if(!(fd = fopen(filename, "w")))
@@ -501,10 +1162,72 @@ void gen_sparc_code(char *basename) {
   /* Functions */
   for(i = 0; i < num_def_functions(); i++)
     gen_sparc_func(fd, &current);
+  out_flush(fd);
 
   /* Footer */
   fprintf(fd, "\t.ident \"HCC: History Capable Compiler\"\n");
+  fclose(fd);
+}
+
+/*
+ * Generate a relocatable ELF object from IC code. The sections match the
+ * assembly output, but debugging information isn't written.
+ */
+static void gen_sparc_object(char *filename) {
+  mir_node_t *current = mir_list_head();
+  name_record_t *record, *cur_var, *ptr_var;
+  char *source;
+  int i;
+
+  if(cflags.flags & CFLAG_OUTPUT_STABS) {
+    compiler_error(CERROR_WARN, CERROR_NO_LINE,
+		   "Debug symbols aren't written to objects\n");
+    cflags.flags &= ~CFLAG_OUTPUT_STABS;
+  }
+
+  source = malloc(strlen(filename) + 4);
+  sprintf(source, "%s.hc", filename);
+  strcat(filename, ".o");
 
+  elf_begin(source);
+
+  for(i = 0; i < num_strings(); i++)
+    elf_string(get_string_literal(i)->string);
+
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+
+    if(record->type_info->decl_type != TYPE_FUNCTION &&
+       !is_history_type(record->type_info) && record->name[0] != '.')
+      elf_common(record->name, sizeof_type(record->type_info), 4);
+  }
+
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+    if(!is_history_type(record->type_info))
+      continue;
+
+    elf_object(record->name, sizeof_type(record->type_info) +
+	       sizeof_history(record->type_info),
+	       WORD_SIZE + sizeof_history(record->type_info), NULL);
+
+    if(!(cflags.flags & CFLAG_HISTORY_SIMPLE_STORE &&
+	 get_history_depth(record->type_info) < cflags.history_simple_depth)) {
+      cur_var = history_current_entry(record);
+      elf_object(cur_var->name, sizeof_type(cur_var->type_info), WORD_SIZE,
+		 NULL);
+
+      ptr_var = history_ptr_entry(record);
+      elf_object(ptr_var->name, sizeof_type(ptr_var->type_info), WORD_SIZE,
+		 record->name);
+    }
+  }
+
+  for(i = 0; i < num_def_functions(); i++)
+    gen_sparc_func(NULL, &current);
+
+  elf_end(filename);
+  free(source);
 }
 
 /*
@@ -524,39 +1247,216 @@ static int max_call_args(mir_node_t *node) {
   return max_args - REG_ARGS;
 }
 
+
 /*
- * Return a string representation of a MIR operand
- * FIXME: This is a bit of a dirty hack
+ * Make room for at least n more characters in the output buffer
  */
-static char *sparc_opstr(mir_operand_t *op, int offset_words) {
-  char *str = malloc(16);
+static void out_reserve(int n) {
+  if(out_len + n <= out_size)
+    return;
+
+  while(out_len + n > out_size)
+    out_size = out_size ? out_size * 2 : OUT_BUF_SIZE;
+
+  if(!(out_buf = realloc(out_buf, out_size)))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Out of memory for assembly output\n");
+}
+
+static void out_char(char c) {
+  out_reserve(1);
+  out_buf[out_len++] = c;
+}
+
+static void out_str(char *str) {
+  int len = strlen(str);
+
+  out_reserve(len);
+  memcpy(out_buf + out_len, str, len);
+  out_len += len;
+}
+
+static void out_int(int val) {
+  char digits[12];
+  unsigned int uval = val;
+  int n = 0;
 
-  if(!op) {
-    sprintf(str, "(null)");
-    return str;
+  if(val < 0) {
+    out_char('-');
+    uval = -uval;
   }
 
-  switch(op->optype) {
-  case MIR_OP_VAR:
-    if(op->indirect)
-      sprintf(str, "[%s + %d]", SP_PREFIX, sp_offset(op->var->offset,
-						     offset_words));
+  do {
+    digits[n++] = '0' + (uval % 10);
+    uval /= 10;
+  } while(uval);
+
+  out_reserve(n);
+  while(n)
+    out_buf[out_len++] = digits[--n];
+}
+
+/*
+ * Write out the output buffer. Anything already written to the stdio
+ * stream goes first, so the two can be mixed.
+ */
+static void out_flush(FILE *fd) {
+  int done, written;
+
+  fflush(fd);
+  for(done = 0; done < out_len; done += written)
+    if((written = write(fileno(fd), out_buf + done, out_len - done)) < 0)
+      compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		     "Cannot write assembly output\n");
+
+  out_len = 0;
+}
+
+/*
+ * Write out the machine instructions for a function. Stabs go through the
+ * stdio stream, so the buffer is flushed ahead of them.
+ */
+static void sparc_print_func(FILE *fd, sparc_instr_t *instr) {
+  int i;
+
+  for(; instr; instr = instr->next) {
+    switch(instr->op) {
+    case SPARC_LABEL:
+      if(instr->operand[0]->type == SPARC_OP_LABEL) {
+	out_char('.');
+	out_str(instr->operand[0]->sym);
+	out_str(":\n");
+	break;
+      }
+
+      /* Function header */
+      if(cflags.flags & CFLAG_OUTPUT_STABS) {
+	out_flush(fd);
+	stabs_print_function(fd, current_func, frame_size, offset_words);
+      }
+
+      out_str("\t.global ");
+      out_str(current_func->name);
+      out_str("\n\t.type ");
+      out_str(current_func->name);
+      out_str(",#function\n\t.proc 020\n");
+      out_str(current_func->name);
+      out_str(":\n");
+      break;
+
+    case SPARC_LINE:
+      out_flush(fd);
+      stabs_print_line_num(fd, instr->operand[0]->val, current_func->name);
+      break;
+
+    default:
+      out_char('\t');
+      out_str(sparc_ops[instr->op].name);
+      if(instr->annul)
+	out_str(",a");
+
+      for(i = 0; i < 3 && instr->operand[i]; i++) {
+	out_str(i ? ", " : "\t");
+	sparc_print_operand(instr->operand[i]);
+      }
+      out_char('\n');
+      break;
+    }
+  }
+
+  /* Function footer */
+  out_char('.');
+  out_str(current_func->name);
+  out_str("_end:\n\t.size ");
+  out_str(current_func->name);
+  out_str(",.");
+  out_str(current_func->name);
+  out_str("_end-");
+  out_str(current_func->name);
+  out_char('\n');
+}
+
+/*
+ * Write out a hardware register
+ */
+static void sparc_print_reg(int reg) {
+  if(reg == SPARC_SP)
+    out_str(SP_PREFIX);
+  else if(reg == SPARC_FP)
+    out_str(FP_PREFIX);
+  else {
+    out_char('%');
+    out_char("goli"[reg / 8]);
+    out_char('0' + reg % 8);
+  }
+}
+
+/*
+ * Write out a machine operand
+ */
+static void sparc_print_operand(sparc_operand_t *op) {
+  switch(op->type) {
+  case SPARC_OP_REG:
+    sparc_print_reg(op->reg);
+    break;
+
+  case SPARC_OP_IMM:
+    out_int(op->val);
+    break;
+
+  case SPARC_OP_HI:
+  case SPARC_OP_LO:
+    out_str(op->type == SPARC_OP_HI ? "%hi(" : "%lo(");
+    if(op->sym)
+      out_str(op->sym);
     else
-      sprintf(str, "(%s + %d)", SP_PREFIX, sp_offset(op->var->offset,
-						     offset_words));
+      out_int(op->val);
+    out_char(')');
     break;
 
-  case MIR_OP_CONST:
-    sprintf(str, "%d", op->val);
+  case SPARC_OP_MEM:
+    out_char('[');
+
+    /* Absolute addresses */
+    if(op->reg == SPARC_G0 && op->index == -1 && !op->sym) {
+      out_int(op->val);
+      out_char(']');
+      break;
+    }
+
+    sparc_print_reg(op->reg);
+    if(op->index != -1) {
+      out_str(" + ");
+      sparc_print_reg(op->index);
+    } else if(op->sym) {
+      out_str(" + %lo(");
+      out_str(op->sym);
+      out_char(')');
+    } else if(op->val > 0) {
+      out_str(" + ");
+      out_int(op->val);
+    } else if(op->val < 0) {
+      out_str(" - ");
+      out_int(-op->val);
+    }
+    out_char(']');
     break;
 
-  case MIR_OP_REG:
-    //if(op->indirect)
-    //   sprintf(str, "[%s%d]", LOCAL_PREFIX, op->val);
-    //else
-      sprintf(str, "%s%d", LOCAL_PREFIX, op->val);
+  case SPARC_OP_SYM:
+    out_str(op->sym);
     break;
-  }
 
-  return str;
+  case SPARC_OP_LABEL:
+    out_char('.');
+    out_str(op->sym);
+    if(op->val) {
+      out_char('+');
+      out_int(op->val);
+    }
+    break;
+
+  case SPARC_OP_Y:
+    out_str("%y");
+    break;
+  }
 }
@@ -0,0 +1,849 @@
+/*
+ * sparcopt.c
+ *
+ * Machine level optimisations for the Sparc backend. These run on the
+ * instruction list for each function once registers have been assigned,
+ * removing instructions made redundant by the code generator, scheduling
+ * around load latency and filling branch delay slots.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cflags.h"
+#include "debug.h"
+#include "sparc.h"
+
+#define REG_BIT(reg) (1U << (reg))
+
+/* Longest run of instructions scheduled together */
+#define MAX_SCHED_BLOCK 128
+
+/*
+ * Registers live when a function returns. A normal return hands back %i0
+ * and the caller's stack and return address. A leaf procedure shares the
+ * caller's window, so everything the caller expects to survive is live.
+ */
+#define RET_LIVE (REG_BIT(SPARC_INS) | REG_BIT(SPARC_FP) | REG_BIT(SPARC_I7))
+#define RETL_LIVE (REG_BIT(SPARC_OUTS) | REG_BIT(SPARC_SP) |		\
+		   REG_BIT(SPARC_O7) | 0xffff0000U | 0xe0)
+
+/* Registers a call may change: the outs, %o7 and %g1-%g4 */
+#define CALL_CLOBBER ((0x3fU << SPARC_OUTS) | REG_BIT(SPARC_O7) | 0x1e)
+
+static int number_instrs(sparc_instr_t *);
+static sparc_instr_t *find_label(sparc_instr_t *, char *);
+static sparc_instr_t *next_instr(sparc_instr_t *);
+static int is_branch(sparc_instr_t *);
+static int is_slot(sparc_instr_t *);
+static unsigned int operand_regs(sparc_operand_t *);
+static unsigned int instr_uses(sparc_instr_t *);
+static unsigned int instr_defs(sparc_instr_t *);
+static int reads_mem(sparc_instr_t *);
+static int writes_mem(sparc_instr_t *);
+static int movable(sparc_instr_t *);
+static unsigned int *sparc_liveness(sparc_instr_t *);
+static void remove_instr(sparc_instr_t *);
+static int remove_redundant_moves(sparc_instr_t *);
+static int merge_low_parts(sparc_instr_t *, unsigned int *);
+static int remove_dead_defs(sparc_instr_t *, unsigned int *);
+static int remove_dead_stores(sparc_instr_t *);
+static void fold_returns(sparc_instr_t *);
+static int fill_from_block(sparc_instr_t *);
+static int fill_from_target(sparc_instr_t *, sparc_instr_t *);
+static int sched_latency(sparc_instr_t *);
+static int sched_boundary(sparc_instr_t *);
+static int sched_uses_y(sparc_instr_t *);
+static int sched_disjoint(sparc_instr_t *, sparc_instr_t *);
+static int sched_dependence(sparc_instr_t *, sparc_instr_t *);
+static int sched_better(int, int, int *, int *, int);
+static int schedule_block(sparc_instr_t **, int);
+static int schedule_instrs(sparc_instr_t *);
+
+extern compiler_options_t cflags;
+
+/* Branch targets, indexed by instruction id */
+static sparc_instr_t **targets;
+
+/*
+ * Run the machine level optimisations on a function. The head of the list
+ * is the function's label.
+ */
+void sparc_optimise(sparc_instr_t *head) {
+  sparc_instr_t *instr;
+  unsigned int *live_out;
+  int changed, removed = 0, filled = 0, moved;
+
+  if(cflags.oflags & OFLAG_PEEPHOLE) {
+    do {
+      changed = remove_redundant_moves(head);
+      changed += remove_dead_stores(head);
+
+      live_out = sparc_liveness(head);
+      changed += merge_low_parts(head, live_out);
+      free(live_out);
+
+      live_out = sparc_liveness(head);
+      changed += remove_dead_defs(head, live_out);
+      free(live_out);
+
+      removed += changed;
+    } while(changed);
+
+    debug_printf(1, "Removed %d machine instructions\n", removed);
+  }
+
+  /* Return values are set in the restore before anything moves */
+  if(cflags.oflags & OFLAG_DELAY_SLOTS)
+    fold_returns(head);
+
+  if(cflags.oflags & OFLAG_SCHEDULE) {
+    moved = schedule_instrs(head);
+    debug_printf(1, "Scheduled %d machine instructions\n", moved);
+  }
+
+  if(cflags.oflags & OFLAG_DELAY_SLOTS) {
+    /* Independent instructions are used first, then target copies */
+    for(instr = head; instr; instr = instr->next)
+      if(is_branch(instr))
+	filled += fill_from_block(instr);
+
+    for(instr = head; instr; instr = instr->next)
+      if(is_branch(instr))
+	filled += fill_from_target(head, instr);
+
+    debug_printf(1, "Filled %d delay slots\n", filled);
+  }
+
+  free(targets);
+  targets = NULL;
+}
+
+/*
+ * Number the instructions in a function and find the branch targets.
+ * Returns the number of instructions.
+ */
+static int number_instrs(sparc_instr_t *head) {
+  sparc_instr_t *instr;
+  int n = 0;
+
+  for(instr = head; instr; instr = instr->next)
+    instr->id = n++;
+
+  free(targets);
+  targets = malloc(n * sizeof(sparc_instr_t *));
+
+  for(instr = head; instr; instr = instr->next) {
+    targets[instr->id] = NULL;
+    if(is_branch(instr) && instr->operand[0] &&
+       instr->operand[0]->type == SPARC_OP_LABEL)
+      targets[instr->id] = find_label(head, instr->operand[0]->sym);
+  }
+
+  return n;
+}
+
+/*
+ * Return the label instruction for a local label
+ */
+static sparc_instr_t *find_label(sparc_instr_t *head, char *label) {
+  for(; head; head = head->next)
+    if(head->op == SPARC_LABEL && head->operand[0]->type == SPARC_OP_LABEL &&
+       !strcmp(head->operand[0]->sym, label))
+      return head;
+
+  return NULL;
+}
+
+/*
+ * Return the first real instruction at or after the given one
+ */
+static sparc_instr_t *next_instr(sparc_instr_t *instr) {
+  while(instr && (sparc_ops[instr->op].flags & SPARC_F_PSEUDO))
+    instr = instr->next;
+
+  return instr;
+}
+
+static int is_branch(sparc_instr_t *instr) {
+  return sparc_ops[instr->op].flags & SPARC_F_BRANCH;
+}
+
+/*
+ * Return non-zero if an instruction is in a delay slot
+ */
+static int is_slot(sparc_instr_t *instr) {
+  return instr->prev && is_branch(instr->prev);
+}
+
+/*
+ * Return the registers read by an operand, or written if it is a dest
+ */
+static unsigned int operand_regs(sparc_operand_t *op) {
+  if(!op)
+    return 0;
+
+  if(op->type == SPARC_OP_REG)
+    return REG_BIT(op->reg);
+
+  if(op->type == SPARC_OP_MEM)
+    return REG_BIT(op->reg) | (op->index != -1 ? REG_BIT(op->index) : 0);
+
+  return 0;
+}
+
+/*
+ * Return the registers read by an instruction
+ */
+static unsigned int instr_uses(sparc_instr_t *instr) {
+  unsigned int uses = 0;
+  int i;
+
+  switch(instr->op) {
+  case SPARC_CALL:
+    uses = ((1U << instr->num_args) - 1) << SPARC_OUTS;
+    uses |= REG_BIT(SPARC_SP);
+    break;
+
+  case SPARC_RET:
+    uses = RET_LIVE;
+    break;
+
+  case SPARC_RETL:
+    uses = RETL_LIVE;
+    break;
+
+  case SPARC_NEG:
+    uses = operand_regs(instr->operand[0]);
+    break;
+
+  case SPARC_SAVE:
+  case SPARC_RESTORE:
+    /* The dest is in the other window */
+    uses = operand_regs(instr->operand[0]) | operand_regs(instr->operand[1]);
+    break;
+
+  default:
+    for(i = 0; i < 3; i++)
+      if(i != sparc_ops[instr->op].dest)
+	uses |= operand_regs(instr->operand[i]);
+    break;
+  }
+
+  return uses & ~REG_BIT(SPARC_G0);
+}
+
+/*
+ * Return the registers written by an instruction
+ */
+static unsigned int instr_defs(sparc_instr_t *instr) {
+  unsigned int defs = 0;
+  int dest = sparc_ops[instr->op].dest;
+
+  if(instr->op == SPARC_CALL)
+    defs = CALL_CLOBBER;
+  else if(dest != -1 && instr->operand[dest] &&
+	  instr->operand[dest]->type == SPARC_OP_REG)
+    defs = REG_BIT(instr->operand[dest]->reg);
+
+  return defs & ~REG_BIT(SPARC_G0);
+}
+
+static int reads_mem(sparc_instr_t *instr) {
+  return (sparc_ops[instr->op].flags & SPARC_F_LOAD) ||
+    instr->op == SPARC_CALL;
+}
+
+static int writes_mem(sparc_instr_t *instr) {
+  return (sparc_ops[instr->op].flags & SPARC_F_STORE) ||
+    instr->op == SPARC_CALL;
+}
+
+/*
+ * Return non-zero if an instruction only affects its operands, so can be
+ * moved or copied into a delay slot. %y isn't tracked, so instructions
+ * which set or read it stay where they are.
+ */
+static int movable(sparc_instr_t *instr) {
+  int flags = sparc_ops[instr->op].flags;
+
+  return (flags & (SPARC_F_PURE | SPARC_F_LOAD | SPARC_F_STORE)) &&
+    !(flags & (SPARC_F_SETY | SPARC_F_USEY));
+}
+
+/*
+ * Compute the registers live after each instruction, indexed by id. The
+ * delay slot of a branch is its only successor, and the slot goes on to
+ * the target and, for conditional branches and calls, the next
+ * instruction. An annulled slot only runs when the branch is taken.
+ */
+static unsigned int *sparc_liveness(sparc_instr_t *head) {
+  sparc_instr_t *instr, *tail, *succ[2], *branch;
+  unsigned int *live_in, *live_out, out;
+  int n, i, changed;
+
+  n = number_instrs(head);
+  live_in = calloc(n, sizeof(unsigned int));
+  live_out = calloc(n, sizeof(unsigned int));
+
+  for(tail = head; tail->next; tail = tail->next)
+    ;
+
+  do {
+    changed = 0;
+
+    for(instr = tail; instr; instr = instr->prev) {
+      succ[0] = instr->next;
+      succ[1] = NULL;
+      out = 0;
+
+      if(is_slot(instr)) {
+	branch = instr->prev;
+
+	switch(branch->op) {
+	case SPARC_RET:
+	  succ[0] = NULL;
+	  out = RET_LIVE;
+	  break;
+
+	case SPARC_RETL:
+	  succ[0] = NULL;
+	  out = RETL_LIVE;
+	  break;
+
+	case SPARC_CALL:
+	  break;
+
+	default:
+	  succ[0] = targets[branch->id];
+
+	  /* A branch past the copied first instruction at its target */
+	  if(succ[0] && branch->operand[0]->val)
+	    succ[0] = next_instr(succ[0])->next;
+
+	  if(branch->op != SPARC_BA && !branch->annul)
+	    succ[1] = instr->next;
+	  break;
+	}
+
+      } else if(is_branch(instr) && instr->annul)
+	succ[1] = instr->next->next;
+
+      for(i = 0; i < 2; i++)
+	if(succ[i])
+	  out |= live_in[succ[i]->id];
+
+      live_out[instr->id] = out;
+      out = instr_uses(instr) | (out & ~instr_defs(instr));
+      if(out != live_in[instr->id]) {
+	live_in[instr->id] = out;
+	changed = 1;
+      }
+    }
+  } while(changed);
+
+  free(live_in);
+  return live_out;
+}
+
+static void remove_instr(sparc_instr_t *instr) {
+  sparc_unlink_instr(instr);
+  sparc_free_instr(instr);
+}
+
+/*
+ * Remove moves between two registers which already hold the same value.
+ * Copies are only tracked within a basic block.
+ */
+static int remove_redundant_moves(sparc_instr_t *head) {
+  sparc_instr_t *instr, *next;
+  unsigned int defs;
+  int copy[32], i, r, src, dest, removed = 0;
+
+  for(i = 0; i < 32; i++)
+    copy[i] = -1;
+
+  for(instr = head; instr; instr = next) {
+    next = instr->next;
+
+    if(instr->op == SPARC_LABEL || is_branch(instr) || is_slot(instr) ||
+       instr->op == SPARC_SAVE || instr->op == SPARC_RESTORE) {
+      for(i = 0; i < 32; i++)
+	copy[i] = -1;
+      continue;
+    }
+
+    if(instr->op == SPARC_MOV && instr->operand[0]->type == SPARC_OP_REG) {
+      src = instr->operand[0]->reg;
+      dest = instr->operand[1]->reg;
+
+      if(copy[dest] == src || copy[src] == dest) {
+	remove_instr(instr);
+	removed++;
+	continue;
+      }
+    }
+
+    defs = instr_defs(instr);
+    for(r = 0; r < 32; r++)
+      if(defs & REG_BIT(r))
+	for(i = 0; i < 32; i++)
+	  if(i == r || copy[i] == r)
+	    copy[i] = -1;
+
+    if(instr->op == SPARC_MOV && instr->operand[0]->type == SPARC_OP_REG)
+      copy[instr->operand[1]->reg] = instr->operand[0]->reg;
+  }
+
+  return removed;
+}
+
+/*
+ * Fold the %lo part of an address built with sethi/or into the load or
+ * store which uses it, if the register isn't needed afterwards:
+ *
+ *   sethi %hi(x), r            sethi %hi(x), r
+ *   or    r, %lo(x), r    =>   ld    [r + %lo(x)], d
+ *   ld    [r], d
+ */
+static int merge_low_parts(sparc_instr_t *head, unsigned int *live_out) {
+  sparc_instr_t *instr, *or, *mem;
+  sparc_operand_t *addr;
+  int reg, merged = 0;
+
+  for(instr = head; instr; instr = instr->next) {
+    if(instr->op != SPARC_SETHI || !instr->operand[0]->sym)
+      continue;
+
+    reg = instr->operand[1]->reg;
+    or = instr->next;
+    if(!or || or->op != SPARC_OR ||
+       or->operand[0]->type != SPARC_OP_REG || or->operand[0]->reg != reg ||
+       or->operand[1]->type != SPARC_OP_LO || or->operand[1]->val ||
+       strcmp(or->operand[1]->sym, instr->operand[0]->sym) ||
+       or->operand[2]->reg != reg)
+      continue;
+
+    mem = or->next;
+    if(!mem || (mem->op != SPARC_LD && mem->op != SPARC_ST))
+      continue;
+
+    addr = mem->operand[mem->op == SPARC_LD ? 0 : 1];
+    if(addr->type != SPARC_OP_MEM || addr->reg != reg || addr->index != -1 ||
+       addr->val || addr->sym)
+      continue;
+
+    /* The full address must not be needed after the load or store */
+    if(mem->op == SPARC_ST && (operand_regs(mem->operand[0]) & REG_BIT(reg)))
+      continue;
+    if((live_out[mem->id] & REG_BIT(reg)) && !(instr_defs(mem) &
+					       REG_BIT(reg)))
+      continue;
+
+    addr->sym = or->operand[1]->sym;
+    remove_instr(or);
+    merged++;
+  }
+
+  return merged;
+}
+
+/*
+ * Remove instructions whose result is never used. Loads from the stack
+ * can't fault, so they are removed as well.
+ */
+static int remove_dead_defs(sparc_instr_t *head, unsigned int *live_out) {
+  sparc_instr_t *instr, *next;
+  unsigned int defs;
+  int removed = 0;
+
+  for(instr = head; instr; instr = next) {
+    next = instr->next;
+
+    if(is_slot(instr))
+      continue;
+
+    /* A multiply may only be there to set %y */
+    if(sparc_ops[instr->op].flags & SPARC_F_SETY)
+      continue;
+
+    if(!(sparc_ops[instr->op].flags & SPARC_F_PURE) &&
+       !(instr->op == SPARC_LD && (instr->operand[0]->reg == SPARC_SP ||
+				   instr->operand[0]->reg == SPARC_FP)))
+      continue;
+
+    defs = instr_defs(instr);
+    if(defs && !(defs & live_out[instr->id])) {
+      remove_instr(instr);
+      removed++;
+    }
+  }
+
+  return removed;
+}
+
+/*
+ * Remove stores to a stack slot which is stored to again before anything
+ * can read it
+ */
+static int remove_dead_stores(sparc_instr_t *head) {
+  sparc_instr_t *instr, *next, *later;
+  sparc_operand_t *addr, *later_addr;
+  int removed = 0;
+
+  for(instr = head; instr; instr = next) {
+    next = instr->next;
+
+    if(instr->op != SPARC_ST || is_slot(instr))
+      continue;
+
+    addr = instr->operand[1];
+    if(addr->reg != SPARC_SP || addr->index != -1 || addr->sym)
+      continue;
+
+    for(later = next; later; later = later->next) {
+      if(later->op == SPARC_LABEL || is_branch(later) || reads_mem(later) ||
+	 later->op == SPARC_SAVE || later->op == SPARC_RESTORE)
+	break;
+
+      if(later->op != SPARC_ST)
+	continue;
+
+      later_addr = later->operand[1];
+      if(later_addr->reg == SPARC_SP && later_addr->index == -1 &&
+	 !later_addr->sym && later_addr->val == addr->val) {
+	remove_instr(instr);
+	removed++;
+	break;
+      }
+    }
+  }
+
+  return removed;
+}
+
+/*
+ * Set the return value in the restore which returns to the caller,
+ * since it reads its operands in the callee's window:
+ *
+ *   mov  x, %i0
+ *   ret               =>   ret
+ *   restore                restore x, 0, %o0
+ */
+static void fold_returns(sparc_instr_t *head) {
+  sparc_instr_t *instr, *mov, *restore;
+  sparc_operand_t *src;
+
+  for(instr = head; instr; instr = instr->next) {
+    if(instr->op != SPARC_RET)
+      continue;
+
+    mov = instr->prev;
+    restore = instr->next;
+    if(mov->op != SPARC_MOV || is_slot(mov) ||
+       mov->operand[1]->reg != SPARC_INS || restore->operand[0])
+      continue;
+
+    src = mov->operand[0];
+    if(src->type == SPARC_OP_REG) {
+      restore->operand[0] = sparc_reg(src->reg);
+      restore->operand[1] = sparc_imm(0);
+
+    } else if(src->type == SPARC_OP_IMM && IS_SIMM13(src->val)) {
+      restore->operand[0] = sparc_reg(SPARC_G0);
+      restore->operand[1] = sparc_imm(src->val);
+
+    } else
+      continue;
+
+    restore->operand[2] = sparc_reg(SPARC_OUTS);
+    remove_instr(mov);
+  }
+}
+
+/*
+ * Fill the delay slot of a branch with an earlier instruction from the
+ * same basic block which nothing after it depends on. Returns non-zero if
+ * the slot was filled.
+ */
+static int fill_from_block(sparc_instr_t *branch) {
+  sparc_instr_t *slot = branch->next, *instr;
+  unsigned int uses, defs, instr_use, instr_def;
+  int loads = 0, stores = 0;
+
+  if(!slot || slot->op != SPARC_NOP)
+    return 0;
+
+  /* Registers the branch itself reads or writes when it issues */
+  uses = 0;
+  defs = 0;
+  if(branch->op == SPARC_RET)
+    uses = REG_BIT(SPARC_I7);
+  else if(branch->op == SPARC_RETL)
+    uses = REG_BIT(SPARC_O7);
+  else if(branch->op == SPARC_CALL)
+    defs = REG_BIT(SPARC_O7);
+
+  for(instr = branch->prev; instr; instr = instr->prev) {
+    if(instr->op == SPARC_LINE)
+      continue;
+
+    if(instr->op == SPARC_LABEL || is_branch(instr) || is_slot(instr) ||
+       instr->op == SPARC_SAVE || instr->op == SPARC_RESTORE)
+      return 0;
+
+    instr_use = instr_uses(instr);
+    instr_def = instr_defs(instr);
+
+    if(movable(instr) && !(instr_def & (uses | defs)) &&
+       !(instr_use & defs) &&
+       !(reads_mem(instr) && stores) &&
+       !(writes_mem(instr) && (loads || stores))) {
+      sparc_unlink_instr(instr);
+      sparc_insert_after(branch, instr);
+      remove_instr(slot);
+      return 1;
+    }
+
+    uses |= instr_use;
+    defs |= instr_def;
+    loads |= reads_mem(instr);
+    stores |= writes_mem(instr);
+  }
+
+  return 0;
+}
+
+/*
+ * Fill the delay slot of a branch with a copy of the first instruction at
+ * its target, and branch past it instead. The slot is annulled for
+ * conditional branches so the copy only runs when the branch is taken.
+ */
+static int fill_from_target(sparc_instr_t *head, sparc_instr_t *branch) {
+  sparc_instr_t *slot = branch->next, *target, *copy;
+
+  if(!slot || slot->op != SPARC_NOP ||
+     (branch->op != SPARC_BA && !(sparc_ops[branch->op].flags &
+				  SPARC_F_COND)))
+    return 0;
+
+  target = find_label(head, branch->operand[0]->sym);
+  if(!target || !(target = next_instr(target)) || !movable(target))
+    return 0;
+
+  copy = sparc_copy_instr(target);
+  sparc_insert_after(branch, copy);
+  remove_instr(slot);
+
+  branch->operand[0]->val = 4;
+  if(branch->op != SPARC_BA)
+    branch->annul = 1;
+
+  return 1;
+}
+
+/*
+ * Cycles before the result of an instruction can be used. Loads have a
+ * one cycle delay, and multiplies and divides take several.
+ */
+static int sched_latency(sparc_instr_t *instr) {
+  switch(instr->op) {
+  case SPARC_LD:
+    return 2;
+
+  case SPARC_SMUL:
+    return 5;
+
+  case SPARC_SDIV:
+    return 20;
+
+  default:
+    return 1;
+  }
+}
+
+/*
+ * Return non-zero if an instruction ends a block for scheduling. Branches
+ * and their slots, window changes and pseudo instructions stay in place.
+ */
+static int sched_boundary(sparc_instr_t *instr) {
+  return (sparc_ops[instr->op].flags & SPARC_F_PSEUDO) || is_branch(instr) ||
+    is_slot(instr) || instr->op == SPARC_SAVE || instr->op == SPARC_RESTORE;
+}
+
+/*
+ * Return non-zero if an instruction sets or reads %y. The nops which wait
+ * for a write to %y are kept in order with it.
+ */
+static int sched_uses_y(sparc_instr_t *instr) {
+  return (sparc_ops[instr->op].flags & (SPARC_F_SETY | SPARC_F_USEY)) ||
+    instr->op == SPARC_NOP;
+}
+
+/*
+ * Return non-zero if two memory accesses are to different words of the
+ * frame, so can be reordered
+ */
+static int sched_disjoint(sparc_instr_t *a, sparc_instr_t *b) {
+  sparc_operand_t *addr_a, *addr_b;
+
+  addr_a = a->operand[a->op == SPARC_ST ? 1 : 0];
+  addr_b = b->operand[b->op == SPARC_ST ? 1 : 0];
+
+  return addr_a->reg == addr_b->reg &&
+    (addr_a->reg == SPARC_SP || addr_a->reg == SPARC_FP) &&
+    addr_a->index == -1 && addr_b->index == -1 &&
+    !addr_a->sym && !addr_b->sym && addr_a->val != addr_b->val;
+}
+
+/*
+ * Return the number of cycles the second of two instructions has to wait
+ * after the first issues, or 0 if they are independent
+ */
+static int sched_dependence(sparc_instr_t *a, sparc_instr_t *b) {
+  unsigned int uses_a = instr_uses(a), defs_a = instr_defs(a);
+  unsigned int uses_b = instr_uses(b), defs_b = instr_defs(b);
+
+  if(defs_a & uses_b)
+    return sched_latency(a);
+
+  if(sched_uses_y(a) && sched_uses_y(b))
+    return (sparc_ops[a->op].flags & SPARC_F_SETY) &&
+      (sparc_ops[b->op].flags & SPARC_F_USEY) ? sched_latency(a) : 1;
+
+  if((uses_a & defs_b) || (defs_a & defs_b))
+    return 1;
+
+  if(((writes_mem(a) && (reads_mem(b) || writes_mem(b))) ||
+      (reads_mem(a) && writes_mem(b))) && !sched_disjoint(a, b))
+    return 1;
+
+  return 0;
+}
+
+/*
+ * Return non-zero if instruction a should issue before b: one which is
+ * ready goes first, then the higher priority among ready instructions or
+ * the sooner ready among waiting ones. Ties keep the original order.
+ */
+static int sched_better(int a, int b, int *ready, int *prio, int cycle) {
+  int ready_a = ready[a] <= cycle, ready_b = ready[b] <= cycle;
+
+  if(ready_a != ready_b)
+    return ready_a;
+
+  if(!ready_a && ready[a] != ready[b])
+    return ready[a] < ready[b];
+
+  return prio[a] > prio[b] || (prio[a] == prio[b] && a < b);
+}
+
+/*
+ * List schedule a block of instructions ending with the given one. Each
+ * instruction's priority is its longest latency path to the end of the
+ * block, including the results the branch after the block waits on.
+ * Instructions are issued in priority order once their operands are
+ * ready, so independent work is moved in after loads and multiplies.
+ * Returns the number of instructions which moved.
+ */
+static int schedule_block(sparc_instr_t **block, int n) {
+  sparc_instr_t *before = block[0]->prev, *after = block[n - 1]->next;
+  sparc_instr_t **order;
+  unsigned int branch_uses = 0;
+  unsigned char *dep;
+  int *prio, *ready, *preds, *done;
+  int i, j, best, cycle, moved = 0;
+
+  dep = calloc(n * n, 1);
+  prio = calloc(n, sizeof(int));
+  ready = calloc(n, sizeof(int));
+  preds = calloc(n, sizeof(int));
+  done = calloc(n, sizeof(int));
+  order = malloc(n * sizeof(sparc_instr_t *));
+
+  for(i = 0; i < n; i++)
+    for(j = i + 1; j < n; j++)
+      if((dep[i * n + j] = sched_dependence(block[i], block[j])))
+	preds[j]++;
+
+  /* Results read by the branch ending the block */
+  if(after && is_branch(after))
+    branch_uses = instr_uses(after);
+
+  for(i = n - 1; i >= 0; i--) {
+    if((instr_defs(block[i]) & branch_uses) ||
+       (after && (sparc_ops[after->op].flags & SPARC_F_COND) &&
+	(sparc_ops[block[i]->op].flags & SPARC_F_SETCC)))
+      prio[i] = sched_latency(block[i]);
+
+    for(j = i + 1; j < n; j++)
+      if(dep[i * n + j] && dep[i * n + j] + prio[j] > prio[i])
+	prio[i] = dep[i * n + j] + prio[j];
+  }
+
+  for(cycle = 0, i = 0; i < n; i++, cycle++) {
+    best = -1;
+    for(j = 0; j < n; j++)
+      if(!done[j] && !preds[j] &&
+	 (best == -1 || sched_better(j, best, ready, prio, cycle)))
+	best = j;
+
+    if(ready[best] > cycle)
+      cycle = ready[best];
+
+    done[best] = 1;
+    order[i] = block[best];
+    if(best != i)
+      moved++;
+
+    for(j = best + 1; j < n; j++)
+      if(dep[best * n + j]) {
+	preds[j]--;
+	if(cycle + dep[best * n + j] > ready[j])
+	  ready[j] = cycle + dep[best * n + j];
+      }
+  }
+
+  /* Relink the block in its new order */
+  for(i = 0; i < n; i++) {
+    order[i]->prev = i ? order[i - 1] : before;
+    order[i]->next = i < n - 1 ? order[i + 1] : after;
+  }
+  before->next = order[0];
+  if(after)
+    after->prev = order[n - 1];
+
+  free(dep);
+  free(prio);
+  free(ready);
+  free(preds);
+  free(done);
+  free(order);
+
+  return moved;
+}
+
+/*
+ * Schedule each basic block of a function. Registers have already been
+ * assigned, so this only reorders instructions and can't add spills.
+ * Returns the number of instructions which moved.
+ */
+static int schedule_instrs(sparc_instr_t *head) {
+  sparc_instr_t *block[MAX_SCHED_BLOCK], *instr, *next;
+  int n = 0, moved = 0;
+
+  for(instr = head; instr; instr = next) {
+    next = instr->next;
+
+    if(!sched_boundary(instr))
+      block[n++] = instr;
+
+    if(n && (sched_boundary(instr) || !next || n == MAX_SCHED_BLOCK)) {
+      if(n > 1)
+	moved += schedule_block(block, n);
+      n = 0;
+    }
+  }
+
+  return moved;
+}
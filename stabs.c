@@ -71,10 +71,11 @@ void stabs_print_function(FILE *fd, name_record_t *func,
     stabs_print_type(fd, arg_scope->name_table[i]->type_info);
     fprintf(fd, "\",64,0,0,%d\n", SPARC_INS + i);
 
-    if(arg_scope->name_table[i]->reg_alloc != -1) {
+    if(arg_scope->name_table[i]->reg_alloc > 0) {
       fprintf(fd, ".stabs \"%s:r", arg_scope->name_table[i]->name);
       stabs_print_type(fd, arg_scope->name_table[i]->type_info);
-      fprintf(fd, "\",64,0,0,%d\n", SPARC_LOCALS + i);
+      fprintf(fd, "\",64,0,0,%d\n",
+	      sparc_reg_number(arg_scope->name_table[i]->reg_alloc - 1));
     }
   }
 
@@ -469,6 +469,7 @@ name_record_t *enter(char *name) {
   entry->reg_alloc = -1;
   entry->storage_level = -1;
   entry->func_inline = 0;
+  entry->func_leaf = 0;
 
   /* Mark all variable as may-aliases if debugging is enabled */
   if(cflags.flags & CFLAG_OUTPUT_STABS)
@@ -804,6 +805,7 @@ name_record_t *declare_entry_point(void) {
   entry->num_args = 0;
   entry->offset = 0;
   entry->func_inline = 0;
+  entry->func_leaf = 0;
   entry->type_info = malloc(sizeof(type_info_t));
   entry->type_info->signature = malloc(sizeof(unsigned int));
   entry->type_info->length = 1;
@@ -828,6 +830,7 @@ name_record_t *declare_builtin_func(char *name, type_info_t *type_info) {
   entry->num_args = 0;
   entry->offset = 0;
   entry->func_inline = 0;
+  entry->func_leaf = 0;
   entry->type_info = type_info;
 
   debug_printf(1, "Added builtin function %s, type = ", entry->name);
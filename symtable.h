@@ -85,6 +85,9 @@ typedef struct name_table_s {
 
   /* For functions */
   int func_inline;
+
+  /* Leaf functions run in the caller's register window */
+  int func_leaf;
   struct mir_node_s *mir_first;
   struct mir_node_s *mir_last;
 
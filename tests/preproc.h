@@ -0,0 +1,21 @@
+/*
+ * tests/preproc.h
+ *
+ * Included twice by preproc.hc, the guard must stop the second copy
+ *
+ */
+#ifndef PREPROC_H
+#define PREPROC_H
+
+#ifdef PREPROC_BODY
+#error preproc.h was read twice
+#endif
+#define PREPROC_BODY
+
+func int twice(int n);
+
+int twice(int n) {
+  return n + n;
+}
+
+#endif /* PREPROC_H */
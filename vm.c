@@ -0,0 +1,1094 @@
+/*
+ * vm.c
+ *
+ * MIR interpreter. Translates the MIR, after the munging passes but
+ * before register allocation, into a compact array of threaded code and
+ * runs it in-process, so that programs can be run without an assembler or
+ * a Sparc machine.
+ *
+ * Operands are decoded once, into slots in a register file for each call.
+ * A function's slots hold its arguments, temporaries, the variables held
+ * in registers, a few scratch slots and its constants. Globals, strings,
+ * the heap and the frames of locals which have their address taken live
+ * in the program's memory, where addresses are 4 byte offsets. The rtlib
+ * history functions are compiled in with the program, and the rtlib
+ * print, timer and memory functions are run natively.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "symtable.h"
+#include "typechk.h"
+#include "scope.h"
+#include "mir.h"
+#include "history.h"
+#include "strings.h"
+#include "cerror.h"
+#include "debug.h"
+#include "cflags.h"
+#include "vm.h"
+
+/* Dispatch with computed gotos where the compiler supports them */
+#ifdef __GNUC__
+#define VM_THREADED
+#endif
+
+static const char *vm_native_names[VM_NUM_NATIVES] = {
+  "printf", "print_num", "print_addr", "print_sep", "print_str", "get_num",
+  "start_timer", "stop_timer", "print_time", "malloc", "free", "memcpy"
+};
+
+/* Slots for operands which have to be loaded from memory */
+#define VM_NUM_SCRATCH 8
+
+/* State saved by a call */
+typedef struct {
+  vm_instr_t *ip;
+  int *regs;
+  vm_func_t *func;
+  int fp;
+
+} vm_call_t;
+
+typedef struct {
+  name_record_t *record;
+  int addr;
+
+} vm_global_t;
+
+static int vm_align(int);
+static int vm_unescape(char *, char *);
+static void vm_load_data(void);
+static int vm_global_addr(name_record_t *);
+static vm_func_t *vm_find_func(name_record_t *);
+static int vm_emit(int, int, int, int);
+static int vm_var_index(name_record_t *);
+static void vm_scan_func(mir_node_t *);
+static int vm_const(int);
+static int vm_scratch(void);
+static int vm_label_num(mir_node_t *);
+static int vm_value(mir_operand_t *);
+static int vm_src(mir_operand_t *);
+static int vm_dest(mir_operand_t *);
+static void vm_set_dest(mir_operand_t *, int);
+static void vm_translate_call(mir_instr_t *);
+static void vm_translate_instr(mir_node_t *);
+static void vm_translate_func(mir_node_t **);
+static void vm_translate(void);
+static char *vm_string(int);
+static void vm_check_addr(int, int);
+static void vm_printf(int *, int *, int);
+static int vm_execute(vm_func_t *);
+
+extern compiler_options_t cflags;
+extern scope_node_t *global_scope;
+
+/* Word of the program's memory */
+#define VM_WORD(addr) (*(int *)(vm_mem + (unsigned int)(addr)))
+
+char *vm_mem;
+static int vm_heap;
+static int *vm_strings;
+
+static vm_global_t *vm_globals;
+static int vm_num_globals;
+
+vm_instr_t *vm_code;
+int vm_num_code;
+static int vm_max_code;
+
+vm_func_t *vm_funcs;
+int vm_num_funcs;
+
+/* Instruction each label was translated to, indexed by label number */
+static int *vm_labels;
+
+static clock_t vm_timer, vm_elapsed;
+
+/*
+ * The function being translated. Variables held in registers are numbered
+ * in the order they are first used. A function's slots start with its
+ * arguments, so that calls write them straight into the callee's slots.
+ */
+static vm_func_t *current_func;
+static name_record_t **func_vars;
+static int num_func_vars, max_func_vars, current_arg, uses_stack;
+static int num_params, temp_base, var_base, scratch_base, num_scratch;
+
+static int vm_align(int addr) {
+  return (addr + 7) & ~7;
+}
+
+/*
+ * Copy a string literal, converting its escapes. Returns the length.
+ */
+static int vm_unescape(char *dest, char *src) {
+  int len = 0, val, i;
+
+  while(*src) {
+    if(*src != '\\' || !src[1]) {
+      dest[len++] = *src++;
+      continue;
+    }
+
+    src++;
+    switch(*src) {
+    case 'n': dest[len++] = '\n'; src++; break;
+    case 't': dest[len++] = '\t'; src++; break;
+    case 'r': dest[len++] = '\r'; src++; break;
+    case 'a': dest[len++] = '\a'; src++; break;
+    case 'b': dest[len++] = '\b'; src++; break;
+    case 'f': dest[len++] = '\f'; src++; break;
+    case 'v': dest[len++] = '\v'; src++; break;
+
+    case '0': case '1': case '2': case '3':
+    case '4': case '5': case '6': case '7':
+      for(i = 0, val = 0; i < 3 && *src >= '0' && *src <= '7'; i++)
+	val = (val * 8) + (*src++ - '0');
+      dest[len++] = val;
+      break;
+
+    default:
+      dest[len++] = *src++;
+      break;
+    }
+  }
+
+  dest[len] = '\0';
+  return len;
+}
+
+/*
+ * Lay out the strings and globals in the program's memory. History
+ * pointers start at the beginning of their buffers.
+ */
+static void vm_load_data(void) {
+  name_record_t *record;
+  int addr = VM_DATA_BASE, size, i;
+
+  if(!(vm_mem = calloc(VM_MEM_SIZE, 1)))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE, "Out of memory\n");
+
+  vm_strings = malloc(sizeof(int) * (num_strings() + 1));
+  for(i = 0; i < num_strings(); i++) {
+    vm_strings[i] = addr;
+    addr += vm_unescape(vm_mem + addr, get_string_literal(i)->string) + 1;
+  }
+
+  vm_globals = malloc(sizeof(vm_global_t) * (global_scope->num_records + 1));
+  vm_num_globals = 0;
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+    if(record->type_info->decl_type == TYPE_FUNCTION)
+      continue;
+
+    size = sizeof_type(record->type_info);
+    if(is_history_type(record->type_info))
+      size += sizeof_history(record->type_info);
+
+    addr = vm_align(addr);
+    vm_globals[vm_num_globals].record = record;
+    vm_globals[vm_num_globals++].addr = addr;
+    addr += size > 0 ? size : (int)sizeof(int);
+  }
+
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+
+    if(is_history_type(record->type_info) &&
+       !(cflags.flags & CFLAG_HISTORY_SIMPLE_STORE &&
+	 get_history_depth(record->type_info) < cflags.history_simple_depth))
+      VM_WORD(vm_global_addr(history_ptr_entry(record))) =
+	vm_global_addr(record);
+  }
+
+  vm_heap = vm_align(addr);
+}
+
+static int vm_global_addr(name_record_t *record) {
+  int i;
+
+  /* Names are resolved as get_var_scope does */
+  for(i = 0; i < vm_num_globals; i++)
+    if(vm_globals[i].record == record ||
+       !strcmp(vm_globals[i].record->name, record->name))
+      return vm_globals[i].addr;
+
+  compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		 "Global %s has no storage\n", record->name);
+  return 0;
+}
+
+static vm_func_t *vm_find_func(name_record_t *record) {
+  int i;
+
+  for(i = 0; i < vm_num_funcs; i++)
+    if(vm_funcs[i].record == record)
+      return &vm_funcs[i];
+
+  return NULL;
+}
+
+/*
+ * Append an instruction, returning its index
+ */
+static int vm_emit(int op, int a, int b, int c) {
+  vm_instr_t *instr;
+
+  if(vm_num_code == vm_max_code) {
+    vm_max_code = vm_max_code ? vm_max_code * 2 : 1024;
+    vm_code = realloc(vm_code, sizeof(vm_instr_t) * vm_max_code);
+  }
+
+  instr = &vm_code[vm_num_code];
+  instr->handler = NULL;
+  instr->op = op;
+  instr->a = a;
+  instr->b = b;
+  instr->c = c;
+  instr->args = NULL;
+  return vm_num_code++;
+}
+
+/*
+ * Return the number of a variable held in a register in the current
+ * function, adding it if it hasn't been seen before
+ */
+static int vm_var_index(name_record_t *var) {
+  int i;
+
+  for(i = 0; i < num_func_vars; i++)
+    if(func_vars[i] == var)
+      return i;
+
+  if(num_func_vars == max_func_vars) {
+    max_func_vars = max_func_vars ? max_func_vars * 2 : 16;
+    func_vars = realloc(func_vars, sizeof(name_record_t *) * max_func_vars);
+  }
+
+  func_vars[num_func_vars] = var;
+  return num_func_vars++;
+}
+
+/*
+ * Find the arguments, variables and temporaries of the function starting
+ * at a label node, and lay out its slots
+ */
+static void vm_scan_func(mir_node_t *node) {
+  mir_instr_t *instr;
+  mir_operand_t *op;
+  int min_temp = INT_MAX, max_temp = -1, i;
+
+  num_func_vars = 0;
+  num_params = current_func->record->num_args > 0 ?
+    current_func->record->num_args : 0;
+  current_arg = 0;
+  uses_stack = 0;
+
+  for(; node->instruction->opcode != MIR_END; node = node->next) {
+    instr = node->instruction;
+
+    switch(instr->opcode) {
+    case MIR_RECEIVE:
+    case MIR_PUSH_ARG:
+      current_arg++;
+      /* Fall through */
+    case MIR_ADDR:
+    case MIR_STACK_ADDR:
+    case MIR_STACK_LOAD:
+    case MIR_STACK_STORE:
+      uses_stack |= instr->opcode != MIR_RECEIVE;
+      break;
+    }
+
+    for(i = 0; i < 3 + instr->num_args; i++) {
+      op = i < 3 ? instr->operand[i] : instr->args[i - 3];
+      if(!op)
+	continue;
+
+      if(op->optype == MIR_OP_REG) {
+	if(op->val < min_temp)
+	  min_temp = op->val;
+	if(op->val > max_temp)
+	  max_temp = op->val;
+
+      } else if(op->optype == MIR_OP_VAR && op->var &&
+	      op->var->type_info->decl_type != TYPE_FUNCTION &&
+	      get_var_scope(op->var) != global_scope &&
+	      !(i == 0 && (instr->opcode == MIR_ADDR ||
+			   instr->opcode == MIR_CALL)))
+	vm_var_index(op->var);
+    }
+  }
+
+  if(current_arg > num_params)
+    num_params = current_arg;
+  current_arg = 0;
+
+  /* Temporaries are numbered across the whole program */
+  if(max_temp < 0)
+    min_temp = 0;
+  temp_base = num_params - min_temp;
+  var_base = temp_base + max_temp + 1;
+  scratch_base = var_base + num_func_vars;
+  current_func->const_base = scratch_base + VM_NUM_SCRATCH;
+  current_func->num_consts = 0;
+  current_func->consts = NULL;
+
+  current_func->frame_size = 0;
+  if(uses_stack)
+    current_func->frame_size =
+      vm_align(max_scope_size(get_func_scope(current_func->record->name)));
+}
+
+/*
+ * Return the slot of a constant in the current function
+ */
+static int vm_const(int val) {
+  int i;
+
+  for(i = 0; i < current_func->num_consts; i++)
+    if(current_func->consts[i] == val)
+      return current_func->const_base + i;
+
+  current_func->consts = realloc(current_func->consts, sizeof(int) *
+				 (current_func->num_consts + 1));
+  current_func->consts[current_func->num_consts] = val;
+  return current_func->const_base + current_func->num_consts++;
+}
+
+/*
+ * Return a scratch slot. They are reused for each MIR instruction.
+ */
+static int vm_scratch(void) {
+  if(num_scratch == VM_NUM_SCRATCH)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Too many memory operands in an instruction\n");
+
+  return scratch_base + num_scratch++;
+}
+
+static int vm_label_num(mir_node_t *node) {
+  return atoi(node->instruction->label + 1);
+}
+
+/*
+ * Return the slot holding the value of a MIR operand, ignoring whether it
+ * is indirect. Globals are loaded into a scratch slot.
+ */
+static int vm_value(mir_operand_t *op) {
+  int slot;
+
+  switch(op->optype) {
+  case MIR_OP_CONST:
+    return vm_const(op->val);
+
+  case MIR_OP_VAR:
+    if(get_var_scope(op->var) != global_scope)
+      return var_base + vm_var_index(op->var);
+
+    slot = vm_scratch();
+    vm_emit(VM_LDG, slot, vm_global_addr(op->var), 0);
+    return slot;
+
+  case MIR_OP_REG:
+  default:
+    return temp_base + op->val;
+  }
+}
+
+/*
+ * Return the slot holding a source operand
+ */
+static int vm_src(mir_operand_t *op) {
+  int slot = vm_value(op), val;
+
+  if(!op->indirect)
+    return slot;
+
+  val = vm_scratch();
+  vm_emit(VM_LD, val, slot, 0);
+  return val;
+}
+
+/*
+ * Return the slot to compute a destination operand into. Operands in
+ * memory are computed into a scratch slot and written by vm_set_dest.
+ */
+static int vm_dest(mir_operand_t *op) {
+  if(op->indirect || (op->optype == MIR_OP_VAR &&
+		      get_var_scope(op->var) == global_scope))
+    return vm_scratch();
+
+  return vm_value(op);
+}
+
+static void vm_set_dest(mir_operand_t *op, int slot) {
+  if(op->indirect)
+    vm_emit(VM_ST, vm_value(op), slot, 0);
+  else if(op->optype == MIR_OP_VAR && get_var_scope(op->var) == global_scope)
+    vm_emit(VM_STG, vm_global_addr(op->var), slot, 0);
+}
+
+/*
+ * Translate a call. Functions without a definition must be rtlib
+ * functions which are run natively.
+ */
+static void vm_translate_call(mir_instr_t *instr) {
+  name_record_t *record = instr->operand[0]->var;
+  vm_func_t *callee = vm_find_func(record);
+  int *args, dest = -1, native = 0, i;
+
+  args = malloc(sizeof(int) * (instr->num_args + 1));
+  for(i = 0; i < instr->num_args; i++)
+    args[i] = vm_src(instr->args[i]);
+
+  if(!callee) {
+    for(native = 0; native < VM_NUM_NATIVES; native++)
+      if(!strcmp(record->name, vm_native_names[native]))
+	break;
+
+    if(native == VM_NUM_NATIVES)
+      compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		     "Function %s isn't defined, and can't be run\n",
+		     record->name);
+  }
+
+  if(instr->operand[2])
+    dest = vm_dest(instr->operand[2]);
+
+  i = callee ? vm_emit(VM_CALL, dest, instr->num_args, callee - vm_funcs) :
+    vm_emit(VM_CALLN, dest, instr->num_args, native);
+  vm_code[i].args = args;
+
+  if(instr->operand[2])
+    vm_set_dest(instr->operand[2], dest);
+}
+
+/*
+ * Translate a single MIR instruction
+ */
+static void vm_translate_instr(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  mir_operand_t *dest = instr->operand[2];
+  int a, b, op;
+
+  num_scratch = 0;
+
+  switch(instr->opcode) {
+  case MIR_NOP:
+  case MIR_BEGIN:
+  case MIR_LABEL:
+    break;
+
+  case MIR_MOVE:
+  case MIR_HEAP_LOAD:
+    /* Globals held in registers are the words in memory themselves */
+    if(instr->opcode == MIR_HEAP_LOAD && dest->optype == MIR_OP_VAR &&
+       dest->var == instr->operand[0]->var)
+      break;
+
+    b = vm_src(instr->operand[0]);
+    a = vm_dest(dest);
+    if(a != b)
+      vm_emit(VM_MOV, a, b, 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_HEAP_STORE:
+    if(instr->operand[0]->optype == MIR_OP_VAR &&
+       instr->operand[0]->var == dest->var)
+      break;
+
+    vm_emit(VM_STG, vm_global_addr(dest->var), vm_src(instr->operand[0]), 0);
+    break;
+
+  case MIR_HEAP_ADDR:
+    a = vm_dest(dest);
+    if(instr->operand[0]->optype == MIR_OP_VAR)
+      b = vm_const(vm_global_addr(instr->operand[0]->var));
+    else
+      b = vm_const(instr->operand[0]->val);
+    vm_emit(VM_MOV, a, b, 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_LOAD_STRING:
+    a = vm_dest(dest);
+    vm_emit(VM_MOV, a, vm_const(vm_strings[instr->operand[0]->val]), 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_ADDR:
+    a = vm_dest(dest);
+    if(instr->operand[0]->optype != MIR_OP_VAR)
+      vm_emit(VM_LD, a, vm_value(instr->operand[0]), 0);
+    else if(get_var_scope(instr->operand[0]->var) == global_scope)
+      vm_emit(VM_MOV, a, vm_const(vm_global_addr(instr->operand[0]->var)),
+	      0);
+    else
+      vm_emit(VM_LEAS, a, instr->operand[0]->var->offset, 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_STACK_ADDR:
+    a = vm_dest(dest);
+    vm_emit(VM_LEAS, a, instr->operand[0]->val, 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_STACK_LOAD:
+    a = vm_dest(dest);
+    vm_emit(VM_LDS, a, instr->operand[0]->val, 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_STACK_STORE:
+    vm_emit(VM_STS, dest->val, vm_src(instr->operand[0]), 0);
+    break;
+
+  case MIR_REG_LOAD:
+    b = vm_value(instr->operand[0]);
+    a = vm_dest(dest);
+    vm_emit(VM_LD, a, b, 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_REG_STORE:
+    b = vm_src(instr->operand[0]);
+    vm_emit(VM_ST, vm_value(dest), b, 0);
+    break;
+
+  case MIR_ADD:
+  case MIR_SUB:
+  case MIR_MUL:
+  case MIR_DIV:
+    switch(instr->opcode) {
+    case MIR_SUB: op = VM_SUB; break;
+    case MIR_MUL: op = VM_MUL; break;
+    case MIR_DIV: op = VM_DIV; break;
+    case MIR_ADD:
+    default: op = VM_ADD; break;
+    }
+
+    a = vm_src(instr->operand[0]);
+    b = vm_src(instr->operand[1]);
+    vm_emit(op, vm_dest(dest), a, b);
+    vm_set_dest(dest, vm_code[vm_num_code - 1].a);
+    break;
+
+  case MIR_JUMP:
+    vm_emit(VM_JMP, 0, 0, vm_label_num(node->jump));
+    break;
+
+  case MIR_IF:
+    a = vm_src(instr->operand[0]);
+    if(!instr->operand[2]) {
+      vm_emit(VM_BEQZ, a, 0, vm_label_num(node->jump));
+      break;
+    }
+
+    switch(instr->operand[2]->val) {
+    case MIR_NEQ: op = VM_BNE; break;
+    case MIR_LSS: op = VM_BLT; break;
+    case MIR_LEQ: op = VM_BLE; break;
+    case MIR_GTR: op = VM_BGT; break;
+    case MIR_GEQ: op = VM_BGE; break;
+    case MIR_EQL:
+    default: op = VM_BEQ; break;
+    }
+    vm_emit(op, a, vm_src(instr->operand[1]), vm_label_num(node->jump));
+    break;
+
+  case MIR_RECEIVE:
+    a = vm_dest(dest);
+    vm_emit(VM_MOV, a, current_arg++, 0);
+    vm_set_dest(dest, a);
+    break;
+
+  case MIR_PUSH_ARG:
+    vm_emit(VM_STS, dest->val, current_arg++, 0);
+    break;
+
+  case MIR_CALL:
+    vm_translate_call(instr);
+    break;
+
+  case MIR_RETURN:
+    vm_emit(VM_RET, instr->operand[0] ? vm_src(instr->operand[0]) :
+	    vm_const(0), 0, 0);
+    break;
+
+  case MIR_END:
+    if(node->prev->instruction->opcode != MIR_RETURN)
+      vm_emit(VM_RET, vm_const(0), 0, 0);
+    break;
+
+  default:
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Can't run MIR opcode %d\n", instr->opcode);
+  }
+}
+
+/*
+ * Translate a function
+ */
+static void vm_translate_func(mir_node_t **node) {
+  mir_instr_t *instr;
+  int done = 0;
+
+  current_func = NULL;
+
+  while(*node && !done) {
+    instr = (*node)->instruction;
+
+    if(instr->opcode == MIR_LABEL) {
+      current_func = vm_find_func(get_func_entry(instr->label));
+      current_func->entry = vm_num_code;
+      vm_scan_func(*node);
+
+    } else if(instr->label)
+      vm_labels[vm_label_num(*node)] = vm_num_code;
+
+    if(current_func)
+      vm_translate_instr(*node);
+
+    done = instr->opcode == MIR_END;
+    *node = (*node)->next;
+  }
+
+  if(current_func)
+    current_func->num_slots = current_func->const_base +
+      current_func->num_consts;
+}
+
+/*
+ * Translate the MIR list, then resolve branches to labels
+ */
+static void vm_translate(void) {
+  mir_node_t *current;
+  int max_label = 0, i;
+
+  vm_funcs = malloc(sizeof(vm_func_t) * (num_def_functions() + 1));
+  vm_num_funcs = 0;
+
+  for(current = mir_list_head(); current; current = current->next) {
+    if(current->instruction->opcode == MIR_LABEL)
+      vm_funcs[vm_num_funcs++].record =
+	get_func_entry(current->instruction->label);
+    else if(current->instruction->label &&
+	    vm_label_num(current) > max_label)
+      max_label = vm_label_num(current);
+  }
+
+  vm_labels = calloc(max_label + 1, sizeof(int));
+
+  current = mir_list_head();
+  for(i = 0; i < num_def_functions(); i++)
+    vm_translate_func(&current);
+
+  for(i = 0; i < vm_num_code; i++)
+    if(vm_code[i].op >= VM_JMP && vm_code[i].op <= VM_BGE)
+      vm_code[i].c = vm_labels[vm_code[i].c];
+}
+
+/*
+ * Native rtlib functions
+ */
+static char *vm_string(int addr) {
+  vm_check_addr(addr, 1);
+  return vm_mem + addr;
+}
+
+static void vm_check_addr(int addr, int size) {
+  if((unsigned int)addr < sizeof(int) || size > VM_MEM_SIZE ||
+     (unsigned int)addr > (unsigned int)(VM_MEM_SIZE - size))
+    vm_error(VM_ERROR_ADDR, addr);
+}
+
+/*
+ * Report an error in the running program
+ */
+void vm_error(int error, int val) {
+  fflush(stdout);
+
+  switch(error) {
+  case VM_ERROR_DIV_ZERO:
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Division by zero at runtime\n");
+    break;
+
+  case VM_ERROR_ADDR:
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Invalid address 0x%x at runtime\n", val);
+    break;
+
+  case VM_ERROR_OVERFLOW:
+  default:
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Stack overflow at runtime\n");
+    break;
+  }
+}
+
+/*
+ * printf, with strings converted from the program's addresses
+ */
+static void vm_printf(int *regs, int *args, int num_args) {
+  char *fmt = vm_string(regs[args[0]]), *conv, spec[32];
+  int arg = 1, i;
+
+  while(*fmt) {
+    if(*fmt != '%') {
+      putchar(*fmt++);
+      continue;
+    }
+
+    /* Find the conversion character, after any flags, width or length */
+    conv = fmt + 1;
+    conv += strspn(conv, "-+ #0123456789.lh");
+    if(!*conv)
+      break;
+
+    /* Copy the conversion, dropping long modifiers */
+    for(i = 0; fmt <= conv && i < (int)sizeof(spec) - 2; fmt++)
+      if(*fmt != 'l')
+	spec[i++] = *fmt;
+    spec[i - 1] = *conv;
+    spec[i] = '\0';
+    fmt = conv + 1;
+
+    switch(spec[i - 1]) {
+    case '%':
+      putchar('%');
+      break;
+
+    case 's':
+      printf(spec, arg < num_args ? vm_string(regs[args[arg]]) : "");
+      arg++;
+      break;
+
+    case 'p':
+      printf("0x%x", arg < num_args ? regs[args[arg]] : 0);
+      arg++;
+      break;
+
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+      printf(spec, arg < num_args ? regs[args[arg]] : 0);
+      arg++;
+      break;
+
+    default:
+      fputs(spec, stdout);
+      break;
+    }
+  }
+}
+
+/*
+ * Run a native function, returning its result
+ */
+int vm_native(int native, int *regs, int *args, int num_args) {
+  int val = 0;
+
+  switch(native) {
+  case VM_PRINTF:
+    if(num_args)
+      vm_printf(regs, args, num_args);
+    return 0;
+
+  case VM_PRINT_NUM:
+    printf("%d\n", num_args ? regs[args[0]] : 0);
+    return 0;
+
+  case VM_PRINT_ADDR:
+    printf("0x%x\n", num_args ? regs[args[0]] : 0);
+    return 0;
+
+  case VM_PRINT_SEP:
+    printf("--\n");
+    return 0;
+
+  case VM_PRINT_STR:
+    if(num_args)
+      fputs(vm_string(regs[args[0]]), stdout);
+    return 0;
+
+  case VM_GET_NUM:
+    if(scanf("%d", &val) != 1)
+      val = 0;
+    return val;
+
+  case VM_START_TIMER:
+    vm_timer = clock();
+    return 0;
+
+  case VM_STOP_TIMER:
+    vm_elapsed = clock() - vm_timer;
+    return 0;
+
+  case VM_PRINT_TIME:
+    printf("Elapsed time = %d tics\n", (int)vm_elapsed);
+    return 0;
+
+  case VM_MALLOC:
+    val = vm_heap;
+    vm_heap = vm_align(vm_heap + (num_args ? regs[args[0]] : 0));
+    if(vm_heap > VM_MEM_SIZE - VM_STACK_SIZE)
+      compiler_error(CERROR_ERROR, CERROR_NO_LINE, "Out of memory\n");
+    return val;
+
+  case VM_FREE:
+    return 0;
+
+  case VM_MEMCPY:
+    if(num_args < 3 || regs[args[2]] <= 0)
+      return 0;
+    vm_check_addr(regs[args[0]], regs[args[2]]);
+    vm_check_addr(regs[args[1]], regs[args[2]]);
+    memmove(vm_mem + regs[args[0]], vm_mem + regs[args[1]], regs[args[2]]);
+    return 0;
+  }
+
+  return 0;
+}
+
+/*
+ * Run the threaded code from a function, returning its result
+ */
+static int vm_execute(vm_func_t *func) {
+#ifdef VM_THREADED
+  static const void *handlers[VM_NUM_OPS] = {
+    &&op_VM_MOV, &&op_VM_ADD, &&op_VM_SUB, &&op_VM_MUL, &&op_VM_DIV,
+    &&op_VM_LDG, &&op_VM_STG, &&op_VM_LD, &&op_VM_ST, &&op_VM_LDS,
+    &&op_VM_STS, &&op_VM_LEAS, &&op_VM_JMP, &&op_VM_BEQZ, &&op_VM_BEQ,
+    &&op_VM_BNE, &&op_VM_BLT, &&op_VM_BLE, &&op_VM_BGT, &&op_VM_BGE,
+    &&op_VM_CALL, &&op_VM_CALLN, &&op_VM_RET
+  };
+#endif
+  vm_instr_t *ip;
+  vm_call_t *calls, *call;
+  vm_func_t *callee;
+  int *regs, *regs_end, *r, *nr, fp, val, i;
+
+#ifdef VM_THREADED
+# define VM_OP(op) op_##op:
+# define VM_NEXT() goto *ip->handler
+
+  for(i = 0; i < vm_num_code; i++)
+    vm_code[i].handler = handlers[vm_code[i].op];
+#else
+# define VM_OP(op) case op:
+# define VM_NEXT() goto dispatch
+#endif
+
+  regs = calloc(VM_REGS_SIZE, sizeof(int));
+  calls = malloc(sizeof(vm_call_t) * VM_MAX_CALLS);
+  if(!regs || !calls)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE, "Out of memory\n");
+  regs_end = regs + VM_REGS_SIZE;
+
+  call = calls;
+  r = regs;
+  memcpy(r + func->const_base, func->consts, sizeof(int) * func->num_consts);
+  fp = VM_MEM_SIZE - func->frame_size;
+  ip = vm_code + func->entry;
+
+#ifdef VM_THREADED
+  VM_NEXT();
+#else
+ dispatch:
+  switch(ip->op) {
+#endif
+
+  VM_OP(VM_MOV)
+    r[ip->a] = r[ip->b];
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_ADD)
+    r[ip->a] = (int)((unsigned int)r[ip->b] + (unsigned int)r[ip->c]);
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_SUB)
+    r[ip->a] = (int)((unsigned int)r[ip->b] - (unsigned int)r[ip->c]);
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_MUL)
+    r[ip->a] = (int)((unsigned int)r[ip->b] * (unsigned int)r[ip->c]);
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_DIV)
+    if(!r[ip->c])
+      vm_error(VM_ERROR_DIV_ZERO, 0);
+    if(r[ip->c] == -1)
+      r[ip->a] = (int)-(unsigned int)r[ip->b];
+    else
+      r[ip->a] = r[ip->b] / r[ip->c];
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_LDG)
+    r[ip->a] = VM_WORD(ip->b);
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_STG)
+    VM_WORD(ip->a) = r[ip->b];
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_LD)
+    vm_check_addr(r[ip->b], (int)sizeof(int));
+    r[ip->a] = VM_WORD(r[ip->b]);
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_ST)
+    vm_check_addr(r[ip->a], (int)sizeof(int));
+    VM_WORD(r[ip->a]) = r[ip->b];
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_LDS)
+    r[ip->a] = VM_WORD(fp + ip->b);
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_STS)
+    VM_WORD(fp + ip->a) = r[ip->b];
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_LEAS)
+    r[ip->a] = fp + ip->b;
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_JMP)
+    ip = vm_code + ip->c;
+    VM_NEXT();
+
+  VM_OP(VM_BEQZ)
+    ip = !r[ip->a] ? vm_code + ip->c : ip + 1;
+    VM_NEXT();
+
+  VM_OP(VM_BEQ)
+    ip = r[ip->a] == r[ip->b] ? vm_code + ip->c : ip + 1;
+    VM_NEXT();
+
+  VM_OP(VM_BNE)
+    ip = r[ip->a] != r[ip->b] ? vm_code + ip->c : ip + 1;
+    VM_NEXT();
+
+  VM_OP(VM_BLT)
+    ip = r[ip->a] < r[ip->b] ? vm_code + ip->c : ip + 1;
+    VM_NEXT();
+
+  VM_OP(VM_BLE)
+    ip = r[ip->a] <= r[ip->b] ? vm_code + ip->c : ip + 1;
+    VM_NEXT();
+
+  VM_OP(VM_BGT)
+    ip = r[ip->a] > r[ip->b] ? vm_code + ip->c : ip + 1;
+    VM_NEXT();
+
+  VM_OP(VM_BGE)
+    ip = r[ip->a] >= r[ip->b] ? vm_code + ip->c : ip + 1;
+    VM_NEXT();
+
+  VM_OP(VM_CALL)
+    /* The arguments are written straight into the callee's first slots */
+    callee = vm_funcs + ip->c;
+    nr = r + func->num_slots;
+    if(nr + callee->num_slots + ip->b > regs_end ||
+       call == calls + VM_MAX_CALLS ||
+       fp - callee->frame_size < VM_MEM_SIZE - VM_STACK_SIZE)
+      vm_error(VM_ERROR_OVERFLOW, 0);
+
+    for(i = 0; i < ip->b; i++)
+      nr[i] = r[ip->args[i]];
+    memcpy(nr + callee->const_base, callee->consts,
+	   sizeof(int) * callee->num_consts);
+
+    call->ip = ip;
+    call->regs = r;
+    call->func = func;
+    call->fp = fp;
+    call++;
+
+    func = callee;
+    r = nr;
+    fp -= callee->frame_size;
+    ip = vm_code + callee->entry;
+    VM_NEXT();
+
+  VM_OP(VM_CALLN)
+    val = vm_native(ip->c, r, ip->args, ip->b);
+    if(ip->a >= 0)
+      r[ip->a] = val;
+    ip++;
+    VM_NEXT();
+
+  VM_OP(VM_RET)
+    val = r[ip->a];
+    if(call == calls) {
+      free(regs);
+      free(calls);
+      return val;
+    }
+
+    call--;
+    ip = call->ip;
+    r = call->regs;
+    func = call->func;
+    fp = call->fp;
+
+    if(ip->a >= 0)
+      r[ip->a] = val;
+    ip++;
+    VM_NEXT();
+
+#ifndef VM_THREADED
+  }
+#endif
+
+  return 0;
+}
+
+/*
+ * Load and translate the program, returning its entry point
+ */
+vm_func_t *vm_load(void) {
+  int i;
+
+  vm_load_data();
+  vm_translate();
+
+  for(i = 0; i < vm_num_funcs; i++)
+    if(!strcmp(vm_funcs[i].record->name, cflags.entry_point))
+      return &vm_funcs[i];
+
+  compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		 "No function %s to run\n", cflags.entry_point);
+  return NULL;
+}
+
+/*
+ * Run the program, returning the result of its entry point
+ */
+int vm_run(void) {
+  vm_func_t *entry = vm_load();
+  int val;
+
+  debug_printf(1, "Running %d threaded instructions\n", vm_num_code);
+  val = vm_execute(entry);
+  fflush(stdout);
+  return val;
+}
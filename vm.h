@@ -0,0 +1,116 @@
+/*
+ * vm.h
+ *
+ * Functions/constants for the MIR interpreter
+ *
+ */
+#include "symtable.h"
+
+#ifndef _VM_H_
+#define _VM_H_
+
+/*
+ * The program's memory. Addresses are offsets into it, and the first word
+ * is never allocated so that null pointers can be caught. Locals which
+ * have their address taken live in frames at the top.
+ */
+#define VM_MEM_SIZE 0x4000000
+#define VM_STACK_SIZE 0x1000000
+#define VM_DATA_BASE 16
+
+/* Register slots for all active calls, and the deepest chain of calls */
+#define VM_REGS_SIZE 0x400000
+#define VM_MAX_CALLS 0x40000
+
+/*
+ * Machine instructions. Operands are slot numbers, except for addresses,
+ * stack offsets and branch targets.
+ */
+enum {
+  VM_MOV,	/* a = b */
+  VM_ADD,	/* a = b + c */
+  VM_SUB,
+  VM_MUL,
+  VM_DIV,
+  VM_LDG,	/* a = [b], b is an address */
+  VM_STG,	/* [a] = b, a is an address */
+  VM_LD,	/* a = [b] */
+  VM_ST,	/* [a] = b */
+  VM_LDS,	/* a = [fp + b] */
+  VM_STS,	/* [fp + a] = b */
+  VM_LEAS,	/* a = fp + b */
+  VM_JMP,	/* goto c */
+  VM_BEQZ,	/* if a == 0 goto c */
+  VM_BEQ,	/* if a == b goto c */
+  VM_BNE,
+  VM_BLT,
+  VM_BLE,
+  VM_BGT,
+  VM_BGE,
+  VM_CALL,	/* a = function c(args), a is -1 if there is no result */
+  VM_CALLN,	/* a = native function c(args) */
+  VM_RET,	/* return a */
+  VM_NUM_OPS
+};
+
+/* rtlib functions which are run natively */
+enum {
+  VM_PRINTF,
+  VM_PRINT_NUM,
+  VM_PRINT_ADDR,
+  VM_PRINT_SEP,
+  VM_PRINT_STR,
+  VM_GET_NUM,
+  VM_START_TIMER,
+  VM_STOP_TIMER,
+  VM_PRINT_TIME,
+  VM_MALLOC,
+  VM_FREE,
+  VM_MEMCPY,
+  VM_NUM_NATIVES
+};
+
+typedef struct {
+  const void *handler;
+  int op;
+  int a, b, c;
+  int *args;
+
+} vm_instr_t;
+
+typedef struct {
+  name_record_t *record;
+  int entry;
+  int num_slots;
+  int frame_size;
+
+  /*
+   * Constants are copied into their slots when the interpreter calls the
+   * function. The JIT uses them as immediates.
+   */
+  int const_base;
+  int num_consts;
+  int *consts;
+
+} vm_func_t;
+
+/* Runtime errors */
+enum {
+  VM_ERROR_DIV_ZERO,
+  VM_ERROR_ADDR,
+  VM_ERROR_OVERFLOW
+};
+
+/* The translated program, shared with the JIT */
+extern char *vm_mem;
+extern vm_instr_t *vm_code;
+extern int vm_num_code;
+extern vm_func_t *vm_funcs;
+extern int vm_num_funcs;
+
+vm_func_t *vm_load(void);
+int vm_native(int, int *, int *, int);
+void vm_error(int, int);
+int vm_run(void);
+
+#endif /* _VM_H_ */
@@ -0,0 +1,80 @@
+/*
+ * x86.h
+ *
+ * Functions/constants for the x86-64 backend
+ *
+ */
+#ifndef _X86_H_
+#define _X86_H_
+
+/* Hardware registers, numbered as in the instruction encoding */
+enum {
+  X86_RAX,
+  X86_RCX,
+  X86_RDX,
+  X86_RBX,
+  X86_RSP,
+  X86_RBP,
+  X86_RSI,
+  X86_RDI,
+  X86_R8,
+  X86_R9,
+  X86_R10,
+  X86_R11,
+  X86_R12,
+  X86_R13,
+  X86_R14,
+  X86_R15,
+
+  X86_NUM_REGS
+};
+
+/*
+ * Sparc registers without an x86 register to map onto live in word sized
+ * slots in the stack frame, numbered after the hardware registers
+ */
+#define X86_SLOT(n) (X86_NUM_REGS + (n))
+#define X86_NUM_SLOTS 10
+
+/* %rax and %r11 are never allocated, and are used as scratch registers */
+#define X86_SCRATCH X86_RAX
+#define X86_SCRATCH2 X86_R11
+
+/* The System V ABI keeps the stack 16 byte aligned at calls */
+#define X86_STACK_ALIGN 16
+#define X86_ARG_SIZE 8
+
+/*
+ * Code is generated for a 32 bit data model, so main runs on a stack in
+ * the bss below 4GB. The function compiled from main is renamed and called
+ * by a small main which switches stacks.
+ */
+#define X86_STACK_SIZE 0x1000000
+#define X86_STACK_NAME "__hcc_stack"
+#define X86_MAIN_NAME "__hcc_main"
+
+/* Machine operands */
+enum {
+  X86_OP_REG,
+  X86_OP_IMM,
+  X86_OP_MEM,
+  X86_OP_SYM,
+  X86_OP_ADDR
+};
+
+/*
+ * Memory operands without a base register are absolute, symbol operands
+ * address a symbol relative to %rip and address operands are the address
+ * of a symbol as an immediate.
+ */
+typedef struct {
+  int type;
+  int reg;
+  int val;
+  char *sym;
+
+} x86_operand_t;
+
+void gen_x86_code(char *);
+
+#endif /* _X86_H_ */
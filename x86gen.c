@@ -0,0 +1,948 @@
+/*
+ * x86gen.c
+ *
+ * x86-64 backend code generator. Converts the register allocated MIR for
+ * the Sparc into x86-64 assembly for the System V ABI, so that programs
+ * can be run natively. The generated code can be assembled and linked
+ * with gcc -no-pie.
+ *
+ * The language has 4 byte ints and pointers, so all arithmetic is done
+ * with 32 bit instructions, which zero extend into the full registers,
+ * and the 64 bit registers are only used as base addresses. Globals and
+ * strings are linked below 4GB, and main switches to a stack in the bss.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symtable.h"
+#include "typechk.h"
+#include "scope.h"
+#include "mir.h"
+#include "history.h"
+#include "strings.h"
+#include "cerror.h"
+#include "cflags.h"
+#include "sparc.h"
+#include "x86.h"
+
+static void x86_scan_func(mir_node_t *);
+static x86_operand_t *x86_new_operand(int);
+static x86_operand_t *x86_reg(int);
+static x86_operand_t *x86_imm(int);
+static x86_operand_t *x86_mem(int, int);
+static x86_operand_t *x86_sym(char *);
+static x86_operand_t *x86_addr(char *);
+static x86_operand_t *x86_hw_opr(int);
+static x86_operand_t *x86_loc(int);
+static x86_operand_t *x86_stack_opr(int);
+static x86_operand_t *x86_ptr_opr(mir_operand_t *);
+static x86_operand_t *x86_opr(mir_operand_t *);
+static int x86_is_mem(x86_operand_t *);
+static int x86_same(x86_operand_t *, x86_operand_t *);
+static void x86_emit(char *, x86_operand_t *, x86_operand_t *);
+static void x86_emit_mov(x86_operand_t *, x86_operand_t *);
+static void x86_emit_lea(int, x86_operand_t *);
+static int x86_work_reg(x86_operand_t *, x86_operand_t *);
+static int x86_log2(unsigned int);
+static void x86_emit_arith(mir_instr_t *);
+static void x86_emit_div(mir_operand_t *, mir_operand_t *, x86_operand_t *);
+static void x86_emit_if(mir_node_t *);
+static void x86_emit_call(mir_instr_t *);
+static void x86_emit_epilogue(void);
+static char *x86_func_name(char *);
+static void gen_x86_instr(mir_node_t *);
+static void gen_x86_func(mir_node_t **);
+static void x86_print_operand(x86_operand_t *);
+
+extern compiler_options_t cflags;
+extern scope_node_t *global_scope;
+
+static const char *x86_names32[X86_NUM_REGS] = {
+  "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+
+static const char *x86_names64[X86_NUM_REGS] = {
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+/*
+ * Where each Sparc register handed out by the register allocator lives,
+ * indexed by the Sparc register number. The outs are the argument
+ * registers, so leaf procedures take their arguments where the ABI passes
+ * them. Locals go in the callee saved registers, and so keep their values
+ * across calls, as do the ins and locals left over in stack slots. %g2 is
+ * clobbered by calls, as %r10 is.
+ */
+static const int x86_sparc_regs[32] = {
+  -1, -1, X86_R10, X86_SLOT(8), X86_SLOT(9), -1, -1, -1,
+  X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9, -1, -1,
+  X86_RBX, X86_R12, X86_R13, X86_R14, X86_R15, X86_RBP,
+  X86_SLOT(0), X86_SLOT(1),
+  X86_SLOT(2), X86_SLOT(3), X86_SLOT(4), X86_SLOT(5), X86_SLOT(6),
+  X86_SLOT(7), -1, -1
+};
+
+/* Registers the ABI passes the first six arguments in */
+static const int x86_arg_regs[REG_ARGS] = {
+  X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9
+};
+
+/* Callee saved registers, in the order they are pushed */
+#define X86_NUM_SAVED 6
+static const int x86_callee_saved[X86_NUM_SAVED] = {
+  X86_RBX, X86_RBP, X86_R12, X86_R13, X86_R14, X86_R15
+};
+
+static FILE *x86_fd;
+static int current_arg, has_main;
+
+/*
+ * The function being generated and its frame. From %rsp up the frame
+ * holds the outgoing stack arguments, the locals and spills, the register
+ * slots, a slot for saving %rdx around divides and the saved registers.
+ */
+static name_record_t *current_func;
+static int frame_size, out_size, slot_base, num_params;
+static int saved_regs[X86_NUM_SAVED], num_saved;
+
+/*
+ * Work out the frame layout of the function starting at a label node
+ */
+static void x86_scan_func(mir_node_t *node) {
+  int used[X86_NUM_REGS], i, j, max_args = REG_ARGS;
+  mir_operand_t *op;
+  mir_instr_t *instr;
+
+  memset(used, 0, sizeof(used));
+  num_params = 0;
+
+  for(; node->instruction->opcode != MIR_END; node = node->next) {
+    instr = node->instruction;
+
+    if(instr->opcode == MIR_CALL && instr->num_args > max_args)
+      max_args = instr->num_args;
+    if(instr->opcode == MIR_RECEIVE || instr->opcode == MIR_PUSH_ARG)
+      num_params++;
+
+    for(i = 0; i < 3 + instr->num_args; i++) {
+      op = i < 3 ? instr->operand[i] : instr->args[i - 3];
+      if(op && op->optype == MIR_OP_REG) {
+	j = x86_sparc_regs[sparc_reg_number(op->val)];
+	if(j >= 0 && j < X86_NUM_REGS)
+	  used[j] = 1;
+      }
+    }
+  }
+
+  num_saved = 0;
+  for(i = 0; i < X86_NUM_SAVED; i++)
+    if(used[x86_callee_saved[i]])
+      saved_regs[num_saved++] = x86_callee_saved[i];
+
+  out_size = (max_args - REG_ARGS) * X86_ARG_SIZE;
+  slot_base = out_size +
+    align(max_scope_size(get_func_scope(current_func->name)));
+
+  /* The call pushed the return address, keep %rsp aligned for calls */
+  frame_size = slot_base + ((X86_NUM_SLOTS + 1) * WORD_SIZE) +
+    ((num_saved + 1) * X86_ARG_SIZE);
+  if(frame_size % X86_STACK_ALIGN != 0)
+    frame_size += X86_STACK_ALIGN - (frame_size % X86_STACK_ALIGN);
+  frame_size -= (num_saved + 1) * X86_ARG_SIZE;
+}
+
+/*
+ * Machine operands. They are freed once emitted.
+ */
+static x86_operand_t *x86_new_operand(int type) {
+  x86_operand_t *op = malloc(sizeof(x86_operand_t));
+
+  if(!op)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE, "Out of memory\n");
+
+  op->type = type;
+  op->reg = -1;
+  op->val = 0;
+  op->sym = NULL;
+  return op;
+}
+
+static x86_operand_t *x86_reg(int reg) {
+  x86_operand_t *op = x86_new_operand(X86_OP_REG);
+
+  op->reg = reg;
+  return op;
+}
+
+static x86_operand_t *x86_imm(int val) {
+  x86_operand_t *op = x86_new_operand(X86_OP_IMM);
+
+  op->val = val;
+  return op;
+}
+
+static x86_operand_t *x86_mem(int reg, int val) {
+  x86_operand_t *op = x86_new_operand(X86_OP_MEM);
+
+  op->reg = reg;
+  op->val = val;
+  return op;
+}
+
+static x86_operand_t *x86_sym(char *sym) {
+  x86_operand_t *op = x86_new_operand(X86_OP_SYM);
+
+  op->sym = sym;
+  return op;
+}
+
+static x86_operand_t *x86_addr(char *sym) {
+  x86_operand_t *op = x86_new_operand(X86_OP_ADDR);
+
+  op->sym = sym;
+  return op;
+}
+
+/*
+ * Return the operand for a hardware register or register slot
+ */
+static x86_operand_t *x86_hw_opr(int reg) {
+  if(reg < X86_NUM_REGS)
+    return x86_reg(reg);
+
+  return x86_mem(X86_RSP, slot_base + ((reg - X86_NUM_REGS) * WORD_SIZE));
+}
+
+/*
+ * Return the operand for an allocated register
+ */
+static x86_operand_t *x86_loc(int reg) {
+  int hw = x86_sparc_regs[sparc_reg_number(reg)];
+
+  if(hw < 0)
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Invalid allocated register %d\n", reg);
+
+  return x86_hw_opr(hw);
+}
+
+/*
+ * Return the memory operand for a stack offset
+ */
+static x86_operand_t *x86_stack_opr(int offset) {
+  return x86_mem(X86_RSP, out_size + offset);
+}
+
+/*
+ * Return the memory operand addressed by a MIR operand holding a pointer.
+ * Pointers in register slots are loaded into the second scratch register.
+ */
+static x86_operand_t *x86_ptr_opr(mir_operand_t *op) {
+  x86_operand_t *ptr;
+
+  if(op->optype == MIR_OP_CONST)
+    return x86_mem(-1, op->val);
+
+  ptr = x86_loc(op->val);
+  if(ptr->type == X86_OP_REG) {
+    ptr->type = X86_OP_MEM;
+    return ptr;
+  }
+
+  x86_emit("movl", ptr, x86_reg(X86_SCRATCH2));
+  return x86_mem(X86_SCRATCH2, 0);
+}
+
+/*
+ * Return the machine operand for a MIR operand
+ */
+static x86_operand_t *x86_opr(mir_operand_t *op) {
+  switch(op->optype) {
+  case MIR_OP_VAR:
+    return x86_stack_opr(op->var->offset);
+
+  case MIR_OP_CONST:
+    return x86_imm(op->val);
+
+  case MIR_OP_REG:
+  default:
+    if(op->indirect)
+      return x86_ptr_opr(op);
+    return x86_loc(op->val);
+  }
+}
+
+static int x86_is_mem(x86_operand_t *op) {
+  return op->type == X86_OP_MEM || op->type == X86_OP_SYM;
+}
+
+static int x86_same(x86_operand_t *a, x86_operand_t *b) {
+  return a->type == b->type && a->reg == b->reg && a->val == b->val &&
+    (a->type == X86_OP_REG || a->type == X86_OP_MEM);
+}
+
+/*
+ * Write out an instruction, freeing its operands
+ */
+static void x86_emit(char *op, x86_operand_t *src, x86_operand_t *dest) {
+  fprintf(x86_fd, "\t%s", op);
+
+  if(src) {
+    fprintf(x86_fd, "\t");
+    x86_print_operand(src);
+    free(src);
+  }
+
+  if(dest) {
+    fprintf(x86_fd, ", ");
+    x86_print_operand(dest);
+    free(dest);
+  }
+
+  fprintf(x86_fd, "\n");
+}
+
+/*
+ * Emit a move, going through the scratch register between memory operands
+ */
+static void x86_emit_mov(x86_operand_t *src, x86_operand_t *dest) {
+  if(x86_same(src, dest)) {
+    free(src);
+    free(dest);
+    return;
+  }
+
+  if(x86_is_mem(src) && x86_is_mem(dest)) {
+    x86_emit("movl", src, x86_reg(X86_SCRATCH));
+    src = x86_reg(X86_SCRATCH);
+
+  } else if(src->type == X86_OP_IMM && !src->val &&
+	    dest->type == X86_OP_REG) {
+    free(src);
+    x86_emit("xorl", x86_reg(dest->reg), dest);
+    return;
+  }
+
+  x86_emit("movl", src, dest);
+}
+
+/*
+ * Emit the address of a stack offset into an operand
+ */
+static void x86_emit_lea(int offset, x86_operand_t *dest) {
+  if(dest->type == X86_OP_REG) {
+    x86_emit("leal", x86_stack_opr(offset), dest);
+    return;
+  }
+
+  x86_emit("leal", x86_stack_opr(offset), x86_reg(X86_SCRATCH));
+  x86_emit("movl", x86_reg(X86_SCRATCH), dest);
+}
+
+/*
+ * Return the register to compute into for a dest, which must not be read
+ * as the second source
+ */
+static int x86_work_reg(x86_operand_t *dest, x86_operand_t *src) {
+  if(dest->type == X86_OP_REG && !(src->type == X86_OP_REG &&
+				   src->reg == dest->reg))
+    return dest->reg;
+
+  return X86_SCRATCH;
+}
+
+/*
+ * Return log2 of a power of two, or -1
+ */
+static int x86_log2(unsigned int val) {
+  int shift = 0;
+
+  if(!val || (val & (val - 1)))
+    return -1;
+
+  while(val >>= 1)
+    shift++;
+
+  return shift;
+}
+
+/*
+ * Emit an arithmetic instruction. Constants are normally the second
+ * operand, but the register allocator can rematerialise them into either.
+ */
+static void x86_emit_arith(mir_instr_t *instr) {
+  mir_operand_t *a = instr->operand[0], *b = instr->operand[1], *t;
+  x86_operand_t *dest = x86_loc(instr->operand[2]->val), *src;
+  int work, val, shift;
+  char *op;
+
+  if(a->optype == MIR_OP_CONST && b->optype == MIR_OP_CONST &&
+     mir_fold_eval(instr->opcode, a->val, b->val, &val)) {
+    x86_emit_mov(x86_imm(val), dest);
+    return;
+  }
+
+  if(instr->opcode == MIR_DIV) {
+    x86_emit_div(a, b, dest);
+    return;
+  }
+
+  /* Keep constants and the dest second for commutative instructions */
+  src = x86_opr(b);
+  if(instr->opcode != MIR_SUB &&
+     (a->optype == MIR_OP_CONST || x86_same(src, dest))) {
+    t = a;
+    a = b;
+    b = t;
+    free(src);
+    src = x86_opr(b);
+  }
+
+  /* Multiplies by powers of two are shifts */
+  if(instr->opcode == MIR_MUL && b->optype == MIR_OP_CONST &&
+     (shift = x86_log2(b->val)) >= 0) {
+    free(src);
+    work = dest->type == X86_OP_REG ? dest->reg : X86_SCRATCH;
+    x86_emit_mov(x86_opr(a), x86_reg(work));
+    if(shift)
+      x86_emit("shll", x86_imm(shift), x86_reg(work));
+    x86_emit_mov(x86_reg(work), dest);
+    return;
+  }
+
+  switch(instr->opcode) {
+  case MIR_SUB: op = "subl"; break;
+  case MIR_MUL: op = "imull"; break;
+  case MIR_ADD:
+  default: op = "addl"; break;
+  }
+
+  work = x86_work_reg(dest, src);
+  x86_emit_mov(x86_opr(a), x86_reg(work));
+  x86_emit(op, src, x86_reg(work));
+  x86_emit_mov(x86_reg(work), dest);
+}
+
+/*
+ * Emit a signed divide. Positive powers of two are shifted, rounding towards
+ * zero, and anything else uses idiv, which takes the dividend in %edx:%eax.
+ */
+static void x86_emit_div(mir_operand_t *a, mir_operand_t *b,
+			 x86_operand_t *dest) {
+  x86_operand_t *divisor;
+  int shift, save_rdx;
+
+  if(b->optype == MIR_OP_CONST && (b->val == 1 || b->val == -1)) {
+    x86_emit_mov(x86_opr(a), x86_reg(X86_SCRATCH));
+    if(b->val == -1)
+      x86_emit("negl", x86_reg(X86_SCRATCH), NULL);
+    x86_emit_mov(x86_reg(X86_SCRATCH), dest);
+    return;
+  }
+
+  if(b->optype == MIR_OP_CONST && b->val > 0 &&
+     (shift = x86_log2(b->val)) > 0) {
+    x86_emit_mov(x86_opr(a), x86_reg(X86_SCRATCH));
+    x86_emit("movl", x86_reg(X86_SCRATCH), x86_reg(X86_SCRATCH2));
+    if(shift > 1)
+      x86_emit("sarl", x86_imm(31), x86_reg(X86_SCRATCH2));
+    x86_emit("shrl", x86_imm(32 - shift), x86_reg(X86_SCRATCH2));
+    x86_emit("addl", x86_reg(X86_SCRATCH2), x86_reg(X86_SCRATCH));
+    x86_emit("sarl", x86_imm(shift), x86_reg(X86_SCRATCH));
+    x86_emit_mov(x86_reg(X86_SCRATCH), dest);
+    return;
+  }
+
+  /* idiv can't take an immediate, or the %edx it overwrites */
+  divisor = x86_opr(b);
+  if(divisor->type == X86_OP_IMM ||
+     (divisor->type == X86_OP_REG && divisor->reg == X86_RDX)) {
+    x86_emit("movl", divisor, x86_reg(X86_SCRATCH2));
+    divisor = x86_reg(X86_SCRATCH2);
+  }
+
+  x86_emit_mov(x86_opr(a), x86_reg(X86_SCRATCH));
+
+  save_rdx = !(dest->type == X86_OP_REG && dest->reg == X86_RDX);
+  if(save_rdx)
+    x86_emit("movl", x86_reg(X86_RDX), x86_hw_opr(X86_SLOT(X86_NUM_SLOTS)));
+
+  x86_emit("cltd", NULL, NULL);
+  x86_emit("idivl", divisor, NULL);
+
+  if(save_rdx)
+    x86_emit("movl", x86_hw_opr(X86_SLOT(X86_NUM_SLOTS)), x86_reg(X86_RDX));
+  x86_emit_mov(x86_reg(X86_SCRATCH), dest);
+}
+
+/*
+ * Emit a conditional branch. Comparisons between constants are decided
+ * here, and a constant first operand is swapped to the second.
+ */
+static void x86_emit_if(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  mir_operand_t *a = instr->operand[0], *b = instr->operand[1];
+  x86_operand_t *src1, *src2;
+  int relop = instr->operand[2] ? instr->operand[2]->val : -1, val;
+  char *branch = "je";
+
+  if(a->optype == MIR_OP_CONST && (relop < 0 || b->optype == MIR_OP_CONST)) {
+    if(relop < 0)
+      val = !a->val;
+    else
+      switch(relop) {
+      case MIR_NEQ: val = a->val != b->val; break;
+      case MIR_LSS: val = a->val < b->val; break;
+      case MIR_LEQ: val = a->val <= b->val; break;
+      case MIR_GTR: val = a->val > b->val; break;
+      case MIR_GEQ: val = a->val >= b->val; break;
+      case MIR_EQL:
+      default: val = a->val == b->val; break;
+      }
+
+    if(val)
+      fprintf(x86_fd, "\tjmp\t.L%s\n", node->jump->instruction->label);
+    return;
+  }
+
+  if(relop < 0) {
+    src1 = x86_opr(a);
+    if(src1->type == X86_OP_REG)
+      x86_emit("testl", x86_reg(src1->reg), src1);
+    else
+      x86_emit("cmpl", x86_imm(0), src1);
+
+  } else {
+    if(a->optype == MIR_OP_CONST) {
+      mir_operand_t *t = a;
+
+      a = b;
+      b = t;
+      switch(relop) {
+      case MIR_LSS: relop = MIR_GTR; break;
+      case MIR_LEQ: relop = MIR_GEQ; break;
+      case MIR_GTR: relop = MIR_LSS; break;
+      case MIR_GEQ: relop = MIR_LEQ; break;
+      }
+    }
+
+    src1 = x86_opr(a);
+    src2 = x86_opr(b);
+    if(x86_is_mem(src1) && x86_is_mem(src2)) {
+      x86_emit("movl", src1, x86_reg(X86_SCRATCH));
+      src1 = x86_reg(X86_SCRATCH);
+    }
+    x86_emit("cmpl", src2, src1);
+
+    switch(relop) {
+    case MIR_NEQ: branch = "jne"; break;
+    case MIR_LSS: branch = "jl"; break;
+    case MIR_LEQ: branch = "jle"; break;
+    case MIR_GTR: branch = "jg"; break;
+    case MIR_GEQ: branch = "jge"; break;
+    }
+  }
+
+  fprintf(x86_fd, "\t%s\t.L%s\n", branch, node->jump->instruction->label);
+}
+
+/*
+ * Sign extend an argument into the whole of a 64 bit register. Variadic C
+ * functions read a long for %ld, so a negative int must arrive as a
+ * negative long. Functions compiled by HCC only look at the low half.
+ */
+static void x86_emit_arg(x86_operand_t *src, int reg) {
+  if(src->type == X86_OP_IMM)
+    fprintf(x86_fd, "\tmovq\t");
+  else
+    fprintf(x86_fd, "\tmovslq\t");
+
+  x86_print_operand(src);
+  fprintf(x86_fd, ", %%%s\n", x86_names64[reg]);
+  free(src);
+}
+
+/*
+ * Emit a call. Arguments past the sixth are passed in 8 byte stack slots,
+ * and %al is cleared since the callee may be variadic.
+ */
+static void x86_emit_call(mir_instr_t *instr) {
+  int i;
+
+  for(i = REG_ARGS; i < instr->num_args; i++) {
+    x86_emit_arg(x86_opr(instr->args[i]), X86_SCRATCH);
+    fprintf(x86_fd, "\tmovq\t%%rax, %d(%%rsp)\n",
+	    (i - REG_ARGS) * X86_ARG_SIZE);
+  }
+
+  for(i = 0; i < instr->num_args && i < REG_ARGS; i++)
+    x86_emit_arg(x86_opr(instr->args[i]), x86_arg_regs[i]);
+
+  x86_emit("xorl", x86_reg(X86_RAX), x86_reg(X86_RAX));
+  fprintf(x86_fd, "\tcall\t%s\n", x86_func_name(instr->operand[0]->var->name));
+
+  /* Return value */
+  if(instr->operand[2])
+    x86_emit_mov(x86_reg(X86_RAX), x86_opr(instr->operand[2]));
+}
+
+/*
+ * Emit the return from the current function
+ */
+static void x86_emit_epilogue(void) {
+  int i;
+
+  if(frame_size)
+    fprintf(x86_fd, "\taddq\t$%d, %%rsp\n", frame_size);
+  for(i = num_saved - 1; i >= 0; i--)
+    fprintf(x86_fd, "\tpopq\t%%%s\n", x86_names64[saved_regs[i]]);
+  fprintf(x86_fd, "\tret\n");
+}
+
+/*
+ * Return the assembler name of a function
+ */
+static char *x86_func_name(char *name) {
+  return strcmp(name, "main") ? name : X86_MAIN_NAME;
+}
+
+/*
+ * Lower a single MIR instruction to machine instructions, not including
+ * its label
+ */
+static void gen_x86_instr(mir_node_t *node) {
+  mir_instr_t *instr = node->instruction;
+  x86_operand_t *src;
+  char *name;
+  int i;
+
+  switch(instr->opcode) {
+  case MIR_NOP:
+    break;
+
+  case MIR_LABEL:
+    /* Function header */
+    current_arg = 0;
+    current_func = get_func_entry(instr->label);
+    x86_scan_func(node);
+
+    name = x86_func_name(current_func->name);
+    if(name == current_func->name)
+      fprintf(x86_fd, "\t.globl %s\n", name);
+    else
+      has_main = 1;
+    fprintf(x86_fd, "\t.type %s, @function\n%s:\n", name, name);
+
+    for(i = 0; i < num_saved; i++)
+      fprintf(x86_fd, "\tpushq\t%%%s\n", x86_names64[saved_regs[i]]);
+    if(frame_size)
+      fprintf(x86_fd, "\tsubq\t$%d, %%rsp\n", frame_size);
+
+    /* Each in holds its incoming argument until it is received */
+    if(!current_func->func_leaf)
+      for(i = 0; i < num_params && i < REG_ARGS; i++)
+	x86_emit_mov(x86_reg(x86_arg_regs[i]),
+		     x86_hw_opr(x86_sparc_regs[SPARC_INS + i]));
+    break;
+
+  case MIR_ADDR:
+    if(instr->operand[0]->optype == MIR_OP_VAR)
+      x86_emit_lea(instr->operand[0]->var->offset,
+		   x86_opr(instr->operand[2]));
+    else
+      x86_emit_mov(x86_ptr_opr(instr->operand[0]),
+		   x86_opr(instr->operand[2]));
+    break;
+
+  case MIR_STACK_ADDR:
+    x86_emit_lea(instr->operand[0]->val, x86_opr(instr->operand[2]));
+    break;
+
+  case MIR_MOVE:
+    /* Only one of the operands can use the pointer scratch register */
+    src = x86_opr(instr->operand[0]);
+    x86_emit_mov(src, x86_opr(instr->operand[2]));
+    break;
+
+  case MIR_ADD:
+  case MIR_SUB:
+  case MIR_MUL:
+  case MIR_DIV:
+    x86_emit_arith(instr);
+    break;
+
+  case MIR_JUMP:
+    fprintf(x86_fd, "\tjmp\t.L%s\n", node->jump->instruction->label);
+    break;
+
+  case MIR_IF:
+    x86_emit_if(node);
+    break;
+
+  case MIR_LOAD_STRING:
+    name = malloc(20);
+    sprintf(name, ".Lstring%d", instr->operand[0]->val);
+    x86_emit_mov(x86_addr(name), x86_opr(instr->operand[2]));
+    free(name);
+    break;
+
+  case MIR_REG_LOAD:
+    src = x86_ptr_opr(instr->operand[0]);
+    x86_emit_mov(src, x86_opr(instr->operand[2]));
+    break;
+
+  case MIR_HEAP_LOAD:
+    x86_emit_mov(x86_sym(instr->operand[0]->var->name),
+		 x86_opr(instr->operand[2]));
+    break;
+
+  case MIR_HEAP_ADDR:
+    if(instr->operand[0]->optype != MIR_OP_VAR &&
+       instr->operand[0]->optype != MIR_OP_CONST)
+      compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		     "Cannot take the heap address of a register\n");
+
+    if(instr->operand[0]->optype == MIR_OP_VAR)
+      src = x86_addr(instr->operand[0]->var->name);
+    else
+      src = x86_imm(instr->operand[0]->val);
+    x86_emit_mov(src, x86_opr(instr->operand[2]));
+    break;
+
+  case MIR_STACK_LOAD:
+    x86_emit_mov(x86_stack_opr(instr->operand[0]->val),
+		 x86_opr(instr->operand[2]));
+    break;
+
+  case MIR_REG_STORE:
+    src = x86_opr(instr->operand[0]);
+    x86_emit_mov(src, x86_ptr_opr(instr->operand[2]));
+    break;
+
+  case MIR_STACK_STORE:
+    x86_emit_mov(x86_opr(instr->operand[0]),
+		 x86_stack_opr(instr->operand[2]->val));
+    break;
+
+  case MIR_HEAP_STORE:
+    /* The address register the Sparc needs isn't used */
+    x86_emit_mov(x86_opr(instr->operand[0]),
+		 x86_sym(instr->operand[2]->var->name));
+    break;
+
+  case MIR_RECEIVE:
+  case MIR_PUSH_ARG:
+    /* Additional arguments are above the return address */
+    if(current_arg >= REG_ARGS)
+      src = x86_mem(X86_RSP, frame_size + ((num_saved + 1) * X86_ARG_SIZE) +
+		    ((current_arg - REG_ARGS) * X86_ARG_SIZE));
+    else
+      src = x86_hw_opr(x86_sparc_regs[(current_func->func_leaf ?
+					SPARC_OUTS : SPARC_INS) +
+				       current_arg]);
+    current_arg++;
+
+    if(instr->opcode == MIR_RECEIVE)
+      x86_emit_mov(src, x86_opr(instr->operand[2]));
+    else
+      x86_emit_mov(src, x86_stack_opr(instr->operand[2]->val));
+    break;
+
+  case MIR_CALL:
+    x86_emit_call(instr);
+    break;
+
+  case MIR_RETURN:
+    if(instr->operand[0])
+      x86_emit_mov(x86_opr(instr->operand[0]), x86_reg(X86_RAX));
+    x86_emit_epilogue();
+    break;
+
+  case MIR_END:
+    /* Function footer */
+    if(node->prev->instruction->opcode != MIR_RETURN)
+      x86_emit_epilogue();
+
+    name = x86_func_name(current_func->name);
+    fprintf(x86_fd, "\t.size %s, .-%s\n\n", name, name);
+    break;
+  }
+}
+
+/*
+ * Generate x86 code for a function
+ */
+static void gen_x86_func(mir_node_t **node) {
+  mir_instr_t *instr;
+  int done = 0;
+
+  current_func = NULL;
+
+  while(*node && !done) {
+    instr = (*node)->instruction;
+
+    if(instr->opcode != MIR_LABEL && instr->label)
+      fprintf(x86_fd, ".L%s:\n", instr->label);
+
+    gen_x86_instr(*node);
+
+    done = instr->opcode == MIR_END;
+    *node = (*node)->next;
+  }
+}
+
+/*
+ * Generate x86-64 code from IC code
+ */
+void gen_x86_code(char *basename) {
+  mir_node_t *current;
+  name_record_t *record, *cur_var, *ptr_var;
+  int i;
+
+  char *filename = malloc(strlen(basename) + 3);
+  sprintf(filename, "%s.s", basename);
+
+  if(cflags.flags & CFLAG_OUTPUT_OBJECT) {
+    compiler_error(CERROR_WARN, CERROR_NO_LINE,
+		   "Objects are only written for the Sparc, writing "
+		   "assembly\n");
+    cflags.flags &= ~CFLAG_OUTPUT_OBJECT;
+  }
+
+  if(cflags.flags & CFLAG_OUTPUT_STABS) {
+    compiler_error(CERROR_WARN, CERROR_NO_LINE,
+		   "Debug symbols are only written for the Sparc\n");
+    cflags.flags &= ~CFLAG_OUTPUT_STABS;
+  }
+
+  if(!(x86_fd = fopen(filename, "w")))
+    compiler_error(CERROR_ERROR, CERROR_NO_LINE,
+		   "Cannot open file %s for writing\n", filename);
+
+  /* Header */
+  fprintf(x86_fd, "\t.file \"%s.hc\"\n", basename);
+
+  /* Read-only data. Strings */
+  if(num_strings()) {
+    fprintf(x86_fd, "\t.section .rodata\n");
+    for(i = 0; i < num_strings(); i++)
+      fprintf(x86_fd, ".Lstring%d:\t.asciz \"%s\"\n", i,
+	      get_string_literal(i)->string);
+  }
+
+  /* BSS (Unitialised data) Segment */
+  fprintf(x86_fd, "\t.bss\n");
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+
+    if(record->type_info->decl_type != TYPE_FUNCTION &&
+       !is_history_type(record->type_info) && record->name[0] != '.')
+      fprintf(x86_fd, "\t.comm %s, %d, %d\n", record->name,
+	      sizeof_type(record->type_info), WORD_SIZE);
+  }
+
+  /* Data (initialised) segment, for global history variables */
+  fprintf(x86_fd, "\t.data\n");
+  for(i = 0; i < global_scope->num_records; i++) {
+    record = global_scope->name_table[i];
+    if(!is_history_type(record->type_info))
+      continue;
+
+    fprintf(x86_fd, "\t.align 4\n");
+    fprintf(x86_fd, "\t.type %s, @object\n", record->name);
+    fprintf(x86_fd, "\t.size %s, %d\n", record->name,
+	    sizeof_type(record->type_info) + sizeof_history(record->type_info));
+    fprintf(x86_fd, "%s:\n", record->name);
+    fprintf(x86_fd, "\t.long 0\n");
+    fprintf(x86_fd, "\t.skip %d\n\n", sizeof_history(record->type_info));
+
+    if(!(cflags.flags & CFLAG_HISTORY_SIMPLE_STORE &&
+	 get_history_depth(record->type_info) < cflags.history_simple_depth)) {
+
+      /* Current value */
+      cur_var = history_current_entry(record);
+
+      fprintf(x86_fd, "\t.align 4\n");
+      fprintf(x86_fd, "\t.type %s, @object\n", cur_var->name);
+      fprintf(x86_fd, "\t.size %s, %d\n", cur_var->name,
+	      sizeof_type(cur_var->type_info));
+      fprintf(x86_fd, "%s:\n", cur_var->name);
+      fprintf(x86_fd, "\t.long 0\n\n");
+
+      /* Pointer */
+      ptr_var = history_ptr_entry(record);
+
+      fprintf(x86_fd, "\t.align 4\n");
+      fprintf(x86_fd, "\t.type %s, @object\n", ptr_var->name);
+      fprintf(x86_fd, "\t.size %s, %d\n", ptr_var->name,
+	      sizeof_type(ptr_var->type_info));
+      fprintf(x86_fd, "%s:\n", ptr_var->name);
+      fprintf(x86_fd, "\t.long %s\n\n", record->name);
+    }
+  }
+
+  /* Text Segment */
+  fprintf(x86_fd, "\t.text\n");
+
+  has_main = 0;
+  current = mir_list_head();
+  for(i = 0; i < num_def_functions(); i++)
+    gen_x86_func(&current);
+
+  /* Run main on a stack below 4GB, %rbx keeps the old stack pointer */
+  if(has_main) {
+    fprintf(x86_fd, "\t.local %s\n", X86_STACK_NAME);
+    fprintf(x86_fd, "\t.comm %s, %d, %d\n", X86_STACK_NAME, X86_STACK_SIZE,
+	    X86_STACK_ALIGN);
+    fprintf(x86_fd, "\t.globl main\n\t.type main, @function\nmain:\n");
+    fprintf(x86_fd, "\tpushq\t%%rbx\n\tmovq\t%%rsp, %%rbx\n");
+    fprintf(x86_fd, "\tmovl\t$%s+%d, %%esp\n", X86_STACK_NAME,
+	    X86_STACK_SIZE);
+    fprintf(x86_fd, "\tcall\t%s\n", X86_MAIN_NAME);
+    fprintf(x86_fd, "\tmovq\t%%rbx, %%rsp\n\tpopq\t%%rbx\n\tret\n");
+    fprintf(x86_fd, "\t.size main, .-main\n\n");
+  }
+
+  /* Footer */
+  fprintf(x86_fd, "\t.ident \"HCC: History Capable Compiler\"\n");
+  fprintf(x86_fd, "\t.section .note.GNU-stack,\"\",@progbits\n");
+  fclose(x86_fd);
+  free(filename);
+}
+
+/*
+ * Print a machine operand
+ */
+static void x86_print_operand(x86_operand_t *op) {
+  switch(op->type) {
+  case X86_OP_REG:
+    fprintf(x86_fd, "%%%s", x86_names32[op->reg]);
+    break;
+
+  case X86_OP_IMM:
+    fprintf(x86_fd, "$%d", op->val);
+    break;
+
+  case X86_OP_MEM:
+    if(op->reg < 0) {
+      fprintf(x86_fd, "%d", op->val);
+      break;
+    }
+
+    if(op->val)
+      fprintf(x86_fd, "%d", op->val);
+    fprintf(x86_fd, "(%%%s)", x86_names64[op->reg]);
+    break;
+
+  case X86_OP_SYM:
+    fprintf(x86_fd, "%s(%%rip)", op->sym);
+    break;
+
+  case X86_OP_ADDR:
+    fprintf(x86_fd, "$%s", op->sym);
+    break;
+  }
+}